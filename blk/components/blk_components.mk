@@ -3,15 +3,15 @@
 #
 # SPDX-License-Identifier: BSD-2-Clause
 #
-# This Makefile snippet builds the blk virtualiser
+# This Makefile snippet builds the blk virtualiser and cache
 # it should be included into your project Makefile
 #
 # NOTES:
-#  Generates blk_virt.elf
+#  Generates blk_virt.elf blk_cache.elf
 #
 
 
-BLK_IMAGES := blk_virt.elf
+BLK_IMAGES := blk_virt.elf blk_cache.elf
 
 CFLAGS_blk ?=
 
@@ -29,11 +29,19 @@ blk_virt.o: ${CHECK_BLK_FLAGS_MD5}
 blk_virt.o: ${SDDF}/blk/components/virt.c
 	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
 
+blk_cache.elf: blk_cache.o
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
+
+blk_cache.o: ${CHECK_BLK_FLAGS_MD5}
+blk_cache.o: ${SDDF}/blk/components/cache.c
+	${CC} ${CFLAGS} ${CFLAGS_blk} -o $@ -c $<
+
 clean::
-	rm -f blk_virt.[od] .blk_cflags-*
+	rm -f blk_virt.[od] blk_cache.[od] .blk_cflags-*
 
 clobber::
 	rm -f ${BLK_IMAGES}
 
 
 -include blk_virt.d
+-include blk_cache.d
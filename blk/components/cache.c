@@ -0,0 +1,782 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Block cache component. It sits between a client and the block virtualiser,
+ * serving the client as the virtualiser would and acting as a client of the
+ * virtualiser itself.
+ *
+ * Its data region with the virtualiser is used as the page cache, one page per
+ * BLK_TRANSFER_SIZE block, so that blocks are read and written back directly
+ * from and to the pages. Pages are replaced with the CLOCK algorithm. Writes
+ * only go to the cache, and dirty pages are written back when they are evicted,
+ * when more than BLK_CACHE_DIRTY_MAX pages are dirty, and on a flush or barrier
+ * request.
+ *
+ * Flush and barrier requests are only started once every earlier request has
+ * completed, and hold back later requests until every dirty page has been
+ * written back and the request has been completed by the device. Discard and
+ * write zeroes requests are ordered the same way, dropping the pages of their
+ * blocks instead of writing back every dirty page.
+ *
+ * Sequential reads are detected per stream, and the blocks following them are
+ * read ahead into the cache. The readahead window of a stream starts at
+ * BLK_CACHE_RA_MIN blocks and doubles with every sequential read up to
+ * BLK_CACHE_RA_MAX, and a read that does not continue any stream replaces the
+ * least recently used one, starting over without readahead.
+ */
+
+#include <microkit.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <sddf/blk/cache.h>
+#include <sddf/util/printf.h>
+#include <sddf/util/string.h>
+#include <sddf/util/util.h>
+#include <blk_config.h>
+
+/* Uncomment this to enable debug logging */
+// #define DEBUG_BLK_CACHE
+
+#if defined(DEBUG_BLK_CACHE)
+#define LOG_BLK_CACHE(...) do{ sddf_dprintf("BLK_CACHE|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_BLK_CACHE(...) do{}while(0)
+#endif
+#define LOG_BLK_CACHE_ERR(...) do{ sddf_dprintf("BLK_CACHE|ERROR: "); sddf_dprintf(__VA_ARGS__); }while(0)
+
+#define VIRT_CH 0
+#define CLIENT_CH 1
+
+/* Size of the page cache, which is the data region shared with the virtualiser */
+#ifndef BLK_CACHE_SIZE
+#define BLK_CACHE_SIZE 0x200000
+#endif
+
+/* Maximum number of client requests being served at a time */
+#ifndef BLK_CACHE_MAX_REQS
+#define BLK_CACHE_MAX_REQS 64
+#endif
+
+#define NUM_PAGES (BLK_CACHE_SIZE / BLK_TRANSFER_SIZE)
+
+/* Dirty pages are written back once there are more than this many */
+#ifndef BLK_CACHE_DIRTY_MAX
+#define BLK_CACHE_DIRTY_MAX (NUM_PAGES / 2)
+#endif
+
+_Static_assert(BLK_CACHE_SIZE % BLK_TRANSFER_SIZE == 0 && NUM_PAGES > 0,
+               "Block cache must hold a whole number of blocks");
+
+/* Readahead window limits in blocks, readahead is disabled if BLK_CACHE_RA_MAX is 0 */
+#ifndef BLK_CACHE_RA_MIN
+#define BLK_CACHE_RA_MIN 4
+#endif
+#ifndef BLK_CACHE_RA_MAX
+#define BLK_CACHE_RA_MAX MIN(64, NUM_PAGES / 4)
+#endif
+
+/* Number of sequential streams tracked at a time */
+#ifndef BLK_CACHE_RA_STREAMS
+#define BLK_CACHE_RA_STREAMS 4
+#endif
+
+/* Microkit patched variables */
+blk_storage_info_t *blk_client_storage_info;
+blk_req_queue_t *blk_client_req_queue;
+blk_resp_queue_t *blk_client_resp_queue;
+uintptr_t blk_client_data;
+blk_storage_info_t *blk_virt_storage_info;
+blk_req_queue_t *blk_virt_req_queue;
+blk_resp_queue_t *blk_virt_resp_queue;
+uintptr_t blk_virt_data;
+/* Optional region for statistics */
+blk_cache_stats_t *blk_cache_stats;
+
+static blk_queue_handle_t client_h;
+static blk_queue_handle_t virt_h;
+
+/* Size of the data region shared with the client, from the blk config */
+static uint64_t client_data_size;
+
+static blk_cache_stats_t local_stats;
+
+/* Page holds the contents of its block */
+#define PAGE_VALID BIT(0)
+/* Page has been written by the client but not the device */
+#define PAGE_DIRTY BIT(1)
+/* Block is being read into the page */
+#define PAGE_READING BIT(2)
+/* Page is being written back */
+#define PAGE_WRITING BIT(3)
+/* Block could not be read */
+#define PAGE_ERROR BIT(4)
+/* Page has been used since the CLOCK hand last passed it */
+#define PAGE_REF BIT(5)
+/* Block was read ahead and has not been read by the client yet */
+#define PAGE_READAHEAD BIT(6)
+
+#define PAGE_NONE UINT32_MAX
+
+/* Id of the flush, barrier, discard or write zeroes request given to the virtualiser, pages use their index */
+#define FLUSH_ID NUM_PAGES
+
+typedef struct page {
+    uint32_t block_number;
+    uint32_t flags;
+    /* next page in the same hash bucket, or in the free list */
+    uint32_t next;
+    bool mapped;
+} page_t;
+
+static page_t pages[NUM_PAGES];
+static uint32_t buckets[NUM_PAGES];
+static uint32_t free_pages = PAGE_NONE;
+static uint32_t clock_hand;
+static uint32_t num_dirty;
+
+/* Client request being served */
+typedef struct creq {
+    blk_req_code_t code;
+    uintptr_t offset;
+    uint32_t block_number;
+    uint16_t count;
+    uint32_t id;
+    /* blocks copied to or from the client */
+    uint16_t done;
+    /* blocks looked up in the cache, for the statistics */
+    uint16_t looked_up;
+    /* flush, barrier, discard or write zeroes has been given to the virtualiser */
+    bool sent;
+    bool complete;
+} creq_t;
+
+static creq_t reqs[BLK_CACHE_MAX_REQS];
+static uint32_t reqs_head;
+static uint32_t reqs_tail;
+
+/* Result of the flush, barrier, discard or write zeroes given to the virtualiser */
+static bool flush_done;
+static blk_resp_status_t flush_status;
+/* A discard or write zeroes has been given to the virtualiser and not completed yet */
+static bool discard_inflight;
+/* A writeback failed since the last flush or barrier */
+static bool writeback_error;
+/* A block failed to be read */
+static bool read_error;
+
+/* Sequential read stream */
+typedef struct stream {
+    /* block the next read of the stream is expected at */
+    uint32_t next_block;
+    /* blocks before which readahead has been issued */
+    uint32_t ra_end;
+    uint32_t window;
+    /* last time a read continued or started the stream */
+    uint64_t used;
+} stream_t;
+
+static stream_t streams[BLK_CACHE_RA_STREAMS];
+static uint64_t streams_tick;
+
+static bool notify_client;
+static bool notify_virt;
+
+static inline uintptr_t page_vaddr(uint32_t p)
+{
+    return blk_virt_data + (uintptr_t)p * BLK_TRANSFER_SIZE;
+}
+
+static uint32_t page_lookup(uint32_t block_number)
+{
+    for (uint32_t p = buckets[block_number % NUM_PAGES]; p != PAGE_NONE; p = pages[p].next) {
+        if (pages[p].block_number == block_number) {
+            return p;
+        }
+    }
+    return PAGE_NONE;
+}
+
+static void page_map(uint32_t p, uint32_t block_number)
+{
+    uint32_t *bucket = &buckets[block_number % NUM_PAGES];
+    pages[p] = (page_t) { block_number, 0, *bucket, true };
+    *bucket = p;
+}
+
+static void page_unmap(uint32_t p)
+{
+    uint32_t *link = &buckets[pages[p].block_number % NUM_PAGES];
+    while (*link != p) {
+        link = &pages[*link].next;
+    }
+    *link = pages[p].next;
+    pages[p].mapped = false;
+}
+
+/* Read a block into a newly mapped page */
+static void page_read(uint32_t p, uint32_t block_number)
+{
+    page_map(p, block_number);
+    pages[p].flags = PAGE_READING;
+    int err = blk_enqueue_req(&virt_h, BLK_REQ_READ, (uintptr_t)p * BLK_TRANSFER_SIZE, block_number, 1, p);
+    assert(!err);
+    notify_virt = true;
+}
+
+static void page_writeback(uint32_t p)
+{
+    int err = blk_enqueue_req(&virt_h, BLK_REQ_WRITE, (uintptr_t)p * BLK_TRANSFER_SIZE, pages[p].block_number, 1, p);
+    assert(!err);
+    pages[p].flags |= PAGE_WRITING;
+    blk_cache_stats->writebacks++;
+    notify_virt = true;
+}
+
+/**
+ * Find a page to hold another block, evicting a clean page if there are no free ones.
+ * Dirty pages passed over are written back so that they can be evicted later.
+ *
+ * @return index of the page, or PAGE_NONE if no page can be evicted yet.
+ */
+static uint32_t page_alloc(void)
+{
+    if (free_pages != PAGE_NONE) {
+        uint32_t p = free_pages;
+        free_pages = pages[p].next;
+        return p;
+    }
+
+    for (uint32_t i = 0; i < 2 * NUM_PAGES; i++) {
+        uint32_t p = clock_hand;
+        clock_hand = (clock_hand + 1) % NUM_PAGES;
+
+        page_t *page = &pages[p];
+        if (page->flags & (PAGE_READING | PAGE_WRITING)) {
+            continue;
+        }
+        if (page->flags & PAGE_REF) {
+            page->flags &= ~PAGE_REF;
+            continue;
+        }
+        if (page->flags & PAGE_DIRTY) {
+            if (!blk_queue_full_req(&virt_h)) {
+                page_writeback(p);
+            }
+            continue;
+        }
+
+        page_unmap(p);
+        blk_cache_stats->evictions++;
+        return p;
+    }
+
+    return PAGE_NONE;
+}
+
+/**
+ * Find a page for a block and read the block into it.
+ *
+ * @param block_number block to read.
+ *
+ * @return index of the page, or PAGE_NONE if there is no page or no space in the virtualiser queue.
+ */
+static uint32_t page_alloc_read(uint32_t block_number)
+{
+    if (blk_queue_full_req(&virt_h)) {
+        return PAGE_NONE;
+    }
+    uint32_t p = page_alloc();
+    if (p == PAGE_NONE) {
+        return PAGE_NONE;
+    }
+    /* Writebacks of the dirty pages passed over may have taken the last slot of the queue */
+    if (blk_queue_full_req(&virt_h)) {
+        pages[p].next = free_pages;
+        free_pages = p;
+        return PAGE_NONE;
+    }
+    page_read(p, block_number);
+    return p;
+}
+
+static void page_set_dirty(uint32_t p)
+{
+    if (!(pages[p].flags & PAGE_DIRTY)) {
+        num_dirty++;
+    }
+    pages[p].flags = (pages[p].flags & ~PAGE_ERROR) | PAGE_VALID | PAGE_DIRTY | PAGE_REF;
+}
+
+static void page_clear_dirty(uint32_t p)
+{
+    if (pages[p].flags & PAGE_DIRTY) {
+        num_dirty--;
+    }
+    pages[p].flags &= ~PAGE_DIRTY;
+}
+
+/**
+ * Write back dirty pages that are not already being written back.
+ *
+ * @param max_dirty number of dirty pages to leave alone.
+ */
+static void writeback_dirty(uint32_t max_dirty)
+{
+    uint32_t dirty = num_dirty;
+    for (uint32_t p = 0; p < NUM_PAGES && dirty > max_dirty; p++) {
+        if (!(pages[p].flags & PAGE_DIRTY)) {
+            continue;
+        }
+        if (!(pages[p].flags & PAGE_WRITING)) {
+            if (blk_queue_full_req(&virt_h)) {
+                return;
+            }
+            page_writeback(p);
+        }
+        dirty--;
+    }
+}
+
+static void creq_complete(creq_t *req, blk_resp_status_t status)
+{
+    int err = blk_enqueue_resp(&client_h, status, req->done, req->id);
+    assert(!err);
+    req->complete = true;
+    notify_client = true;
+}
+
+static void creq_read(creq_t *req)
+{
+    uintptr_t buf = blk_client_data + req->offset;
+
+    for (uint16_t i = req->done; i < req->count; i++) {
+        uint32_t block_number = req->block_number + i;
+        uint32_t p = page_lookup(block_number);
+
+        if (i >= req->looked_up) {
+            if (p != PAGE_NONE && (pages[p].flags & PAGE_VALID)) {
+                blk_cache_stats->read_hits++;
+            } else {
+                blk_cache_stats->read_misses++;
+            }
+            req->looked_up = i + 1;
+        }
+
+        if (p == PAGE_NONE) {
+            p = page_alloc_read(block_number);
+            if (p == PAGE_NONE) {
+                break;
+            }
+        }
+
+        if (pages[p].flags & PAGE_ERROR) {
+            creq_complete(req, BLK_RESP_ERR_IO);
+            return;
+        }
+        if (!(pages[p].flags & PAGE_VALID) || i != req->done) {
+            continue;
+        }
+
+        sddf_memcpy((void *)(buf + (uintptr_t)i * BLK_TRANSFER_SIZE), (void *)page_vaddr(p), BLK_TRANSFER_SIZE);
+        if (pages[p].flags & PAGE_READAHEAD) {
+            blk_cache_stats->readahead_hits++;
+        }
+        pages[p].flags = (pages[p].flags & ~PAGE_READAHEAD) | PAGE_REF;
+        req->done++;
+    }
+
+    if (req->done == req->count) {
+        creq_complete(req, BLK_RESP_OK);
+    }
+}
+
+static void creq_write(creq_t *req)
+{
+    uintptr_t buf = blk_client_data + req->offset;
+
+    while (req->done < req->count) {
+        uint32_t block_number = req->block_number + req->done;
+        uint32_t p = page_lookup(block_number);
+
+        if (p != PAGE_NONE && (pages[p].flags & (PAGE_READING | PAGE_WRITING))) {
+            break;
+        }
+        if (p == PAGE_NONE) {
+            p = page_alloc();
+            if (p == PAGE_NONE) {
+                break;
+            }
+            page_map(p, block_number);
+        }
+
+        sddf_memcpy((void *)page_vaddr(p), (void *)(buf + (uintptr_t)req->done * BLK_TRANSFER_SIZE),
+                    BLK_TRANSFER_SIZE);
+        page_set_dirty(p);
+        blk_cache_stats->writes++;
+        req->done++;
+    }
+
+    if (req->done == req->count) {
+        creq_complete(req, BLK_RESP_OK);
+    }
+}
+
+static void creq_flush(creq_t *req)
+{
+    if (!req->sent) {
+        writeback_dirty(0);
+        if (num_dirty != 0 || blk_queue_full_req(&virt_h)) {
+            return;
+        }
+
+        int err = blk_enqueue_req(&virt_h, req->code, 0, 0, 0, FLUSH_ID);
+        assert(!err);
+        req->sent = true;
+        flush_done = false;
+        notify_virt = true;
+        return;
+    }
+
+    if (flush_done) {
+        blk_resp_status_t status = writeback_error ? BLK_RESP_ERR_IO : flush_status;
+        writeback_error = false;
+        creq_complete(req, status);
+    }
+}
+
+static void creq_discard(creq_t *req)
+{
+    if (!req->sent) {
+        if (blk_queue_full_req(&virt_h)) {
+            return;
+        }
+
+        /* Cached copies of the blocks are dropped, once none of them is being read or written back */
+        for (uint16_t i = 0; i < req->count; i++) {
+            uint32_t p = page_lookup(req->block_number + i);
+            if (p != PAGE_NONE && (pages[p].flags & (PAGE_READING | PAGE_WRITING))) {
+                return;
+            }
+        }
+        for (uint16_t i = 0; i < req->count; i++) {
+            uint32_t p = page_lookup(req->block_number + i);
+            if (p == PAGE_NONE) {
+                continue;
+            }
+            page_clear_dirty(p);
+            page_unmap(p);
+            pages[p].next = free_pages;
+            free_pages = p;
+        }
+
+        int err = blk_enqueue_req(&virt_h, req->code, 0, req->block_number, req->count, FLUSH_ID);
+        assert(!err);
+        req->sent = true;
+        flush_done = false;
+        discard_inflight = true;
+        notify_virt = true;
+        return;
+    }
+
+    if (flush_done) {
+        discard_inflight = false;
+        req->done = (flush_status == BLK_RESP_OK) ? req->count : 0;
+        creq_complete(req, flush_status);
+    }
+}
+
+/**
+ * Account a client read to the stream it continues, or start a new stream with it.
+ *
+ * @param block_number first block of the read.
+ * @param count number of blocks of the read.
+ */
+static void readahead_update(uint32_t block_number, uint16_t count)
+{
+    stream_t *stream = &streams[0];
+    for (int i = 0; i < BLK_CACHE_RA_STREAMS; i++) {
+        if (streams[i].window != 0 && streams[i].next_block == block_number) {
+            stream = &streams[i];
+            break;
+        }
+        if (streams[i].used < stream->used) {
+            stream = &streams[i];
+        }
+    }
+
+    if (stream->window != 0 && stream->next_block == block_number) {
+        stream->window = MIN(stream->window * 2, BLK_CACHE_RA_MAX);
+    } else {
+        /* Random access, nothing is read ahead until the stream turns out to be sequential */
+        stream->window = MAX(BLK_CACHE_RA_MIN / 2, 1);
+        stream->ra_end = 0;
+    }
+    stream->next_block = block_number + count;
+    stream->used = ++streams_tick;
+}
+
+/* Read ahead the blocks in the windows of the streams, as far as the cache and queue allow */
+static void readahead_issue(void)
+{
+    /* Blocks read ahead now could be read from before the discard or write zeroes */
+    if (discard_inflight) {
+        return;
+    }
+
+    for (int i = 0; i < BLK_CACHE_RA_STREAMS; i++) {
+        stream_t *stream = &streams[i];
+        if (stream->window < BLK_CACHE_RA_MIN) {
+            continue;
+        }
+
+        uint64_t end = MIN((uint64_t)stream->next_block + stream->window, blk_client_storage_info->capacity);
+        /* Only top the window up once half of it has been consumed, so that reads are issued in batches */
+        if (stream->ra_end > stream->next_block && stream->ra_end - stream->next_block >= stream->window / 2) {
+            continue;
+        }
+
+        uint32_t block_number = MAX(stream->ra_end, stream->next_block);
+        for (; block_number < end; block_number++) {
+            if (page_lookup(block_number) != PAGE_NONE) {
+                continue;
+            }
+            uint32_t p = page_alloc_read(block_number);
+            if (p == PAGE_NONE) {
+                break;
+            }
+            pages[p].flags |= PAGE_READAHEAD;
+            blk_cache_stats->readahead++;
+        }
+        stream->ra_end = block_number;
+    }
+}
+
+/**
+ * Make as much progress on the client requests being served as the cache allows.
+ */
+static void handle_reqs(void)
+{
+    bool earlier_pending = false;
+    for (uint32_t i = reqs_head; i != reqs_tail; i++) {
+        creq_t *req = &reqs[i % BLK_CACHE_MAX_REQS];
+        if (req->complete) {
+            continue;
+        }
+
+        switch (req->code) {
+        case BLK_REQ_READ:
+            creq_read(req);
+            break;
+        case BLK_REQ_WRITE:
+            creq_write(req);
+            break;
+        case BLK_REQ_FLUSH:
+        case BLK_REQ_BARRIER:
+            if (!earlier_pending) {
+                creq_flush(req);
+            }
+            break;
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES:
+            if (!earlier_pending) {
+                creq_discard(req);
+            }
+            break;
+        default:
+            assert(false);
+        }
+
+        if (!req->complete) {
+            if (req->code != BLK_REQ_READ && req->code != BLK_REQ_WRITE) {
+                /* Later requests wait for the flush, barrier, discard or write zeroes */
+                break;
+            }
+            earlier_pending = true;
+        }
+    }
+
+    while (reqs_head != reqs_tail && reqs[reqs_head % BLK_CACHE_MAX_REQS].complete) {
+        reqs_head++;
+    }
+
+    if (num_dirty > BLK_CACHE_DIRTY_MAX) {
+        writeback_dirty(BLK_CACHE_DIRTY_MAX);
+    }
+
+    if (BLK_CACHE_RA_MAX > 0) {
+        readahead_issue();
+    }
+}
+
+static void handle_client(void)
+{
+    blk_req_code_t code;
+    uintptr_t offset;
+    uint32_t block_number;
+    uint16_t count;
+    uint32_t id;
+
+    while (!blk_queue_empty_req(&client_h) && reqs_tail - reqs_head < BLK_CACHE_MAX_REQS) {
+        int err = blk_dequeue_req(&client_h, &code, &offset, &block_number, &count, &id);
+        assert(!err);
+
+        blk_resp_status_t status = BLK_RESP_OK;
+        switch (code) {
+        case BLK_REQ_READ:
+        case BLK_REQ_WRITE:
+            if (count == 0 || (uint64_t)block_number + count > blk_client_storage_info->capacity
+                || offset % BLK_TRANSFER_SIZE != 0
+                || offset + (uint64_t)count * BLK_TRANSFER_SIZE > client_data_size) {
+                LOG_BLK_CACHE_ERR("invalid request for block %u count %u offset 0x%lx\n", block_number, count,
+                                  offset);
+                status = BLK_RESP_ERR_INVALID_PARAM;
+            } else if (code == BLK_REQ_WRITE && blk_client_storage_info->read_only) {
+                status = BLK_RESP_ERR_INVALID_PARAM;
+            }
+            break;
+        case BLK_REQ_FLUSH:
+        case BLK_REQ_BARRIER:
+            blk_cache_stats->flushes++;
+            break;
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES: {
+            uint16_t max_count = (code == BLK_REQ_DISCARD) ? blk_client_storage_info->max_discard
+                                                           : blk_client_storage_info->max_write_zeroes;
+            if (count == 0 || count > max_count || (uint64_t)block_number + count > blk_client_storage_info->capacity
+                || blk_client_storage_info->read_only) {
+                LOG_BLK_CACHE_ERR("invalid request code %d for block %u count %u\n", code, block_number, count);
+                status = BLK_RESP_ERR_INVALID_PARAM;
+            }
+            break;
+        }
+        default:
+            LOG_BLK_CACHE_ERR("invalid request code %d\n", code);
+            status = BLK_RESP_ERR_INVALID_PARAM;
+        }
+
+        if (status != BLK_RESP_OK) {
+            err = blk_enqueue_resp(&client_h, status, 0, id);
+            assert(!err);
+            notify_client = true;
+            continue;
+        }
+
+        reqs[reqs_tail % BLK_CACHE_MAX_REQS] = (creq_t) {
+            .code = code, .offset = offset, .block_number = block_number, .count = count, .id = id
+        };
+        reqs_tail++;
+
+        if (code == BLK_REQ_READ && BLK_CACHE_RA_MAX > 0) {
+            readahead_update(block_number, count);
+        }
+    }
+}
+
+static void handle_virt(void)
+{
+    blk_resp_status_t status;
+    uint16_t success_count;
+    uint32_t id;
+
+    while (!blk_dequeue_resp(&virt_h, &status, &success_count, &id)) {
+        if (id == FLUSH_ID) {
+            flush_status = status;
+            flush_done = true;
+            continue;
+        }
+
+        assert(id < NUM_PAGES);
+        page_t *page = &pages[id];
+        if (page->flags & PAGE_READING) {
+            page->flags &= ~PAGE_READING;
+            if (status == BLK_RESP_OK) {
+                page->flags |= PAGE_VALID | PAGE_REF;
+            } else {
+                LOG_BLK_CACHE_ERR("failed to read block %u\n", page->block_number);
+                page->flags |= PAGE_ERROR;
+                read_error = true;
+                blk_cache_stats->errors++;
+            }
+        } else {
+            assert(page->flags & PAGE_WRITING);
+            page->flags &= ~PAGE_WRITING;
+            if (status != BLK_RESP_OK) {
+                /* The data is lost, this is reported by the next flush or barrier */
+                LOG_BLK_CACHE_ERR("failed to write back block %u\n", page->block_number);
+                writeback_error = true;
+                blk_cache_stats->errors++;
+            }
+            page_clear_dirty(id);
+        }
+    }
+}
+
+/* Drop pages that failed to be read once every request waiting on them has seen the error */
+static void drop_errors(void)
+{
+    if (!read_error) {
+        return;
+    }
+    read_error = false;
+
+    for (uint32_t p = 0; p < NUM_PAGES; p++) {
+        if (pages[p].mapped && (pages[p].flags & PAGE_ERROR)) {
+            page_unmap(p);
+            pages[p].next = free_pages;
+            free_pages = p;
+        }
+    }
+}
+
+void notified(microkit_channel ch)
+{
+    if (ch == VIRT_CH) {
+        handle_virt();
+    }
+    handle_client();
+    handle_reqs();
+    drop_errors();
+
+    if (notify_virt) {
+        notify_virt = false;
+        microkit_notify(VIRT_CH);
+    }
+    if (notify_client) {
+        notify_client = false;
+        microkit_notify(CLIENT_CH);
+    }
+}
+
+void init(void)
+{
+    uint32_t queue_capacity = blk_cli_queue_size(microkit_name);
+    blk_queue_init(&client_h, blk_client_req_queue, blk_client_resp_queue, queue_capacity);
+    blk_queue_init(&virt_h, blk_virt_req_queue, blk_virt_resp_queue, queue_capacity);
+    client_data_size = blk_cache_cli_data_region_size(microkit_name);
+
+    if (blk_cache_stats == NULL) {
+        blk_cache_stats = &local_stats;
+    }
+
+    for (uint32_t i = 0; i < NUM_PAGES; i++) {
+        buckets[i] = PAGE_NONE;
+        pages[i].next = (i + 1 < NUM_PAGES) ? i + 1 : PAGE_NONE;
+    }
+    free_pages = 0;
+
+    /* The client sees the same device as we do */
+    while (!blk_storage_is_ready(blk_virt_storage_info));
+    blk_storage_info_t info = *blk_virt_storage_info;
+    info.ready = false;
+    /* Requests are served from the cache pages, so vectored requests would not save any copies */
+    info.max_segments = 0;
+    *blk_client_storage_info = info;
+    __atomic_store_n(&blk_client_storage_info->ready, true, __ATOMIC_RELEASE);
+
+    LOG_BLK_CACHE("caching %u blocks of a device of %lu blocks\n", NUM_PAGES, info.capacity);
+}
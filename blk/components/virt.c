@@ -8,6 +8,9 @@
 #include <stdbool.h>
 #include <sddf/blk/queue.h>
 #include <sddf/blk/msdos_mbr.h>
+#include <sddf/blk/gpt.h>
+#include <sddf/blk/sched.h>
+#include <sddf/timer/client.h>
 #include <sddf/util/cache.h>
 #include <sddf/util/ialloc.h>
 #include <sddf/util/printf.h>
@@ -29,6 +32,63 @@
 #define DRIVER_CH 0
 #define CLI_CH_OFFSET 1
 
+/*
+ * Rate limits and the deadline scheduler need the time, so they are only available
+ * when the block config defines BLK_VIRT_TIMER and the virtualiser is given a
+ * channel to the timer driver after those of the clients.
+ */
+#ifdef BLK_VIRT_TIMER
+#define TIMER_CH (CLI_CH_OFFSET + BLK_NUM_CLIENTS)
+#endif
+
+#ifndef BLK_VIRT_SCHED
+#define BLK_VIRT_SCHED BLK_SCHED_RR
+#endif
+
+#if BLK_VIRT_SCHED == BLK_SCHED_DEADLINE && !defined(BLK_VIRT_TIMER)
+#error "The deadline scheduler needs BLK_VIRT_TIMER"
+#endif
+
+/* Rate limited clients may burst up to this many nanoseconds worth of requests and bytes */
+#ifndef BLK_VIRT_RATE_BURST
+#define BLK_VIRT_RATE_BURST (NS_IN_S / 10)
+#endif
+
+/* Fixed point scale of the virtual time of the weighted fair scheduler */
+#define WFQ_SCALE 0x10000
+
+/* Maximum number of clients, limited by the data region addresses patched in below */
+#define BLK_VIRT_MAX_CLIENTS 16
+_Static_assert(BLK_NUM_CLIENTS >= 1 && BLK_NUM_CLIENTS <= BLK_VIRT_MAX_CLIENTS,
+               "Block virtualiser supports between 1 and BLK_VIRT_MAX_CLIENTS clients");
+
+/* Maximum number of partitions read from the partition table, clients may be given any of them */
+#ifndef BLK_VIRT_MAX_PARTITIONS
+#define BLK_VIRT_MAX_PARTITIONS 128
+#endif
+_Static_assert(BLK_VIRT_MAX_PARTITIONS >= MSDOS_MBR_MAX_PRIMARY_PARTITIONS,
+               "Block virtualiser must support all MBR primary partitions");
+
+/*
+ * Maximum number of blocks in a driver request made by merging client requests.
+ * Read or write requests from a client to contiguous blocks with contiguous buffers
+ * are merged into one driver request, as long as it stays within this size.
+ */
+#ifndef BLK_VIRT_MAX_MERGE_BLOCKS
+#define BLK_VIRT_MAX_MERGE_BLOCKS 32
+#endif
+_Static_assert(BLK_VIRT_MAX_MERGE_BLOCKS >= 1 && BLK_VIRT_MAX_MERGE_BLOCKS <= UINT16_MAX,
+               "Merged requests must fit the block count of a request");
+
+/*
+ * The segment list of a vectored request given to the driver is kept in the driver data
+ * region at the bookkeeping index of the request, with the io address of each buffer.
+ * The partition table is read into the same region, but only before serving clients.
+ */
+#define SEG_LIST_OFFSET(id) ((uintptr_t)(id) * sizeof(blk_seg_list_t))
+_Static_assert(BLK_QUEUE_CAPACITY_DRIV * sizeof(blk_seg_list_t) <= BLK_DATA_REGION_SIZE_DRIV,
+               "Driver data region must fit the segment list of every request in flight");
+
 /* Microkit patched variables */
 blk_storage_info_t *blk_driver_storage_info;
 blk_req_queue_t *blk_driver_req_queue;
@@ -39,19 +99,65 @@ blk_storage_info_t *blk_client_storage_info;
 blk_req_queue_t *blk_client_req_queue;
 blk_resp_queue_t *blk_client_resp_queue;
 uintptr_t blk_client_data;
-uintptr_t blk_client0_data_paddr;
-uintptr_t blk_client1_data_paddr;
+uintptr_t blk_client0_data_paddr, blk_client1_data_paddr, blk_client2_data_paddr, blk_client3_data_paddr;
+uintptr_t blk_client4_data_paddr, blk_client5_data_paddr, blk_client6_data_paddr, blk_client7_data_paddr;
+uintptr_t blk_client8_data_paddr, blk_client9_data_paddr, blk_client10_data_paddr, blk_client11_data_paddr;
+uintptr_t blk_client12_data_paddr, blk_client13_data_paddr, blk_client14_data_paddr, blk_client15_data_paddr;
+
+/* Physical address of the data region of each client, only those of BLK_NUM_CLIENTS are patched */
+static uintptr_t *const cli_data_paddrs[BLK_VIRT_MAX_CLIENTS] = {
+    &blk_client0_data_paddr,  &blk_client1_data_paddr,  &blk_client2_data_paddr,  &blk_client3_data_paddr,
+    &blk_client4_data_paddr,  &blk_client5_data_paddr,  &blk_client6_data_paddr,  &blk_client7_data_paddr,
+    &blk_client8_data_paddr,  &blk_client9_data_paddr,  &blk_client10_data_paddr, &blk_client11_data_paddr,
+    &blk_client12_data_paddr, &blk_client13_data_paddr, &blk_client14_data_paddr, &blk_client15_data_paddr,
+};
 
 /* Driver queue handle */
 blk_queue_handle_t drv_h;
 
+/*
+ * Driver request being built from client requests. The driver request id is the
+ * bookkeeping index of its first client request, and the rest are chained through
+ * reqbk_t.next in block order.
+ */
+typedef struct merge {
+    bool pending;
+    blk_req_code_t code;
+    uintptr_t io;
+    uint32_t block_number;
+    uint16_t count;
+    uint32_t first;
+    uint32_t last;
+    uint32_t num_reqs;
+} merge_t;
+
 /* Client specific info */
 typedef struct client {
     blk_queue_handle_t queue_h;
     microkit_channel ch;
-    uint32_t start_sector;
-    uint32_t sectors;
+    /* Partition of the client in blocks of BLK_TRANSFER_SIZE, such that
+     * start_block + num_blocks fits the block number of a driver request */
+    uint32_t start_block;
+    uint64_t num_blocks;
+    /* Data region of the client */
     uintptr_t data_paddr;
+    uintptr_t data_vaddr;
+    uint64_t data_size;
+    /* Driver request being built, kept between scheduling turns of the client */
+    merge_t merge;
+    blk_qos_t qos;
+    /* Client requests given to the driver and not yet completed */
+    uint32_t inflight;
+    /* Whether the client had requests waiting when last scheduled */
+    bool waiting;
+    /* Virtual time of the weighted fair scheduler */
+    uint64_t vtime;
+    /* Time since which the next request of the client has been waiting */
+    uint64_t waiting_since;
+    /* Rate limit token buckets, in nanoseconds times requests or bytes */
+    int64_t iops_tokens;
+    int64_t bandwidth_tokens;
+    uint64_t rate_time;
 } client_t;
 client_t clients[BLK_NUM_CLIENTS];
 
@@ -62,31 +168,58 @@ typedef struct reqbk {
     uintptr_t vaddr;
     uint16_t count;
     blk_req_code_t code;
+    /* Next client request merged into the same driver request, or REQBK_NONE */
+    uint32_t next;
 } reqbk_t;
 static reqbk_t reqsbk[BLK_QUEUE_CAPACITY_DRIV];
 
+#define REQBK_NONE UINT32_MAX
+
+#if BLK_VIRT_SCHED == BLK_SCHED_RR
+/* Next client to be given a turn by the round robin scheduler */
+static int sched_rr_next;
+#elif BLK_VIRT_SCHED == BLK_SCHED_WFQ
+/* Virtual time of the last client scheduled by the weighted fair scheduler */
+static uint64_t sched_vtime;
+#endif
+#ifdef BLK_VIRT_TIMER
+/* Whether a timeout is pending to resume rate limited clients */
+static bool timeout_pending;
+#endif
+
 /* Index allocator for driver request id */
 static ialloc_t ialloc;
 static uint32_t ialloc_idxlist[BLK_QUEUE_CAPACITY_DRIV];
 
-/* MS-DOS Master boot record */
-struct msdos_mbr msdos_mbr;
+/* Partition of the device, in bytes. Partitions that do not exist have a size of 0. */
+typedef struct partition {
+    uint64_t start;
+    uint64_t size;
+} partition_t;
+static partition_t partitions[BLK_VIRT_MAX_PARTITIONS];
+static uint32_t num_partitions;
 
-/* The virtualiser is not initialised until we can read the MBR and populate the block device configuration. */
+/* Partition table read before the virtualiser is initialised, starting with the MBR */
+static enum {
+    PT_READ_MBR,
+    PT_READ_GPT_ENTRIES,
+} pt_state = PT_READ_MBR;
+
+/* GPT header, and where its partition entries are within the blocks read from the driver */
+static struct gpt_header gpt_header;
+static uintptr_t gpt_entries_offset;
+
+/* The virtualiser is not initialised until we can read the partition table and populate the block device
+ * configuration. */
 bool initialised = false;
 
 static void partitions_init()
 {
-    if (msdos_mbr.signature != MSDOS_MBR_SIGNATURE) {
-        LOG_BLK_VIRT_ERR("Invalid MBR signature\n");
-        return;
-    }
-
-    /* Validate partition and assign to client */
+    /* Validate partition and assign to client, so that requests only need checking against the bounds */
     for (int client = 0; client < BLK_NUM_CLIENTS; client++) {
         size_t client_partition = blk_partition_mapping[client];
 
-        if (msdos_mbr.partitions[client_partition].type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
+        if (client_partition >= num_partitions || partitions[client_partition].size == 0) {
             /* Partition does not exist */
             LOG_BLK_VIRT_ERR(
                 "Invalid client partition mapping for client %d: partition: %zu, partition does not exist\n", client,
@@ -94,53 +227,174 @@ static void partitions_init()
             return;
         }
 
-        if (msdos_mbr.partitions[client_partition].lba_start % (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE) != 0) {
+        partition_t *partition = &partitions[client_partition];
+        if (partition->start % BLK_TRANSFER_SIZE != 0) {
             /* Partition start sector is not aligned to sDDF transfer size */
-            LOG_BLK_VIRT_ERR("Partition %d start sector %d not aligned to sDDF transfer size\n", (int)client_partition,
-                             msdos_mbr.partitions[client_partition].lba_start);
+            LOG_BLK_VIRT_ERR("Partition %d start 0x%lx not aligned to sDDF transfer size\n", (int)client_partition,
+                             partition->start);
+            return;
+        }
+
+        uint64_t start_block = partition->start / BLK_TRANSFER_SIZE;
+        uint64_t num_blocks = partition->size / BLK_TRANSFER_SIZE;
+        if (start_block + num_blocks > (uint64_t)UINT32_MAX + 1) {
+            LOG_BLK_VIRT_ERR("Partition %d is beyond the block numbers of sDDF requests\n", (int)client_partition);
             return;
         }
 
         /* We have a valid partition now. */
-        clients[client].start_sector = msdos_mbr.partitions[client_partition].lba_start;
-        clients[client].sectors = msdos_mbr.partitions[client_partition].sectors;
+        clients[client].start_block = start_block;
+        clients[client].num_blocks = num_blocks;
     }
 
     for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
         blk_storage_info_t *curr_blk_storage_info = blk_virt_cli_storage_info(blk_client_storage_info, i);
         curr_blk_storage_info->sector_size = blk_driver_storage_info->sector_size;
-        curr_blk_storage_info->capacity = clients[i].sectors / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE);
+        curr_blk_storage_info->capacity = clients[i].num_blocks;
+        curr_blk_storage_info->max_discard = blk_driver_storage_info->max_discard;
+        curr_blk_storage_info->max_write_zeroes = blk_driver_storage_info->max_write_zeroes;
+        curr_blk_storage_info->max_segments = MIN(blk_driver_storage_info->max_segments, BLK_MAX_SEGMENTS);
         curr_blk_storage_info->read_only = false;
         __atomic_store_n(&curr_blk_storage_info->ready, true, __ATOMIC_RELEASE);
     }
 }
 
-static void request_mbr()
+/**
+ * Read blocks of the partition table into the start of the driver data region.
+ *
+ * @param block_number first block to read.
+ * @param count number of blocks to read.
+ */
+static void request_partition_table(uint32_t block_number, uint16_t count)
 {
     int err = 0;
-    uintptr_t mbr_paddr = blk_data_paddr_driver;
-    uintptr_t mbr_vaddr = blk_driver_data;
+    uintptr_t pt_paddr = blk_data_paddr_driver;
+    uintptr_t pt_vaddr = blk_driver_data;
 
-    uint32_t mbr_req_id = 0;
-    err = ialloc_alloc(&ialloc, &mbr_req_id);
+    uint32_t pt_req_id = 0;
+    err = ialloc_alloc(&ialloc, &pt_req_id);
     assert(!err);
-    reqsbk[mbr_req_id] = (reqbk_t) { 0, 0, mbr_vaddr, 1, 0 };
+    reqsbk[pt_req_id] = (reqbk_t) { 0, 0, pt_vaddr, count, 0, REQBK_NONE };
 
-    /* Virt-to-driver data region needs to be big enough to transfer MBR data */
-    assert(BLK_DATA_REGION_SIZE_DRIV >= BLK_TRANSFER_SIZE);
-    err = blk_enqueue_req(&drv_h, BLK_REQ_READ, mbr_paddr, 0, 1, mbr_req_id);
+    /* Virt-to-driver data region needs to be big enough to transfer partition table data */
+    assert(BLK_DATA_REGION_SIZE_DRIV >= (uint64_t)BLK_TRANSFER_SIZE * count);
+    err = blk_enqueue_req(&drv_h, BLK_REQ_READ, pt_paddr, block_number, count, pt_req_id);
     assert(!err);
 
     microkit_deferred_notify(DRIVER_CH);
 }
 
-static bool handle_mbr_reply()
+static void mbr_partitions(struct msdos_mbr *mbr)
+{
+    for (int i = 0; i < MSDOS_MBR_MAX_PRIMARY_PARTITIONS; i++) {
+        if (mbr->partitions[i].type == MSDOS_MBR_PARTITION_TYPE_EMPTY) {
+            partitions[i] = (partition_t) { 0, 0 };
+            continue;
+        }
+        partitions[i].start = (uint64_t)mbr->partitions[i].lba_start * MSDOS_MBR_SECTOR_SIZE;
+        partitions[i].size = (uint64_t)mbr->partitions[i].sectors * MSDOS_MBR_SECTOR_SIZE;
+    }
+    num_partitions = MSDOS_MBR_MAX_PRIMARY_PARTITIONS;
+}
+
+/**
+ * Check the GPT header in the blocks read with the MBR and request its partition entries.
+ *
+ * @param vaddr start of the blocks read with the MBR.
+ *
+ * @return true if the partition entries were requested.
+ */
+static bool request_gpt_entries(uintptr_t vaddr)
+{
+    uint64_t sector_size = blk_driver_storage_info->sector_size;
+    if (sector_size < MSDOS_MBR_SECTOR_SIZE || sector_size > BLK_TRANSFER_SIZE || BLK_TRANSFER_SIZE % sector_size) {
+        LOG_BLK_VIRT_ERR("Unsupported sector size %lu for GPT\n", sector_size);
+        return false;
+    }
+
+    uintptr_t header_vaddr = vaddr + GPT_HEADER_LBA * sector_size;
+    sddf_memcpy(&gpt_header, (void *)header_vaddr, sizeof(struct gpt_header));
+    if (gpt_header.signature != GPT_SIGNATURE || gpt_header.header_size < GPT_HEADER_MIN_SIZE
+        || gpt_header.header_size > sector_size) {
+        LOG_BLK_VIRT_ERR("Invalid GPT header\n");
+        return false;
+    }
+
+    /* The checksum covers the header with its checksum field zeroed */
+    ((struct gpt_header *)header_vaddr)->header_crc32 = 0;
+    if (gpt_crc32((void *)header_vaddr, gpt_header.header_size) != gpt_header.header_crc32) {
+        LOG_BLK_VIRT_ERR("Invalid GPT header checksum\n");
+        return false;
+    }
+
+    if (gpt_header.partition_entry_size < sizeof(struct gpt_partition_entry)
+        || gpt_header.partition_entry_lba > UINT32_MAX) {
+        LOG_BLK_VIRT_ERR("Invalid GPT partition entries\n");
+        return false;
+    }
+
+    uint64_t entries_start = gpt_header.partition_entry_lba * sector_size;
+    uint64_t entries_size = (uint64_t)gpt_header.num_partition_entries * gpt_header.partition_entry_size;
+    gpt_entries_offset = entries_start % BLK_TRANSFER_SIZE;
+    uint64_t count = (gpt_entries_offset + entries_size + BLK_TRANSFER_SIZE - 1) / BLK_TRANSFER_SIZE;
+    if (count > BLK_DATA_REGION_SIZE_DRIV / BLK_TRANSFER_SIZE || count > UINT16_MAX) {
+        LOG_BLK_VIRT_ERR("GPT partition entries do not fit the driver data region\n");
+        return false;
+    }
+
+    request_partition_table(entries_start / BLK_TRANSFER_SIZE, count);
+    return true;
+}
+
+/**
+ * Check the GPT partition entries and use them as the partitions of the device.
+ *
+ * @param vaddr start of the blocks read with the partition entries.
+ *
+ * @return true if the partition entries are valid.
+ */
+static bool gpt_partitions(uintptr_t vaddr)
+{
+    uintptr_t entries_vaddr = vaddr + gpt_entries_offset;
+    uint64_t entries_size = (uint64_t)gpt_header.num_partition_entries * gpt_header.partition_entry_size;
+    if (gpt_crc32((void *)entries_vaddr, entries_size) != gpt_header.partition_entries_crc32) {
+        LOG_BLK_VIRT_ERR("Invalid GPT partition entries checksum\n");
+        return false;
+    }
+
+    uint64_t sector_size = blk_driver_storage_info->sector_size;
+    num_partitions = MIN(gpt_header.num_partition_entries, BLK_VIRT_MAX_PARTITIONS);
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        struct gpt_partition_entry entry;
+        sddf_memcpy(&entry, (void *)(entries_vaddr + i * gpt_header.partition_entry_size), sizeof(entry));
+
+        bool used = false;
+        for (size_t j = 0; j < sizeof(entry.type_guid); j++) {
+            used |= entry.type_guid[j] != 0;
+        }
+
+        if (!used || entry.first_lba > entry.last_lba || entry.last_lba >= UINT64_MAX / sector_size) {
+            partitions[i] = (partition_t) { 0, 0 };
+            continue;
+        }
+        partitions[i].start = entry.first_lba * sector_size;
+        partitions[i].size = (entry.last_lba - entry.first_lba + 1) * sector_size;
+    }
+
+    return true;
+}
+
+/**
+ * Handle a response from the driver to a read of the partition table, and initialise
+ * the virtualiser once the whole partition table is read.
+ */
+static void handle_partition_table_reply()
 {
     int err = 0;
     if (blk_queue_empty_resp(&drv_h)) {
-        LOG_BLK_VIRT(
-            "Notified by driver but queue is empty, expecting a response to a BLK_REQ_READ request into sector 0\n");
-        return false;
+        LOG_BLK_VIRT("Notified by driver but queue is empty, expecting a response to a BLK_REQ_READ request of the "
+                     "partition table\n");
+        return;
     }
 
     blk_resp_status_t drv_status;
@@ -149,21 +403,47 @@ static bool handle_mbr_reply()
     err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &drv_resp_id);
     assert(!err);
 
-    reqbk_t mbr_bk = reqsbk[drv_resp_id];
+    reqbk_t pt_bk = reqsbk[drv_resp_id];
     err = ialloc_free(&ialloc, drv_resp_id);
     assert(!err);
 
     if (drv_status != BLK_RESP_OK) {
-        LOG_BLK_VIRT_ERR("Failed to read sector 0 from driver\n");
-        return false;
+        LOG_BLK_VIRT_ERR("Failed to read partition table from driver\n");
+        return;
     }
 
     /* TODO: This is a raw seL4 system call because Microkit does not (currently)
      * include a corresponding libmicrokit API. */
-    seL4_ARM_VSpace_Invalidate_Data(3, mbr_bk.vaddr, mbr_bk.vaddr + (BLK_TRANSFER_SIZE * mbr_bk.count));
-    sddf_memcpy(&msdos_mbr, (void *)mbr_bk.vaddr, sizeof(struct msdos_mbr));
+    seL4_ARM_VSpace_Invalidate_Data(3, pt_bk.vaddr, pt_bk.vaddr + (BLK_TRANSFER_SIZE * pt_bk.count));
 
-    return true;
+    switch (pt_state) {
+    case PT_READ_MBR: {
+        struct msdos_mbr msdos_mbr;
+        sddf_memcpy(&msdos_mbr, (void *)pt_bk.vaddr, sizeof(struct msdos_mbr));
+        if (msdos_mbr.signature != MSDOS_MBR_SIGNATURE) {
+            LOG_BLK_VIRT_ERR("Invalid MBR signature\n");
+            return;
+        }
+
+        if (msdos_mbr.partitions[0].type == GPT_PROTECTIVE_MBR_TYPE) {
+            if (request_gpt_entries(pt_bk.vaddr)) {
+                pt_state = PT_READ_GPT_ENTRIES;
+            }
+            return;
+        }
+
+        mbr_partitions(&msdos_mbr);
+        break;
+    }
+    case PT_READ_GPT_ENTRIES:
+        if (!gpt_partitions(pt_bk.vaddr)) {
+            return;
+        }
+        break;
+    }
+
+    partitions_init();
+    initialised = true;
 }
 
 void init(void)
@@ -177,13 +457,17 @@ void init(void)
         uint32_t queue_size = blk_virt_cli_queue_size(i);
         blk_queue_init(&clients[i].queue_h, curr_req, curr_resp, queue_size);
         clients[i].ch = CLI_CH_OFFSET + i;
-    }
-
-    /* TODO: make data paddr handling system agnostic */
-    assert(BLK_NUM_CLIENTS <= 2 && BLK_NUM_CLIENTS >= 1);
-    clients[0].data_paddr = blk_client0_data_paddr;
-    if (BLK_NUM_CLIENTS > 1) {
-        clients[1].data_paddr = blk_client1_data_paddr;
+        clients[i].qos = blk_virt_cli_qos(i);
+        clients[i].data_paddr = *cli_data_paddrs[i];
+        clients[i].data_vaddr = blk_virt_cli_data_region(blk_client_data, i);
+        clients[i].data_size = blk_virt_cli_data_region_size(i);
+#ifndef BLK_VIRT_TIMER
+        if (clients[i].qos.iops || clients[i].qos.bandwidth) {
+            LOG_BLK_VIRT_ERR("client %d has rate limits but there is no timer, ignoring them\n", i);
+            clients[i].qos.iops = 0;
+            clients[i].qos.bandwidth = 0;
+        }
+#endif
     }
 
     /* Initialise driver queue */
@@ -192,7 +476,60 @@ void init(void)
     /* Initialise index allocator */
     ialloc_init(&ialloc, ialloc_idxlist, BLK_QUEUE_CAPACITY_DRIV);
 
-    request_mbr();
+    /* Read the MBR, along with the GPT header that follows it on GPT disks */
+    request_partition_table(0, blk_driver_storage_info->sector_size < BLK_TRANSFER_SIZE ? 1 : 2);
+}
+
+/**
+ * Complete a client request once the driver has responded to it.
+ *
+ * @param reqbk bookkeeping of the client request.
+ * @param status response status to give to the client.
+ * @param success_count number of blocks of the client request successfully transferred.
+ */
+static void handle_driver_resp(reqbk_t reqbk, blk_resp_status_t status, uint16_t success_count)
+{
+    switch (reqbk.code) {
+    case BLK_REQ_READ:
+        if (status == BLK_RESP_OK) {
+            /* Invalidate cache */
+            /* TODO: This is a raw seL4 system call because Microkit does not (currently)
+             * include a corresponding libmicrokit API. */
+            seL4_ARM_VSpace_Invalidate_Data(3, reqbk.vaddr, reqbk.vaddr + (BLK_TRANSFER_SIZE * reqbk.count));
+        }
+        break;
+    case BLK_REQ_READV:
+        if (status == BLK_RESP_OK) {
+            /* The driver only has read access to the segment list, so it still holds what we validated */
+            client_t *client = &clients[reqbk.cli_id];
+            blk_seg_list_t *seg_list = (blk_seg_list_t *)reqbk.vaddr;
+            for (int i = 0; i < seg_list->num_segs; i++) {
+                uintptr_t vaddr = client->data_vaddr + (seg_list->segs[i].io_or_offset - client->data_paddr);
+                seL4_ARM_VSpace_Invalidate_Data(3, vaddr, vaddr + (BLK_TRANSFER_SIZE * seg_list->segs[i].count));
+            }
+        }
+        break;
+    case BLK_REQ_WRITE:
+    case BLK_REQ_WRITEV:
+    case BLK_REQ_FLUSH:
+    case BLK_REQ_BARRIER:
+    case BLK_REQ_DISCARD:
+    case BLK_REQ_WRITE_ZEROES:
+        break;
+    default:
+        /* This should never happen as we will have sanitized request codes before they are bookkept */
+        LOG_BLK_VIRT_ERR("bookkept client %d request code %d is invalid, this should never happen\n", reqbk.cli_id,
+                         reqbk.code);
+        assert(false);
+    }
+
+    blk_queue_handle_t h = clients[reqbk.cli_id].queue_h;
+
+    /* Response queue should never be full since number of inflight requests (ialloc size)
+     * should always be less than or equal to resp queue capacity.
+     */
+    int err = blk_enqueue_resp(&h, status, success_count, reqbk.cli_req_id);
+    assert(!err);
 }
 
 static void handle_driver()
@@ -208,38 +545,32 @@ static void handle_driver()
         err = blk_dequeue_resp(&drv_h, &drv_status, &drv_success_count, &drv_resp_id);
         assert(!err);
 
-        reqbk_t reqbk = reqsbk[drv_resp_id];
-        err = ialloc_free(&ialloc, drv_resp_id);
-        assert(!err);
+        /* Fan the response out to every client request merged into the driver request */
+        bool merged = reqsbk[drv_resp_id].next != REQBK_NONE;
+        uint16_t remaining = drv_success_count;
+        for (uint32_t id = drv_resp_id; id != REQBK_NONE;) {
+            reqbk_t reqbk = reqsbk[id];
+            err = ialloc_free(&ialloc, id);
+            assert(!err);
+            id = reqbk.next;
 
-        switch (reqbk.code) {
-        case BLK_REQ_READ:
-            if (drv_status == BLK_RESP_OK) {
-                /* Invalidate cache */
-                /* TODO: This is a raw seL4 system call because Microkit does not (currently)
-                    * include a corresponding libmicrokit API. */
-                seL4_ARM_VSpace_Invalidate_Data(3, reqbk.vaddr, reqbk.vaddr + (BLK_TRANSFER_SIZE * reqbk.count));
+            blk_resp_status_t status = drv_status;
+            uint16_t success_count = drv_success_count;
+            if (merged) {
+                /* Blocks are transferred in order, so on failure the first client requests may have completed */
+                if (drv_status == BLK_RESP_OK || remaining >= reqbk.count) {
+                    status = BLK_RESP_OK;
+                    success_count = reqbk.count;
+                } else {
+                    success_count = remaining;
+                }
+                remaining -= MIN(remaining, reqbk.count);
             }
-            break;
-        case BLK_REQ_WRITE:
-        case BLK_REQ_FLUSH:
-        case BLK_REQ_BARRIER:
-            break;
-        default:
-            /* This should never happen as we will have sanitized request codes before they are bookkept */
-            LOG_BLK_VIRT_ERR("bookkept client %d request code %d is invalid, this should never happen\n", reqbk.cli_id,
-                             reqbk.code);
-            assert(false);
-        }
 
-        blk_queue_handle_t h = clients[reqbk.cli_id].queue_h;
-
-        /* Response queue should never be full since number of inflight requests (ialloc size)
-         * should always be less than or equal to resp queue capacity.
-         */
-        err = blk_enqueue_resp(&h, drv_status, drv_success_count, reqbk.cli_req_id);
-        assert(!err);
-        client_notify[reqbk.cli_id] = true;
+            handle_driver_resp(reqbk, status, success_count);
+            clients[reqbk.cli_id].inflight--;
+            client_notify[reqbk.cli_id] = true;
+        }
     }
 
     /* Notify corresponding client if a response was enqueued */
@@ -250,63 +581,262 @@ static void handle_driver()
     }
 }
 
-static bool handle_client(int cli_id)
+/**
+ * Merge a client request into the driver request being built, if it is a read or
+ * write that directly follows it on both the device and in memory.
+ *
+ * @return true if the client request was merged.
+ */
+static bool merge_append(merge_t *merge, blk_req_code_t code, uintptr_t io, uint32_t block_number, uint16_t count,
+                         uint32_t id)
+{
+    if (!merge->pending || code != merge->code || (code != BLK_REQ_READ && code != BLK_REQ_WRITE)) {
+        return false;
+    }
+    if (io != merge->io + (uintptr_t)merge->count * BLK_TRANSFER_SIZE
+        || block_number != merge->block_number + merge->count || merge->count + count > BLK_VIRT_MAX_MERGE_BLOCKS) {
+        return false;
+    }
+
+    reqsbk[merge->last].next = id;
+    merge->last = id;
+    merge->count += count;
+    merge->num_reqs++;
+    return true;
+}
+
+/**
+ * Enqueue the driver request being built for a client, if there is one, and charge
+ * it to the client.
+ *
+ * @return true if a request was enqueued to the driver.
+ */
+static bool merge_submit(client_t *client)
+{
+    merge_t *merge = &client->merge;
+    if (!merge->pending) {
+        return false;
+    }
+
+    int err = blk_enqueue_req(&drv_h, merge->code, merge->io, merge->block_number, merge->count, merge->first);
+    assert(!err);
+
+    client->inflight += merge->num_reqs;
+#if BLK_VIRT_SCHED == BLK_SCHED_WFQ
+    uint32_t weight = client->qos.weight ? client->qos.weight : 1;
+    client->vtime += (uint64_t)MAX(merge->count, 1) * WFQ_SCALE / weight;
+#endif
+#ifdef BLK_VIRT_TIMER
+    if (client->qos.iops) {
+        client->iops_tokens -= (int64_t)merge->num_reqs * NS_IN_S;
+    }
+    if (client->qos.bandwidth
+        && (merge->code == BLK_REQ_READ || merge->code == BLK_REQ_WRITE || merge->code == BLK_REQ_READV
+            || merge->code == BLK_REQ_WRITEV)) {
+        client->bandwidth_tokens -= (int64_t)merge->count * BLK_TRANSFER_SIZE * NS_IN_S;
+    }
+#endif
+
+    *merge = (merge_t) { 0 };
+    return true;
+}
+
+/* Whether a client has requests that are yet to be given to the driver */
+static bool client_waiting(client_t *client)
+{
+    return client->merge.pending || !blk_queue_empty_req(&client->queue_h);
+}
+
+/* Whether a client may be given a turn to enqueue a request to the driver */
+static bool client_eligible(client_t *client)
+{
+    if (!client->merge.pending && (blk_queue_empty_req(&client->queue_h) || ialloc_full(&ialloc))) {
+        return false;
+    }
+    if (client->qos.max_inflight && client->inflight >= client->qos.max_inflight) {
+        return false;
+    }
+    return client->iops_tokens >= 0 && client->bandwidth_tokens >= 0;
+}
+
+#ifdef BLK_VIRT_TIMER
+static void rate_refill(client_t *client, uint64_t now)
+{
+    int64_t elapsed = MIN(now - client->rate_time, BLK_VIRT_RATE_BURST);
+    client->rate_time = now;
+
+    if (client->qos.iops) {
+        int64_t max = (int64_t)client->qos.iops * BLK_VIRT_RATE_BURST;
+        client->iops_tokens = MIN(client->iops_tokens + elapsed * (int64_t)client->qos.iops, max);
+    }
+    if (client->qos.bandwidth) {
+        int64_t max = (int64_t)client->qos.bandwidth * BLK_VIRT_RATE_BURST;
+        client->bandwidth_tokens = MIN(client->bandwidth_tokens + elapsed * (int64_t)client->qos.bandwidth, max);
+    }
+}
+
+/* Time in nanoseconds until a rate limited client is back within its limits */
+static uint64_t rate_wait(client_t *client)
+{
+    uint64_t wait = 0;
+    if (client->iops_tokens < 0) {
+        wait = MAX(wait, (uint64_t)-client->iops_tokens / client->qos.iops + 1);
+    }
+    if (client->bandwidth_tokens < 0) {
+        wait = MAX(wait, (uint64_t)-client->bandwidth_tokens / client->qos.bandwidth + 1);
+    }
+    return wait;
+}
+#endif
+
+/**
+ * Choose the client to give the next turn to, according to BLK_VIRT_SCHED.
+ *
+ * @return index of the client, or -1 if no client is eligible.
+ */
+static int sched_pick(void)
+{
+    int best = -1;
+#if BLK_VIRT_SCHED == BLK_SCHED_RR
+    for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
+        int cli_id = (sched_rr_next + i) % BLK_NUM_CLIENTS;
+        if (client_eligible(&clients[cli_id])) {
+            sched_rr_next = (cli_id + 1) % BLK_NUM_CLIENTS;
+            return cli_id;
+        }
+    }
+#elif BLK_VIRT_SCHED == BLK_SCHED_WFQ
+    for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
+        if (client_eligible(&clients[i]) && (best < 0 || clients[i].vtime < clients[best].vtime)) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        sched_vtime = clients[best].vtime;
+    }
+#elif BLK_VIRT_SCHED == BLK_SCHED_DEADLINE
+    uint64_t best_deadline = UINT64_MAX;
+    for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
+        if (!client_eligible(&clients[i])) {
+            continue;
+        }
+        uint64_t deadline = clients[i].qos.deadline ? clients[i].waiting_since + clients[i].qos.deadline : UINT64_MAX;
+        if (best < 0 || deadline < best_deadline
+            || (deadline == best_deadline && clients[i].waiting_since < clients[best].waiting_since)) {
+            best = i;
+            best_deadline = deadline;
+        }
+    }
+#else
+#error "Unknown BLK_VIRT_SCHED"
+#endif
+    return best;
+}
+
+/**
+ * Copy the segment list of a vectored client request, checking that the buffer of every
+ * segment is within the data region of the client and that their counts add up to that
+ * of the request.
+ *
+ * @param client client the request is from.
+ * @param offset offset of the segment list within the data region of the client.
+ * @param count number of blocks of the request.
+ * @param seg_list where to copy the segment list to, with the io address of each buffer.
+ *
+ * @return true if the segment list is valid.
+ */
+static bool seg_list_copy(client_t *client, uintptr_t offset, uint16_t count, blk_seg_list_t *seg_list)
+{
+    if (offset % _Alignof(blk_seg_list_t) != 0 || offset >= client->data_size
+        || sizeof(blk_seg_list_t) > client->data_size - offset) {
+        return false;
+    }
+
+    /* The client can change its copy at any time, so we only look at ours */
+    sddf_memcpy(seg_list, (void *)(client->data_vaddr + offset), sizeof(blk_seg_list_t));
+    if (seg_list->num_segs == 0 || seg_list->num_segs > MIN(blk_driver_storage_info->max_segments, BLK_MAX_SEGMENTS)) {
+        return false;
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < seg_list->num_segs; i++) {
+        blk_seg_t *seg = &seg_list->segs[i];
+        if (seg->count == 0 || seg->io_or_offset >= client->data_size
+            || (uint64_t)BLK_TRANSFER_SIZE * seg->count > client->data_size - seg->io_or_offset
+            || (client->data_paddr + seg->io_or_offset) % BLK_TRANSFER_SIZE != 0) {
+            return false;
+        }
+        total += seg->count;
+        seg->io_or_offset += client->data_paddr;
+    }
+
+    return total == count;
+}
+
+/**
+ * Give a client a turn, in which at most one driver request is enqueued. Client requests
+ * are dequeued until one cannot be merged into the driver request being built, which is
+ * then kept for the next turn of the client.
+ *
+ * @param cli_id client to take requests from.
+ * @param client_notify set if a response was enqueued to the client.
+ *
+ * @return true if a request was enqueued to the driver.
+ */
+static bool handle_client(int cli_id, bool *client_notify)
 {
     int err = 0;
-    blk_queue_handle_t h = clients[cli_id].queue_h;
-    uintptr_t cli_data_base = blk_virt_cli_data_region(blk_client_data, cli_id);
-    uint64_t cli_data_region_size = blk_virt_cli_data_region_size(cli_id);
+    client_t *client = &clients[cli_id];
+    blk_queue_handle_t h = client->queue_h;
 
     blk_req_code_t cli_code = 0;
     uintptr_t cli_offset = 0;
     uint32_t cli_block_number = 0;
     uint16_t cli_count = 0;
     uint32_t cli_req_id = 0;
+    blk_seg_list_t seg_list;
 
-    bool driver_notify = false;
-    bool client_notify = false;
     /*
-     * In addition to checking the client actually has a request, we check that the
-     * we can enqueue the request into the driver as well as that our index state tracking
-     * is not full. We check the index allocator as there can be more in-flight requests
-     * than currently in the driver queue.
+     * In addition to checking the client actually has a request, we check that our index
+     * state tracking is not full. We check the index allocator as there can be more in-flight
+     * requests than currently in the driver queue. The caller checks that the driver queue
+     * has space for the one request of this turn.
      */
-    while (!blk_queue_empty_req(&h) && !blk_queue_full_req(&drv_h) && !ialloc_full(&ialloc)) {
+    while (!blk_queue_empty_req(&h) && !ialloc_full(&ialloc)
+           && (!client->qos.max_inflight || client->inflight + client->merge.num_reqs < client->qos.max_inflight)) {
 
         err = blk_dequeue_req(&h, &cli_code, &cli_offset, &cli_block_number, &cli_count, &cli_req_id);
         assert(!err);
 
-        uint32_t drv_block_number = 0;
-        drv_block_number = cli_block_number + (clients[cli_id].start_sector / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE));
+        uint32_t drv_block_number = client->start_block + cli_block_number;
 
         blk_resp_status_t resp_status = BLK_RESP_ERR_UNSPEC;
 
         switch (cli_code) {
         case BLK_REQ_READ:
         case BLK_REQ_WRITE: {
-            unsigned long client_sectors = clients[cli_id].sectors / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE);
-            unsigned long client_start_sector = clients[cli_id].start_sector / (BLK_TRANSFER_SIZE / MSDOS_MBR_SECTOR_SIZE);
-            if (drv_block_number < client_start_sector || drv_block_number + cli_count > client_start_sector + client_sectors) {
-                /* Requested block number out of bounds */
-                LOG_BLK_VIRT_ERR("client %d request for block %d is out of bounds\n", cli_id, cli_block_number);
+            if (cli_count == 0) {
+                LOG_BLK_VIRT_ERR("client %d requested zero blocks\n", cli_id);
                 resp_status = BLK_RESP_ERR_INVALID_PARAM;
                 goto req_fail;
             }
 
-            if ((cli_offset + BLK_TRANSFER_SIZE * cli_count) > cli_data_region_size) {
-                /* Requested offset is out of bounds from client data region */
-                LOG_BLK_VIRT_ERR("client %d request offset 0x%lx is invalid\n", cli_id, cli_offset);
+            if (cli_block_number >= client->num_blocks || cli_count > client->num_blocks - cli_block_number) {
+                /* Requested block number out of bounds */
+                LOG_BLK_VIRT_ERR("client %d request for block %d is out of bounds\n", cli_id, cli_block_number);
                 resp_status = BLK_RESP_ERR_INVALID_PARAM;
                 goto req_fail;
             }
 
-            if (cli_count == 0) {
-                LOG_BLK_VIRT_ERR("client %d requested zero blocks\n", cli_id);
+            if (cli_offset >= client->data_size
+                || (uint64_t)BLK_TRANSFER_SIZE * cli_count > client->data_size - cli_offset) {
+                /* Requested offset is out of bounds from client data region */
+                LOG_BLK_VIRT_ERR("client %d request offset 0x%lx is invalid\n", cli_id, cli_offset);
                 resp_status = BLK_RESP_ERR_INVALID_PARAM;
                 goto req_fail;
             }
 
-            if ((clients[cli_id].data_paddr + cli_offset) % BLK_TRANSFER_SIZE != 0) {
+            if ((client->data_paddr + cli_offset) % BLK_TRANSFER_SIZE != 0) {
                 LOG_BLK_VIRT_ERR(
                     "client %d requested dma address is not aligned to page size (same as blk transfer size)\n",
                     cli_id);
@@ -315,9 +845,44 @@ static bool handle_client(int cli_id)
             }
             break;
         }
+        case BLK_REQ_READV:
+        case BLK_REQ_WRITEV:
+            if (cli_block_number >= client->num_blocks || cli_count > client->num_blocks - cli_block_number) {
+                /* Requested block number out of bounds */
+                LOG_BLK_VIRT_ERR("client %d request for block %d is out of bounds\n", cli_id, cli_block_number);
+                resp_status = BLK_RESP_ERR_INVALID_PARAM;
+                goto req_fail;
+            }
+
+            if (!seg_list_copy(client, cli_offset, cli_count, &seg_list)) {
+                LOG_BLK_VIRT_ERR("client %d request segment list at offset 0x%lx is invalid\n", cli_id, cli_offset);
+                resp_status = BLK_RESP_ERR_INVALID_PARAM;
+                goto req_fail;
+            }
+            break;
         case BLK_REQ_FLUSH:
         case BLK_REQ_BARRIER:
             break;
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES: {
+            uint16_t max_count = (cli_code == BLK_REQ_DISCARD) ? blk_driver_storage_info->max_discard
+                                                               : blk_driver_storage_info->max_write_zeroes;
+            if (cli_count == 0 || cli_count > max_count) {
+                /* Zero blocks, or more than the device supports, which is none if it does not support the request */
+                LOG_BLK_VIRT_ERR("client %d request code %d for %d blocks is not supported\n", cli_id, cli_code,
+                                 cli_count);
+                resp_status = BLK_RESP_ERR_INVALID_PARAM;
+                goto req_fail;
+            }
+
+            if (cli_block_number >= client->num_blocks || cli_count > client->num_blocks - cli_block_number) {
+                /* Requested block number out of bounds */
+                LOG_BLK_VIRT_ERR("client %d request for block %d is out of bounds\n", cli_id, cli_block_number);
+                resp_status = BLK_RESP_ERR_INVALID_PARAM;
+                goto req_fail;
+            }
+            break;
+        }
         default:
             /* Invalid request code given */
             LOG_BLK_VIRT_ERR("client %d gave an invalid request code %d\n", cli_id, cli_code);
@@ -325,20 +890,40 @@ static bool handle_client(int cli_id)
             goto req_fail;
         }
 
+        uintptr_t cli_vaddr = client->data_vaddr + cli_offset;
         if (cli_code == BLK_REQ_WRITE) {
-            cache_clean(cli_data_base + cli_offset, cli_data_base + cli_offset + (BLK_TRANSFER_SIZE * cli_count));
+            cache_clean(cli_vaddr, cli_vaddr + (BLK_TRANSFER_SIZE * cli_count));
+        } else if (cli_code == BLK_REQ_WRITEV) {
+            for (int i = 0; i < seg_list.num_segs; i++) {
+                uintptr_t seg_vaddr = client->data_vaddr + (seg_list.segs[i].io_or_offset - client->data_paddr);
+                cache_clean(seg_vaddr, seg_vaddr + (BLK_TRANSFER_SIZE * seg_list.segs[i].count));
+            }
         }
 
-        /* Bookkeep client request and generate driver req id */
-        uint32_t drv_req_id = 0;
-        err = ialloc_alloc(&ialloc, &drv_req_id);
+        /* Bookkeep client request and generate its id */
+        uint32_t req_id = 0;
+        err = ialloc_alloc(&ialloc, &req_id);
         assert(!err);
-        reqsbk[drv_req_id] = (reqbk_t) { cli_id, cli_req_id, cli_data_base + cli_offset, cli_count, cli_code };
 
-        err = blk_enqueue_req(&drv_h, cli_code, clients[cli_id].data_paddr + cli_offset, drv_block_number, cli_count,
-                              drv_req_id);
-        assert(!err);
-        driver_notify = true;
+        uintptr_t drv_io = client->data_paddr + cli_offset;
+        if (cli_code == BLK_REQ_READV || cli_code == BLK_REQ_WRITEV) {
+            /* The driver is given our copy of the segment list, which is bookkept in place of the buffer */
+            cli_vaddr = blk_driver_data + SEG_LIST_OFFSET(req_id);
+            sddf_memcpy((void *)cli_vaddr, &seg_list, sizeof(blk_seg_list_t));
+            drv_io = blk_data_paddr_driver + SEG_LIST_OFFSET(req_id);
+        }
+        reqsbk[req_id] = (reqbk_t) { cli_id, cli_req_id, cli_vaddr, cli_count, cli_code, REQBK_NONE };
+
+        if (merge_append(&client->merge, cli_code, drv_io, drv_block_number, cli_count, req_id)) {
+            continue;
+        }
+
+        merge_t next = { true, cli_code, drv_io, drv_block_number, cli_count, req_id, req_id, 1 };
+        if (merge_submit(client)) {
+            client->merge = next;
+            return true;
+        }
+        client->merge = next;
         continue;
 
     req_fail:
@@ -347,23 +932,72 @@ static bool handle_client(int cli_id)
          */
         err = blk_enqueue_resp(&h, resp_status, 0, cli_req_id);
         assert(!err);
-        client_notify = true;
+        *client_notify = true;
     }
 
-    if (client_notify) {
-        microkit_notify(clients[cli_id].ch);
-    }
-
-    return driver_notify;
+    return merge_submit(client);
 }
 
 static void handle_clients()
 {
     bool driver_notify = false;
+    bool client_notify[BLK_NUM_CLIENTS] = { 0 };
+
+#ifdef BLK_VIRT_TIMER
+    uint64_t now = sddf_timer_time_now(TIMER_CH);
+#else
+    uint64_t now = 0;
+#endif
+
     for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
-        if (handle_client(i)) {
+        bool waiting = client_waiting(&clients[i]);
+        if (waiting && !clients[i].waiting) {
+#if BLK_VIRT_SCHED == BLK_SCHED_WFQ
+            /* A client does not build up credit while it is idle */
+            clients[i].vtime = MAX(clients[i].vtime, sched_vtime);
+#endif
+            clients[i].waiting_since = now;
+        }
+        clients[i].waiting = waiting;
+#ifdef BLK_VIRT_TIMER
+        rate_refill(&clients[i], now);
+#endif
+    }
+
+    while (!blk_queue_full_req(&drv_h)) {
+        int cli_id = sched_pick();
+        if (cli_id < 0) {
+            break;
+        }
+
+        if (handle_client(cli_id, &client_notify[cli_id])) {
             driver_notify = true;
         }
+        /* The next request of the client is taken to arrive once this one is dispatched */
+        clients[cli_id].waiting = client_waiting(&clients[cli_id]);
+        clients[cli_id].waiting_since = now;
+    }
+
+#ifdef BLK_VIRT_TIMER
+    /* Wake up once the first client held back only by its rate limits is within them again */
+    if (!timeout_pending) {
+        uint64_t wait = UINT64_MAX;
+        for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
+            if (client_waiting(&clients[i]) && (clients[i].iops_tokens < 0 || clients[i].bandwidth_tokens < 0)) {
+                wait = MIN(wait, rate_wait(&clients[i]));
+            }
+        }
+        if (wait != UINT64_MAX) {
+            sddf_timer_set_timeout(TIMER_CH, wait);
+            timeout_pending = true;
+        }
+    }
+#endif
+
+    for (int i = 0; i < BLK_NUM_CLIENTS; i++) {
+        if (client_notify[i]) {
+            microkit_notify(clients[i].ch);
+        }
     }
 
     if (driver_notify) {
@@ -374,11 +1008,7 @@ static void handle_clients()
 void notified(microkit_channel ch)
 {
     if (initialised == false) {
-        bool success = handle_mbr_reply();
-        if (success) {
-            partitions_init();
-            initialised = true;
-        };
+        handle_partition_table_reply();
         return;
     }
 
@@ -386,6 +1016,11 @@ void notified(microkit_channel ch)
         handle_driver();
         handle_clients();
     } else {
+#ifdef BLK_VIRT_TIMER
+        if (ch == TIMER_CH) {
+            timeout_pending = false;
+        }
+#endif
         handle_clients();
     }
 }
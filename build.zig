@@ -48,6 +48,7 @@ const util_src = [_][]const u8{
     "util/newlibc.c",
     "util/cache.c",
     "util/fsmalloc.c",
+    "util/slab.c",
     "util/bitarray.c",
     "util/assert.c",
 };
@@ -270,6 +271,7 @@ pub fn build(b: *std.Build) void {
     const serial_config_include_option = b.option([]const u8, "serial_config_include", "Include path to serial config header") orelse "";
     const net_config_include_option = b.option([]const u8, "net_config_include", "Include path to network config header") orelse "";
     const i2c_client_include_option = b.option([]const u8, "i2c_client_include", "Include path to client config header") orelse "";
+    const virtio_transport_pci = b.option(bool, "virtio_transport_pci", "Build virtIO drivers for the PCI transport instead of MMIO") orelse false;
 
     // TODO: Right now this is not super ideal. What's happening is that we do not
     // always need a serial config include, but we must always specify it
@@ -345,6 +347,9 @@ pub fn build(b: *std.Build) void {
     // Block drivers
     inline for (std.meta.fields(DriverClass.Block)) |class| {
         const driver = addBlockDriver(b, blk_config_include, util, @enumFromInt(class.value), target, optimize);
+        if (virtio_transport_pci and comptime std.mem.eql(u8, class.name, "virtio")) {
+            driver.defineCMacro("VIRTIO_TRANSPORT_PCI", null);
+        }
         driver.linkLibrary(util_putchar_debug);
         b.installArtifact(driver);
     }
@@ -430,6 +435,9 @@ pub fn build(b: *std.Build) void {
     // Network drivers
     inline for (std.meta.fields(DriverClass.Network)) |class| {
         const driver = addNetworkDriver(b, net_config_include, util, @enumFromInt(class.value), target, optimize);
+        if (virtio_transport_pci and comptime std.mem.eql(u8, class.name, "virtio")) {
+            driver.defineCMacro("VIRTIO_TRANSPORT_PCI", null);
+        }
         driver.linkLibrary(util_putchar_debug);
         b.installArtifact(driver);
     }
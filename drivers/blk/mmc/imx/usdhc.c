@@ -55,7 +55,15 @@ volatile imx_usdhc_regs_t *usdhc_regs;
 blk_storage_info_t *blk_storage_info;
 blk_req_queue_t *blk_req_queue;
 blk_resp_queue_t *blk_resp_queue;
+/* Data region of the virtualiser, read only, holding the segment lists of vectored requests */
 uintptr_t blk_data;
+uintptr_t blk_data_paddr;
+
+/* ADMA2 descriptor table for the buffers of the vectored request being transferred */
+#define ADMA2_TABLE_SIZE 0x4000
+#define ADMA2_TABLE_ENTRIES (ADMA2_TABLE_SIZE / sizeof(usdhc_adma2_desc_t))
+uintptr_t adma2_table_vaddr;
+uintptr_t adma2_table_paddr;
 
 /* Make sure to update drv_to_blk_status() as well */
 typedef enum {
@@ -120,6 +128,15 @@ static struct driver_state {
         DataStateInit = DRIVER_STATE_INIT,
         DataStateSend,
     } data_transfer;
+
+    enum {
+        EraseStateInit = DRIVER_STATE_INIT,
+        EraseStateEnd,
+        EraseStateErase,
+        EraseStateBusy,
+    } erase;
+
+    uint64_t erase_start_time;
 } driver_state;
 
 static inline void reset_driver_and_card_state(void)
@@ -134,6 +151,8 @@ static inline void reset_driver_and_card_state(void)
         .card_ident = DRIVER_STATE_INIT,
         .card_init_start_time = DRIVER_STATE_INIT,
         .data_transfer = DRIVER_STATE_INIT,
+        .erase = DRIVER_STATE_INIT,
+        .erase_start_time = DRIVER_STATE_INIT,
     };
 
     card_info = (struct card_info) {
@@ -427,7 +446,7 @@ static void set_clock_frequency_registers(sd_clock_freq_t frequency)
     usdhc_regs->sys_ctrl = sys_ctrl;
 }
 
-static bool has_timed_out(uint64_t start, uint32_t timeout)
+static bool has_timed_out(uint64_t start, uint64_t timeout)
 {
     return (sddf_timer_time_now(CHANNEL_TIMER) - start) > timeout;
 }
@@ -755,6 +774,61 @@ drv_status_t perform_card_identification_and_select()
     }
 }
 
+/* Set the DMA of the next data transfer to use a buffer, or with adma2 an ADMA2 descriptor table. */
+static void usdhc_set_dma_address(uintptr_t dma_address, bool adma2)
+{
+    uint32_t dmasel = adma2 ? USDHC_PROT_CTRL_DMASEL_ADMA2 : USDHC_PROT_CTRL_DMASEL_SIMPLE;
+    usdhc_regs->prot_ctrl = (usdhc_regs->prot_ctrl & ~USDHC_PROT_CTRL_DMASEL_MASK)
+                            | (dmasel << USDHC_PROT_CTRL_DMASEL_SHIFT);
+    if (adma2) {
+        usdhc_regs->adma_sys_addr = dma_address;
+    } else {
+        usdhc_regs->ds_addr = dma_address;
+    }
+}
+
+/*
+    Fill in the ADMA2 descriptor table with the buffers of the segments of a vectored request,
+    given the io address of its segment list in the data region of the virtualiser. Returns
+    false if the buffers need more descriptors than the table has, or if a buffer does not
+    lie below 4GiB, as descriptors only hold 32-bit addresses.
+*/
+static bool usdhc_adma2_table_fill(uintptr_t seg_list_io)
+{
+    /* The virtualiser has checked the segments against our storage info */
+    assert(seg_list_io >= blk_data_paddr
+           && seg_list_io - blk_data_paddr <= BLK_DATA_REGION_SIZE_DRIV - sizeof(blk_seg_list_t));
+    blk_seg_list_t *seg_list = (blk_seg_list_t *)(blk_data + (seg_list_io - blk_data_paddr));
+    assert(seg_list->num_segs >= 1 && seg_list->num_segs <= BLK_MAX_SEGMENTS);
+
+    usdhc_adma2_desc_t *table = (usdhc_adma2_desc_t *)adma2_table_vaddr;
+    size_t num_descs = 0;
+    for (int i = 0; i < seg_list->num_segs; i++) {
+        uint64_t addr = seg_list->segs[i].io_or_offset;
+        uint64_t remaining = (uint64_t)seg_list->segs[i].count * BLK_TRANSFER_SIZE;
+        if (addr + remaining > BIT(32)) {
+            LOG_DRIVER_ERR("Segment at 0x%lx is not addressable by ADMA2\n", addr);
+            return false;
+        }
+        while (remaining > 0) {
+            if (num_descs == ADMA2_TABLE_ENTRIES) {
+                return false;
+            }
+            uint16_t len = MIN(remaining, USDHC_ADMA2_MAX_LEN);
+            table[num_descs++] = (usdhc_adma2_desc_t) {
+                .attr = USDHC_ADMA2_ATTR_VALID | USDHC_ADMA2_ATTR_ACT_TRAN,
+                .len = len,
+                .addr = addr,
+            };
+            addr += len;
+            remaining -= len;
+        }
+    }
+    table[num_descs - 1].attr |= USDHC_ADMA2_ATTR_END;
+
+    return true;
+}
+
 /* [IMX8MDQLQRM] 10.3.4.3.2.1 Normal read
 
     1. Wait until the card is ready for data
@@ -767,8 +841,10 @@ drv_status_t perform_card_identification_and_select()
     6. Wait for the Transfer Complete interrupt.
 
     Also reference [SD-PHY] 4.3.3 Data Read.
+
+    With adma2, dma_address is that of an ADMA2 descriptor table rather than of the buffer.
 */
-drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, uint16_t sector_count)
+drv_status_t usdhc_read_blocks(uintptr_t dma_address, bool adma2, uint32_t sector_number, uint16_t sector_count)
 {
     drv_status_t status;
     uint32_t data_address;
@@ -783,7 +859,7 @@ drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, ui
         usdhc_regs->blk_att = (usdhc_regs->blk_att & ~USDHC_BLK_ATT_BLKSIZE_MASK) | (SD_BLOCK_SIZE <<
                                                                                      USDHC_BLK_ATT_BLKSIZE_SHIFT);
 
-        usdhc_regs->ds_addr = dma_address;
+        usdhc_set_dma_address(dma_address, adma2);
 
         /* Select read data transfer direction */
         usdhc_regs->mix_ctrl |= USDHC_MIX_CTRL_DTDSEL;
@@ -834,8 +910,10 @@ drv_status_t usdhc_read_blocks(uintptr_t dma_address, uint32_t sector_number, ui
     6. Wait for the Transfer Complete interrupt.
 
     Also reference [SD-PHY] 4.3.4 Data Write
+
+    With adma2, dma_address is that of an ADMA2 descriptor table rather than of the buffer.
 */
-drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, uint16_t sector_count)
+drv_status_t usdhc_write_blocks(uintptr_t dma_address, bool adma2, uint32_t sector_number, uint16_t sector_count)
 {
     drv_status_t status;
     uint32_t data_address;
@@ -850,7 +928,7 @@ drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, u
         usdhc_regs->blk_att = (usdhc_regs->blk_att & ~USDHC_BLK_ATT_BLKSIZE_MASK) | (SD_BLOCK_SIZE <<
                                                                                      USDHC_BLK_ATT_BLKSIZE_SHIFT);
 
-        usdhc_regs->ds_addr = dma_address;
+        usdhc_set_dma_address(dma_address, adma2);
 
         /* Select write data transfer direction */
         usdhc_regs->mix_ctrl &= ~USDHC_MIX_CTRL_DTDSEL;
@@ -890,6 +968,80 @@ drv_status_t usdhc_write_blocks(uintptr_t dma_address, uint32_t sector_number, u
     }
 }
 
+/* [SD-PHY] 4.3.5 Erase
+
+    1. Set the first write block to erase with ERASE_WR_BLK_START
+    2. Set the last write block to erase with ERASE_WR_BLK_END
+    3. Start the erase with ERASE
+
+    The card signals busy on DAT0 until the erase has finished. As we never get an interrupt
+    for the end of the busy signal of a response-with-busy, we poll the DAT0 line for it
+    from timer notifications, and fail the erase after SD_ERASE_TIMEOUT.
+    The erased blocks read as either all zeroes or all ones depending on the card, so this
+    can only be used for discarding blocks.
+*/
+drv_status_t usdhc_erase_blocks(uint32_t sector_number, uint32_t sector_count)
+{
+    drv_status_t status;
+    uint32_t start_address = sector_number;
+    uint32_t end_address = sector_number + sector_count - 1;
+    if (!card_info.ccs) {
+        start_address *= SD_BLOCK_SIZE;
+        end_address *= SD_BLOCK_SIZE;
+    }
+
+    switch (driver_state.erase) {
+    case EraseStateInit:
+        status = send_command(SD_CMD32_ERASE_WR_BLK_START, start_address);
+        if (status != DrvSuccess) {
+            return status;
+        }
+
+        driver_state.erase = EraseStateEnd;
+        driver_state.command = (struct command_state) {};
+        fallthrough;
+
+    case EraseStateEnd:
+        status = send_command(SD_CMD33_ERASE_WR_BLK_END, end_address);
+        if (status != DrvSuccess) {
+            return status;
+        }
+
+        driver_state.erase = EraseStateErase;
+        driver_state.command = (struct command_state) {};
+        fallthrough;
+
+    case EraseStateErase:
+        status = send_command(SD_CMD38_ERASE, 0);
+        if (status != DrvSuccess) {
+            return status;
+        }
+
+        card_info.card_state = CardStatePrg;
+        driver_state.erase_start_time = sddf_timer_time_now(CHANNEL_TIMER);
+        driver_state.erase = EraseStateBusy;
+        driver_state.command = (struct command_state) {};
+        fallthrough;
+
+    case EraseStateBusy:
+        if (!(usdhc_regs->pres_state & USDHC_PRES_STATE_DLSL0)) {
+            if (has_timed_out(driver_state.erase_start_time, SD_ERASE_TIMEOUT)) {
+                LOG_DRIVER_ERR("card never finished erasing...\n");
+                return DrvErrorInternal;
+            }
+            sddf_timer_set_timeout(CHANNEL_TIMER, SD_ERASE_POLL_INTERVAL);
+            return DrvIrqWait;
+        }
+
+        card_info.card_state = CardStateTran;
+        return DrvSuccess;
+
+    default:
+        /* unreachable */
+        return DrvIrqWait;
+    }
+}
+
 void setup_blk_storage_info()
 {
     assert(!blk_storage_info->ready);
@@ -967,6 +1119,17 @@ void setup_blk_storage_info()
 
     LOG_DRIVER("Card size (blocks): %lu\n", blk_storage_info->capacity);
 
+    /* Discards are erases, which the card supports if it supports the erase command class */
+    uint32_t ccc = (csd & SD_CSD_CCC_MASK) >> SD_CSD_CCC_SHIFT;
+    if (ccc & SD_CSD_CCC_ERASE) {
+        blk_storage_info->max_discard = SD_ERASE_MAX_BYTES / BLK_TRANSFER_SIZE;
+    }
+
+    /* Vectored requests are transferred with ADMA2 */
+    if (usdhc_regs->host_ctrl_cap & USDHC_HOST_CTRL_CAP_ADMAS) {
+        blk_storage_info->max_segments = BLK_MAX_SEGMENTS;
+    }
+
     __atomic_store_n(&blk_storage_info->ready, true, __ATOMIC_RELEASE);
     LOG_DRIVER("Driver initialisation complete\n");
 }
@@ -1003,7 +1166,7 @@ void handle_clients(void)
 
         switch (req_code) {
         case BLK_REQ_READ:
-            status = usdhc_read_blocks(req_offset, req_block_number * block_to_sectors,
+            status = usdhc_read_blocks(req_offset, false, req_block_number * block_to_sectors,
                                        req_count * block_to_sectors);
             if (status == DrvIrqWait) {
                 return;
@@ -1014,7 +1177,7 @@ void handle_clients(void)
             break;
 
         case BLK_REQ_WRITE:
-            status = usdhc_write_blocks(req_offset, req_block_number * block_to_sectors,
+            status = usdhc_write_blocks(req_offset, false, req_block_number * block_to_sectors,
                                         req_count * block_to_sectors);
             if (status == DrvIrqWait) {
                 return;
@@ -1024,6 +1187,40 @@ void handle_clients(void)
             success_count = 1;
             break;
 
+        case BLK_REQ_READV:
+        case BLK_REQ_WRITEV:
+            /* The buffers are given to the DMA through the ADMA2 descriptor table */
+            if (driver_state.data_transfer == DataStateInit && !usdhc_adma2_table_fill(req_offset)) {
+                LOG_DRIVER_ERR("Vectored request cannot be described by the ADMA2 descriptor table\n");
+                status = DrvErrorInternal;
+                success_count = 0;
+                break;
+            }
+            if (req_code == BLK_REQ_READV) {
+                status = usdhc_read_blocks(adma2_table_paddr, true, req_block_number * block_to_sectors,
+                                           req_count * block_to_sectors);
+            } else {
+                status = usdhc_write_blocks(adma2_table_paddr, true, req_block_number * block_to_sectors,
+                                            req_count * block_to_sectors);
+            }
+            if (status == DrvIrqWait) {
+                return;
+            }
+            driver_state.data_transfer = DataStateInit;
+
+            success_count = (status == DrvSuccess) ? req_count : 0;
+            break;
+
+        case BLK_REQ_DISCARD:
+            status = usdhc_erase_blocks(req_block_number * block_to_sectors, req_count * block_to_sectors);
+            if (status == DrvIrqWait) {
+                return;
+            }
+            driver_state.erase = EraseStateInit;
+
+            success_count = (status == DrvSuccess) ? req_count : 0;
+            break;
+
         case BLK_REQ_FLUSH:
         case BLK_REQ_BARRIER:
             /* No-ops. */
@@ -1091,8 +1288,8 @@ void notified(microkit_channel ch)
         break;
 
     case CHANNEL_TIMER:
-        LOG_DRIVER("got timer interrupt -- UNHANDLED\n");
-        assert(false);
+        /* Only used to poll for the end of an erase */
+        usdhc_executor(false);
         break;
 
     default:
@@ -174,6 +174,7 @@ typedef struct imx_usdhc_regs {
 #define USDHC_INT_SIGNAL_EN_DMAEIEN  BIT(28)  /* DMA error interrupt enable */
 
 /* [IMX8MDQLQRM] Section 10.3.7.1.18 Host Controller Capabilities */
+#define USDHC_HOST_CTRL_CAP_ADMAS BIT(20)  /* ADMA Support */
 #define USDHC_HOST_CTRL_CAP_DMAS  BIT(22)  /* DMA Support */
 #define USDHC_HOST_CTRL_CAP_VS33  BIT(24)  /* Voltage support 3.3 V */
 
@@ -187,6 +188,23 @@ typedef struct imx_usdhc_regs {
 /* [IMX8MDQLQRM] Section 10.3.7.1.29 Vendor Specific Register */
 #define USDHC_VEND_SPEC_FRC_SDCLK_ON BIT(8) /* Force CLK output active. */
 
+/* [SD-HOST] Section 1.13 Advanced DMA, ADMA2 descriptor format.
+   The descriptor table and the buffers must be 32-bit addressable and word aligned.
+*/
+#define USDHC_ADMA2_ATTR_VALID    BIT(0)         /* Descriptor is valid */
+#define USDHC_ADMA2_ATTR_END      BIT(1)         /* Last descriptor of the table */
+#define USDHC_ADMA2_ATTR_INT      BIT(2)         /* Interrupt once the descriptor is done */
+#define USDHC_ADMA2_ATTR_ACT_TRAN (0b10 << 4)    /* Transfer the data of the descriptor */
+
+/* Length of the data of a descriptor; 16 bits with 0 meaning 64KiB, so we stay below that */
+#define USDHC_ADMA2_MAX_LEN 0x8000
+
+typedef struct {
+    uint16_t attr;
+    uint16_t len;
+    uint32_t addr;
+} usdhc_adma2_desc_t;
+
 
 /*
     Below this point is generic non-imx specific SD items from [SD-PHY].
@@ -228,6 +246,9 @@ typedef struct {
 #define SD_CMD16_SET_BLOCKLEN        _SD_CMD_DEF(16, RespType_R1)   /* [31:0] block length */
 #define SD_CMD18_READ_MULTIPLE_BLOCK _SD_CMD_DEF(18, RespType_R1, .data_present = true)  /* [31:0] data address */
 #define SD_CMD25_WRITE_MULTIPLE_BLOCK  _SD_CMD_DEF(25, RespType_R1, .data_present = true)  /* [31:0] data address */
+#define SD_CMD32_ERASE_WR_BLK_START  _SD_CMD_DEF(32, RespType_R1)   /* [31:0] data address */
+#define SD_CMD33_ERASE_WR_BLK_END    _SD_CMD_DEF(33, RespType_R1)   /* [31:0] data address */
+#define SD_CMD38_ERASE               _SD_CMD_DEF(38, RespType_R1b)  /* [31:0] erase function, 0 for erase */
 #define SD_CMD55_APP_CMD             _SD_CMD_DEF(55, RespType_R1)   /* [31:16] RCA, [15:0] stuff bits */
 
 #define SD_ACMD41_SD_SEND_OP_COND    _SD_ACMD_DEF(41, RespType_R3)  /* [31] zero, [30] host capacity status (CCS), [29] eSD reserved , [28] XPC, [27:25] zeroed, [24] S18R, [23:0] Vdd Voltage Window (host) */
@@ -264,6 +285,9 @@ typedef struct {
 /* [SD-PHY] Section 5.3.1 CSD Register */
 #define SD_CSD_CSD_STRUCTURE_SHIFT    126             /* CSD Structure (version)      */
 #define SD_CSD_CSD_STRUCTURE_MASK     _MASK_128(126, 127) /* CSD-slice: [127:126]         */
+#define SD_CSD_CCC_SHIFT              84                 /* card command classes         */
+#define SD_CSD_CCC_MASK               _MASK_128(84, 95)  /* CSD-slice: [95:84]           */
+#define SD_CSD_CCC_ERASE              BIT(5)             /* class 5: erase commands      */
 
 /* [SD-PHY] Section 5.3.2 CSD Register (CSD Version 1.0) */
 #define SD_CSD_V1_READ_BL_LEN_SHIFT   80                 /* max. read data block length  */
@@ -286,6 +310,15 @@ typedef struct {
 #define SD_CLOCK_STABLE_TIMEOUT (150 * NS_IN_MS)
 /* [SD-PHY] 4.2.3.1 Initialization Command - timeout is 1s */
 #define SD_INITIALISATION_TIMEOUT (1 * NS_IN_S)
+/*
+   [SD-PHY] 4.10.2.4 AU_SIZE - allocation units of SDHC cards are at most 4MiB, so an erase
+   of at most that size spans at most two of them. [SD-PHY] 4.10.2.5 ERASE_TIMEOUT and
+   ERASE_OFFSET - erasing an allocation unit takes at most 63s + 3s.
+*/
+#define SD_ERASE_MAX_BYTES (4 * 1024 * 1024)
+#define SD_ERASE_TIMEOUT (2 * 66 * NS_IN_S)
+/* Interval at which DAT0 is polled for the end of the busy signal of an erase */
+#define SD_ERASE_POLL_INTERVAL (10 * NS_IN_MS)
 
 /* [SD-PHY] Section 4.10.1 Card Status Field 'CURRENT_STATE',
        and Section 4.1 - Table 4-1. */
@@ -6,14 +6,28 @@
 # Include this snippet in your project Makefile to build the virtIO block driver.
 # Assumes libsddf_util_debug.a is in ${LIBS}.
 # Expects the 'blk_regs' variable to be set by the Microkit SDF
+# Set VIRTIO_TRANSPORT to pci to drive a virtIO PCI device instead, in which case
+# the 'pci_config_vaddr', 'pci_bar_window_vaddr' and 'pci_bar_window_paddr'
+# variables are expected instead of 'blk_regs'.
+# Set VIRTIO_BLK_NUM_QUEUES to serve that many sDDF queues, each on its own
+# virtqueue, from a device supporting VIRTIO_BLK_F_MQ. See block.c for the
+# channels and memory regions of each queue.
 
 VIRTIO_BLK_DRIVER_DIR := $(realpath $(dir $(lastword $(MAKEFILE_LIST))))
 
+VIRTIO_TRANSPORT ?= mmio
+ifeq (${VIRTIO_TRANSPORT},pci)
+CFLAGS_virtio_blk := -DVIRTIO_TRANSPORT_PCI
+endif
+ifneq (${VIRTIO_BLK_NUM_QUEUES},)
+CFLAGS_virtio_blk += -DVIRTIO_BLK_NUM_QUEUES=${VIRTIO_BLK_NUM_QUEUES}
+endif
+
 blk_driver.elf: blk/virtio/blk_driver.o
 	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
 
 blk/virtio/blk_driver.o: ${VIRTIO_BLK_DRIVER_DIR}/block.c |blk/virtio
-	$(CC) -c $(CFLAGS) -I${VIRTIO_BLK_DRIVER_DIR}/include -o $@ $<
+	$(CC) -c $(CFLAGS) $(CFLAGS_virtio_blk) -I${VIRTIO_BLK_DRIVER_DIR}/include -o $@ $<
 
 -include blk_driver.d
 
@@ -5,7 +5,7 @@
 
 /*
  * This driver follows the non-legacy virtIO 1.2 specification for the block device.
- * It assumes that the transport method is MMIO.
+ * The transport method is MMIO, or PCI when built with VIRTIO_TRANSPORT_PCI.
  * This driver is very minimal and was written for the goal of building systems that
  * use virtIO block devices in a simulator like QEMU. It is *not* written with
  * performance in mind.
@@ -17,15 +17,38 @@
 
 #include <microkit.h>
 #include <sddf/util/util.h>
-#include <sddf/util/ialloc.h>
 #include <sddf/virtio/virtio.h>
 #include <sddf/virtio/virtio_queue.h>
+#include <sddf/virtio/virtio_transport.h>
 #include <sddf/blk/queue.h>
 #include <sddf/blk/storage_info.h>
 #include "block.h"
 
+/*
+ * Number of sDDF queues served by the driver, each with a virtqueue of its own so that
+ * they do not share a ring. More than one needs a device with VIRTIO_BLK_F_MQ and at
+ * least this many queues.
+ *
+ * The request and response queues of sDDF queue i are at offset i * VIRTIO_BLK_QUEUE_REGION_SIZE
+ * in the blk_request and blk_response regions, as is its data region in blk_data, and its
+ * virtualiser notifies the driver on VIRT_CH(i).
+ */
+#ifndef VIRTIO_BLK_NUM_QUEUES
+#define VIRTIO_BLK_NUM_QUEUES 1
+#endif
+
+#ifndef VIRTIO_BLK_QUEUE_REGION_SIZE
+#define VIRTIO_BLK_QUEUE_REGION_SIZE 0x200000
+#endif
+
 #define IRQ_CH 0
-#define VIRT_CH 1
+#define VIRT_CH(i) (2 * (i) + 1)
+/*
+ * With the PCI transport and MSI-X, configuration changes are signalled on IRQ_CH
+ * and used buffer notifications of queue i on VQ_IRQ_CH(i). MSI-X vector 0 raises
+ * interrupt VIRTIO_PCI_BLK_MSIX_IRQ_BASE, and vector i + 1 the one i + 1 after it.
+ */
+#define VQ_IRQ_CH(i) (2 * (i) + 2)
 
 /*
  * This offset is the default for QEMU, but can change depending on
@@ -40,119 +63,187 @@
 #define VIRTQ_NUM_REQUESTS QUEUE_SIZE
 
 /*
- * This is the size of the region that holds virtIO specific metadata, such as the virtq
- * and list of virtIO request headers. This much match the size of the region in the
- * system description.
+ * This is the size of the region that holds virtIO specific metadata, such as the virtq,
+ * the indirect descriptor tables of requests and the segments of discard and write zeroes
+ * requests. This much match the size of the region in the system description.
  */
 #define VIRTIO_REGION_SIZE 0x200000
 
+/* This is the size of the region that holds the virtIO request headers of every queue */
+#ifndef VIRTIO_HEADERS_REGION_SIZE
+#define VIRTIO_HEADERS_REGION_SIZE 0x10000
+#endif
+
+/*
+ * With VIRTIO_F_EVENT_IDX, the device is asked to only interrupt once this many
+ * requests have completed, or once every request in flight has completed if there
+ * are fewer. Higher values mean fewer interrupts at the cost of delaying responses
+ * until the rest of their batch completes.
+ */
+#ifndef VIRTIO_BLK_IRQ_THRESHOLD
+#define VIRTIO_BLK_IRQ_THRESHOLD 4
+#endif
+
 uintptr_t blk_regs;
 
+#ifdef VIRTIO_TRANSPORT_PCI
+/*
+ * The configuration space of the device function is mapped through ECAM, and
+ * its BARs are assigned from the window at pci_bar_window_paddr.
+ */
+uintptr_t pci_config_vaddr;
+uintptr_t pci_bar_window_vaddr;
+uintptr_t pci_bar_window_paddr;
+
+#ifndef VIRTIO_PCI_BLK_BAR_WINDOW_SIZE
+#define VIRTIO_PCI_BLK_BAR_WINDOW_SIZE (0x10000)
+#endif
+
+#ifndef VIRTIO_PCI_BLK_MSIX_IRQ_BASE
+#define VIRTIO_PCI_BLK_MSIX_IRQ_BASE (80)
+#endif
+#endif
+
 blk_storage_info_t *blk_storage_info;
 uintptr_t blk_request;
 uintptr_t blk_response;
+/* Data regions of the virtualisers, read only, holding the segment lists of vectored requests */
+uintptr_t blk_data;
+uintptr_t blk_data_paddr;
 
 uintptr_t requests_paddr;
 uintptr_t requests_vaddr;
 
-static volatile virtio_mmio_regs_t *regs;
-
-static volatile struct virtq virtq;
-static blk_queue_handle_t blk_queue;
+static virtio_transport_t transport;
 
 uintptr_t virtio_headers_paddr;
 uintptr_t virtio_headers_vaddr;
-static struct virtio_blk_req *virtio_headers;
 
-/*
- * A mapping from virtIO header index in the descriptor virtq ring, to the sDDF ID given
- * in the request. We need this mapping due to out of order operations.
- */
-uint32_t virtio_header_to_id[QUEUE_SIZE];
-
-/*
- * Due to the out-of-order nature of virtIO, we need a way of allocating indexes in a
- * non-linear way.
- */
-ialloc_t ialloc_desc;
-uint32_t descriptors[QUEUE_SIZE];
-
-uint16_t last_seen_used = 0;
+/* An sDDF queue and the virtqueue its requests are given to the device on */
+typedef struct blk_virtq {
+    virtio_queue_t vq;
+    uint32_t vq_idxlist[QUEUE_SIZE];
+    uint16_t vq_chain_lens[QUEUE_SIZE];
+    blk_queue_handle_t blk_queue;
+
+    /* Headers of the requests in the virtq, and their physical address */
+    struct virtio_blk_req *virtio_headers;
+    uintptr_t virtio_headers_paddr;
+    /* Indirect descriptor tables of the requests in the virtq, used with VIRTIO_F_INDIRECT_DESC */
+    uintptr_t indirect_vaddr;
+    uintptr_t indirect_paddr;
+    /* Data of the discard and write zeroes requests in the virtq, and its physical address */
+    struct virtio_blk_discard_write_zeroes *segments;
+    uintptr_t segments_paddr;
+
+    /*
+     * A mapping from the head of the chain of each request in the virtq, to the sDDF ID given
+     * in the request. We need this mapping due to out of order operations. The virtIO header
+     * and data length of a request are also indexed by the head of its chain.
+     */
+    uint32_t virtio_header_to_id[QUEUE_SIZE];
+    uint32_t request_data_lens[QUEUE_SIZE];
+} blk_virtq_t;
+static blk_virtq_t queues[VIRTIO_BLK_NUM_QUEUES];
+
+/* Every request takes a header, data and footer descriptor, with vectored requests taking a data
+ * descriptor for each of their segments */
+#define REQUEST_NUM_DESCS 3
+#define REQUEST_MAX_DESCS (BLK_MAX_SEGMENTS + 2)
+#define REQUEST_INDIRECT_SIZE (REQUEST_MAX_DESCS * sizeof(struct virtq_desc))
+
+/* Features accepted by both the driver and the device */
+uint64_t features;
+
+static inline bool feature_negotiated(uint8_t feature)
+{
+    return features & BIT(feature);
+}
 
 /* Block device configuration, populated during initiliastion. */
 volatile struct virtio_blk_config *virtio_config;
 
-void handle_response()
+/*
+ * Number of descriptors of the virtq each request takes. With VIRTIO_F_INDIRECT_DESC a request
+ * only takes one, pointing to an indirect table of its own holding its descriptors, so that as
+ * many requests can be in flight as the virtq has descriptors. Vectored requests are only
+ * accepted with VIRTIO_F_INDIRECT_DESC, so that otherwise every request takes three.
+ */
+static inline uint16_t request_virtq_descs(void)
 {
-    bool notify = false;
-
-    uint16_t i = last_seen_used;
-    uint16_t curr_idx = virtq.used->idx;
-    while (i != curr_idx) {
-        uint16_t virtq_idx = i % virtq.num;
-        struct virtq_used_elem hdr_used = virtq.used->ring[virtq_idx];
-        assert(virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc hdr_desc = virtq.desc[hdr_used.id];
-        LOG_DRIVER("response header addr: 0x%lx, len: %d\n", hdr_desc.addr, hdr_desc.len);
-
-        assert(hdr_desc.len == VIRTIO_BLK_REQ_HDR_SIZE);
-        struct virtio_blk_req *hdr = &virtio_headers[virtq_idx];
-        virtio_blk_print_req(hdr);
+    return feature_negotiated(VIRTIO_F_INDIRECT_DESC) ? 1 : REQUEST_NUM_DESCS;
+}
 
-        uint16_t data_desc_idx = virtq.desc[hdr_used.id].next;
-        struct virtq_desc data_desc = virtq.desc[data_desc_idx % virtq.num];
-        uint32_t data_len = data_desc.len;
-#ifdef DEBUG_DRIVER
-        uint64_t data_addr = data_desc.addr;
-        LOG_DRIVER("response data addr: 0x%lx, data len: %d\n", data_addr, data_len);
-#endif
+/**
+ * Add the descriptors of a request to the virtq.
+ *
+ * @param queue queue to add the request to.
+ * @param head head the request will have, given by virtio_queue_next_head.
+ * @param chain descriptors of the request.
+ * @param count number of descriptors of the request, at most REQUEST_MAX_DESCS.
+ *
+ * @return head of the request.
+ */
+static uint16_t request_add(blk_virtq_t *queue, uint16_t head, struct virtq_desc *chain, uint16_t count)
+{
+    if (feature_negotiated(VIRTIO_F_INDIRECT_DESC)) {
+        return virtio_queue_add_indirect(&queue->vq, queue->indirect_vaddr + head * REQUEST_INDIRECT_SIZE,
+                                         queue->indirect_paddr + head * REQUEST_INDIRECT_SIZE, chain, count);
+    }
+    assert(count == REQUEST_NUM_DESCS);
+    return virtio_queue_add(&queue->vq, chain, count);
+}
 
-        uint16_t footer_desc_idx = virtq.desc[data_desc_idx].next;
+void handle_response(int q)
+{
+    blk_virtq_t *queue = &queues[q];
+    bool notify = false;
+    bool reprocess = true;
+
+    while (reprocess) {
+        uint16_t head;
+        uint32_t used_len;
+        while (virtio_queue_get_used(&queue->vq, &head, &used_len)) {
+            struct virtio_blk_req *hdr = &queue->virtio_headers[head];
+            virtio_blk_print_req(hdr);
+
+            blk_resp_status_t status;
+            if (hdr->status == VIRTIO_BLK_S_OK) {
+                status = BLK_RESP_OK;
+            } else {
+                status = BLK_RESP_ERR_UNSPEC;
+            }
+            uint16_t success_count = queue->request_data_lens[head] / BLK_TRANSFER_SIZE;
+            int err = blk_enqueue_resp(&queue->blk_queue, status, success_count, queue->virtio_header_to_id[head]);
+            assert(!err);
 
-        blk_resp_status_t status;
-        if (hdr->status == VIRTIO_BLK_S_OK) {
-            status = BLK_RESP_OK;
-        } else {
-            status = BLK_RESP_ERR_UNSPEC;
+            notify = true;
         }
-        int err = blk_enqueue_resp(&blk_queue, status, data_len / BLK_TRANSFER_SIZE, virtio_header_to_id[hdr_used.id]);
-        assert(!err);
 
-        /* Free up the descriptors we used */
-        err = ialloc_free(&ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&ialloc_desc, data_desc_idx);
-        assert(!err);
-        err = ialloc_free(&ialloc_desc, footer_desc_idx);
-        assert(!err);
-
-        i += 1;
-        notify = true;
+        reprocess = virtio_queue_set_used_threshold(&queue->vq, VIRTIO_BLK_IRQ_THRESHOLD, request_virtq_descs());
     }
 
     if (notify) {
-        microkit_notify(VIRT_CH);
+        microkit_notify(VIRT_CH(q));
     }
-
-    last_seen_used = i;
 }
 
-void handle_request()
+void handle_request(int q)
 {
+    blk_virtq_t *queue = &queues[q];
     /* Whether or not we notify the virtIO device to say something has changed
      * in the virtq. */
     bool virtio_queue_notify = false;
 
     /* Consume all requests and put them in the 'avail' ring of the virtq. We do not
      * dequeue unless we know we can put the request in the virtq. */
-    while (!blk_queue_empty_req(&blk_queue) && ialloc_num_free(&ialloc_desc) >= 3) {
+    while (!blk_queue_empty_req(&queue->blk_queue) && virtio_queue_num_free(&queue->vq) >= request_virtq_descs()) {
         blk_req_code_t req_code;
         uintptr_t phys_addr;
         uint32_t block_number;
         uint16_t count;
         uint32_t id;
-        int err = blk_dequeue_req(&blk_queue, &req_code, &phys_addr, &block_number, &count, &id);
+        int err = blk_dequeue_req(&queue->blk_queue, &req_code, &phys_addr, &block_number, &count, &id);
         assert(!err);
 
         /*
@@ -194,19 +285,10 @@ void handle_request()
                            phys_addr, block_number, count, id);
             }
 
-            uint32_t hdr_desc_idx = -1;
-            uint32_t data_desc_idx = -1;
-            uint32_t footer_desc_idx = -1;
+            /* The header must be filled in before the chain can be seen by the device */
+            uint16_t head = virtio_queue_next_head(&queue->vq);
 
-            int err;
-            err = ialloc_alloc(&ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            err = ialloc_alloc(&ialloc_desc, &data_desc_idx);
-            assert(!err && data_desc_idx != -1);
-            err = ialloc_alloc(&ialloc_desc, &footer_desc_idx);
-            assert(!err && footer_desc_idx != -1);
-
-            uint16_t data_flags = VIRTQ_DESC_F_NEXT;
+            uint16_t data_flags = 0;
             uint16_t type;
             if (req_code == BLK_REQ_READ) {
                 type = VIRTIO_BLK_T_IN;
@@ -216,48 +298,140 @@ void handle_request()
                 type = VIRTIO_BLK_T_OUT;
             }
 
-            struct virtio_blk_req *hdr = &virtio_headers[hdr_desc_idx];
+            struct virtio_blk_req *hdr = &queue->virtio_headers[head];
             hdr->type = type;
             hdr->sector = virtio_block_number;
 
-            virtq.desc[hdr_desc_idx] = (struct virtq_desc) {
-                .addr = virtio_headers_paddr + (hdr_desc_idx * sizeof(struct virtio_blk_req)),
-                .len = VIRTIO_BLK_REQ_HDR_SIZE,
-                .flags = VIRTQ_DESC_F_NEXT,
-                .next = data_desc_idx,
+            uint64_t hdr_addr = queue->virtio_headers_paddr + (head * sizeof(struct virtio_blk_req));
+            struct virtq_desc chain[REQUEST_NUM_DESCS] = {
+                {
+                    .addr = hdr_addr,
+                    .len = VIRTIO_BLK_REQ_HDR_SIZE,
+                },
+                {
+                    .addr = phys_addr,
+                    .len = VIRTIO_BLK_SECTOR_SIZE * virtio_count,
+                    .flags = data_flags,
+                },
+                {
+                    .addr = hdr_addr + VIRTIO_BLK_REQ_HDR_SIZE,
+                    .len = 1,
+                    .flags = VIRTQ_DESC_F_WRITE,
+                },
             };
+            head = request_add(queue, head, chain, REQUEST_NUM_DESCS);
+            virtio_queue_notify = true;
 
-            virtq.desc[data_desc_idx] = (struct virtq_desc) {
-                .addr = phys_addr,
-                .len = VIRTIO_BLK_SECTOR_SIZE * virtio_count,
-                .flags = data_flags,
-                .next = footer_desc_idx,
-            };
+            queue->virtio_header_to_id[head] = id;
+            queue->request_data_lens[head] = chain[1].len;
+
+            break;
+        }
+        case BLK_REQ_READV:
+        case BLK_REQ_WRITEV: {
+            /* The segment list is in the data region of the virtualiser, which has checked every segment */
+            assert(phys_addr >= blk_data_paddr
+                   && phys_addr - blk_data_paddr
+                          <= VIRTIO_BLK_NUM_QUEUES * VIRTIO_BLK_QUEUE_REGION_SIZE - sizeof(blk_seg_list_t));
+            blk_seg_list_t *seg_list = (blk_seg_list_t *)(blk_data + (phys_addr - blk_data_paddr));
+            uint16_t num_segs = seg_list->num_segs;
+            assert(num_segs >= 1 && num_segs <= BLK_MAX_SEGMENTS);
+            assert(virtio_block_number + virtio_count <= virtio_config->capacity);
+
+            LOG_DRIVER("handling %s request with %d segments, block_number: 0x%x, count: 0x%x, id: 0x%x\n",
+                       req_code == BLK_REQ_READV ? "vectored read" : "vectored write", num_segs, block_number,
+                       count, id);
 
-            virtq.desc[footer_desc_idx] = (struct virtq_desc) {
-                .addr = virtq.desc[hdr_desc_idx].addr + VIRTIO_BLK_REQ_HDR_SIZE,
+            uint16_t head = virtio_queue_next_head(&queue->vq);
+
+            struct virtio_blk_req *hdr = &queue->virtio_headers[head];
+            hdr->type = (req_code == BLK_REQ_READV) ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+            hdr->sector = virtio_block_number;
+
+            /* The buffer of each segment gets a data descriptor of its own, between the header and footer */
+            uint16_t data_flags = (req_code == BLK_REQ_READV) ? VIRTQ_DESC_F_WRITE : 0;
+            uint64_t hdr_addr = queue->virtio_headers_paddr + (head * sizeof(struct virtio_blk_req));
+            struct virtq_desc chain[REQUEST_MAX_DESCS];
+            chain[0] = (struct virtq_desc) {
+                .addr = hdr_addr,
+                .len = VIRTIO_BLK_REQ_HDR_SIZE,
+            };
+            uint32_t data_len = 0;
+            for (uint16_t i = 0; i < num_segs; i++) {
+                chain[i + 1] = (struct virtq_desc) {
+                    .addr = seg_list->segs[i].io_or_offset,
+                    .len = seg_list->segs[i].count * BLK_TRANSFER_SIZE,
+                    .flags = data_flags,
+                };
+                data_len += chain[i + 1].len;
+            }
+            chain[num_segs + 1] = (struct virtq_desc) {
+                .addr = hdr_addr + VIRTIO_BLK_REQ_HDR_SIZE,
                 .len = 1,
                 .flags = VIRTQ_DESC_F_WRITE,
             };
+            head = request_add(queue, head, chain, num_segs + 2);
+            virtio_queue_notify = true;
+
+            queue->virtio_header_to_id[head] = id;
+            queue->request_data_lens[head] = data_len;
+
+            break;
+        }
+        case BLK_REQ_DISCARD:
+        case BLK_REQ_WRITE_ZEROES: {
+            /* The virtualiser checks the count against the maximum we gave in the storage info */
+            assert(virtio_block_number + virtio_count <= virtio_config->capacity);
+
+            LOG_DRIVER("handling %s request with block_number: 0x%x, count: 0x%x, id: 0x%x\n",
+                       req_code == BLK_REQ_DISCARD ? "discard" : "write zeroes", block_number, count, id);
+
+            /* Discard and write zeroes requests carry a segment describing the blocks as their data */
+            uint16_t head = virtio_queue_next_head(&queue->vq);
+
+            struct virtio_blk_req *hdr = &queue->virtio_headers[head];
+            hdr->type = (req_code == BLK_REQ_DISCARD) ? VIRTIO_BLK_T_DISCARD : VIRTIO_BLK_T_WRITE_ZEROES;
+            hdr->sector = 0;
+            queue->segments[head] = (struct virtio_blk_discard_write_zeroes) {
+                .sector = virtio_block_number,
+                .num_sectors = virtio_count,
+                .flags = 0,
+            };
 
-            virtq.avail->ring[virtq.avail->idx % virtq.num] = hdr_desc_idx;
-            virtq.avail->idx++;
+            uint64_t hdr_addr = queue->virtio_headers_paddr + (head * sizeof(struct virtio_blk_req));
+            struct virtq_desc chain[REQUEST_NUM_DESCS] = {
+                {
+                    .addr = hdr_addr,
+                    .len = VIRTIO_BLK_REQ_HDR_SIZE,
+                },
+                {
+                    .addr = queue->segments_paddr + head * sizeof(struct virtio_blk_discard_write_zeroes),
+                    .len = sizeof(struct virtio_blk_discard_write_zeroes),
+                },
+                {
+                    .addr = hdr_addr + VIRTIO_BLK_REQ_HDR_SIZE,
+                    .len = 1,
+                    .flags = VIRTQ_DESC_F_WRITE,
+                },
+            };
+            head = request_add(queue, head, chain, REQUEST_NUM_DESCS);
             virtio_queue_notify = true;
 
-            virtio_header_to_id[hdr_desc_idx] = id;
+            queue->virtio_header_to_id[head] = id;
+            queue->request_data_lens[head] = count * BLK_TRANSFER_SIZE;
 
             break;
         }
         case BLK_REQ_FLUSH: {
-            int err = blk_enqueue_resp(&blk_queue, BLK_RESP_OK, 0, id);
+            int err = blk_enqueue_resp(&queue->blk_queue, BLK_RESP_OK, 0, id);
             assert(!err);
-            microkit_notify(VIRT_CH);
+            microkit_notify(VIRT_CH(q));
             break;
         }
         case BLK_REQ_BARRIER: {
-            int err = blk_enqueue_resp(&blk_queue, BLK_RESP_OK, 0, id);
+            int err = blk_enqueue_resp(&queue->blk_queue, BLK_RESP_OK, 0, id);
             assert(!err);
-            microkit_notify(VIRT_CH);
+            microkit_notify(VIRT_CH(q));
             break;
         }
         default:
@@ -267,17 +441,20 @@ void handle_request()
         }
     }
 
-    if (virtio_queue_notify) {
-        regs->QueueNotify = 0;
+    if (virtio_queue_notify && virtio_queue_publish(&queue->vq)) {
+        virtio_transport_notify(&transport, &queue->vq);
     }
 }
 
 void handle_irq()
 {
-    uint32_t irq_status = regs->InterruptStatus;
+    /* With MSI-X, only configuration changes are signalled on this interrupt. Otherwise the interrupt
+     * is acknowledged first so that a notification raised while handling responses is not lost. */
+    uint32_t irq_status = transport.msix ? VIRTIO_MMIO_IRQ_CONFIG : virtio_transport_irq_status_ack(&transport);
     if (irq_status & VIRTIO_MMIO_IRQ_VQUEUE) {
-        handle_response();
-        regs->InterruptACK = VIRTIO_MMIO_IRQ_VQUEUE;
+        for (int q = 0; q < VIRTIO_BLK_NUM_QUEUES; q++) {
+            handle_response(q);
+        }
     }
 
     if (irq_status & VIRTIO_MMIO_IRQ_CONFIG) {
@@ -287,39 +464,34 @@ void handle_irq()
 
 void virtio_blk_init(void)
 {
-    // Do MMIO device init (section 4.2.3.1)
-    if (!virtio_mmio_check_magic(regs)) {
-        LOG_DRIVER_ERR("invalid virtIO magic value!\n");
+    // Do transport specific device init (sections 4.1.5 and 4.2.3)
+#ifdef VIRTIO_TRANSPORT_PCI
+    if (!virtio_transport_pci_init(&transport, pci_config_vaddr, pci_bar_window_vaddr, pci_bar_window_paddr,
+                                   VIRTIO_PCI_BLK_BAR_WINDOW_SIZE)) {
+        LOG_DRIVER_ERR("not a virtIO PCI device, or its BARs do not fit in the window!\n");
         assert(false);
     }
-
-    if (virtio_mmio_version(regs) != VIRTIO_VERSION) {
-        LOG_DRIVER_ERR("not correct virtIO version!\n");
+#else
+    if (!virtio_transport_mmio_init(&transport, blk_regs + VIRTIO_MMIO_BLK_OFFSET)) {
+        LOG_DRIVER_ERR("invalid virtIO magic value or driver does not support given virtIO version!\n");
         assert(false);
     }
+#endif
 
-    if (!virtio_mmio_check_device_id(regs, VIRTIO_DEVICE_ID_BLK)) {
+    if (virtio_transport_device_id(&transport) != VIRTIO_DEVICE_ID_BLK) {
         LOG_DRIVER_ERR("not a virtIO block device!\n");
         assert(false);
     }
 
-    if (virtio_mmio_version(regs) != VIRTIO_BLK_DRIVER_VERSION) {
-        LOG_DRIVER_ERR("driver does not support given virtIO version: 0x%x\n", virtio_mmio_version(regs));
-        assert(false);
-    }
-
-    ialloc_init(&ialloc_desc, descriptors, QUEUE_SIZE);
-
-    virtio_headers = (struct virtio_blk_req *) virtio_headers_vaddr;
-
     /* First reset the device */
-    regs->Status = 0;
+    virtio_transport_set_status(&transport, 0);
     /* Set the ACKNOWLEDGE bit to say we have noticed the device */
-    regs->Status = VIRTIO_DEVICE_STATUS_ACKNOWLEDGE;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_ACKNOWLEDGE);
     /* Set the DRIVER bit to say we know how to drive the device */
-    regs->Status = VIRTIO_DEVICE_STATUS_DRIVER;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_DRIVER);
 
-    virtio_config = (volatile struct virtio_blk_config *)regs->Config;
+    virtio_config = virtio_transport_config(&transport);
+    assert(virtio_config != NULL);
 #ifdef DEBUG_DRIVER
     virtio_blk_print_config(virtio_config);
 #endif
@@ -331,6 +503,11 @@ void virtio_blk_init(void)
         assert(false);
     }
 
+    uint64_t device_features = virtio_transport_device_features(&transport);
+#ifdef DEBUG_DRIVER
+    virtio_blk_print_features(device_features);
+#endif
+
     /* This driver does not support Read-Only devices, so we always leave this as false */
     blk_storage_info->read_only = false;
     blk_storage_info->capacity = (virtio_config->capacity * VIRTIO_BLK_SECTOR_SIZE) / BLK_TRANSFER_SIZE;
@@ -339,69 +516,96 @@ void virtio_blk_init(void)
     blk_storage_info->blocks = virtio_config->geometry.sectors;
     blk_storage_info->block_size = 1;
     blk_storage_info->sector_size = VIRTIO_BLK_SECTOR_SIZE;
+    /* Discard and write zeroes are used whenever the device offers them */
+    uint32_t sectors_per_block = BLK_TRANSFER_SIZE / VIRTIO_BLK_SECTOR_SIZE;
+    if (device_features & BIT(VIRTIO_BLK_F_DISCARD)) {
+        blk_storage_info->max_discard = MIN(virtio_config->max_discard_sectors / sectors_per_block, UINT16_MAX);
+    }
+    if (device_features & BIT(VIRTIO_BLK_F_WRITE_ZEROES)) {
+        blk_storage_info->max_write_zeroes = MIN(virtio_config->max_write_zeroes_sectors / sectors_per_block,
+                                                 UINT16_MAX);
+    }
+    /* Vectored requests need indirect descriptors, see request_virtq_descs */
+    if (device_features & BIT(VIRTIO_F_INDIRECT_DESC)) {
+        blk_storage_info->max_segments = BLK_MAX_SEGMENTS;
+        if ((device_features & BIT(VIRTIO_BLK_F_SEG_MAX)) && virtio_config->seg_max < BLK_MAX_SEGMENTS) {
+            blk_storage_info->max_segments = virtio_config->seg_max;
+        }
+    }
 
     /* Finished populating configuration */
     __atomic_store_n(&blk_storage_info->ready, true, __ATOMIC_RELEASE);
 
-#ifdef DEBUG_DRIVER
-    uint32_t features_low = regs->DeviceFeatures;
-    regs->DeviceFeaturesSel = 1;
-    uint32_t features_high = regs->DeviceFeatures;
-    uint64_t features = features_low | ((uint64_t)features_high << 32);
-    virtio_blk_print_features(features);
-#endif
     /* Select features we want from the device */
-    regs->DriverFeatures = 0;
-    regs->DriverFeaturesSel = 1;
-    regs->DriverFeatures = 0;
+    features = (device_features & (BIT(VIRTIO_F_EVENT_IDX) | BIT(VIRTIO_F_RING_PACKED) | BIT(VIRTIO_F_INDIRECT_DESC)
+                                   | BIT(VIRTIO_BLK_F_SEG_MAX) | BIT(VIRTIO_BLK_F_DISCARD)
+                                   | BIT(VIRTIO_BLK_F_WRITE_ZEROES)))
+               | BIT(VIRTIO_F_VERSION_1);
+    if (VIRTIO_BLK_NUM_QUEUES > 1) {
+        if (!(device_features & BIT(VIRTIO_BLK_F_MQ)) || virtio_config->num_queues < VIRTIO_BLK_NUM_QUEUES) {
+            LOG_DRIVER_ERR("device does not support %d queues\n", VIRTIO_BLK_NUM_QUEUES);
+            assert(false);
+        }
+        features |= BIT(VIRTIO_BLK_F_MQ);
+    }
+    virtio_transport_set_driver_features(&transport, features);
 
-    regs->Status |= VIRTIO_DEVICE_STATUS_FEATURES_OK;
-    if (!(regs->Status & VIRTIO_DEVICE_STATUS_FEATURES_OK)) {
+    virtio_transport_set_status(&transport, virtio_transport_status(&transport) | VIRTIO_DEVICE_STATUS_FEATURES_OK);
+    if (!(virtio_transport_status(&transport) & VIRTIO_DEVICE_STATUS_FEATURES_OK)) {
         LOG_DRIVER_ERR("device status features is not OK!\n");
         return;
     }
 
-    /* Add virtqueues */
-    size_t desc_off = 0;
-    size_t avail_off = ALIGN(desc_off + (16 * VIRTQ_NUM_REQUESTS), 2);
-    size_t used_off = ALIGN(avail_off + (6 + 2 * VIRTQ_NUM_REQUESTS), 4);
-    size_t size = used_off + (6 + 8 * VIRTQ_NUM_REQUESTS);
-
-    assert(size <= VIRTIO_REGION_SIZE);
-
-    virtq.num = VIRTQ_NUM_REQUESTS;
-    virtq.desc = (struct virtq_desc *)(requests_vaddr + desc_off);
-    virtq.avail = (struct virtq_avail *)(requests_vaddr + avail_off);
-    virtq.used = (struct virtq_used *)(requests_vaddr + used_off);
-
-    assert(regs->QueueNumMax >= VIRTQ_NUM_REQUESTS);
-    regs->QueueSel = 0;
-    regs->QueueNum = VIRTQ_NUM_REQUESTS;
-    regs->QueueDescLow = (requests_paddr + desc_off) & 0xFFFFFFFF;
-    regs->QueueDescHigh = (requests_paddr + desc_off) >> 32;
-    regs->QueueDriverLow = (requests_paddr + avail_off) & 0xFFFFFFFF;
-    regs->QueueDriverHigh = (requests_paddr + avail_off) >> 32;
-    regs->QueueDeviceLow = (requests_paddr + used_off) & 0xFFFFFFFF;
-    regs->QueueDeviceHigh = (requests_paddr + used_off) >> 32;
-    regs->QueueReady = 1;
+#ifdef VIRTIO_TRANSPORT_PCI
+    if (!virtio_transport_msix_setup(&transport, VIRTIO_PCI_BLK_MSIX_IRQ_BASE, VIRTIO_BLK_NUM_QUEUES + 1)) {
+        LOG_DRIVER("MSI-X is not available, using legacy interrupts\n");
+    }
+#endif
+
+    /* Add virtqueues, with queue i given the MSI-X vector i + 1. The indirect tables follow the rings,
+     * and the discard and write zeroes segments follow the indirect tables. */
+    size_t ring_size = ALIGN(virtio_queue_ring_size(VIRTQ_NUM_REQUESTS), 16);
+    size_t indirect_size = QUEUE_SIZE * REQUEST_INDIRECT_SIZE;
+    size_t segments_size = QUEUE_SIZE * sizeof(struct virtio_blk_discard_write_zeroes);
+    size_t headers_size = QUEUE_SIZE * sizeof(struct virtio_blk_req);
+    assert((ring_size + indirect_size + segments_size) * VIRTIO_BLK_NUM_QUEUES <= VIRTIO_REGION_SIZE);
+    assert(headers_size * VIRTIO_BLK_NUM_QUEUES <= VIRTIO_HEADERS_REGION_SIZE);
+    for (int q = 0; q < VIRTIO_BLK_NUM_QUEUES; q++) {
+        blk_virtq_t *queue = &queues[q];
+        queue->virtio_headers = (struct virtio_blk_req *)(virtio_headers_vaddr + q * headers_size);
+        queue->virtio_headers_paddr = virtio_headers_paddr + q * headers_size;
+        queue->indirect_vaddr = requests_vaddr + ring_size * VIRTIO_BLK_NUM_QUEUES + q * indirect_size;
+        queue->indirect_paddr = requests_paddr + ring_size * VIRTIO_BLK_NUM_QUEUES + q * indirect_size;
+        size_t segments_offset = (ring_size + indirect_size) * VIRTIO_BLK_NUM_QUEUES + q * segments_size;
+        queue->segments = (struct virtio_blk_discard_write_zeroes *)(requests_vaddr + segments_offset);
+        queue->segments_paddr = requests_paddr + segments_offset;
+        virtio_queue_init(&queue->vq, q, VIRTQ_NUM_REQUESTS, features, requests_vaddr + q * ring_size,
+                          queue->vq_idxlist, queue->vq_chain_lens);
+        bool ok = virtio_transport_queue_register(&transport, &queue->vq, requests_paddr + q * ring_size, q + 1);
+        assert(ok);
+    }
 
     /* Finish initialisation */
-    regs->Status |= VIRTIO_DEVICE_STATUS_DRIVER_OK;
-    regs->InterruptACK = VIRTIO_MMIO_IRQ_VQUEUE;
+    virtio_transport_set_status(&transport, virtio_transport_status(&transport) | VIRTIO_DEVICE_STATUS_DRIVER_OK);
+    virtio_transport_irq_status_ack(&transport);
 }
 
 void init(void)
 {
-    regs = (volatile virtio_mmio_regs_t *)(blk_regs + VIRTIO_MMIO_BLK_OFFSET);
     virtio_blk_init();
+    for (int q = 0; q < VIRTIO_BLK_NUM_QUEUES; q++) {
+        if (transport.msix) {
+            microkit_irq_ack(VQ_IRQ_CH(q));
+        }
 
-    blk_queue_init(&blk_queue, (blk_req_queue_t *)blk_request, (blk_resp_queue_t *)blk_response, QUEUE_SIZE);
+        blk_queue_init(&queues[q].blk_queue, (blk_req_queue_t *)(blk_request + q * VIRTIO_BLK_QUEUE_REGION_SIZE),
+                       (blk_resp_queue_t *)(blk_response + q * VIRTIO_BLK_QUEUE_REGION_SIZE), QUEUE_SIZE);
+    }
 }
 
 void notified(microkit_channel ch)
 {
-    switch (ch) {
-    case IRQ_CH:
+    if (ch == IRQ_CH) {
         handle_irq();
         microkit_deferred_irq_ack(ch);
         /*
@@ -409,12 +613,28 @@ void notified(microkit_channel ch)
          * by the virtualiser because we ran out of space, so we try again now that
          * we have received a response and have resources freed.
          */
-        handle_request();
-        break;
-    case VIRT_CH:
-        handle_request();
-        break;
-    default:
+        for (int q = 0; q < VIRTIO_BLK_NUM_QUEUES; q++) {
+            handle_request(q);
+        }
+        return;
+    }
+
+    int q = (ch - 1) / 2;
+    if (q >= VIRTIO_BLK_NUM_QUEUES) {
         LOG_DRIVER_ERR("received notification from unknown channel: 0x%x\n", ch);
+        return;
+    }
+
+    if (ch == VIRT_CH(q)) {
+        handle_request(q);
+        return;
+    }
+
+    if (!transport.msix) {
+        LOG_DRIVER_ERR("received notification from unknown channel: 0x%x\n", ch);
+        return;
     }
+    handle_response(q);
+    microkit_deferred_irq_ack(ch);
+    handle_request(q);
 }
@@ -88,6 +88,14 @@ struct virtio_blk_config {
     uint32_t secure_erase_sector_alignment;
 };
 
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP (1 << 0)
+
+struct virtio_blk_discard_write_zeroes {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+};
+
 struct virtio_blk_req {
     uint32_t type;
     uint32_t reserved;
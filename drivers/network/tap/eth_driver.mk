@@ -0,0 +1,40 @@
+#
+# Copyright 2024, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Include this snippet in your project Makefile to build the TAP
+# driver, which attaches a system run on a Linux host to a host
+# network interface.
+#
+# NOTES:
+#   Generates eth_driver.elf
+#   Must be built with the host compiler alongside linux/linux.mk,
+#   see linux/README.md.
+#   Expects System Description File to map the RX data region read-write,
+#   and the TX data regions of the clients as for the TX virtualiser.
+#   Assumes libmicrokit_linux.a and libsddf_util_debug.a are in LIBS
+#   Set TAP_BACKEND to packet to attach to an existing interface with an
+#   AF_PACKET socket instead of a TAP interface.
+
+ETHERNET_DRIVER_DIR := $(dir $(lastword $(MAKEFILE_LIST)))
+
+TAP_BACKEND ?= tap
+ifeq (${TAP_BACKEND},packet)
+CFLAGS_tap_net := -DTAP_BACKEND_AF_PACKET
+endif
+
+CHECK_NETDRV_FLAGS_MD5:=.netdrv_cflags-$(shell echo -- ${CFLAGS} ${CFLAGS_network} ${CFLAGS_tap_net} | shasum | sed 's/ *-//')
+
+${CHECK_NETDRV_FLAGS_MD5}:
+	-rm -f .netdrv_cflags-*
+	touch $@
+
+eth_driver.elf: tap/ethernet.o
+	$(CC) $(LDFLAGS_linux) $< $(LIBS) -o $@
+
+tap/ethernet.o: ${ETHERNET_DRIVER_DIR}/ethernet.c ${CHECK_NETDRV_FLAGS_MD5}
+	mkdir -p tap
+	${CC} -c ${CFLAGS} ${CFLAGS_network} ${CFLAGS_tap_net} -I ${ETHERNET_DRIVER_DIR} -o $@ $<
+
+-include tap/ethernet.d
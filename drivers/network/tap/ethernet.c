@@ -0,0 +1,558 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * This driver attaches an sDDF network system run on a Linux host (see linux/README.md)
+ * to a host network interface, so that the rest of the system can be tested and
+ * benchmarked against real traffic. By default it drives a TAP interface. When built
+ * with TAP_BACKEND_AF_PACKET, it instead attaches to an existing interface through an
+ * AF_PACKET socket in promiscuous mode. The interface is named by the SDDF_NET_IF
+ * environment variable.
+ *
+ * The driver follows the structure of the virtIO net driver. Free RX buffers are held
+ * by the driver as if in a hardware ring until packets are received into them, and the
+ * interface becoming readable is delivered as the interrupt of the driver. Packets are
+ * received and transmitted in batches with recvmmsg/sendmmsg on AF_PACKET sockets. TAP
+ * devices do not support these, so the TAP backend reads and writes until it would block.
+ *
+ * Both backends exchange a virtIO net header with the host kernel in front of every
+ * packet, which carries the checksum and segmentation offload metadata. As with the
+ * virtIO net driver, received packets are written into their buffer with this header as
+ * headroom, and passed up with their offset pointing at the frame. RX buffers are
+ * written to by the kernel, so unlike for other drivers the RX data region must be
+ * mapped read-write.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+#include <microkit.h>
+#include <sddf/network/queue.h>
+#include <sddf/util/util.h>
+#include <sddf/util/printf.h>
+#include <ethernet_config.h>
+
+#include "ethernet.h"
+
+#define IRQ_CH 0
+#define TX_CH  1
+#define RX_CH  2
+
+uintptr_t rx_buffer_data_vaddr;
+uintptr_t rx_buffer_data_paddr;
+
+/*
+ * The driver reads transmitted packets directly from the TX data regions of the clients.
+ * They are mapped one after the other, NET_DATA_REGION_SIZE apart, as for the TX virtualiser.
+ */
+uintptr_t tx_buffer_data_region_cli0_vaddr;
+uintptr_t tx_buffer_data_region_cli0_paddr;
+uintptr_t tx_buffer_data_region_cli1_paddr;
+
+net_queue_t *rx_free;
+net_queue_t *rx_active;
+net_queue_t *tx_free;
+net_queue_t *tx_active;
+
+net_queue_handle_t rx_queue;
+net_queue_handle_t tx_queue;
+
+uintptr_t tx_buffer_region_paddrs[NUM_NETWORK_CLIENTS];
+
+/* File descriptor of the TAP device or AF_PACKET socket */
+int net_if_fd = -1;
+
+/* IO addresses of the free RX buffers held by the driver, received into in order */
+#define RX_COUNT 512
+uint64_t rx_buffers[RX_COUNT];
+uint32_t rx_head;
+uint32_t rx_tail;
+
+/* The interrupt is left unacknowledged while there are no RX buffers to receive into */
+bool irq_masked;
+
+#define RX_HEADROOM (sizeof(struct virtio_net_hdr))
+_Static_assert(NET_BUFFER_SIZE - RX_HEADROOM >= 1514, "RX buffers must fit a header and a full sized frame");
+
+/*
+ * Without VIRTIO_NET_F_MRG_RXBUF style merging, receiving TSO segments requires every RX
+ * buffer to hold a 64KiB segment plus its headers, so they are only accepted when sDDF
+ * buffers are that large.
+ */
+#define NET_IF_TSO_MAX_FRAME 65550
+#if NET_BUFFER_SIZE >= NET_IF_TSO_MAX_FRAME
+#define TAP_RX_OFFLOADS (TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6)
+#else
+#define TAP_RX_OFFLOADS (TUN_F_CSUM)
+#endif
+
+static inline uint32_t rx_held(void)
+{
+    return rx_tail - rx_head;
+}
+
+static inline void *rx_buffer_vaddr(uint64_t io_addr)
+{
+    return (void *)(rx_buffer_data_vaddr + (io_addr - rx_buffer_data_paddr));
+}
+
+/**
+ * Find the buffer of a transmitted packet in the TX data regions of the clients.
+ *
+ * @param buffer buffer holding the packet.
+ *
+ * @return virtual address of the packet, or NULL if it is outside of every TX data region.
+ */
+static void *tx_buffer_vaddr(net_buff_desc_t *buffer)
+{
+    for (int client = 0; client < NUM_NETWORK_CLIENTS; client++) {
+        uintptr_t paddr = tx_buffer_region_paddrs[client];
+        if (buffer->io_or_offset >= paddr && buffer->io_or_offset + buffer->len <= paddr + NET_DATA_REGION_SIZE) {
+            uintptr_t region_vaddr = tx_buffer_data_region_cli0_vaddr + client * NET_DATA_REGION_SIZE;
+            return (void *)(region_vaddr + (buffer->io_or_offset - paddr));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fill in the virtIO net header of a packet from the offload fields of its buffer.
+ *
+ * @param hdr virtIO net header to fill in.
+ * @param buffer buffer holding the packet.
+ */
+static void tx_fill_hdr(struct virtio_net_hdr *hdr, net_buff_desc_t *buffer)
+{
+    *hdr = (struct virtio_net_hdr) { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+
+    if (!(buffer->flags & NET_BUFF_F_CSUM_PARTIAL)) {
+        return;
+    }
+
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = buffer->csum_start;
+    hdr->csum_offset = buffer->csum_offset;
+
+    if (buffer->flags & NET_BUFF_F_TSO4) {
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    } else if (buffer->flags & NET_BUFF_F_TSO6) {
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    } else {
+        return;
+    }
+    hdr->gso_size = buffer->mss;
+    hdr->hdr_len = buffer->csum_start + buffer->csum_offset + sizeof(uint16_t);
+}
+
+/**
+ * Wait for the kernel to make room to transmit, as a driver would wait for space in a
+ * full hardware ring.
+ */
+static void net_if_wait_writable(void)
+{
+    struct pollfd pfd = { .fd = net_if_fd, .events = POLLOUT };
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+}
+
+#ifdef TAP_BACKEND_AF_PACKET
+
+static bool net_if_open(const char *name)
+{
+    net_if_fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if (net_if_fd < 0) {
+        LOG_DRIVER_ERR("could not create AF_PACKET socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    int one = 1;
+    if (setsockopt(net_if_fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one))) {
+        LOG_DRIVER_ERR("could not enable virtIO net headers: %s\n", strerror(errno));
+        return false;
+    }
+    /* Packets transmitted by the driver would otherwise be received again */
+    if (setsockopt(net_if_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one))) {
+        LOG_DRIVER_ERR("could not ignore outgoing packets: %s\n", strerror(errno));
+        return false;
+    }
+
+    int ifindex = if_nametoindex(name);
+    if (ifindex == 0) {
+        LOG_DRIVER_ERR("no interface '%s'\n", name);
+        return false;
+    }
+    struct sockaddr_ll addr = { .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_ALL), .sll_ifindex = ifindex };
+    if (bind(net_if_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        LOG_DRIVER_ERR("could not bind to '%s': %s\n", name, strerror(errno));
+        return false;
+    }
+
+    /* Clients have their own MAC addresses, so every packet on the interface is received */
+    struct packet_mreq mreq = { .mr_ifindex = ifindex, .mr_type = PACKET_MR_PROMISC };
+    if (setsockopt(net_if_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+        LOG_DRIVER_ERR("could not make '%s' promiscuous: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Receive a batch of packets into buffers.
+ *
+ * @param iovs buffer to receive each packet into.
+ * @param lens length of each packet received, or 0 if it did not fit its buffer.
+ * @param count number of buffers.
+ *
+ * @return number of packets received.
+ */
+static uint32_t net_if_recv(struct iovec *iovs, uint32_t *lens, uint32_t count)
+{
+    struct mmsghdr msgs[NET_IF_BATCH] = { 0 };
+    for (uint32_t i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received = recvmmsg(net_if_fd, msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_DRIVER_ERR("could not receive packets: %s\n", strerror(errno));
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < received; i++) {
+        lens[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+    }
+    return received;
+}
+
+/**
+ * Transmit a batch of packets, each with its virtIO net header.
+ *
+ * @param iovs header and packet of each packet.
+ * @param count number of packets.
+ */
+static void net_if_send(struct iovec (*iovs)[2], uint32_t count)
+{
+    struct mmsghdr msgs[NET_IF_BATCH] = { 0 };
+    for (uint32_t i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov = iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    uint32_t sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(net_if_fd, &msgs[sent], count - sent, 0);
+        if (n >= 0) {
+            sent += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            net_if_wait_writable();
+        } else if (errno != EINTR) {
+            /* The first packet of the batch was rejected, drop it and carry on with the rest */
+            LOG_DRIVER_ERR("could not transmit packet: %s\n", strerror(errno));
+            sent++;
+        }
+    }
+}
+
+#else
+
+static bool net_if_open(const char *name)
+{
+    net_if_fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (net_if_fd < 0) {
+        LOG_DRIVER_ERR("could not open /dev/net/tun: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct ifreq ifr = { .ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR };
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(net_if_fd, TUNSETIFF, &ifr)) {
+        LOG_DRIVER_ERR("could not attach to TAP interface '%s': %s\n", name, strerror(errno));
+        return false;
+    }
+
+    int hdr_len = sizeof(struct virtio_net_hdr);
+    if (ioctl(net_if_fd, TUNSETVNETHDRSZ, &hdr_len)) {
+        LOG_DRIVER_ERR("could not set virtIO net header size: %s\n", strerror(errno));
+        return false;
+    }
+    /* Allows the host to pass packets up with their checksum left to be completed */
+    if (ioctl(net_if_fd, TUNSETOFFLOAD, TAP_RX_OFFLOADS)) {
+        LOG_DRIVER_ERR("could not set offloads: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Receive a batch of packets into buffers.
+ *
+ * @param iovs buffer to receive each packet into.
+ * @param lens length of each packet received, or 0 if it did not fit its buffer.
+ * @param count number of buffers.
+ *
+ * @return number of packets received.
+ */
+static uint32_t net_if_recv(struct iovec *iovs, uint32_t *lens, uint32_t count)
+{
+    uint32_t received = 0;
+    while (received < count) {
+        ssize_t len = readv(net_if_fd, &iovs[received], 1);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_DRIVER_ERR("could not receive packet: %s\n", strerror(errno));
+            }
+            break;
+        }
+        /* The TAP device reports the full length of packets that it truncated */
+        lens[received] = (len > iovs[received].iov_len) ? 0 : len;
+        received++;
+    }
+    return received;
+}
+
+/**
+ * Transmit a batch of packets, each with its virtIO net header.
+ *
+ * @param iovs header and packet of each packet.
+ * @param count number of packets.
+ */
+static void net_if_send(struct iovec (*iovs)[2], uint32_t count)
+{
+    uint32_t sent = 0;
+    while (sent < count) {
+        if (writev(net_if_fd, iovs[sent], 2) >= 0) {
+            sent++;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            net_if_wait_writable();
+        } else if (errno != EINTR) {
+            LOG_DRIVER_ERR("could not transmit packet: %s\n", strerror(errno));
+            sent++;
+        }
+    }
+}
+
+#endif
+
+static void rx_provide(void)
+{
+    bool reprocess = true;
+    while (reprocess) {
+        while (rx_held() < RX_COUNT && !net_queue_empty_free(&rx_queue)) {
+            net_buff_desc_t buffer;
+            int err = net_dequeue_free(&rx_queue, &buffer);
+            assert(!err);
+
+            /* Buffers come back with their offset at the frame, past the headroom */
+            rx_buffers[rx_tail % RX_COUNT] = buffer.io_or_offset - (buffer.io_or_offset % NET_BUFFER_SIZE);
+            rx_tail++;
+        }
+
+        net_request_signal_free(&rx_queue);
+        reprocess = false;
+
+        if (!net_queue_empty_free(&rx_queue) && rx_held() < RX_COUNT) {
+            net_cancel_signal_free(&rx_queue);
+            reprocess = true;
+        }
+    }
+
+    /* Reception stopped when the driver ran out of buffers, so it can now continue */
+    if (irq_masked && rx_held() > 0) {
+        irq_masked = false;
+        microkit_irq_ack(IRQ_CH);
+    }
+}
+
+static void rx_return(void)
+{
+    uint32_t packets_transferred = 0;
+    while (rx_held() > 0) {
+        uint32_t count = MIN(rx_held(), NET_IF_BATCH);
+        struct iovec iovs[NET_IF_BATCH];
+        uint32_t lens[NET_IF_BATCH];
+        for (uint32_t i = 0; i < count; i++) {
+            iovs[i].iov_base = rx_buffer_vaddr(rx_buffers[(rx_head + i) % RX_COUNT]);
+            iovs[i].iov_len = NET_BUFFER_SIZE;
+        }
+
+        uint32_t received = net_if_recv(iovs, lens, count);
+        for (uint32_t i = 0; i < received; i++) {
+            uint64_t addr = rx_buffers[rx_head % RX_COUNT];
+            rx_head++;
+
+            if (lens[i] <= RX_HEADROOM) {
+                /* Too large for the buffer, so it was dropped and the buffer can be reused */
+                LOG_DRIVER("dropped truncated packet\n");
+                rx_buffers[rx_tail % RX_COUNT] = addr;
+                rx_tail++;
+                continue;
+            }
+
+            net_buff_desc_t buffer = { addr + RX_HEADROOM, lens[i] - RX_HEADROOM };
+            struct virtio_net_hdr *hdr = iovs[i].iov_base;
+            if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+                /* Packet came from a local peer that left its checksum to be completed */
+                buffer.flags = NET_BUFF_F_CSUM_PARTIAL;
+                buffer.csum_start = hdr->csum_start;
+                buffer.csum_offset = hdr->csum_offset;
+            } else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+                buffer.flags = NET_BUFF_F_CSUM_VALID;
+            }
+            int err = net_enqueue_active(&rx_queue, buffer);
+            assert(!err);
+
+            packets_transferred++;
+        }
+
+        if (received < count) {
+            /* Nothing more to receive */
+            break;
+        }
+    }
+
+    if (packets_transferred > 0 && net_require_signal_active(&rx_queue)) {
+        LOG_DRIVER("signalling RX\n");
+        net_cancel_signal_active(&rx_queue);
+        microkit_notify(RX_CH);
+    }
+}
+
+static void tx_provide(void)
+{
+    /* Packets are copied by the kernel as they are transmitted, so their buffers are
+     * returned straight away */
+    uint32_t returned = 0;
+    bool reprocess = true;
+    while (reprocess) {
+        while (!net_queue_empty_active(&tx_queue)) {
+            struct virtio_net_hdr hdrs[NET_IF_BATCH];
+            struct iovec iovs[NET_IF_BATCH][2];
+            net_buff_desc_t buffers[NET_IF_BATCH];
+            uint32_t count = 0;
+
+            while (count < NET_IF_BATCH && !net_queue_empty_active(&tx_queue)) {
+                net_buff_desc_t *buffer = &buffers[count];
+                int err = net_dequeue_active(&tx_queue, buffer);
+                assert(!err);
+
+                void *data = tx_buffer_vaddr(buffer);
+                if (data == NULL) {
+                    LOG_DRIVER_ERR("TX buffer 0x%lx is outside of every TX data region\n", buffer->io_or_offset);
+                    err = net_enqueue_free(&tx_queue, (net_buff_desc_t) { buffer->io_or_offset, 0 });
+                    assert(!err);
+                    returned++;
+                    continue;
+                }
+
+                tx_fill_hdr(&hdrs[count], buffer);
+                iovs[count][0] = (struct iovec) { .iov_base = &hdrs[count], .iov_len = sizeof(hdrs[count]) };
+                iovs[count][1] = (struct iovec) { .iov_base = data, .iov_len = buffer->len };
+                count++;
+            }
+
+            net_if_send(iovs, count);
+
+            for (uint32_t i = 0; i < count; i++) {
+                int err = net_enqueue_free(&tx_queue, (net_buff_desc_t) { buffers[i].io_or_offset, 0 });
+                assert(!err);
+            }
+            returned += count;
+        }
+
+        net_request_signal_active(&tx_queue);
+        reprocess = false;
+
+        if (!net_queue_empty_active(&tx_queue)) {
+            net_cancel_signal_active(&tx_queue);
+            reprocess = true;
+        }
+    }
+
+    if (returned > 0 && net_require_signal_free(&tx_queue)) {
+        net_cancel_signal_free(&tx_queue);
+        microkit_notify(TX_CH);
+    }
+}
+
+static void handle_irq(void)
+{
+    rx_return();
+
+    /* With no buffers left, the interrupt would keep firing until the client returns some */
+    if (rx_held() == 0) {
+        irq_masked = true;
+    } else {
+        microkit_deferred_irq_ack(IRQ_CH);
+    }
+}
+
+void init(void)
+{
+    net_queue_init(&rx_queue, rx_free, rx_active, NET_RX_QUEUE_CAPACITY_DRIV);
+    net_queue_init(&tx_queue, tx_free, tx_active, NET_TX_QUEUE_CAPACITY_DRIV);
+
+    tx_buffer_region_paddrs[0] = tx_buffer_data_region_cli0_paddr;
+    tx_buffer_region_paddrs[1] = tx_buffer_data_region_cli1_paddr;
+
+    const char *name = getenv(NET_IF_ENV);
+#ifdef TAP_BACKEND_AF_PACKET
+    if (name == NULL) {
+        LOG_DRIVER_ERR("%s must name the interface to attach to\n", NET_IF_ENV);
+        exit(1);
+    }
+#else
+    if (name == NULL) {
+        name = TAP_DEFAULT_IF;
+    }
+#endif
+    if (!net_if_open(name)) {
+        exit(1);
+    }
+    LOG_DRIVER("attached to '%s'\n", name);
+
+    microkit_linux_irq_fd(net_if_fd, IRQ_CH);
+
+    rx_provide();
+    tx_provide();
+}
+
+void notified(microkit_channel ch)
+{
+    switch (ch) {
+    case IRQ_CH:
+        handle_irq();
+        break;
+    case RX_CH:
+        rx_provide();
+        break;
+    case TX_CH:
+        tx_provide();
+        break;
+    default:
+        LOG_DRIVER_ERR("received notification on unexpected channel %u\n", ch);
+        break;
+    }
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sddf/util/printf.h>
+
+// #define DEBUG_DRIVER
+
+#ifdef DEBUG_DRIVER
+#define LOG_DRIVER(...) do{ sddf_dprintf("ETH DRIVER|INFO: "); sddf_dprintf(__VA_ARGS__); }while(0)
+#else
+#define LOG_DRIVER(...) do{}while(0)
+#endif
+
+#define LOG_DRIVER_ERR(...) do{ sddf_printf("ETH DRIVER|ERROR: "); sddf_printf(__VA_ARGS__); }while(0)
+
+/* Environment variable naming the host interface to attach to */
+#define NET_IF_ENV "SDDF_NET_IF"
+
+/* Name of the TAP interface if none is given, it is created if it does not exist */
+#define TAP_DEFAULT_IF "sddf0"
+
+/* Maximum number of packets received or transmitted with a single system call */
+#define NET_IF_BATCH 64
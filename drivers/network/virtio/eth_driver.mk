@@ -10,21 +10,30 @@
 #   Generates eth.elf
 #   Needs the appropriate VirtIO-MMIO region to be set in System Description File.
 # 	This can be dependent on how many VirtIO MMIO devices exist within your system.
-#   Assumes libsddf_util_debug.a is in LIBS
+#   Assumes libsddf_util_debug.a is in LIBS, and that libsddf_network.a can be
+#   built from network_lib.mk for software TX checksums.
+#   Set VIRTIO_TRANSPORT to pci to drive a virtIO PCI device instead. The
+#   System Description File must then map the ECAM configuration space of the
+#   device function and a window for its BARs rather than the MMIO region.
 
 ETHERNET_DRIVER_DIR := $(dir $(lastword $(MAKEFILE_LIST)))
 
-CHECK_NETDRV_FLAGS_MD5:=.netdrv_cflags-$(shell echo -- ${CFLAGS} ${CFLAGS_network} | shasum | sed 's/ *-//')
+VIRTIO_TRANSPORT ?= mmio
+ifeq (${VIRTIO_TRANSPORT},pci)
+CFLAGS_virtio_net := -DVIRTIO_TRANSPORT_PCI
+endif
+
+CHECK_NETDRV_FLAGS_MD5:=.netdrv_cflags-$(shell echo -- ${CFLAGS} ${CFLAGS_network} ${CFLAGS_virtio_net} | shasum | sed 's/ *-//')
 
 ${CHECK_NETDRV_FLAGS_MD5}:
 	-rm -f .netdrv_cflags-*
 	touch $@
 
-eth_driver.elf: virtio/ethernet.o
-	$(LD) $(LDFLAGS) $< $(LIBS) -o $@
+eth_driver.elf: virtio/ethernet.o libsddf_network.a
+	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
 
 virtio/ethernet.o: ${ETHERNET_DRIVER_DIR}/ethernet.c ${CHECK_NETDRV_FLAGS}
 	mkdir -p virtio
-	${CC} -c ${CFLAGS} ${CFLAGS_network} -I ${ETHERNET_DRIVER_DIR} -o $@ $<
+	${CC} -c ${CFLAGS} ${CFLAGS_network} ${CFLAGS_virtio_net} -I ${ETHERNET_DRIVER_DIR} -o $@ $<
 
 -include virtio/ethernet.d
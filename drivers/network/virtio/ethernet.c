@@ -5,7 +5,7 @@
 
 /*
  * This driver follows the non-legacy virtIO 1.2 specification for the network device.
- * It assumes that the transport method is MMIO.
+ * The transport method is MMIO, or PCI when built with VIRTIO_TRANSPORT_PCI.
  * This driver is very minimal and was written for the goal of building systems that
  * use networking on a simulator like QEMU. It is *not* intended to be performant.
  *
@@ -17,12 +17,15 @@
 #include <stdint.h>
 #include <microkit.h>
 #include <sddf/network/queue.h>
+#include <sddf/network/checksum.h>
+#include <sddf/util/cache.h>
 #include <sddf/util/fence.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
-#include <sddf/util/ialloc.h>
+#include <sddf/util/string.h>
 #include <sddf/virtio/virtio.h>
 #include <sddf/virtio/virtio_queue.h>
+#include <sddf/virtio/virtio_transport.h>
 #include <ethernet_config.h>
 
 #include "ethernet.h"
@@ -40,7 +43,46 @@
 #define TX_CH  1
 #define RX_CH  2
 
+/*
+ * With VIRTIO_NET_F_MQ, each virtqueue pair is exposed as its own set of sDDF
+ * queues, given by net_driv_queue_info, and its own channels. Pair i uses
+ * TX_CH + 2 * i and RX_CH + 2 * i.
+ */
+#ifndef NET_DRIV_NUM_QUEUE_PAIRS
+#define NET_DRIV_NUM_QUEUE_PAIRS 1
+#endif
+
+#define QUEUE_PAIR_TX_CH(i) (TX_CH + 2 * (i))
+#define QUEUE_PAIR_RX_CH(i) (RX_CH + 2 * (i))
+
+/*
+ * With the PCI transport and MSI-X, configuration changes are signalled on IRQ_CH
+ * and each RX and TX virtq has its own interrupt, on the channels following those
+ * of the queue pairs in order of virtq index. MSI-X vector 0 raises interrupt
+ * VIRTIO_PCI_NET_MSIX_IRQ_BASE, and vector 1 + i the one for virtq i.
+ */
+#define NUM_VQ_IRQS (2 * NET_DRIV_NUM_QUEUE_PAIRS)
+#define VQ_IRQ_CH(i) (QUEUE_PAIR_RX_CH(NET_DRIV_NUM_QUEUE_PAIRS - 1) + 1 + (i))
+
 uintptr_t eth_regs;
+
+#ifdef VIRTIO_TRANSPORT_PCI
+/*
+ * The configuration space of the device function is mapped through ECAM, and
+ * its BARs are assigned from the window at pci_bar_window_paddr.
+ */
+uintptr_t pci_config_vaddr;
+uintptr_t pci_bar_window_vaddr;
+uintptr_t pci_bar_window_paddr;
+
+#ifndef VIRTIO_PCI_NET_BAR_WINDOW_SIZE
+#define VIRTIO_PCI_NET_BAR_WINDOW_SIZE (0x10000)
+#endif
+
+#ifndef VIRTIO_PCI_NET_MSIX_IRQ_BASE
+#define VIRTIO_PCI_NET_MSIX_IRQ_BASE (80)
+#endif
+#endif
 /*
  * The 'hardware' ring buffer region is used to store the virtIO virtqs
  * as well as the RX and TX virtIO headers.
@@ -48,6 +90,25 @@ uintptr_t eth_regs;
 uintptr_t hw_ring_buffer_vaddr;
 uintptr_t hw_ring_buffer_paddr;
 
+/*
+ * The RX data region is mapped read-only so that the virtIO net header the device
+ * writes at the front of each RX buffer can be read. The RX buffers of every queue
+ * pair must come from this region.
+ */
+uintptr_t rx_buffer_data_vaddr;
+uintptr_t rx_buffer_data_paddr;
+
+/*
+ * The TX data regions of the clients are mapped one after another from
+ * tx_buffer_data_region_cli0_vaddr, each NET_DATA_REGION_SIZE long. They are only
+ * written when the device does not offer VIRTIO_NET_F_CSUM, to complete the partial
+ * checksums of transmitted packets in software.
+ */
+uintptr_t tx_buffer_data_region_cli0_vaddr;
+uintptr_t tx_buffer_data_region_cli0_paddr;
+uintptr_t tx_buffer_data_region_cli1_paddr;
+
+/* Queues of the first queue pair */
 net_queue_t *rx_free;
 net_queue_t *rx_active;
 net_queue_t *tx_free;
@@ -57,246 +118,401 @@ net_queue_t *tx_active;
 #define TX_COUNT 512
 #define MAX_COUNT MAX(RX_COUNT, TX_COUNT)
 
+/* Each queue pair has its own slice of the hardware ring buffer region */
 #define HW_RING_SIZE (0x10000)
 
-struct virtq rx_virtq;
-struct virtq tx_virtq;
-uint16_t rx_last_seen_used = 0;
-uint16_t tx_last_seen_used = 0;
+/* The control virtqueue only ever has one command in flight */
+#define CTRL_COUNT 4
+#define CTRL_RING_SIZE (0x1000)
 
-net_queue_handle_t rx_queue;
-net_queue_handle_t tx_queue;
+#if NET_DRIV_NUM_QUEUE_PAIRS > 1
+#define HW_RING_REGION_SIZE (HW_RING_SIZE * NET_DRIV_NUM_QUEUE_PAIRS + CTRL_RING_SIZE)
+#else
+#define HW_RING_REGION_SIZE HW_RING_SIZE
+#endif
+
+#ifdef NET_HW_REGION_SIZE
+_Static_assert(HW_RING_REGION_SIZE <= NET_HW_REGION_SIZE,
+               "Hardware ring buffer region must fit the virtqs of every queue pair");
+#endif
 
 /*
- * This driver has no use of the virtIO net headers that go before
- * each packet. Our policy is to discard them when we get RX and
- * initialise to the default values on TX. In order to this, we use a
- * separate memory region and not the sDDF data region.
+ * Offloads are only negotiated when the device offers them. Without
+ * VIRTIO_NET_F_MRG_RXBUF, receiving TSO segments requires every RX buffer to
+ * hold a 64KiB segment plus its headers, so guest TSO is only negotiated when
+ * sDDF buffers are that large.
  */
-uintptr_t virtio_net_tx_headers_vaddr;
-uintptr_t virtio_net_tx_headers_paddr;
-uintptr_t virtio_net_rx_headers_paddr;
-virtio_net_hdr_t *virtio_net_tx_headers;
+#define VIRTIO_NET_TSO_MAX_FRAME 65550
+#if NET_BUFFER_SIZE >= VIRTIO_NET_TSO_MAX_FRAME
+#define VIRTIO_NET_GUEST_TSO_FEATURES (BIT(VIRTIO_NET_F_GUEST_TSO4) | BIT(VIRTIO_NET_F_GUEST_TSO6))
+#else
+#define VIRTIO_NET_GUEST_TSO_FEATURES 0
+#endif
+
+#if NET_DRIV_NUM_QUEUE_PAIRS > 1
+#define VIRTIO_NET_MQ_FEATURES (BIT(VIRTIO_NET_F_CTRL_VQ) | BIT(VIRTIO_NET_F_MQ))
+#else
+#define VIRTIO_NET_MQ_FEATURES 0
+#endif
 
-volatile virtio_mmio_regs_t *regs;
+#define VIRTIO_NET_DRIVER_FEATURES (BIT(VIRTIO_NET_F_MAC) | BIT(VIRTIO_NET_F_CSUM) \
+                                    | BIT(VIRTIO_NET_F_GUEST_CSUM) | BIT(VIRTIO_NET_F_HOST_TSO4) \
+                                    | BIT(VIRTIO_NET_F_HOST_TSO6) | VIRTIO_NET_GUEST_TSO_FEATURES \
+                                    | VIRTIO_NET_MQ_FEATURES | BIT(VIRTIO_F_EVENT_IDX) \
+                                    | BIT(VIRTIO_F_RING_PACKED))
 
-ialloc_t rx_ialloc_desc;
-uint32_t rx_descriptors[RX_COUNT];
-ialloc_t tx_ialloc_desc;
-uint32_t tx_descriptors[TX_COUNT];
+/*
+ * With VIRTIO_F_EVENT_IDX, the device is asked to only interrupt once this many
+ * buffers have been used in a queue, or once every buffer in flight has been
+ * used if there are fewer. Batching TX completions only delays the return of
+ * TX buffers. Batching RX delays received packets until enough have arrived to
+ * reach the threshold, so it should only be raised for workloads that keep the
+ * RX queue busy.
+ */
+#ifndef VIRTIO_NET_RX_IRQ_THRESHOLD
+#define VIRTIO_NET_RX_IRQ_THRESHOLD 1
+#endif
 
-int rx_last_desc_idx = 0;
-int tx_last_desc_idx = 0;
+#ifndef VIRTIO_NET_TX_IRQ_THRESHOLD
+#define VIRTIO_NET_TX_IRQ_THRESHOLD 32
+#endif
 
-static inline bool virtio_avail_full_rx(struct virtq *virtq)
+/*
+ * Received packets are written by the device into a single descriptor that covers the
+ * whole sDDF buffer, with the virtIO net header in the first bytes of the buffer as
+ * headroom and the frame right after it. This relies on the device not requiring the
+ * header to be in a descriptor of its own, which is implied by VIRTIO_F_VERSION_1 (and is
+ * VIRTIO_F_ANY_LAYOUT for legacy devices). Received buffers are passed up with their
+ * offset pointing at the frame, and components returning them align the offset back down
+ * to the start of the buffer.
+ */
+#define RX_HEADROOM (sizeof(virtio_net_hdr_t))
+_Static_assert(NET_BUFFER_SIZE - RX_HEADROOM >= 1514, "RX buffers must fit a header and a full sized frame");
+
+/* Features accepted by both the driver and the device */
+uint64_t features;
+
+/* Data struct holding the state of an RX/TX virtqueue pair and the sDDF queues it serves */
+typedef struct queue_pair {
+    virtio_queue_t rx_vq;
+    virtio_queue_t tx_vq;
+    uint32_t rx_idxlist[RX_COUNT];
+    uint32_t tx_idxlist[TX_COUNT];
+    uint16_t rx_chain_lens[RX_COUNT];
+    uint16_t tx_chain_lens[TX_COUNT];
+
+    /* IO address of the buffer of each chain in flight, indexed by the head of the chain */
+    uint64_t rx_buffer_addrs[RX_COUNT];
+    uint64_t tx_buffer_addrs[TX_COUNT];
+
+    net_queue_handle_t rx_queue;
+    net_queue_handle_t tx_queue;
+
+    /*
+     * The virtIO net headers that go before each packet carry the checksum and
+     * segmentation offload metadata. On TX they are filled in from the offload
+     * fields of the sDDF buffer, and on RX the checksum state is passed up in
+     * the buffer flags. TX headers live in the hardware ring buffer region, indexed
+     * by the head of the chain, as there is no headroom in the TX buffers of the
+     * clients. RX headers are in the headroom of each RX buffer.
+     */
+    uintptr_t tx_headers_paddr;
+    virtio_net_hdr_t *tx_headers;
+} queue_pair_t;
+
+queue_pair_t queue_pairs[NET_DRIV_NUM_QUEUE_PAIRS];
+
+/* Control virtqueue, only set up when more than one queue pair is used */
+virtio_queue_t ctrl_vq;
+uint32_t ctrl_idxlist[CTRL_COUNT];
+uint16_t ctrl_chain_lens[CTRL_COUNT];
+uintptr_t ctrl_cmd_vaddr;
+uintptr_t ctrl_cmd_paddr;
+
+virtio_transport_t transport;
+
+/* Every received packet takes a single descriptor, and every transmitted packet two */
+#define RX_CHAIN_LEN 1
+#define TX_CHAIN_LEN 2
+
+static inline bool virtio_avail_full_rx(queue_pair_t *qp)
 {
-    return rx_last_desc_idx >= rx_virtq.num;
+    return virtio_queue_num_free(&qp->rx_vq) < RX_CHAIN_LEN;
 }
 
-static inline bool virtio_avail_full_tx(struct virtq *virtq)
+static inline bool virtio_avail_full_tx(queue_pair_t *qp)
 {
-    return tx_last_desc_idx >= tx_virtq.num;
+    return virtio_queue_num_free(&qp->tx_vq) < TX_CHAIN_LEN;
 }
 
-static void rx_provide(void)
+static inline bool feature_negotiated(uint8_t feature)
+{
+    return features & BIT(feature);
+}
+
+/**
+ * Fill in the virtIO net header of a packet from the offload fields of its buffer.
+ *
+ * @param hdr virtIO net header to fill in.
+ * @param buffer buffer holding the packet.
+ */
+static void tx_fill_hdr(virtio_net_hdr_t *hdr, net_buff_desc_t *buffer)
+{
+    hdr->flags = 0;
+    hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+    hdr->hdr_len = 0;
+    hdr->gso_size = 0;
+    hdr->csum_start = 0;
+    hdr->csum_offset = 0;
+    hdr->num_buffers = 0;
+
+    if (!(buffer->flags & NET_BUFF_F_CSUM_PARTIAL) || !feature_negotiated(VIRTIO_NET_F_CSUM)) {
+        return;
+    }
+
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = buffer->csum_start;
+    hdr->csum_offset = buffer->csum_offset;
+
+    /* Segmentation requires the device to also complete the checksum of each segment */
+    if ((buffer->flags & NET_BUFF_F_TSO4) && feature_negotiated(VIRTIO_NET_F_HOST_TSO4)) {
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    } else if ((buffer->flags & NET_BUFF_F_TSO6) && feature_negotiated(VIRTIO_NET_F_HOST_TSO6)) {
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    } else {
+        return;
+    }
+    hdr->gso_size = buffer->mss;
+    /* Without VIRTIO_NET_F_GUEST_HDRLEN this is only a hint, so it need only reach the checksum field */
+    hdr->hdr_len = buffer->csum_start + buffer->csum_offset + sizeof(uint16_t);
+}
+
+/**
+ * Find the virtual address of a TX buffer from its IO address.
+ *
+ * @param io_addr IO address of the buffer.
+ * @param len number of bytes in the buffer.
+ *
+ * @return pointer to the buffer, NULL if it is not in the TX data region of a client.
+ */
+static uint8_t *tx_buffer_vaddr(uint64_t io_addr, uint32_t len)
+{
+    uintptr_t paddrs[NUM_NETWORK_CLIENTS] = { tx_buffer_data_region_cli0_paddr };
+#if NUM_NETWORK_CLIENTS > 1
+    paddrs[1] = tx_buffer_data_region_cli1_paddr;
+#endif
+
+    for (int client = 0; client < NUM_NETWORK_CLIENTS; client++) {
+        if (io_addr >= paddrs[client] && io_addr + len <= paddrs[client] + NET_DATA_REGION_SIZE) {
+            return (uint8_t *)(tx_buffer_data_region_cli0_vaddr + client * NET_DATA_REGION_SIZE
+                               + (io_addr - paddrs[client]));
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Complete the partial checksum of a packet in software, for devices that do not offer
+ * VIRTIO_NET_F_CSUM. The checksum field holds the pseudo-header sum, so the one's
+ * complement sum is taken from csum_start to the end of the packet.
+ *
+ * @param buffer buffer holding the packet, with NET_BUFF_F_CSUM_PARTIAL set.
+ *
+ * @return false if the packet cannot be transmitted, true otherwise.
+ */
+static bool tx_complete_csum(net_buff_desc_t *buffer)
+{
+    /* Segmentation cannot be done without the device */
+    if (buffer->flags & (NET_BUFF_F_TSO4 | NET_BUFF_F_TSO6)) {
+        LOG_DRIVER_ERR("dropping TSO packet, device does not offer checksum offload\n");
+        return false;
+    }
+
+    uint8_t *frame = tx_buffer_vaddr(buffer->io_or_offset, buffer->len);
+    uint32_t field = buffer->csum_start + buffer->csum_offset;
+    if (frame == NULL || field + sizeof(uint16_t) > buffer->len) {
+        LOG_DRIVER_ERR("dropping packet with invalid checksum offsets\n");
+        return false;
+    }
+
+    uint16_t csum = ~net_chksum(frame + buffer->csum_start, buffer->len - buffer->csum_start);
+    /* A zero UDP checksum means no checksum, and is the same as 0xffff for everything else */
+    if (csum == 0) {
+        csum = 0xffff;
+    }
+    /* The checksum is in memory byte order, and the field need not be aligned */
+    sddf_memcpy(frame + field, &csum, sizeof(csum));
+    cache_clean((uintptr_t)(frame + field), (uintptr_t)(frame + field + sizeof(csum)));
+
+    return true;
+}
+
+static void rx_provide(queue_pair_t *qp)
 {
     /* We need to take all of our sDDF free entries and place them in the virtIO 'free' ring. */
     bool reprocess = true;
     while (reprocess) {
-        while (!virtio_avail_full_rx(&rx_virtq) && !net_queue_empty_free(&rx_queue)) {
+        while (!virtio_avail_full_rx(qp) && !net_queue_empty_free(&qp->rx_queue)) {
             net_buff_desc_t buffer;
-            int err = net_dequeue_free(&rx_queue, &buffer);
+            int err = net_dequeue_free(&qp->rx_queue, &buffer);
             assert(!err);
 
-            // Allocate a desc entry for the header, and one for the packet
-            uint32_t hdr_desc_idx = -1;
-            err = ialloc_alloc(&rx_ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            uint32_t pkt_desc_idx = -1;
-            err = ialloc_alloc(&rx_ialloc_desc, &pkt_desc_idx);
-            assert(!err && pkt_desc_idx != -1);
-
-            assert(hdr_desc_idx < rx_virtq.num);
-            assert(pkt_desc_idx < rx_virtq.num);
-
-            // Get the header address, which is an index into the virtio net headers memory region
-            rx_virtq.desc[hdr_desc_idx].addr = virtio_net_rx_headers_paddr + (hdr_desc_idx * sizeof(virtio_net_hdr_t));
-            rx_virtq.desc[hdr_desc_idx].len = sizeof(virtio_net_hdr_t);
-            // Set the next of the header to the packet
-            rx_virtq.desc[hdr_desc_idx].next = pkt_desc_idx;
-            rx_virtq.desc[hdr_desc_idx].flags = VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE;
-            // The packet address will be the actual buffer that we have dequeued from the client
-            rx_virtq.desc[pkt_desc_idx].addr = buffer.io_or_offset;
-            rx_virtq.desc[pkt_desc_idx].len = NET_BUFFER_SIZE;
-            rx_virtq.desc[pkt_desc_idx].flags = VIRTQ_DESC_F_WRITE;
-            // Set the entry in the available ring to point to the desc entry for the header
-            rx_virtq.avail->ring[rx_virtq.avail->idx % rx_virtq.num] = hdr_desc_idx;
-            // We only want to increment the avail ring by 1, as we are only increasing by one in
-            // this list, but we are adding two desc entries.
-            rx_virtq.avail->idx++;
-            rx_last_desc_idx += 2;
+            /* Buffers come back with their offset at the frame, past the headroom. The
+             * device writes the virtIO net header into the headroom, followed by the packet. */
+            uint64_t buffer_addr = buffer.io_or_offset - (buffer.io_or_offset % NET_BUFFER_SIZE);
+            struct virtq_desc desc = { .addr = buffer_addr, .len = NET_BUFFER_SIZE, .flags = VIRTQ_DESC_F_WRITE };
+            uint16_t head = virtio_queue_add(&qp->rx_vq, &desc, RX_CHAIN_LEN);
+            qp->rx_buffer_addrs[head] = buffer_addr;
         }
 
-        net_request_signal_free(&rx_queue);
+        net_request_signal_free(&qp->rx_queue);
         reprocess = false;
 
-        if (!net_queue_empty_free(&rx_queue) && !virtio_avail_full_rx(&rx_virtq)) {
-            net_cancel_signal_free(&rx_queue);
+        if (!net_queue_empty_free(&qp->rx_queue) && !virtio_avail_full_rx(qp)) {
+            net_cancel_signal_free(&qp->rx_queue);
             reprocess = true;
         }
     }
+
+    /* The device only asks to be notified of new RX buffers once it has run out */
+    if (virtio_queue_publish(&qp->rx_vq)) {
+        virtio_transport_notify(&transport, &qp->rx_vq);
+    }
 }
 
-static void rx_return(void)
+static void rx_return(queue_pair_t *qp)
 {
     /* Extract RX buffers from the 'used' and pass them up to the client by putting them
      * in our sDDF 'active' queues. */
     uint16_t packets_transferred = 0;
-    uint16_t i = rx_last_seen_used;
-    uint16_t curr_idx = rx_virtq.used->idx;
-    while (i != curr_idx) {
-        LOG_DRIVER("i: 0x%lx\n", i);
-        struct virtq_used_elem hdr_used = rx_virtq.used->ring[i % rx_virtq.num];
-        assert(rx_virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc pkt = rx_virtq.desc[rx_virtq.desc[hdr_used.id].next % rx_virtq.num];
-        uint64_t addr = pkt.addr;
-        uint32_t len = pkt.len;
-        assert(!(pkt.flags & VIRTQ_DESC_F_NEXT));
-
-        net_buff_desc_t buffer = { addr, len };
-        int err = net_enqueue_active(&rx_queue, buffer);
-        assert(!err);
-
-        err = ialloc_free(&rx_ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&rx_ialloc_desc, rx_virtq.desc[hdr_used.id].next);
-        assert(!err);
-
-        rx_last_desc_idx -= 2;
-        assert(rx_last_desc_idx >= 0);
-        i++;
-        packets_transferred++;
-    }
-    rx_last_seen_used += packets_transferred;
-
-    if (packets_transferred > 0 && net_require_signal_active(&rx_queue)) {
+    bool reprocess = true;
+    while (reprocess) {
+        uint16_t head;
+        uint32_t used_len;
+        while (virtio_queue_get_used(&qp->rx_vq, &head, &used_len)) {
+            uint64_t addr = qp->rx_buffer_addrs[head];
+            /* The used length covers the virtIO net header as well as the packet */
+            assert(used_len >= RX_HEADROOM);
+            net_buff_desc_t buffer = { addr + RX_HEADROOM, used_len - RX_HEADROOM };
+
+            virtio_net_hdr_t *hdr = (virtio_net_hdr_t *)(rx_buffer_data_vaddr + (addr - rx_buffer_data_paddr));
+            if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+                /* Packet came from a local peer that left its checksum to be completed */
+                buffer.flags = NET_BUFF_F_CSUM_PARTIAL;
+                buffer.csum_start = hdr->csum_start;
+                buffer.csum_offset = hdr->csum_offset;
+            } else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+                buffer.flags = NET_BUFF_F_CSUM_VALID;
+            }
+            int err = net_enqueue_active(&qp->rx_queue, buffer);
+            assert(!err);
+
+            packets_transferred++;
+        }
+
+        reprocess = virtio_queue_set_used_threshold(&qp->rx_vq, VIRTIO_NET_RX_IRQ_THRESHOLD, RX_CHAIN_LEN);
+    }
+
+    if (packets_transferred > 0 && net_require_signal_active(&qp->rx_queue)) {
         LOG_DRIVER("signalling RX\n");
-        net_cancel_signal_active(&rx_queue);
-        microkit_notify(RX_CH);
+        net_cancel_signal_active(&qp->rx_queue);
+        microkit_notify(QUEUE_PAIR_RX_CH(qp - queue_pairs));
     }
 }
 
-static void tx_provide(void)
+static void tx_provide(queue_pair_t *qp)
 {
+    bool dropped = false;
     bool reprocess = true;
-    bool packets_transferred = false;
     while (reprocess) {
-        while (!virtio_avail_full_tx(&tx_virtq) && !net_queue_empty_active(&tx_queue)) {
+        while (!virtio_avail_full_tx(qp) && !net_queue_empty_active(&qp->tx_queue)) {
             net_buff_desc_t buffer;
-            int err = net_dequeue_active(&tx_queue, &buffer);
+            int err = net_dequeue_active(&qp->tx_queue, &buffer);
             assert(!err);
 
-            /* Now we need to put our buffer into the virtIO ring */
-            uint32_t hdr_desc_idx = -1;
-            err = ialloc_alloc(&tx_ialloc_desc, &hdr_desc_idx);
-            assert(!err && hdr_desc_idx != -1);
-            uint32_t pkt_desc_idx = -1;
-            err = ialloc_alloc(&tx_ialloc_desc, &pkt_desc_idx);
-            assert(!err && pkt_desc_idx != -1);
-            /* We should not run out of descriptors assuming that the avail ring is not full. */
-            assert(hdr_desc_idx < tx_virtq.num);
-            assert(pkt_desc_idx < tx_virtq.num);
-            tx_virtq.avail->ring[tx_virtq.avail->idx % tx_virtq.num] = hdr_desc_idx;
-
-            virtio_net_hdr_t *hdr = &virtio_net_tx_headers[hdr_desc_idx];
-            hdr->flags = 0;
-            hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
-            hdr->hdr_len = 0;  /* not used unless we have segmentation offload */
-            hdr->gso_size = 0; /* same */
-            hdr->csum_start = 0;
-            hdr->csum_offset = 0;
-            tx_virtq.desc[hdr_desc_idx].addr = virtio_net_tx_headers_paddr + (hdr_desc_idx * sizeof(virtio_net_hdr_t));
-            tx_virtq.desc[hdr_desc_idx].len = sizeof(virtio_net_hdr_t);
-            tx_virtq.desc[hdr_desc_idx].next = pkt_desc_idx;
-            tx_virtq.desc[hdr_desc_idx].flags = VIRTQ_DESC_F_NEXT;
-            tx_virtq.desc[pkt_desc_idx].addr = buffer.io_or_offset;
-            tx_virtq.desc[pkt_desc_idx].len = buffer.len;
-            tx_virtq.desc[pkt_desc_idx].flags = 0;
-
-            tx_virtq.avail->idx++;
-            tx_last_desc_idx += 2;
-
-            packets_transferred = true;
+            if ((buffer.flags & NET_BUFF_F_CSUM_PARTIAL) && !feature_negotiated(VIRTIO_NET_F_CSUM)
+                && !tx_complete_csum(&buffer)) {
+                /* The free queue holds every TX buffer, so there is room to return it */
+                err = net_enqueue_free(&qp->tx_queue, buffer);
+                assert(!err);
+                dropped = true;
+                continue;
+            }
+
+            /* The header must be filled in before the chain can be seen by the device */
+            uint16_t head = virtio_queue_next_head(&qp->tx_vq);
+            tx_fill_hdr(&qp->tx_headers[head], &buffer);
+
+            struct virtq_desc chain[TX_CHAIN_LEN] = {
+                { .addr = qp->tx_headers_paddr + head * sizeof(virtio_net_hdr_t), .len = sizeof(virtio_net_hdr_t) },
+                { .addr = buffer.io_or_offset, .len = buffer.len },
+            };
+            head = virtio_queue_add(&qp->tx_vq, chain, TX_CHAIN_LEN);
+            qp->tx_buffer_addrs[head] = buffer.io_or_offset;
         }
 
-        net_request_signal_active(&tx_queue);
+        net_request_signal_active(&qp->tx_queue);
         reprocess = false;
 
-        if (!virtio_avail_full_tx(&tx_virtq) && !net_queue_empty_active(&tx_queue)) {
-            net_cancel_signal_active(&tx_queue);
+        if (!virtio_avail_full_tx(qp) && !net_queue_empty_active(&qp->tx_queue)) {
+            net_cancel_signal_active(&qp->tx_queue);
             reprocess = true;
         }
     }
 
-    if (packets_transferred) {
-        /* Finally, need to notify the queue if we have transferred data */
+    if (dropped && net_require_signal_free(&qp->tx_queue)) {
+        net_cancel_signal_free(&qp->tx_queue);
+        microkit_notify(QUEUE_PAIR_TX_CH(qp - queue_pairs));
+    }
+
+    /* Finally, need to notify the queue if we have transferred data and the device is not
+     * already processing it */
+    if (virtio_queue_publish(&qp->tx_vq)) {
         /* This assumes VIRTIO_F_NOTIFICATION_DATA has not been negotiated */
-        regs->QueueNotify = VIRTIO_NET_TX_QUEUE;
+        virtio_transport_notify(&transport, &qp->tx_vq);
     }
 }
 
-static void tx_return(void)
+static void tx_return(queue_pair_t *qp)
 {
     /* We must look through the 'used' ring of the TX virtqueue and place them in our
      * sDDF TX free queue. */
     uint16_t enqueued = 0;
-    uint16_t i = tx_last_seen_used;
-    uint16_t curr_idx = tx_virtq.used->idx;
-    while (i != curr_idx && !net_queue_full_free(&tx_queue)) {
-        /* For each TX free entry in the sDDF queue, there are *two* virtq used entries.
-         * One for the virtIO header, and one for the packet. */
-        struct virtq_used_elem hdr_used = tx_virtq.used->ring[i % tx_virtq.num];
-
-        assert(tx_virtq.desc[hdr_used.id].flags & VIRTQ_DESC_F_NEXT);
-
-        struct virtq_desc pkt = tx_virtq.desc[tx_virtq.desc[hdr_used.id].next % tx_virtq.num];
-        uint64_t addr = pkt.addr;
-        assert(!(pkt.flags & VIRTQ_DESC_F_NEXT));
-
-        net_buff_desc_t buffer = { addr, 0 };
-        int err = net_enqueue_free(&tx_queue, buffer);
-        assert(!err);
+    bool reprocess = true;
+    while (reprocess) {
+        uint16_t head;
+        uint32_t len;
+        while (!net_queue_full_free(&qp->tx_queue) && virtio_queue_get_used(&qp->tx_vq, &head, &len)) {
+            net_buff_desc_t buffer = { qp->tx_buffer_addrs[head], 0 };
+            int err = net_enqueue_free(&qp->tx_queue, buffer);
+            assert(!err);
 
-        err = ialloc_free(&tx_ialloc_desc, hdr_used.id);
-        assert(!err);
-        err = ialloc_free(&tx_ialloc_desc, tx_virtq.desc[hdr_used.id].next);
-        assert(!err);
-        tx_last_desc_idx -= 2;
-        assert(tx_last_desc_idx >= 0);
-        i++;
+            enqueued++;
+        }
 
-        enqueued++;
+        /* A full free queue would stop us from processing any more of the used ring */
+        reprocess = virtio_queue_set_used_threshold(&qp->tx_vq, VIRTIO_NET_TX_IRQ_THRESHOLD, TX_CHAIN_LEN)
+                    && !net_queue_full_free(&qp->tx_queue);
     }
 
-    tx_last_seen_used += enqueued;
-
-    if (enqueued > 0 && net_require_signal_free(&tx_queue)) {
-        net_cancel_signal_free(&tx_queue);
-        microkit_notify(TX_CH);
+    if (enqueued > 0 && net_require_signal_free(&qp->tx_queue)) {
+        net_cancel_signal_free(&qp->tx_queue);
+        microkit_notify(QUEUE_PAIR_TX_CH(qp - queue_pairs));
     }
 }
 
 static void handle_irq()
 {
-    uint32_t irq_status = regs->InterruptStatus;
+    // With MSI-X, only configuration changes are signalled on this interrupt. Otherwise the
+    // interrupt is acknowledged before handling it, so that a notification raised while we
+    // process the used rings is not lost.
+    uint32_t irq_status = transport.msix ? VIRTIO_MMIO_IRQ_CONFIG : virtio_transport_irq_status_ack(&transport);
     if (irq_status & VIRTIO_MMIO_IRQ_VQUEUE) {
-        // We don't know whether the IRQ is related to a change to the RX queue
-        // or TX queue, so we check both.
-        rx_return();
-        tx_return();
-        // We have handled the used buffer notification
-        regs->InterruptACK = VIRTIO_MMIO_IRQ_VQUEUE;
+        // We don't know which queue the IRQ is related to, so we check all of them.
+        for (int i = 0; i < NET_DRIV_NUM_QUEUE_PAIRS; i++) {
+            rx_return(&queue_pairs[i]);
+            tx_return(&queue_pairs[i]);
+        }
     }
 
     if (irq_status & VIRTIO_MMIO_IRQ_CONFIG) {
@@ -304,124 +520,201 @@ static void handle_irq()
     }
 }
 
+/**
+ * Send a command on the control virtqueue and wait for the device to process it.
+ * Commands are only sent during initialisation, so polling for completion is fine.
+ *
+ * @param class class of the command.
+ * @param command command within the class.
+ * @param data command specific data.
+ * @param len number of bytes of command specific data.
+ *
+ * @return true if the device acknowledged the command with VIRTIO_NET_OK.
+ */
+static bool ctrl_send_command(uint8_t class, uint8_t command, const void *data, uint16_t len)
+{
+    /* The command header, data and ack each take their own part of the command buffer */
+    virtio_net_ctrl_hdr_t *hdr = (virtio_net_ctrl_hdr_t *)ctrl_cmd_vaddr;
+    uint8_t *cmd_data = (uint8_t *)(ctrl_cmd_vaddr + 16);
+    volatile virtio_net_ctrl_ack_t *ack = (virtio_net_ctrl_ack_t *)(ctrl_cmd_vaddr + 48);
+    assert(len <= 32);
+
+    hdr->class = class;
+    hdr->command = command;
+    for (uint16_t i = 0; i < len; i++) {
+        cmd_data[i] = ((const uint8_t *)data)[i];
+    }
+    *ack = VIRTIO_NET_ERR;
+
+    struct virtq_desc chain[3] = {
+        { .addr = ctrl_cmd_paddr, .len = sizeof(virtio_net_ctrl_hdr_t) },
+        { .addr = ctrl_cmd_paddr + 16, .len = len },
+        { .addr = ctrl_cmd_paddr + 48, .len = sizeof(virtio_net_ctrl_ack_t), .flags = VIRTQ_DESC_F_WRITE },
+    };
+    virtio_queue_add(&ctrl_vq, chain, 3);
+    virtio_queue_publish(&ctrl_vq);
+    virtio_transport_notify(&transport, &ctrl_vq);
+
+    uint16_t head;
+    uint32_t used_len;
+    while (!virtio_queue_get_used(&ctrl_vq, &head, &used_len));
+
+    return *ack == VIRTIO_NET_OK;
+}
+
+/**
+ * Set up the virtqs of a queue pair in the hardware ring buffer region and register them
+ * with the device.
+ *
+ * @param qp queue pair to set up.
+ * @param pair index of the queue pair.
+ * @param ring_off offset of the slice of the hardware ring buffer region of the queue pair.
+ */
+static void queue_pair_setup(queue_pair_t *qp, uint16_t pair, size_t ring_off)
+{
+    uintptr_t ring_vaddr = hw_ring_buffer_vaddr + ring_off;
+    uintptr_t ring_paddr = hw_ring_buffer_paddr + ring_off;
+
+    size_t rx_off = 0;
+    size_t tx_off = ALIGN(rx_off + virtio_queue_ring_size(RX_COUNT), 16);
+    size_t virtq_size = tx_off + virtio_queue_ring_size(TX_COUNT);
+
+    virtio_queue_init(&qp->rx_vq, VIRTIO_NET_RX_QUEUE + 2 * pair, RX_COUNT, features, ring_vaddr + rx_off,
+                      qp->rx_idxlist, qp->rx_chain_lens);
+    virtio_queue_init(&qp->tx_vq, VIRTIO_NET_TX_QUEUE + 2 * pair, TX_COUNT, features, ring_vaddr + tx_off,
+                      qp->tx_idxlist, qp->tx_chain_lens);
+
+    /* Virtio TX headers will proceed the virtq structures */
+    qp->tx_headers = (virtio_net_hdr_t *)(ring_vaddr + virtq_size);
+    qp->tx_headers_paddr = ring_paddr + virtq_size;
+    /* Headers are indexed by the head of their chain, which may be any of the descriptors in the queue */
+    size_t tx_headers_size = TX_COUNT * sizeof(virtio_net_hdr_t);
+
+    assert(virtq_size + tx_headers_size <= HW_RING_SIZE);
+
+    rx_provide(qp);
+    tx_provide(qp);
+
+    // Setup RX queue first, then TX queue. MSI-X vector 0 is for configuration changes.
+    bool ok = virtio_transport_queue_register(&transport, &qp->rx_vq, ring_paddr + rx_off, 1 + qp->rx_vq.index);
+    assert(ok);
+    ok = virtio_transport_queue_register(&transport, &qp->tx_vq, ring_paddr + tx_off, 1 + qp->tx_vq.index);
+    assert(ok);
+}
+
+/**
+ * Set up the control virtqueue in the hardware ring buffer region, after the slices of
+ * the queue pairs, and register it with the device.
+ *
+ * @param index virtIO queue index of the control virtq.
+ * @param ring_off offset of the slice of the hardware ring buffer region of the control virtq.
+ */
+static void ctrl_setup(uint16_t index, size_t ring_off)
+{
+    uintptr_t ring_vaddr = hw_ring_buffer_vaddr + ring_off;
+    uintptr_t ring_paddr = hw_ring_buffer_paddr + ring_off;
+
+    size_t cmd_off = ALIGN(virtio_queue_ring_size(CTRL_COUNT), 64);
+    assert(cmd_off + 64 <= CTRL_RING_SIZE);
+
+    virtio_queue_init(&ctrl_vq, index, CTRL_COUNT, features, ring_vaddr, ctrl_idxlist, ctrl_chain_lens);
+    /* Completions are polled for */
+    virtio_queue_disable_used_irq(&ctrl_vq);
+
+    ctrl_cmd_vaddr = ring_vaddr + cmd_off;
+    ctrl_cmd_paddr = ring_paddr + cmd_off;
+
+    bool ok = virtio_transport_queue_register(&transport, &ctrl_vq, ring_paddr, VIRTIO_MSI_NO_VECTOR);
+    assert(ok);
+}
+
 static void eth_setup(void)
 {
-    // Do MMIO device init (section 4.2.3.1)
-    if (!virtio_mmio_check_magic(regs)) {
-        LOG_DRIVER_ERR("invalid virtIO magic value!\n");
+    // Do transport specific device init (sections 4.1.5 and 4.2.3)
+#ifdef VIRTIO_TRANSPORT_PCI
+    if (!virtio_transport_pci_init(&transport, pci_config_vaddr, pci_bar_window_vaddr, pci_bar_window_paddr,
+                                   VIRTIO_PCI_NET_BAR_WINDOW_SIZE)) {
+        LOG_DRIVER_ERR("not a virtIO PCI device, or its BARs do not fit in the window!\n");
         assert(false);
     }
-
-    if (virtio_mmio_version(regs) != VIRTIO_VERSION) {
-        LOG_DRIVER_ERR("not correct virtIO version!\n");
+#else
+    if (!virtio_transport_mmio_init(&transport, eth_regs + VIRTIO_MMIO_NET_OFFSET)) {
+        LOG_DRIVER_ERR("invalid virtIO magic value or version!\n");
         assert(false);
     }
+#endif
 
-    if (!virtio_mmio_check_device_id(regs, VIRTIO_DEVICE_ID_NET)) {
+    if (virtio_transport_device_id(&transport) != VIRTIO_DEVICE_ID_NET) {
         LOG_DRIVER_ERR("not a virtIO network device!\n");
         assert(false);
     }
 
-    LOG_DRIVER("version: 0x%x\n", virtio_mmio_version(regs));
-
     // Do normal device initialisation (section 3.2)
 
     // First reset the device
-    regs->Status = 0;
+    virtio_transport_set_status(&transport, 0);
 
     // Set the ACKNOWLEDGE bit to say we have noticed the device
-    regs->Status = VIRTIO_DEVICE_STATUS_ACKNOWLEDGE;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_ACKNOWLEDGE);
     // Set the DRIVER bit to say we know how to drive the device
-    regs->Status = VIRTIO_DEVICE_STATUS_DRIVER;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_DRIVER);
 
+    uint64_t device_features = virtio_transport_device_features(&transport);
 #ifdef DEBUG_DRIVER
-    uint32_t feature_low = regs->DeviceFeatures;
-    regs->DeviceFeaturesSel = 1;
-    uint32_t feature_high = regs->DeviceFeatures;
-    uint64_t feature = feature_low | ((uint64_t)feature_high << 32);
-    virtio_net_print_features(feature);
+    virtio_net_print_features(device_features);
 #endif
 
-    regs->DriverFeatures = VIRTIO_NET_F_MAC;
-    regs->DriverFeaturesSel = 1;
-    regs->DriverFeatures = VIRTIO_F_VERSION_1;
+    features = (device_features & VIRTIO_NET_DRIVER_FEATURES) | BIT(VIRTIO_F_VERSION_1);
+    /* Both checksum and segmentation offloads on TX depend on VIRTIO_NET_F_CSUM */
+    if (!feature_negotiated(VIRTIO_NET_F_CSUM)) {
+        features &= ~(BIT(VIRTIO_NET_F_HOST_TSO4) | BIT(VIRTIO_NET_F_HOST_TSO6));
+    }
+    if (!feature_negotiated(VIRTIO_NET_F_GUEST_CSUM)) {
+        features &= ~(BIT(VIRTIO_NET_F_GUEST_TSO4) | BIT(VIRTIO_NET_F_GUEST_TSO6));
+    }
+#ifdef NETWORK_HW_HAS_PARTIAL_CHECKSUM
+    if (!feature_negotiated(VIRTIO_NET_F_CSUM)) {
+        LOG_DRIVER("device does not offer checksum offload, completing TX checksums in software\n");
+    }
+#endif
+    virtio_transport_set_driver_features(&transport, features);
 
-    regs->Status = VIRTIO_DEVICE_STATUS_FEATURES_OK;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_FEATURES_OK);
 
-    if (!(regs->Status & VIRTIO_DEVICE_STATUS_FEATURES_OK)) {
+    if (!(virtio_transport_status(&transport) & VIRTIO_DEVICE_STATUS_FEATURES_OK)) {
         LOG_DRIVER_ERR("device status features is not OK!\n");
         return;
     }
 
-    volatile virtio_net_config_t *config = (virtio_net_config_t *)regs->Config;
+    volatile virtio_net_config_t *config = virtio_transport_config(&transport);
+    assert(config != NULL);
 #ifdef DEBUG_DRIVER
     virtio_net_print_config(config);
 #endif
 
-    // Setup the virtqueues
+    if (NET_DRIV_NUM_QUEUE_PAIRS > 1) {
+        if (!feature_negotiated(VIRTIO_NET_F_MQ) || !feature_negotiated(VIRTIO_NET_F_CTRL_VQ)
+            || config->max_virtqueue_pairs < NET_DRIV_NUM_QUEUE_PAIRS) {
+            LOG_DRIVER_ERR("device does not support %d virtqueue pairs!\n", NET_DRIV_NUM_QUEUE_PAIRS);
+            assert(false);
+        }
+    }
 
-    size_t rx_desc_off = 0;
-    size_t rx_avail_off = ALIGN(rx_desc_off + (16 * RX_COUNT), 2);
-    size_t rx_used_off = ALIGN(rx_avail_off + (6 + 2 * RX_COUNT), 4);
-    size_t tx_desc_off = ALIGN(rx_used_off + (6 + 8 * RX_COUNT), 16);
-    size_t tx_avail_off = ALIGN(tx_desc_off + (16 * TX_COUNT), 2);
-    size_t tx_used_off = ALIGN(tx_avail_off + (6 + 2 * TX_COUNT), 4);
-    size_t virtq_size = tx_used_off + (6 + 8 * TX_COUNT);
-
-    rx_virtq.num = RX_COUNT;
-    rx_virtq.desc = (struct virtq_desc *)(hw_ring_buffer_vaddr + rx_desc_off);
-    rx_virtq.avail = (struct virtq_avail *)(hw_ring_buffer_vaddr + rx_avail_off);
-    rx_virtq.used = (struct virtq_used *)(hw_ring_buffer_vaddr + rx_used_off);
-
-    assert((uintptr_t)rx_virtq.desc % 16 == 0);
-    assert((uintptr_t)rx_virtq.avail % 2 == 0);
-    assert((uintptr_t)rx_virtq.used % 4 == 0);
-
-    tx_virtq.num = TX_COUNT;
-    tx_virtq.desc = (struct virtq_desc *)(hw_ring_buffer_vaddr + tx_desc_off);
-    tx_virtq.avail = (struct virtq_avail *)(hw_ring_buffer_vaddr + tx_avail_off);
-    tx_virtq.used = (struct virtq_used *)(hw_ring_buffer_vaddr + tx_used_off);
-
-    assert((uintptr_t)tx_virtq.desc % 16 == 0);
-    assert((uintptr_t)tx_virtq.avail % 2 == 0);
-    assert((uintptr_t)tx_virtq.used % 4 == 0);
-
-    /* Virtio TX headers will proceed the virtq structures. Then RX headers. */
-    virtio_net_tx_headers_vaddr = hw_ring_buffer_vaddr + virtq_size;
-    virtio_net_tx_headers_paddr = hw_ring_buffer_paddr + virtq_size;
-    virtio_net_tx_headers = (virtio_net_hdr_t *) virtio_net_tx_headers_vaddr;
-    size_t tx_headers_size = ((TX_COUNT / 2) * sizeof(virtio_net_hdr_t));
-    virtio_net_rx_headers_paddr = virtio_net_tx_headers_paddr + tx_headers_size;
-    size_t rx_headers_size = ((RX_COUNT / 2) * sizeof(virtio_net_hdr_t));
-
-    assert(virtq_size + tx_headers_size + rx_headers_size <= HW_RING_SIZE);
-
-    rx_provide();
-    tx_provide();
-
-    // Setup RX queue first
-    assert(regs->QueueNumMax >= RX_COUNT);
-    regs->QueueSel = VIRTIO_NET_RX_QUEUE;
-    regs->QueueNum = RX_COUNT;
-    regs->QueueDescLow = (hw_ring_buffer_paddr + rx_desc_off) & 0xFFFFFFFF;
-    regs->QueueDescHigh = (hw_ring_buffer_paddr + rx_desc_off) >> 32;
-    regs->QueueDriverLow = (hw_ring_buffer_paddr + rx_avail_off) & 0xFFFFFFFF;
-    regs->QueueDriverHigh = (hw_ring_buffer_paddr + rx_avail_off) >> 32;
-    regs->QueueDeviceLow = (hw_ring_buffer_paddr + rx_used_off) & 0xFFFFFFFF;
-    regs->QueueDeviceHigh = (hw_ring_buffer_paddr + rx_used_off) >> 32;
-    regs->QueueReady = 1;
-
-    // Setup TX queue
-    assert(regs->QueueNumMax >= TX_COUNT);
-    regs->QueueSel = VIRTIO_NET_TX_QUEUE;
-    regs->QueueNum = TX_COUNT;
-    regs->QueueDescLow = (hw_ring_buffer_paddr + tx_desc_off) & 0xFFFFFFFF;
-    regs->QueueDescHigh = (hw_ring_buffer_paddr + tx_desc_off) >> 32;
-    regs->QueueDriverLow = (hw_ring_buffer_paddr + tx_avail_off) & 0xFFFFFFFF;
-    regs->QueueDriverHigh = (hw_ring_buffer_paddr + tx_avail_off) >> 32;
-    regs->QueueDeviceLow = (hw_ring_buffer_paddr + tx_used_off) & 0xFFFFFFFF;
-    regs->QueueDeviceHigh = (hw_ring_buffer_paddr + tx_used_off) >> 32;
-    regs->QueueReady = 1;
+#ifdef VIRTIO_TRANSPORT_PCI
+    // Give every RX and TX virtq its own interrupt, falling back to a shared legacy interrupt
+    if (!virtio_transport_msix_setup(&transport, VIRTIO_PCI_NET_MSIX_IRQ_BASE, 1 + NUM_VQ_IRQS)) {
+        LOG_DRIVER("MSI-X is not available, using legacy interrupts\n");
+    }
+#endif
+
+    // Setup the virtqueues
+    for (int i = 0; i < NET_DRIV_NUM_QUEUE_PAIRS; i++) {
+        queue_pair_setup(&queue_pairs[i], i, i * HW_RING_SIZE);
+    }
+    if (NET_DRIV_NUM_QUEUE_PAIRS > 1) {
+        /* The control virtq follows the RX and TX virtqs of every queue pair the device supports */
+        ctrl_setup(2 * config->max_virtqueue_pairs, NET_DRIV_NUM_QUEUE_PAIRS * HW_RING_SIZE);
+    }
 
     // Set the MAC address
     config->mac[0] = 0x52;
@@ -432,40 +725,72 @@ static void eth_setup(void)
     config->mac[5] = 0x07;
 
     // Set the DRIVER_OK status bit
-    regs->Status = VIRTIO_DEVICE_STATUS_DRIVER_OK;
-    regs->InterruptACK = VIRTIO_MMIO_IRQ_VQUEUE;
+    virtio_transport_set_status(&transport, VIRTIO_DEVICE_STATUS_DRIVER_OK);
+    virtio_transport_irq_status_ack(&transport);
+
+    if (NET_DRIV_NUM_QUEUE_PAIRS > 1) {
+        /* The device only uses the first queue pair until told otherwise. Once it is, each
+         * flow is received on the queue pair it was last transmitted from. */
+        virtio_net_ctrl_mq_t mq = { .virtqueue_pairs = NET_DRIV_NUM_QUEUE_PAIRS };
+        if (!ctrl_send_command(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &mq, sizeof(mq))) {
+            LOG_DRIVER_ERR("device did not accept %d virtqueue pairs!\n", NET_DRIV_NUM_QUEUE_PAIRS);
+            assert(false);
+        }
+    }
 }
 
 void init(void)
 {
-    regs = (volatile virtio_mmio_regs_t *)(eth_regs + VIRTIO_MMIO_NET_OFFSET);
-
-    ialloc_init(&rx_ialloc_desc, rx_descriptors, RX_COUNT);
-    ialloc_init(&tx_ialloc_desc, tx_descriptors, TX_COUNT);
-
-    net_queue_init(&rx_queue, rx_free, rx_active, NET_RX_QUEUE_CAPACITY_DRIV);
-    net_queue_init(&tx_queue, tx_free, tx_active, NET_TX_QUEUE_CAPACITY_DRIV);
+    net_queue_info_t rx_info[NET_DRIV_NUM_QUEUE_PAIRS];
+    net_queue_info_t tx_info[NET_DRIV_NUM_QUEUE_PAIRS];
+    net_driv_queue_info(rx_free, rx_active, tx_free, tx_active, rx_info, tx_info);
+
+    for (int i = 0; i < NET_DRIV_NUM_QUEUE_PAIRS; i++) {
+        queue_pair_t *qp = &queue_pairs[i];
+        net_queue_init(&qp->rx_queue, rx_info[i].free, rx_info[i].active, rx_info[i].capacity);
+        net_queue_init(&qp->tx_queue, tx_info[i].free, tx_info[i].active, tx_info[i].capacity);
+    }
 
     eth_setup();
 
     microkit_irq_ack(IRQ_CH);
+    if (transport.msix) {
+        for (int i = 0; i < NUM_VQ_IRQS; i++) {
+            microkit_irq_ack(VQ_IRQ_CH(i));
+        }
+    }
 }
 
 void notified(microkit_channel ch)
 {
-    switch (ch) {
-    case IRQ_CH:
+    if (ch == IRQ_CH) {
         handle_irq();
         microkit_deferred_irq_ack(ch);
-        break;
-    case RX_CH:
-        rx_provide();
-        break;
-    case TX_CH:
-        tx_provide();
-        break;
-    default:
+        return;
+    }
+
+    if (transport.msix && ch >= VQ_IRQ_CH(0) && ch < VQ_IRQ_CH(NUM_VQ_IRQS)) {
+        /* Each virtq has its own interrupt, so only its used ring needs to be processed */
+        int index = ch - VQ_IRQ_CH(0);
+        if (index % 2 == VIRTIO_NET_RX_QUEUE) {
+            rx_return(&queue_pairs[index / 2]);
+        } else {
+            tx_return(&queue_pairs[index / 2]);
+        }
+        microkit_deferred_irq_ack(ch);
+        return;
+    }
+
+    /* Channels after the IRQ channel alternate between the TX and RX channels of each queue pair */
+    int pair = (ch - TX_CH) / 2;
+    if (ch < TX_CH || pair >= NET_DRIV_NUM_QUEUE_PAIRS) {
         LOG_DRIVER_ERR("received notification on unexpected channel %u\n", ch);
-        break;
+        return;
+    }
+
+    if (ch == QUEUE_PAIR_RX_CH(pair)) {
+        rx_provide(&queue_pairs[pair]);
+    } else {
+        tx_provide(&queue_pairs[pair]);
     }
 }
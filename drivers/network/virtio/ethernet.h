@@ -53,7 +53,25 @@
 #define VIRTIO_NET_S_LINK_UP 1
 #define VIRTIO_NET_S_ANNOUNCE 2
 
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+#define VIRTIO_NET_HDR_F_RSC_INFO 4
+
 #define VIRTIO_NET_HDR_GSO_NONE 0
+#define VIRTIO_NET_HDR_GSO_TCPV4 1
+#define VIRTIO_NET_HDR_GSO_UDP 3
+#define VIRTIO_NET_HDR_GSO_TCPV6 4
+#define VIRTIO_NET_HDR_GSO_UDP_L4 5
+#define VIRTIO_NET_HDR_GSO_ECN 0x80
+
+/* Control virtqueue classes and commands */
+#define VIRTIO_NET_CTRL_MQ 4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN 1
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX 0x8000
+
+#define VIRTIO_NET_OK 0
+#define VIRTIO_NET_ERR 1
 
 typedef struct virtio_net_config {
     uint8_t mac[6];
@@ -76,8 +94,21 @@ typedef struct virtio_net_hdr {
     uint16_t gso_size;        /* Bytes to append to hdr_len per frame */
     uint16_t csum_start;  /* Position to start checksumming from */
     uint16_t csum_offset; /* Offset after that to place checksum */
+    uint16_t num_buffers; /* Always present with VIRTIO_F_VERSION_1 */
 } virtio_net_hdr_t;
 
+/* Layout of a command on the control virtqueue, each part is in its own descriptor */
+typedef struct virtio_net_ctrl_hdr {
+    uint8_t class;
+    uint8_t command;
+} virtio_net_ctrl_hdr_t;
+
+typedef struct virtio_net_ctrl_mq {
+    uint16_t virtqueue_pairs;
+} virtio_net_ctrl_mq_t;
+
+typedef uint8_t virtio_net_ctrl_ack_t;
+
 static void virtio_net_print_config(volatile virtio_net_config_t *config)
 {
     LOG_DRIVER("Printing virtIO net config:\n");
@@ -102,6 +133,7 @@ static void virtio_net_print_hdr(volatile virtio_net_hdr_t *hdr)
     sddf_printf("    gso_size: 0x%x\n", hdr->gso_size);
     sddf_printf("    csum_start: 0x%x\n", hdr->csum_start);
     sddf_printf("    csum_offset: 0x%x\n", hdr->csum_offset);
+    sddf_printf("    num_buffers: 0x%x\n", hdr->num_buffers);
 }
 
 static void virtio_net_print_features(uint64_t features)
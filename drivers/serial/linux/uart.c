@@ -0,0 +1,142 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Serial driver for systems run on a Linux host (see linux/README.md), standing in
+ * for the UART with the standard output and input of the process. Standard input
+ * becoming readable is delivered as the interrupt of the driver through
+ * microkit_linux_irq_fd. The file descriptors may be shared with the terminal of
+ * other processes, so they are left blocking and only read once poll reports them
+ * readable.
+ */
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <microkit.h>
+#include <sddf/serial/queue.h>
+#include <sddf/util/printf.h>
+#include <serial_config.h>
+
+#define IRQ_CH 0
+#define TX_CH  1
+#define RX_CH  2
+
+serial_queue_t *rx_queue;
+serial_queue_t *tx_queue;
+
+char *rx_data;
+char *tx_data;
+
+serial_queue_handle_t rx_queue_handle;
+serial_queue_handle_t tx_queue_handle;
+
+#if !SERIAL_TX_ONLY
+/* The interrupt is left unacknowledged while the RX queue is full */
+static bool rx_irq_masked;
+#endif
+
+static void tx_provide(void)
+{
+    bool transferred = false;
+    bool reprocess = true;
+    while (reprocess) {
+        uint32_t len;
+        while ((len = serial_queue_contiguous_length(&tx_queue_handle)) > 0) {
+            uint32_t head = tx_queue_handle.queue->head;
+            ssize_t written = write(STDOUT_FILENO, tx_queue_handle.data_region + head % tx_queue_handle.capacity, len);
+            if (written <= 0) {
+                /* Nothing else can be done with the output, drop it rather than spin */
+                written = len;
+            }
+            serial_update_visible_head(&tx_queue_handle, head + written);
+            transferred = true;
+        }
+
+        serial_request_producer_signal(&tx_queue_handle);
+        reprocess = false;
+
+        if (!serial_queue_empty(&tx_queue_handle, tx_queue_handle.queue->head)) {
+            serial_cancel_producer_signal(&tx_queue_handle);
+            reprocess = true;
+        }
+    }
+
+    if (transferred && serial_require_consumer_signal(&tx_queue_handle)) {
+        serial_cancel_consumer_signal(&tx_queue_handle);
+        microkit_notify(TX_CH);
+    }
+}
+
+#if !SERIAL_TX_ONLY
+static bool stdin_readable(void)
+{
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+static void rx_return(void)
+{
+    bool enqueued = false;
+    uint32_t len;
+    while ((len = serial_queue_contiguous_free(&rx_queue_handle)) > 0 && stdin_readable()) {
+        uint32_t tail = rx_queue_handle.queue->tail;
+        ssize_t received = read(STDIN_FILENO, rx_queue_handle.data_region + tail % rx_queue_handle.capacity, len);
+        if (received <= 0) {
+            /* Standard input was closed, so there is nothing more to receive */
+            return;
+        }
+        serial_update_visible_tail(&rx_queue_handle, tail + received);
+        enqueued = true;
+    }
+
+    if (serial_queue_full(&rx_queue_handle, rx_queue_handle.queue->tail)) {
+        /* Leave the interrupt unacknowledged until the virtualiser has consumed some of the queue */
+        rx_irq_masked = true;
+        serial_request_consumer_signal(&rx_queue_handle);
+    } else {
+        rx_irq_masked = false;
+        microkit_deferred_irq_ack(IRQ_CH);
+    }
+
+    if (enqueued && serial_require_producer_signal(&rx_queue_handle)) {
+        serial_cancel_producer_signal(&rx_queue_handle);
+        microkit_notify(RX_CH);
+    }
+}
+#endif
+
+void init(void)
+{
+#if !SERIAL_TX_ONLY
+    serial_queue_init(&rx_queue_handle, rx_queue, SERIAL_RX_DATA_REGION_CAPACITY_DRIV, rx_data);
+    microkit_linux_irq_fd(STDIN_FILENO, IRQ_CH);
+#endif
+    serial_queue_init(&tx_queue_handle, tx_queue, SERIAL_TX_DATA_REGION_CAPACITY_DRIV, tx_data);
+}
+
+void notified(microkit_channel ch)
+{
+    switch (ch) {
+#if !SERIAL_TX_ONLY
+    case IRQ_CH:
+        rx_return();
+        break;
+    case RX_CH:
+        if (rx_irq_masked) {
+            serial_cancel_consumer_signal(&rx_queue_handle);
+            rx_return();
+        }
+        break;
+#endif
+    case TX_CH:
+        tx_provide();
+        break;
+    default:
+        sddf_dprintf("UART|LOG: received notification on unexpected channel: %u\n", ch);
+        break;
+    }
+}
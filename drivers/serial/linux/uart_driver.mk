@@ -0,0 +1,31 @@
+#
+# Copyright 2024, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Include this snippet in your project Makefile to build
+#    the serial driver for systems run on a Linux host, which
+#    uses standard output and input in place of a UART
+#
+# NOTES:
+#   Generates uart_driver.elf
+#   Must be built with the host compiler alongside linux/linux.mk,
+#   see linux/README.md.
+
+UART_DRIVER_DIR := $(dir $(lastword $(MAKEFILE_LIST)))
+
+uart_driver.elf: serial/linux/uart_driver.o
+	$(CC) $(LDFLAGS_linux) $< $(LIBS) -o $@
+
+serial/linux/uart_driver.o: ${UART_DRIVER_DIR}/uart.c |serial/linux
+	$(CC) -c $(CFLAGS) -o $@ $<
+
+serial/linux:
+	mkdir -p $@
+
+-include serial/linux/uart_driver.d
+
+clean::
+	rm -f serial/linux/uart_driver.[do]
+clobber:: clean
+	rm -rf uart_driver.elf serial
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Timer driver for systems run on a Linux host (see linux/README.md). Time is read
+ * from CLOCK_MONOTONIC, relative to when the driver started, and the earliest timeout
+ * is programmed into a timerfd. The timerfd becoming readable is delivered as the
+ * interrupt of the driver through microkit_linux_irq_fd.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <microkit.h>
+#include <sddf/timer/protocol.h>
+#include <sddf/util/util.h>
+#include <sddf/util/printf.h>
+
+#define IRQ_CH 0
+#define MAX_TIMEOUTS 6
+
+static int timer_fd = -1;
+static uint64_t start_time;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+static inline uint64_t get_time(void)
+{
+    return monotonic_ns() - start_time;
+}
+
+void set_timeout(uint64_t timeout)
+{
+    /* The deadline is never zero, which would disarm the timer, as start_time is after boot */
+    uint64_t deadline = start_time + timeout;
+    struct itimerspec its = {
+        .it_value = { .tv_sec = deadline / NS_IN_S, .tv_nsec = deadline % NS_IN_S },
+    };
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        sddf_dprintf("TIMER DRIVER|ERROR: could not set timeout\n");
+    }
+}
+
+static uint64_t timeouts[MAX_TIMEOUTS];
+
+static void process_timeouts(uint64_t curr_time)
+{
+    for (int i = 0; i < MAX_TIMEOUTS; i++) {
+        if (timeouts[i] <= curr_time) {
+            microkit_notify(i);
+            timeouts[i] = UINT64_MAX;
+        }
+    }
+
+    uint64_t next_timeout = UINT64_MAX;
+    for (int i = 0; i < MAX_TIMEOUTS; i++) {
+        if (timeouts[i] < next_timeout) {
+            next_timeout = timeouts[i];
+        }
+    }
+
+    if (next_timeout != UINT64_MAX) {
+        set_timeout(next_timeout);
+    }
+}
+
+void init(void)
+{
+    for (int i = 0; i < MAX_TIMEOUTS; i++) {
+        timeouts[i] = UINT64_MAX;
+    }
+
+    start_time = monotonic_ns();
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        sddf_dprintf("TIMER DRIVER|ERROR: could not create timerfd\n");
+        return;
+    }
+    microkit_linux_irq_fd(timer_fd, IRQ_CH);
+}
+
+void notified(microkit_channel ch)
+{
+    assert(ch == IRQ_CH);
+
+    /* Reading the expiry count clears the timerfd, a stale expiry just reads nothing */
+    uint64_t expirations;
+    (void)!read(timer_fd, &expirations, sizeof(expirations));
+    microkit_deferred_irq_ack(ch);
+
+    process_timeouts(get_time());
+}
+
+seL4_MessageInfo_t protected(microkit_channel ch, microkit_msginfo msginfo)
+{
+    switch (microkit_msginfo_get_label(msginfo)) {
+    case SDDF_TIMER_GET_TIME: {
+        seL4_SetMR(0, get_time());
+        return microkit_msginfo_new(0, 1);
+    }
+    case SDDF_TIMER_SET_TIMEOUT: {
+        uint64_t curr_time = get_time();
+        uint64_t offset_ns = (uint64_t)(seL4_GetMR(0));
+        timeouts[ch] = curr_time + offset_ns;
+        process_timeouts(curr_time);
+        break;
+    }
+    default:
+        sddf_dprintf("TIMER DRIVER|LOG: Unknown request %lu to timer from channel %u\n", microkit_msginfo_get_label(msginfo),
+                     ch);
+        break;
+    }
+
+    return microkit_msginfo_new(0, 0);
+}
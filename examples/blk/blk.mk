@@ -66,6 +66,12 @@ IMAGE_FILE   := loader.img
 REPORT_FILE  := report.txt
 SYSTEM_FILE  := ${TOP}/board/$(MICROKIT_BOARD)/blk.system
 
+# With BLK_CACHE=1 the block cache sits between the client and the virtualiser
+ifeq ($(strip $(BLK_CACHE)),1)
+IMAGES += blk_cache.elf
+SYSTEM_FILE  := ${TOP}/board/$(MICROKIT_BOARD)/blk_cache.system
+endif
+
 BLK_DRIVER   := $(SDDF)/drivers/blk/${BLK_DRIVER_DIR}
 TIMER_DRIVER := $(SDDF)/drivers/timer/${TIMER_DRIVER_DIR}
 
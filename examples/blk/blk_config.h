@@ -6,18 +6,22 @@
 #pragma once
 
 #include <sddf/blk/queue.h>
+#include <sddf/blk/sched.h>
 #include <sddf/blk/storage_info.h>
 #include <sddf/util/string.h>
 
 #define BLK_NUM_CLIENTS                         1
 
 #define BLK_NAME_CLI0                           "client"
+/* Block cache between the client and the virtualiser, in systems built with BLK_CACHE=1 */
+#define BLK_NAME_CACHE                          "blk_cache"
 
 #define BLK_QUEUE_CAPACITY_CLI0                 1024
 #define BLK_QUEUE_CAPACITY_DRIV                 BLK_QUEUE_CAPACITY_CLI0
 
 #define BLK_QUEUE_REGION_SIZE                   0x200000
 #define BLK_DATA_REGION_SIZE_CLI0               BLK_QUEUE_REGION_SIZE
+#define BLK_DATA_REGION_SIZE_CACHE_CLI          BLK_QUEUE_REGION_SIZE
 #define BLK_DATA_REGION_SIZE_DRIV               BLK_QUEUE_REGION_SIZE
 
 #define BLK_QUEUE_REGION_SIZE_CLI0              BLK_QUEUE_REGION_SIZE
@@ -26,6 +30,9 @@
 /* Mapping from client index to disk partition that the client will have access to. */
 static const int blk_partition_mapping[BLK_NUM_CLIENTS] = { 0 };
 
+/* Policy used by the virtualiser to schedule requests of the clients, see sddf/blk/sched.h */
+#define BLK_VIRT_SCHED                          BLK_SCHED_RR
+
 static inline blk_storage_info_t *blk_virt_cli_storage_info(blk_storage_info_t *info, unsigned int id)
 {
     switch (id) {
@@ -90,7 +97,30 @@ static inline uint32_t blk_cli_queue_size(char *pd_name)
 {
     if (!sddf_strcmp(pd_name, BLK_NAME_CLI0)) {
         return BLK_QUEUE_CAPACITY_CLI0;
+    } else if (!sddf_strcmp(pd_name, BLK_NAME_CACHE)) {
+        /* The cache passes the requests of the client on to the virtualiser */
+        return BLK_QUEUE_CAPACITY_CLI0;
+    } else {
+        return 0;
+    }
+}
+
+/* Size of the data region the block cache shares with its client */
+static inline uint64_t blk_cache_cli_data_region_size(char *pd_name)
+{
+    if (!sddf_strcmp(pd_name, BLK_NAME_CACHE)) {
+        return BLK_DATA_REGION_SIZE_CACHE_CLI;
     } else {
         return 0;
     }
 }
+
+static inline blk_qos_t blk_virt_cli_qos(unsigned int id)
+{
+    switch (id) {
+    case 0:
+        return (blk_qos_t) { .weight = 1 };
+    default:
+        return (blk_qos_t) { 0 };
+    }
+}
@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <sddf/network/udpfast.h>
+
 #define UDP_ECHO_PORT 1235
 #define UTILIZATION_PORT 1236
 #define TCP_ECHO_PORT 1237
@@ -13,5 +16,6 @@
 #define ETHER_MTU 1500
 
 int setup_udp_socket(void);
+uint16_t udp_echo_fastpath(void *arg, const udpfast_pkt_t *pkt, uint8_t *reply, uint16_t reply_size);
 int setup_utilization_socket(void);
 int setup_tcp_socket(void);
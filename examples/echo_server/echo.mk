@@ -26,9 +26,39 @@ REPORT_FILE := report.txt
 
 vpath %.c ${SDDF} ${ECHO_SERVER}
 
-IMAGES := eth_driver.elf lwip.elf benchmark.elf idle.elf network_virt_rx.elf\
+IMAGES := eth_driver.elf lwip.elf network_virt_rx.elf\
 	  network_virt_tx.elf copy.elf timer_driver.elf uart_driver.elf serial_virt_tx.elf
 
+# The ARP component is not part of the echo server system, but is built against its
+# ethernet config so that it keeps compiling
+IMAGES += arp.elf
+
+ifeq ($(strip $(MICROKIT_BOARD)), linux)
+# Every protection domain is built as a Linux process, see linux/README.md. The benchmark
+# protection domains cannot run on Linux, so they are not built and excluded when run.
+include ${SDDF}/linux/linux.mk
+
+LD := $(CC)
+CFLAGS := -g3 -O3 -Wall \
+	  -Wno-unused-function \
+	  -DCONFIG_PLAT_LINUX \
+	  -I$(SDDF)/include \
+	  ${CFLAGS_linux} \
+	  -I${ECHO_INCLUDE}/lwip \
+	  -I${ETHERNET_CONFIG_INCLUDE} \
+	  -I$(SERIAL_CONFIG_INCLUDE) \
+	  -I${SDDF}/$(LWIPDIR)/include \
+	  -I${SDDF}/$(LWIPDIR)/include/ipv4 \
+	  -MD \
+	  -MP
+
+LDFLAGS := ${LDFLAGS_linux}
+LIBS := -Wl,--start-group libmicrokit_linux.a libsddf_util_debug.a -Wl,--end-group
+
+${IMAGES}: libmicrokit_linux.a
+else
+IMAGES += benchmark.elf idle.elf
+
 CFLAGS := -mcpu=$(CPU) \
 	  -mstrict-align \
 	  -ffreestanding \
@@ -47,6 +77,7 @@ CFLAGS := -mcpu=$(CPU) \
 
 LDFLAGS := -L$(BOARD_DIR)/lib -L${LIBC}
 LIBS := --start-group -lmicrokit -Tmicrokit.ld -lc libsddf_util_debug.a --end-group
+endif
 
 CHECK_FLAGS_BOARD_MD5:=.board_cflags-$(shell echo -- ${CFLAGS} ${BOARD} ${MICROKIT_CONFIG} | shasum | sed 's/ *-//')
 
@@ -71,10 +102,14 @@ LWIP_OBJS := $(LWIPFILES:.c=.o) lwip.o utilization_socket.o \
 OBJS := $(LWIP_OBJS)
 DEPS := $(filter %.d,$(OBJS:.o=.d))
 
+ifeq ($(strip $(MICROKIT_BOARD)), linux)
+all: $(IMAGES)
+else
 all: loader.img
+endif
 
 ${LWIP_OBJS}: ${CHECK_FLAGS_BOARD_MD5}
-lwip.elf: $(LWIP_OBJS) libsddf_util.a
+lwip.elf: $(LWIP_OBJS) libsddf_util.a libsddf_network.a
 	$(LD) $(LDFLAGS) $^ $(LIBS) -o $@
 
 LWIPDIRS := $(addprefix ${LWIPDIR}/, core/ipv4 netif api)
@@ -92,12 +127,19 @@ ${IMAGE_FILE} $(REPORT_FILE): $(IMAGES) $(SYSTEM_FILE)
 
 include ${SDDF}/util/util.mk
 include ${SDDF}/network/components/network_components.mk
+include ${SDDF}/network/lib/network_lib.mk
 include ${ETHERNET_DRIVER}/eth_driver.mk
+ifneq ($(strip $(MICROKIT_BOARD)), linux)
 include ${BENCHMARK}/benchmark.mk
+endif
 include ${TIMER_DRIVER}/timer_driver.mk
 include ${UART_DRIVER}/uart_driver.mk
 include ${SERIAL_COMPONENTS}/serial_components.mk
 
+# Attach to a host interface named by SDDF_NET_IF, see drivers/network/tap
+run: $(IMAGES)
+	${SDDF}/linux/sddf_linux.py $(SYSTEM_FILE) --search-path $(BUILD_DIR) --exclude bench --exclude benchIdle
+
 qemu: $(IMAGE_FILE)
 	$(QEMU) -machine virt,virtualization=on \
 			-cpu cortex-a53 \
@@ -20,10 +20,17 @@
 #define NET_VIRT_TX_NAME "net_virt_tx"
 #define NET_DRIVER_NAME "eth"
 #define NET_TIMER_NAME "timer"
+#define NET_ARP_NAME "arp"
 
 #define NET_DATA_REGION_SIZE                    0x200000
 #define NET_HW_REGION_SIZE                      0x10000
 
+/* Number of RX/TX queue pairs of the driver, only supported by the virtIO net driver */
+#define NET_DRIV_NUM_QUEUE_PAIRS                1
+
+/* Define to mirror packets to the packet capture component, see network/components/capture.c */
+// #define NET_CAPTURE
+
 #if defined(CONFIG_PLAT_IMX8MM_EVK)
 #define MAC_ADDR_CLI0                       0x525401000001
 #define MAC_ADDR_CLI1                       0x525401000002
@@ -39,6 +46,9 @@
 #elif defined(CONFIG_PLAT_IMX8MP_EVK)
 #define MAC_ADDR_CLI0                       0x525401000009
 #define MAC_ADDR_CLI1                       0x52540100000A
+#elif defined(CONFIG_PLAT_LINUX)
+#define MAC_ADDR_CLI0                       0x52540100000B
+#define MAC_ADDR_CLI1                       0x52540100000C
 #else
 #error "Must define MAC addresses for clients in ethernet config"
 #endif
@@ -73,6 +83,14 @@ _Static_assert(NET_RX_DATA_REGION_SIZE_CLI0 >= NET_RX_QUEUE_CAPACITY_CLI0 * NET_
 _Static_assert(NET_RX_DATA_REGION_SIZE_CLI1 >= NET_RX_QUEUE_CAPACITY_CLI1 * NET_BUFFER_SIZE,
                "Client1 RX data region size must fit Client1 RX buffers");
 
+/*
+ * The ARP component answers ARP requests and Neighbor Solicitations on behalf of the clients
+ * before it, and is the last network client of the systems that use it. lwIP answers for
+ * itself in the echo server, so the component is only built against this config.
+ */
+#define NET_RX_QUEUE_CAPACITY_ARP                    512
+#define NET_TX_QUEUE_CAPACITY_ARP                    512
+
 #define NET_MAX_QUEUE_CAPACITY MAX(NET_TX_QUEUE_CAPACITY_DRIV, MAX(NET_RX_QUEUE_CAPACITY_DRIV, MAX(NET_RX_QUEUE_CAPACITY_CLI0, NET_RX_QUEUE_CAPACITY_CLI1)))
 _Static_assert(NET_TX_QUEUE_CAPACITY_DRIV >= NET_TX_QUEUE_CAPACITY_CLI0 + NET_TX_QUEUE_CAPACITY_CLI1,
                "Driver TX queue must have capacity to fit all of client's TX buffers.");
@@ -102,6 +120,13 @@ static inline void net_virt_mac_addrs(char *pd_name, uint64_t macs[NUM_NETWORK_C
     }
 }
 
+static inline void net_arp_mac_addrs(char *pd_name, uint64_t macs[NUM_NETWORK_CLIENTS - 1])
+{
+    if (!sddf_strcmp(pd_name, NET_ARP_NAME)) {
+        macs[0] = MAC_ADDR_CLI0;
+    }
+}
+
 static inline void net_cli_queue_capacity(char *pd_name, size_t *rx_queue_capacity, size_t *tx_queue_capacity)
 {
     if (!sddf_strcmp(pd_name, NET_CLI0_NAME)) {
@@ -110,6 +135,9 @@ static inline void net_cli_queue_capacity(char *pd_name, size_t *rx_queue_capaci
     } else if (!sddf_strcmp(pd_name, NET_CLI1_NAME)) {
         *rx_queue_capacity = NET_RX_QUEUE_CAPACITY_CLI1;
         *tx_queue_capacity = NET_TX_QUEUE_CAPACITY_CLI1;
+    } else if (!sddf_strcmp(pd_name, NET_ARP_NAME)) {
+        *rx_queue_capacity = NET_RX_QUEUE_CAPACITY_ARP;
+        *tx_queue_capacity = NET_TX_QUEUE_CAPACITY_ARP;
     }
 }
 
@@ -148,6 +176,25 @@ static inline void net_virt_queue_info(char *pd_name, net_queue_t *cli0_free, ne
     }
 }
 
+/*
+ * The driver queues of each queue pair are mapped in the order RX free, RX active, TX free,
+ * TX active. The queues of pair i are mapped 4 * NET_DATA_REGION_SIZE past those of pair i - 1.
+ */
+static inline void net_driv_queue_info(net_queue_t *rx_free, net_queue_t *rx_active, net_queue_t *tx_free,
+                                       net_queue_t *tx_active, net_queue_info_t rx[NET_DRIV_NUM_QUEUE_PAIRS],
+                                       net_queue_info_t tx[NET_DRIV_NUM_QUEUE_PAIRS])
+{
+    for (int i = 0; i < NET_DRIV_NUM_QUEUE_PAIRS; i++) {
+        uintptr_t off = i * 4 * NET_DATA_REGION_SIZE;
+        rx[i] = (net_queue_info_t) { .free = (net_queue_t *)((uintptr_t)rx_free + off),
+                                     .active = (net_queue_t *)((uintptr_t)rx_active + off),
+                                     .capacity = NET_RX_QUEUE_CAPACITY_DRIV };
+        tx[i] = (net_queue_info_t) { .free = (net_queue_t *)((uintptr_t)tx_free + off),
+                                     .active = (net_queue_t *)((uintptr_t)tx_active + off),
+                                     .capacity = NET_TX_QUEUE_CAPACITY_DRIV };
+    }
+}
+
 static inline void net_mem_region_vaddr(char *pd_name, uintptr_t mem_regions[NUM_NETWORK_CLIENTS],
                                         uintptr_t start_region)
 {
@@ -43,7 +43,9 @@ typedef uintptr_t mem_ptr_t;
 #endif
 
 
-#define LWIP_CHKSUM_ALGORITHM 3
+/* Use the sDDF checksum routine, which has SIMD paths for AArch64 and x86-64 */
+#include <sddf/network/checksum.h>
+#define LWIP_CHKSUM net_chksum
 
 #define PACK_STRUCT_STRUCT __attribute__((packed))
 #define PACK_STRUCT_BEGIN
@@ -55,7 +57,12 @@ typedef uintptr_t mem_ptr_t;
 #define LWIP_PLATFORM_HTONL(x) ( (((u32_t)(x))>>24) | (((x)&0xFF0000)>>8) \
                                | (((x)&0xFF00)<<8) | (((x)&0xFF)<<24) )
 
+#ifdef __linux__
+/* Built as a Linux process, where the C library provides it */
+#include <sys/types.h>
+#else
 typedef unsigned long long ssize_t;
+#endif
 
 #define LWIP_RAND                       rand
 
@@ -46,8 +46,25 @@
 #define MEM_ALIGNMENT                   4
 
 /**
- * The size of the heap memory. If the application will send
- * a lot of data that needs to be copied, this should be set high.
+ * Back both the lwIP heap and the memp pools with the sDDF slab allocator
+ * (see lwip.c). Every mem_malloc and memp_malloc is served in O(1) from a
+ * power-of-two size class in a region owned by this client, so connection
+ * churn does not fragment the heap. Memory use is bounded by the capacity of
+ * each size class rather than by MEM_SIZE and the MEMP_NUM_* options.
+ */
+#define MEM_LIBC_MALLOC                 1
+#define MEMP_MEM_MALLOC                 1
+
+void *lwip_slab_malloc(size_t size);
+void *lwip_slab_calloc(size_t count, size_t size);
+void lwip_slab_free(void *ptr);
+
+#define mem_clib_malloc                 lwip_slab_malloc
+#define mem_clib_calloc                 lwip_slab_calloc
+#define mem_clib_free                   lwip_slab_free
+
+/**
+ * Only determines the width of mem_size_t when MEM_LIBC_MALLOC is set.
  */
 #define MEM_SIZE                        0x30000
 
@@ -85,7 +102,10 @@
  */
 #ifdef NETWORK_HW_HAS_CHECKSUM
 
-/* Leave the checksum checking on tx to hw */
+/*
+ * Leave the checksum checking on tx to hw. With NETWORK_HW_HAS_PARTIAL_CHECKSUM,
+ * frames are prepared with net_chksum_offload before being transmitted.
+ */
 #define CHECKSUM_GEN_IP                 0
 #define CHECKSUM_GEN_UDP                0
 #define CHECKSUM_GEN_TCP                0
@@ -8,8 +8,11 @@
 #include <microkit.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
+#include <sddf/util/slab.h>
 #include <sddf/network/queue.h>
+#include <sddf/network/offload.h>
 #include <sddf/network/util.h>
+#include <sddf/network/udpfast.h>
 #include <sddf/serial/queue.h>
 #include <sddf/timer/client.h>
 #include <sddf/benchmark/sel4bench.h>
@@ -37,7 +40,6 @@ char *serial_tx_data;
 serial_queue_t *serial_tx_queue;
 serial_queue_handle_t serial_tx_queue_handle;
 
-#define LWIP_TICK_MS 100
 #define NUM_PBUFFS NET_MAX_CLIENT_QUEUE_CAPACITY
 
 net_queue_t *rx_free;
@@ -64,6 +66,53 @@ LWIP_MEMPOOL_DECLARE(
     "Zero-copy RX pool"
 );
 
+/*
+ * Capacity of each slab size class backing the lwIP heap and pools, starting at 64 bytes.
+ * Pbuf, TCP segment, timeout and RX pool structs fit in the 64 byte class, TCP header pbufs in the
+ * 128 byte class, TCP PCBs in the 512 byte class and PBUF_POOL buffers in the 2048 byte class.
+ * The 1MiB class holds the send queues of TCP echo connections, see tcp_echo_socket.c.
+ */
+#define LWIP_SLAB_CAPACITY_64   8192
+#define LWIP_SLAB_CAPACITY_128  3072
+#define LWIP_SLAB_CAPACITY_256  256
+#define LWIP_SLAB_CAPACITY_512  64
+#define LWIP_SLAB_CAPACITY_1024 64
+#define LWIP_SLAB_CAPACITY_2048 (PBUF_POOL_SIZE + 88)
+#define LWIP_SLAB_CAPACITY_4096 16
+#define LWIP_SLAB_CAPACITY_1M   4
+
+#define LWIP_SLAB_NUM_CLASSES 15
+#define LWIP_SLAB_REGION_SIZE (LWIP_SLAB_CAPACITY_64 * 64 + LWIP_SLAB_CAPACITY_128 * 128 + \
+                               LWIP_SLAB_CAPACITY_256 * 256 + LWIP_SLAB_CAPACITY_512 * 512 + \
+                               LWIP_SLAB_CAPACITY_1024 * 1024 + LWIP_SLAB_CAPACITY_2048 * 2048 + \
+                               LWIP_SLAB_CAPACITY_4096 * 4096 + LWIP_SLAB_CAPACITY_1M * 0x100000)
+
+static const uint64_t lwip_slab_capacities[LWIP_SLAB_NUM_CLASSES] = {
+    LWIP_SLAB_CAPACITY_64, LWIP_SLAB_CAPACITY_128, LWIP_SLAB_CAPACITY_256, LWIP_SLAB_CAPACITY_512,
+    LWIP_SLAB_CAPACITY_1024, LWIP_SLAB_CAPACITY_2048, LWIP_SLAB_CAPACITY_4096, 0, 0, 0, 0, 0, 0, 0,
+    LWIP_SLAB_CAPACITY_1M
+};
+
+static uint8_t lwip_slab_region[LWIP_SLAB_REGION_SIZE] __attribute__((aligned(SLAB_MIN_OBJ_SIZE)));
+
+/* Allocator for the lwIP heap and pools. High-water marks can be read from here when sizing the classes. */
+slab_t lwip_slab;
+
+void *lwip_slab_malloc(size_t size)
+{
+    return slab_alloc(&lwip_slab, size);
+}
+
+void *lwip_slab_calloc(size_t count, size_t size)
+{
+    return slab_calloc(&lwip_slab, count, size);
+}
+
+void lwip_slab_free(void *ptr)
+{
+    slab_free(&lwip_slab, ptr);
+}
+
 typedef struct state {
     struct netif netif;
     uint8_t mac[ETH_HWADDR_LEN];
@@ -71,18 +120,58 @@ typedef struct state {
     net_queue_handle_t tx_queue;
     struct pbuf *head;
     struct pbuf *tail;
+    udpfast_t udpfast;
 } state_t;
 
 state_t state;
 
+/* Time in nanoseconds at which the timer driver will next notify us, UINT64_MAX if no timeout is pending */
+static uint64_t timer_deadline = UINT64_MAX;
+
+/* Time in nanoseconds of the last sys_now() call */
+static uint64_t sys_now_ns;
+
+/*
+ * Set whenever lwIP reads the time. lwIP's sys_timeout() calls sys_now() to compute the
+ * deadline of every timeout it adds, so the earliest timeout can only have moved earlier
+ * if this is set.
+ */
+static bool timeouts_changed = true;
+
+/**
+ * Program the timer for the next lwIP timeout. The timer driver holds a single
+ * timeout per client, so it is only reprogrammed when lwIP's next deadline is
+ * earlier than the pending one. A later pending timeout that lwIP no longer
+ * needs only costs a spurious wakeup, after which this is called again.
+ */
 void set_timeout(void)
 {
-    sddf_timer_set_timeout(TIMER, LWIP_TICK_MS * NS_IN_MS);
+    if (!timeouts_changed) {
+        return;
+    }
+
+    /* Reads the time through sys_now(), which is reused for the deadline below */
+    u32_t sleep_ms = sys_timeouts_sleeptime();
+    timeouts_changed = false;
+    if (sleep_ms == SYS_TIMEOUTS_SLEEPTIME_INFINITE) {
+        return;
+    }
+
+    uint64_t timeout = (uint64_t)sleep_ms * NS_IN_MS;
+    uint64_t deadline = sys_now_ns + timeout;
+    if (deadline >= timer_deadline) {
+        return;
+    }
+
+    timer_deadline = deadline;
+    sddf_timer_set_timeout(TIMER, timeout);
 }
 
 uint32_t sys_now(void)
 {
-    return sddf_timer_time_now(TIMER) / NS_IN_MS;
+    sys_now_ns = sddf_timer_time_now(TIMER);
+    timeouts_changed = true;
+    return sys_now_ns / NS_IN_MS;
 }
 
 /**
@@ -177,6 +266,9 @@ static err_t lwip_eth_send(struct netif *netif, struct pbuf *p)
     }
 
     buffer.len = copied;
+#ifdef NETWORK_HW_HAS_PARTIAL_CHECKSUM
+    net_chksum_offload((void *)frame, &buffer);
+#endif
     err = net_enqueue_active(&state.tx_queue, buffer);
     assert(!err);
 
@@ -230,6 +322,17 @@ void receive(void)
             int err = net_dequeue_active(&state.rx_queue, &buffer);
             assert(!err);
 
+            udpfast_result_t result = udpfast_input(&state.udpfast, (void *)(buffer.io_or_offset + rx_buffer_data_region),
+                                                    buffer.len, &state.tx_queue, tx_buffer_data_region);
+            if (result != UDPFAST_PASS) {
+                notify_tx |= (result == UDPFAST_REPLIED);
+                buffer.len = 0;
+                err = net_enqueue_free(&state.rx_queue, buffer);
+                assert(!err);
+                notify_rx = true;
+                continue;
+            }
+
             struct pbuf *p = create_interface_buffer(buffer.io_or_offset, buffer.len);
             assert(p != NULL);
             if (state.netif.input(p, &state.netif) != ERR_OK) {
@@ -282,6 +385,7 @@ static void netif_status_callback(struct netif *netif)
         sddf_printf("LWIP|NOTICE: DHCP request for %s returned IP address: %s\n", microkit_name,
                     ip4addr_ntoa(netif_ip4_addr(netif)));
     }
+    udpfast_set_ip(&state.udpfast, ip4_addr_get_u32(netif_ip4_addr(netif)));
 }
 
 void init(void)
@@ -295,13 +399,17 @@ void init(void)
     net_queue_init(&state.tx_queue, tx_free, tx_active, tx_capacity);
     net_buffers_init(&state.tx_queue, 0);
 
+    int err = slab_init(&lwip_slab, (uintptr_t)lwip_slab_region, LWIP_SLAB_REGION_SIZE, lwip_slab_capacities,
+                        LWIP_SLAB_NUM_CLASSES);
+    assert(!err);
+
     lwip_init();
-    set_timeout();
 
     LWIP_MEMPOOL_INIT(RX_POOL);
 
     uint64_t mac_addr = net_cli_mac_addr(microkit_name);
     net_set_mac_addr(state.mac, mac_addr);
+    udpfast_init(&state.udpfast, state.mac, UDP_ECHO_PORT, udp_echo_fastpath, NULL);
 
     /* Set dummy IP configuration values to get lwIP bootstrapped  */
     struct ip4_addr netmask, ipaddr, gw, multicast;
@@ -330,6 +438,8 @@ void init(void)
     setup_utilization_socket();
     setup_tcp_socket();
 
+    set_timeout();
+
     if (notify_rx && net_require_signal_free(&state.rx_queue)) {
         net_cancel_signal_free(&state.rx_queue);
         notify_rx = false;
@@ -358,8 +468,9 @@ void notified(microkit_channel ch)
         receive();
         break;
     case TIMER:
+        timer_deadline = UINT64_MAX;
+        timeouts_changed = true;
         sys_check_timeouts();
-        set_timeout();
         break;
     case TX_CH:
         transmit();
@@ -373,6 +484,9 @@ void notified(microkit_channel ch)
         break;
     }
 
+    /* Only re-arms the timer if handling the event may have added lwIP timeouts */
+    set_timeout();
+
     if (notify_rx && net_require_signal_free(&state.rx_queue)) {
         net_cancel_signal_free(&state.rx_queue);
         notify_rx = false;
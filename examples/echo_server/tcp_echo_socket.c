@@ -8,6 +8,7 @@
 
 #include "echo.h"
 #include "lwip/ip.h"
+#include "lwip/mem.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
 
@@ -17,34 +18,22 @@
 #define ECHO_QUEUE_CAPACITY (TCP_WND + 1)
 
 struct echo_state {
-    bool in_use;
     // sending ring buffer
     size_t tail; // data gets added at tail
     size_t head; // moved forward for acknowledged data
     char buf[ECHO_QUEUE_CAPACITY];
 };
 
-// This previously was a LWIP_MEMPOOL, but turns out that doesn't support sizes
-// greater than ~65536 (due to integer overflow somewhere).
-#define MAX_CONCURRENT 4
-static struct echo_state tcp_state_pool[MAX_CONCURRENT];
-
+// Allocated from the lwIP heap, which is backed by the slab allocator in lwip.c
 static struct echo_state *tcp_state_alloc()
 {
-    for (int i = 0; i < MAX_CONCURRENT; ++i) {
-        if (!tcp_state_pool[i].in_use) {
-            tcp_state_pool[i].in_use = true;
-            return &tcp_state_pool[i];
-        }
-    }
-    return NULL;
+    return mem_malloc(sizeof(struct echo_state));
 }
 
 static void tcp_state_free(struct echo_state *state)
 {
     assert(state);
-    assert(state->in_use);
-    state->in_use = false;
+    mem_free(state);
 }
 
 static size_t queue_space(struct echo_state *state)
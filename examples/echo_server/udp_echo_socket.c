@@ -4,6 +4,7 @@
  */
 
 #include <microkit.h>
+#include <string.h>
 
 #include "lwip/ip.h"
 #include "lwip/pbuf.h"
@@ -26,6 +27,14 @@ static void lwip_udp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *
     pbuf_free(p);
 }
 
+/* Echo handler for datagrams taking the UDP fast path, bypassing lwIP */
+uint16_t udp_echo_fastpath(void *arg, const udpfast_pkt_t *pkt, uint8_t *reply, uint16_t reply_size)
+{
+    uint16_t len = MIN(pkt->len, reply_size);
+    memcpy(reply, pkt->payload, len);
+    return len;
+}
+
 int setup_udp_socket(void)
 {
     udp_socket = udp_new_ip_type(IPADDR_TYPE_V4);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <sddf/blk/queue.h>
+#include <sddf/blk/sched.h>
 #include <sddf/blk/storage_info.h>
 #include <sddf/util/string.h>
 
@@ -26,6 +27,9 @@
 /* Mapping from client index to disk partition that the client will have access to. */
 static const int blk_partition_mapping[BLK_NUM_CLIENTS] = { 2 };
 
+/* Policy used by the virtualiser to schedule requests of the clients, see sddf/blk/sched.h */
+#define BLK_VIRT_SCHED                          BLK_SCHED_RR
+
 static inline blk_storage_info_t *blk_virt_cli_storage_info(blk_storage_info_t *info, unsigned int id)
 {
     switch (id) {
@@ -96,3 +100,13 @@ static inline uint32_t blk_cli_queue_size(char *pd_name)
         return 0;
     }
 }
+
+static inline blk_qos_t blk_virt_cli_qos(unsigned int id)
+{
+    switch (id) {
+    case 0:
+        return (blk_qos_t) { .weight = 1 };
+    default:
+        return (blk_qos_t) { 0 };
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2024, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Statistics of the block cache component (blk/components/cache.c). They are
+ * kept in the region the cache's blk_cache_stats is mapped to, if any, so that
+ * they can be read by other protection domains.
+ */
+typedef struct blk_cache_stats {
+    /* blocks read by the client that were found in the cache */
+    uint64_t read_hits;
+    /* blocks read by the client that were not yet in the cache */
+    uint64_t read_misses;
+    /* blocks read ahead of sequential reads by the client */
+    uint64_t readahead;
+    /* blocks read ahead that were then read by the client */
+    uint64_t readahead_hits;
+    /* blocks written by the client, which are always written to the cache */
+    uint64_t writes;
+    /* dirty blocks written back to the device */
+    uint64_t writebacks;
+    /* blocks evicted from the cache to make space for others */
+    uint64_t evictions;
+    /* flush and barrier requests from the client */
+    uint64_t flushes;
+    /* reads from or writebacks to the device that failed */
+    uint64_t errors;
+} blk_cache_stats_t;
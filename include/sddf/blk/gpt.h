@@ -0,0 +1,74 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * GUID Partition Table.
+ *
+ * https://en.wikipedia.org/wiki/GUID_Partition_Table
+ *
+ * A GPT disk starts with a protective MBR holding a single partition of type
+ * GPT_PROTECTIVE_MBR_TYPE, followed by the GPT header in logical block 1.
+ * All fields are little endian.
+*/
+
+#define GPT_PROTECTIVE_MBR_TYPE 0xEE
+/* "EFI PART" */
+#define GPT_SIGNATURE 0x5452415020494645ULL
+#define GPT_HEADER_LBA 1
+#define GPT_HEADER_MIN_SIZE 92
+
+struct gpt_header {
+    uint64_t signature;
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t header_crc32;
+    uint32_t reserved;
+    uint64_t current_lba;
+    uint64_t backup_lba;
+    uint64_t first_usable_lba;
+    uint64_t last_usable_lba;
+    uint8_t disk_guid[16];
+    uint64_t partition_entry_lba;
+    uint32_t num_partition_entries;
+    uint32_t partition_entry_size;
+    uint32_t partition_entries_crc32;
+} __attribute__((packed));
+
+struct gpt_partition_entry {
+    /* all zero for unused entries */
+    uint8_t type_guid[16];
+    uint8_t unique_guid[16];
+    uint64_t first_lba;
+    /* inclusive */
+    uint64_t last_lba;
+    uint64_t attributes;
+    uint16_t name[36];
+} __attribute__((packed));
+
+/**
+ * Compute the CRC32 used by GPT to check the header and partition entries.
+ *
+ * @param data start of the data.
+ * @param len length of the data in bytes.
+ *
+ * @return CRC32 of the data.
+ */
+static inline uint32_t gpt_crc32(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
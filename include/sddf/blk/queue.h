@@ -20,6 +20,13 @@ typedef enum blk_req_code {
     BLK_REQ_WRITE,
     BLK_REQ_FLUSH,
     BLK_REQ_BARRIER,
+    /* the device may forget the contents of the blocks, no buffer is given */
+    BLK_REQ_DISCARD,
+    /* the blocks read as zeroes afterwards, no buffer is given */
+    BLK_REQ_WRITE_ZEROES,
+    /* read/write with io_or_offset referring to a blk_seg_list_t rather than a buffer */
+    BLK_REQ_READV,
+    BLK_REQ_WRITEV,
 } blk_req_code_t;
 
 /* Response status for block */
@@ -45,6 +52,25 @@ typedef struct blk_req {
     uint32_t id; /* stores request ID */
 } blk_req_t;
 
+/* Maximum number of segments of a BLK_REQ_READV or BLK_REQ_WRITEV request */
+#define BLK_MAX_SEGMENTS 16
+
+/* Buffer of one segment of a vectored request */
+typedef struct blk_seg {
+    uint64_t io_or_offset; /* offset of buffer within buffer memory region or io address of buffer */
+    uint16_t count; /* number of blocks to read/write into/from the buffer */
+} blk_seg_t;
+
+/*
+ * Segment list of a vectored request, kept in the buffer memory region and aligned to 8 bytes.
+ * The blocks of the request are transferred to/from the buffers of the segments in order, so
+ * the count of the request must be the total count of its segments.
+ */
+typedef struct blk_seg_list {
+    uint16_t num_segs; /* number of segments in use */
+    blk_seg_t segs[BLK_MAX_SEGMENTS];
+} blk_seg_list_t;
+
 /* Response struct contained in response queue */
 typedef struct blk_resp {
     blk_resp_status_t status; /* response status */
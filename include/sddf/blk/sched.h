@@ -0,0 +1,39 @@
+/*
+ * Copyright 2024, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Policies the block virtualiser can use to decide which client's request is given
+ * to the driver next, selected with BLK_VIRT_SCHED in the block config.
+ */
+
+/* Clients take turns, one driver request each */
+#define BLK_SCHED_RR 0
+/* Clients get a share of the transferred blocks proportional to their weight */
+#define BLK_SCHED_WFQ 1
+/* The client whose oldest waiting request is closest to its deadline goes first */
+#define BLK_SCHED_DEADLINE 2
+
+/*
+ * Quality of service of a client of the block virtualiser, given by
+ * blk_virt_cli_qos() in the block config. A limit of 0 means no limit.
+ */
+typedef struct blk_qos {
+    /* share of the device under BLK_SCHED_WFQ, treated as 1 if 0 */
+    uint32_t weight;
+    /* maximum number of requests given to the driver and not yet completed */
+    uint32_t max_inflight;
+    /* maximum requests per second */
+    uint32_t iops;
+    /* maximum bytes per second */
+    uint64_t bandwidth;
+    /* target latency in nanoseconds under BLK_SCHED_DEADLINE, clients with 0 are served
+     * only when no client with a deadline is waiting */
+    uint64_t deadline;
+} blk_qos_t;
@@ -25,6 +25,13 @@ typedef struct blk_storage_info {
     /* optimal block size, specified in BLK_TRANSFER_SIZE sized units */
     uint16_t block_size;
     uint16_t queue_depth;
+    /* maximum number of blocks in a BLK_REQ_DISCARD or BLK_REQ_WRITE_ZEROES request,
+     * 0 if the device does not support the request */
+    uint16_t max_discard;
+    uint16_t max_write_zeroes;
+    /* maximum number of segments of a BLK_REQ_READV or BLK_REQ_WRITEV request,
+     * 0 if the device does not support vectored requests */
+    uint16_t max_segments;
     /* geometry to guide FS layout */
     uint16_t cylinders, heads, blocks;
     /* total capacity of the device, specified in BLK_TRANSFER_SIZE sized units. */
@@ -5,14 +5,219 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <microkit.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/util.h>
 
-bool arp_register_ipv4(microkit_channel arp_ch, uint32_t ipv4_addr, uint8_t mac[6])
+/**
+ * This file provides the interface to the ARP component (network/components/arp.c), which
+ * answers ARP requests and IPv6 Neighbor Solicitations on behalf of the clients that register
+ * their addresses with it.
+ *
+ * The registered IPv4 and IPv6 addresses of every client are kept in a single open addressed
+ * hash table, in the address table region of ARP_TABLE_REGION_SIZE bytes. The region is
+ * written by the ARP component, where it is mapped as arp_table. In systems that define
+ * NET_ARP_CLIENT it is also mapped read-only into the RX virtualiser, which only delivers
+ * the Neighbor Solicitations for registered addresses to the ARP component. A solicitation
+ * read while the table is being changed may go to the wrong place, which costs the sender
+ * a retransmission.
+ */
+
+/* The address table holds up to half of ARP_TABLE_SIZE addresses, to keep probe sequences short */
+#ifndef ARP_TABLE_BITS
+#define ARP_TABLE_BITS 7
+#endif
+#define ARP_TABLE_SIZE (1 << ARP_TABLE_BITS)
+#define ARP_MAX_ADDRS (ARP_TABLE_SIZE / 2)
+
+#define ARP_TABLE_REGION_SIZE 0x1000
+
+/* PPC labels of requests to the ARP component */
+#define ARP_ADD_IPV4 0
+#define ARP_ADD_IPV6 1
+#define ARP_REMOVE_IPV4 2
+#define ARP_REMOVE_IPV6 3
+
+/* PPC labels of replies from the ARP component */
+#define ARP_OK 0
+#define ARP_ERR_INVALID 1 /* unknown request or unusable address */
+#define ARP_ERR_FULL 2 /* ARP_MAX_ADDRS addresses are registered already */
+#define ARP_ERR_IN_USE 3 /* address is registered by another client */
+#define ARP_ERR_NOT_FOUND 4 /* address is not registered by the client */
+
+#define ARP_ENTRY_EMPTY 0
+#define ARP_ENTRY_IPV4 1
+#define ARP_ENTRY_IPV6 2
+
+/* Registered address, placed by a hash of the address */
+typedef struct arp_entry {
+    union {
+        uint32_t ipv4_addr; /* in network byte order */
+        uint8_t ipv6_addr[IPV6_ADDR_LEN];
+    };
+    uint8_t mac_addr[ETH_HWADDR_LEN];
+    uint8_t type; /* ARP_ENTRY_*, written last when an address is inserted */
+    uint8_t client;
+    bool announce; /* a gratuitous ARP is due for this address */
+} arp_entry_t;
+
+_Static_assert(sizeof(arp_entry_t) * ARP_TABLE_SIZE <= ARP_TABLE_REGION_SIZE,
+               "The address table must fit in its region");
+
+#define ICMPV6_TYPE_NEIGHBOR_SOLICITATION 135
+#define ICMPV6_TYPE_NEIGHBOR_ADVERTISEMENT 136
+#define NDP_HOP_LIMIT 255
+
+struct __attribute__((__packed__)) ndp_option_ll_addr {
+    uint8_t type;
+    uint8_t len;
+    uint8_t addr[ETH_HWADDR_LEN];
+};
+
+/* Neighbor Solicitation and Advertisement share the same layout (RFC 4861, sections 4.3 and 4.4) */
+struct __attribute__((__packed__)) ndp_packet {
+    struct ethernet_header eth;
+    struct ipv6_header ip;
+    uint8_t icmp_type;
+    uint8_t icmp_code;
+    uint16_t icmp_chksum;
+    uint32_t flags;
+    uint8_t target[IPV6_ADDR_LEN];
+    struct ndp_option_ll_addr options[];
+};
+
+static inline uint32_t arp_hash_ipv4(uint32_t addr)
+{
+    /* Fibonacci hashing, the top bits of the product depend on all bits of the address */
+    return (addr * 2654435761U) >> (32 - ARP_TABLE_BITS);
+}
+
+static inline uint32_t arp_hash_ipv6(const uint8_t addr[IPV6_ADDR_LEN])
+{
+    uint32_t words[IPV6_ADDR_LEN / sizeof(uint32_t)];
+    __builtin_memcpy(words, addr, IPV6_ADDR_LEN);
+    return arp_hash_ipv4(words[0] ^ words[1] ^ words[2] ^ words[3]);
+}
+
+static inline uint32_t arp_entry_hash(const arp_entry_t *entry)
+{
+    return entry->type == ARP_ENTRY_IPV4 ? arp_hash_ipv4(entry->ipv4_addr) : arp_hash_ipv6(entry->ipv6_addr);
+}
+
+/**
+ * Find the slot for an address in the address table.
+ *
+ * @param table address table.
+ * @param type ARP_ENTRY_IPV4 or ARP_ENTRY_IPV6.
+ * @param addr IPv4 address in network byte order, or IPv6 address.
+ *
+ * @return the entry holding the address if it is registered, otherwise the empty slot it would be inserted into.
+ */
+static inline arp_entry_t *arp_table_slot(arp_entry_t *table, uint8_t type, const void *addr)
+{
+    uint32_t len = (type == ARP_ENTRY_IPV4) ? sizeof(uint32_t) : IPV6_ADDR_LEN;
+    uint32_t i;
+    if (type == ARP_ENTRY_IPV4) {
+        uint32_t ipv4_addr;
+        __builtin_memcpy(&ipv4_addr, addr, sizeof(ipv4_addr));
+        i = arp_hash_ipv4(ipv4_addr);
+    } else {
+        i = arp_hash_ipv6(addr);
+    }
+
+    /* The table is never more than half full, so this always finds the address or an empty slot */
+    while (table[i].type != ARP_ENTRY_EMPTY
+           && (table[i].type != type || __builtin_memcmp(table[i].ipv6_addr, addr, len))) {
+        i = (i + 1) & (ARP_TABLE_SIZE - 1);
+    }
+    return &table[i];
+}
+
+/**
+ * Check whether a frame is an ICMPv6 Neighbor Solicitation.
+ *
+ * @param frame start of the frame.
+ * @param len length of the frame.
+ *
+ * @return true if the frame is a Neighbor Solicitation, so its target can be read.
+ */
+static inline bool arp_is_ndp_solicitation(const void *frame, uint32_t len)
+{
+    const struct ndp_packet *pkt = frame;
+    /* Neighbor Solicitations must not have been forwarded by a router */
+    return len >= sizeof(struct ndp_packet) && pkt->eth.type == HTONS(ETH_TYPE_IPV6)
+           && pkt->ip.next_header == IPV6_NEXT_HEADER_ICMPV6 && pkt->ip.hop_limit == NDP_HOP_LIMIT
+           && pkt->icmp_type == ICMPV6_TYPE_NEIGHBOR_SOLICITATION && pkt->icmp_code == 0;
+}
+
+static inline void arp_set_ipv6_mrs(const uint8_t ipv6_addr[IPV6_ADDR_LEN])
+{
+    for (int i = 0; i < IPV6_ADDR_LEN / sizeof(uint32_t); i++) {
+        uint32_t word;
+        __builtin_memcpy(&word, &ipv6_addr[i * sizeof(uint32_t)], sizeof(word));
+        microkit_mr_set(i, word);
+    }
+}
+
+/**
+ * Register an IPv4 address of the calling client with the ARP component. A client may register
+ * several, up to ARP_MAX_ADDRS for all clients together. Registering an address again updates its MAC address.
+ *
+ * @param arp_ch channel of the ARP component.
+ * @param ipv4_addr address to register, in network byte order.
+ * @param mac MAC address to answer with.
+ *
+ * @return ARP_OK if the address is registered, otherwise an ARP_ERR_* code.
+ */
+static inline int arp_register_ipv4(microkit_channel arp_ch, uint32_t ipv4_addr, const uint8_t mac[ETH_HWADDR_LEN])
 {
     microkit_mr_set(0, ipv4_addr);
     microkit_mr_set(1, (mac[0] << 8) | mac[1]);
-    microkit_mr_set(2, (mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5]);
-    microkit_ppcall(arp_ch, microkit_msginfo_new(0, 3));
+    microkit_mr_set(2, ((uint32_t)mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5]);
+    return microkit_msginfo_get_label(microkit_ppcall(arp_ch, microkit_msginfo_new(ARP_ADD_IPV4, 3)));
+}
 
-    return true;
+/**
+ * Register an IPv6 address of the calling client with the ARP component. It is answered for
+ * with the MAC address of the client.
+ *
+ * @param arp_ch channel of the ARP component.
+ * @param ipv6_addr address to register.
+ *
+ * @return ARP_OK if the address is registered, otherwise an ARP_ERR_* code.
+ */
+static inline int arp_register_ipv6(microkit_channel arp_ch, const uint8_t ipv6_addr[IPV6_ADDR_LEN])
+{
+    arp_set_ipv6_mrs(ipv6_addr);
+    return microkit_msginfo_get_label(microkit_ppcall(arp_ch, microkit_msginfo_new(ARP_ADD_IPV6, 4)));
+}
+
+/**
+ * Remove an IPv4 address the calling client registered with the ARP component.
+ *
+ * @param arp_ch channel of the ARP component.
+ * @param ipv4_addr address to remove, in network byte order.
+ *
+ * @return ARP_OK if the address was removed, otherwise an ARP_ERR_* code.
+ */
+static inline int arp_deregister_ipv4(microkit_channel arp_ch, uint32_t ipv4_addr)
+{
+    microkit_mr_set(0, ipv4_addr);
+    return microkit_msginfo_get_label(microkit_ppcall(arp_ch, microkit_msginfo_new(ARP_REMOVE_IPV4, 1)));
+}
+
+/**
+ * Remove an IPv6 address the calling client registered with the ARP component.
+ *
+ * @param arp_ch channel of the ARP component.
+ * @param ipv6_addr address to remove.
+ *
+ * @return ARP_OK if the address was removed, otherwise an ARP_ERR_* code.
+ */
+static inline int arp_deregister_ipv6(microkit_channel arp_ch, const uint8_t ipv6_addr[IPV6_ADDR_LEN])
+{
+    arp_set_ipv6_mrs(ipv6_addr);
+    return microkit_msginfo_get_label(microkit_ppcall(arp_ch, microkit_msginfo_new(ARP_REMOVE_IPV6, 4)));
 }
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/queue.h>
+#include <sddf/util/util.h>
+
+/**
+ * This file provides the interface between the RX and TX virtualisers and the packet
+ * capture component (network/components/capture.c), used when a system defines
+ * NET_CAPTURE in its ethernet config.
+ *
+ * Packets are mirrored by enqueueing their buffer into the active queue of a capture
+ * queue pair and taking a reference to it, so that the buffer is only handed back once
+ * both its normal consumer and the capture component have returned it. Nothing is
+ * copied on the data path. If the capture queue is full the packet is simply not
+ * captured, so capture never holds up traffic.
+ *
+ * Which packets are mirrored is decided by the capture rules in the capture control
+ * region, which is written by the capture component and read by the virtualisers.
+ */
+
+#define NET_CAPTURE_DIR_RX BIT(0)
+#define NET_CAPTURE_DIR_TX BIT(1)
+
+#ifndef NET_CAPTURE_MAX_RULES
+#define NET_CAPTURE_MAX_RULES 8
+#endif
+
+#ifndef NET_CAPTURE_QUEUE_CAPACITY
+#define NET_CAPTURE_QUEUE_CAPACITY 512
+#endif
+
+#define ETH_TYPE_VLAN 0x8100U
+
+/* A packet matches a rule if it matches every field of the rule that is not 0 */
+typedef struct net_capture_rule {
+    /* directions to capture, see NET_CAPTURE_DIR_* */
+    uint8_t dir;
+    /* IPv4 protocol or IPv6 next header */
+    uint8_t ip_proto;
+    /* ethertype, after any VLAN tag */
+    uint16_t ethertype;
+    /* TCP or UDP source or destination port */
+    uint16_t port;
+} net_capture_rule_t;
+
+typedef struct net_capture_ctrl {
+    /* packets are only mirrored while set, with release/acquire ordering against the rules */
+    uint32_t enabled;
+    /* number of rules, every packet matches if there are none */
+    uint32_t num_rules;
+    net_capture_rule_t rules[NET_CAPTURE_MAX_RULES];
+    /* packets not mirrored by the RX virtualiser as its capture queue was full */
+    uint64_t rx_dropped;
+    /* packets not mirrored by the TX virtualiser as its capture queue was full */
+    uint64_t tx_dropped;
+} net_capture_ctrl_t;
+
+/**
+ * Check whether a packet matches a capture rule.
+ *
+ * @param rule rule to check.
+ * @param dir direction of the packet, NET_CAPTURE_DIR_RX or NET_CAPTURE_DIR_TX.
+ * @param frame start of the Ethernet frame.
+ * @param len length of the frame.
+ *
+ * @return true if the packet matches.
+ */
+static inline bool net_capture_rule_match(const net_capture_rule_t *rule, uint8_t dir, const uint8_t *frame,
+                                          uint16_t len)
+{
+    if (rule->dir && !(rule->dir & dir)) {
+        return false;
+    }
+
+    uint32_t off = sizeof(struct ethernet_header);
+    if (len < off) {
+        return false;
+    }
+    uint16_t ethertype = (frame[off - 2] << 8) | frame[off - 1];
+    if (ethertype == ETH_TYPE_VLAN && len >= off + 4) {
+        off += 4;
+        ethertype = (frame[off - 2] << 8) | frame[off - 1];
+    }
+    if (rule->ethertype && rule->ethertype != ethertype) {
+        return false;
+    }
+    if (!rule->ip_proto && !rule->port) {
+        return true;
+    }
+
+    uint8_t proto;
+    if (ethertype == ETH_TYPE_IP && len >= off + sizeof(struct ipv4_header)) {
+        const struct ipv4_header *ip = (const struct ipv4_header *)(frame + off);
+        const uint8_t *frag = (const uint8_t *)&ip->frag;
+        proto = ip->proto;
+        /* Only the first fragment carries the ports */
+        if ((((frag[0] << 8) | frag[1]) & 0x1fffU) && rule->port) {
+            return false;
+        }
+        off += (ip->version_ihl & 0xf) * 4;
+    } else if (ethertype == ETH_TYPE_IPV6 && len >= off + sizeof(struct ipv6_header)) {
+        proto = ((const struct ipv6_header *)(frame + off))->next_header;
+        off += sizeof(struct ipv6_header);
+    } else {
+        return false;
+    }
+    if (rule->ip_proto && rule->ip_proto != proto) {
+        return false;
+    }
+    if (!rule->port) {
+        return true;
+    }
+
+    if ((proto != IPV4_PROTO_TCP && proto != IPV4_PROTO_UDP) || len < off + 4) {
+        return false;
+    }
+    uint16_t src = (frame[off] << 8) | frame[off + 1];
+    uint16_t dest = (frame[off + 2] << 8) | frame[off + 3];
+    return rule->port == src || rule->port == dest;
+}
+
+/**
+ * Check whether a packet is to be captured.
+ *
+ * @param ctrl capture control region.
+ * @param dir direction of the packet, NET_CAPTURE_DIR_RX or NET_CAPTURE_DIR_TX.
+ * @param frame start of the Ethernet frame.
+ * @param len length of the frame.
+ *
+ * @return true if capture is enabled and the packet matches any of the rules.
+ */
+static inline bool net_capture_match(net_capture_ctrl_t *ctrl, uint8_t dir, const uint8_t *frame, uint16_t len)
+{
+    if (!__atomic_load_n(&ctrl->enabled, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    uint32_t num_rules = MIN(ctrl->num_rules, NET_CAPTURE_MAX_RULES);
+    if (num_rules == 0) {
+        return true;
+    }
+    for (uint32_t i = 0; i < num_rules; i++) {
+        if (net_capture_rule_match(&ctrl->rules[i], dir, frame, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Mirror a packet to the capture component if it is to be captured. The caller must take
+ * an extra reference to the buffer if it was mirrored, and release it once the capture
+ * component returns the buffer in the free queue of the capture queue pair.
+ *
+ * @param queue capture queue pair.
+ * @param ctrl capture control region.
+ * @param dir direction of the packet, NET_CAPTURE_DIR_RX or NET_CAPTURE_DIR_TX.
+ * @param buffer buffer descriptor to give to the capture component.
+ * @param frame start of the Ethernet frame.
+ * @param dropped counter of packets that could not be mirrored.
+ *
+ * @return true if the packet was mirrored.
+ */
+static inline bool net_capture_mirror(net_queue_handle_t *queue, net_capture_ctrl_t *ctrl, uint8_t dir,
+                                      net_buff_desc_t buffer, const uint8_t *frame, uint64_t *dropped)
+{
+    if (!net_capture_match(ctrl, dir, frame, buffer.len)) {
+        return false;
+    }
+    if (net_enqueue_active(queue, buffer)) {
+        (*dropped)++;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Compute the 16-bit one's complement sum of a buffer as described in RFC 1071.
+ *
+ * The result is *not* inverted, and is returned in the same byte order as the
+ * data in memory, which makes it a drop-in replacement for lwIP's LWIP_CHKSUM.
+ * The buffer may start at any byte address.
+ *
+ * Depending on the target, this will use AArch64 NEON, x86-64 AVX2/SSE2 or a
+ * portable 64-bit word implementation.
+ *
+ * @param data start of the buffer to be summed.
+ * @param len number of bytes to be summed, at most 65535.
+ *
+ * @return non-inverted Internet checksum of the buffer.
+ */
+uint16_t net_chksum(const void *data, int len);
+
+/**
+ * Fold a 32-bit partial one's complement sum down to 16 bits.
+ *
+ * @param sum partial sum to fold.
+ *
+ * @return folded 16-bit sum.
+ */
+static inline uint16_t net_chksum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
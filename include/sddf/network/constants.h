@@ -10,6 +10,7 @@
 
 #define ETH_TYPE_ARP 0x0806U
 #define ETH_TYPE_IP 0x0800U
+#define ETH_TYPE_IPV6 0x86DDU
 #define ETH_HWADDR_LEN 6
 #define ETHARP_OPCODE_REQUEST 1
 #define ETHARP_OPCODE_REPLY 2
@@ -26,6 +27,46 @@ struct ethernet_header {
   uint16_t type;
 } __attribute__((packed));
 
+#define IPV4_PROTO_ICMP 1U
+#define IPV4_PROTO_TCP 6U
+#define IPV4_PROTO_UDP 17U
+#define IPV4_VERSION_IHL_NO_OPTIONS 0x45U
+#define IPV4_FRAG_MF_OFFSET_MASK 0x3fffU
+
+struct ipv4_header {
+  uint8_t version_ihl;
+  uint8_t tos;
+  uint16_t len;
+  uint16_t id;
+  uint16_t frag;
+  uint8_t ttl;
+  uint8_t proto;
+  uint16_t chksum;
+  uint32_t src;
+  uint32_t dest;
+} __attribute__((packed));
+
+#define IPV6_ADDR_LEN 16
+#define IPV6_NEXT_HEADER_TCP 6U
+#define IPV6_NEXT_HEADER_UDP 17U
+#define IPV6_NEXT_HEADER_ICMPV6 58U
+
+struct ipv6_header {
+  uint32_t version_class_flow;
+  uint16_t payload_len;
+  uint8_t next_header;
+  uint8_t hop_limit;
+  uint8_t src[IPV6_ADDR_LEN];
+  uint8_t dest[IPV6_ADDR_LEN];
+} __attribute__((packed));
+
+struct udp_header {
+  uint16_t src;
+  uint16_t dest;
+  uint16_t len;
+  uint16_t chksum;
+} __attribute__((packed));
+
 /*
  * By default we assume that the hardware we are dealing with
  * cannot generate checksums on transmit. We use this macro
@@ -34,3 +75,14 @@ struct ethernet_header {
 #if defined(CONFIG_PLAT_IMX8MM_EVK) || defined(CONFIG_PLAT_MAAXBOARD) || defined(CONFIG_PLAT_IMX8MP_EVK)
 #define NETWORK_HW_HAS_CHECKSUM
 #endif
+
+/*
+ * Some hardware (such as virtIO network devices) can only complete a single
+ * partial checksum per packet from offsets given by the driver, and cannot
+ * generate the IPv4 header checksum. Clients of such hardware must prepare each
+ * packet with net_chksum_offload before transmitting it.
+ */
+#if defined(CONFIG_PLAT_QEMU_ARM_VIRT)
+#define NETWORK_HW_HAS_CHECKSUM
+#define NETWORK_HW_HAS_PARTIAL_CHECKSUM
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <sddf/network/queue.h>
+
+/**
+ * Prepare a frame for transmission on hardware that can only complete a partial
+ * checksum per packet (see NETWORK_HW_HAS_PARTIAL_CHECKSUM).
+ *
+ * The IPv4 header checksum is computed in software. For TCP, UDP, ICMP and
+ * ICMPv6 packets, the checksum field is seeded with the pseudo header sum and
+ * the buffer is marked with NET_BUFF_F_CSUM_PARTIAL, csum_start and csum_offset
+ * so that the device can complete the checksum. Fragments and packets with IPv6
+ * extension headers are left without an offloaded transport checksum.
+ *
+ * The segmentation offload flags and mss of the buffer are left untouched.
+ *
+ * @param frame start of the frame.
+ * @param buffer buffer holding the frame, with len set to the length of the frame.
+ */
+void net_chksum_offload(void *frame, net_buff_desc_t *buffer);
@@ -13,11 +13,29 @@
 #include <sddf/util/fence.h>
 #include <sddf/util/util.h>
 
+/* Checksum of the packet must be computed from csum_start to the end of the packet and stored at
+ * csum_start + csum_offset (TX). On RX, the checksum field only holds the pseudo header sum. */
+#define NET_BUFF_F_CSUM_PARTIAL BIT(0)
+/* Checksums of the packet have been validated by the device (RX) */
+#define NET_BUFF_F_CSUM_VALID BIT(1)
+/* TCP over IPv4 packet to be segmented by the device into segments of mss bytes of payload (TX) */
+#define NET_BUFF_F_TSO4 BIT(2)
+/* TCP over IPv6 packet to be segmented by the device into segments of mss bytes of payload (TX) */
+#define NET_BUFF_F_TSO6 BIT(3)
+
 typedef struct net_buff_desc {
     /* offset of buffer within buffer memory region or io address of buffer */
     uint64_t io_or_offset;
     /* length of data inside buffer */
     uint16_t len;
+    /* offload flags, see NET_BUFF_F_* */
+    uint8_t flags;
+    /* offset of the checksum field from csum_start */
+    uint8_t csum_offset;
+    /* offset of the start of checksumming from the start of the packet */
+    uint16_t csum_start;
+    /* maximum segment size for segmentation offload */
+    uint16_t mss;
 } net_buff_desc_t;
 
 typedef struct net_queue {
@@ -146,6 +164,34 @@ static inline int net_enqueue_active(net_queue_handle_t *queue, net_buff_desc_t
     return 0;
 }
 
+/**
+ * Enqueue a batch of elements into an active queue. The consumer sees either none or all of
+ * the elements, and the queue index is only updated once.
+ *
+ * @param queue queue to enqueue into.
+ * @param buffers buffer descriptors for buffers to be enqueued.
+ * @param count number of buffers to be enqueued.
+ *
+ * @return -1 when queue does not have space for all buffers, 0 on success.
+ */
+static inline int net_enqueue_active_batch(net_queue_handle_t *queue, const net_buff_desc_t *buffers, uint32_t count)
+{
+    if (queue->capacity - net_queue_length(queue->active) < count) {
+        return -1;
+    }
+
+    uint16_t tail = queue->active->tail;
+    for (uint32_t i = 0; i < count; i++) {
+        queue->active->buffers[(uint16_t)(tail + i) % queue->capacity] = buffers[i];
+    }
+#ifdef CONFIG_ENABLE_SMP_SUPPORT
+    THREAD_MEMORY_RELEASE();
+#endif
+    queue->active->tail = tail + count;
+
+    return 0;
+}
+
 /**
  * Dequeue an element from the free queue.
  *
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/queue.h>
+
+/**
+ * This file provides a UDP fast path for network clients. Received frames are parsed in
+ * place in the RX buffer, and frames addressed to the bound IPv4 address and UDP port are
+ * handed straight to a callback, bypassing the IP stack. The callback writes its reply
+ * payload directly into a TX buffer, behind headers copied from a precomputed template.
+ * Only the per-packet fields of the headers are filled in, and the IPv4 and UDP checksums
+ * are computed incrementally from sums of the constant template fields.
+ *
+ * Anything the fast path does not handle (other protocols, IP options, fragments, or no
+ * free TX buffer to reply with) is left for the client's IP stack.
+ *
+ * Received checksums are not verified, as with the IP stack configuration of the clients,
+ * checksum checking on RX is left to hardware.
+ */
+
+#define UDPFAST_HDR_LEN (sizeof(struct ethernet_header) + sizeof(struct ipv4_header) + sizeof(struct udp_header))
+#define UDPFAST_MTU 1500
+#define UDPFAST_MAX_PAYLOAD (UDPFAST_MTU - sizeof(struct ipv4_header) - sizeof(struct udp_header))
+#define UDPFAST_TTL 64
+
+/* Headers of a UDP over IPv4 over Ethernet frame without IP options */
+struct udpfast_header {
+    struct ethernet_header eth;
+    struct ipv4_header ip;
+    struct udp_header udp;
+} __attribute__((packed));
+
+/* Received datagram. Addresses and ports are in network byte order. */
+typedef struct udpfast_pkt {
+    struct ethernet_address src_mac;
+    uint32_t src_ip;
+    uint16_t src_port;
+    const uint8_t *payload; /* payload in the RX buffer */
+    uint16_t len; /* number of bytes of payload */
+} udpfast_pkt_t;
+
+/**
+ * Handle a datagram received on the fast path.
+ *
+ * @param arg argument given to udpfast_init.
+ * @param pkt received datagram, only valid for the duration of the call.
+ * @param reply buffer for the reply payload.
+ * @param reply_size number of bytes available in reply.
+ *
+ * @return number of bytes of reply payload written, 0 to not reply.
+ */
+typedef uint16_t (*udpfast_handler_t)(void *arg, const udpfast_pkt_t *pkt, uint8_t *reply, uint16_t reply_size);
+
+typedef enum udpfast_result {
+    UDPFAST_PASS, /* frame is not for the fast path and should be given to the IP stack */
+    UDPFAST_CONSUMED, /* frame was handled without sending a reply */
+    UDPFAST_REPLIED, /* frame was handled and a reply was enqueued in the TX active queue */
+} udpfast_result_t;
+
+typedef struct udpfast {
+    struct udpfast_header tmpl; /* reply header template */
+    uint32_t ip_chksum_base; /* one's complement sum of the constant IPv4 header fields */
+    uint32_t udp_chksum_base; /* one's complement sum of the constant pseudo header and UDP header fields */
+    uint32_t ip; /* bound IPv4 address in network byte order, 0 if not yet known */
+    uint16_t port; /* bound UDP port in network byte order */
+    uint16_t ip_id; /* IPv4 identification of the next reply */
+    udpfast_handler_t handler;
+    void *arg;
+    net_buff_desc_t tx_buffer; /* TX buffer held for the next reply */
+    bool tx_buffer_held; /* whether tx_buffer holds a buffer */
+    uint64_t rx_count; /* number of datagrams handled */
+    uint64_t tx_count; /* number of replies sent */
+} udpfast_t;
+
+/**
+ * Initialise the UDP fast path. No datagrams are matched until an IPv4 address is set.
+ *
+ * @param udpfast pointer to the udpfast struct.
+ * @param mac MAC address of the client.
+ * @param port UDP port to bind in host byte order.
+ * @param handler callback for received datagrams.
+ * @param arg argument to pass to handler.
+ */
+void udpfast_init(udpfast_t *udpfast, const uint8_t mac[ETH_HWADDR_LEN], uint16_t port, udpfast_handler_t handler,
+                  void *arg);
+
+/**
+ * Set the IPv4 address to match datagrams against and send replies from, and recompute
+ * the header template.
+ *
+ * @param udpfast pointer to the udpfast struct.
+ * @param ip IPv4 address in network byte order, 0 to stop matching datagrams.
+ */
+void udpfast_set_ip(udpfast_t *udpfast, uint32_t ip);
+
+/**
+ * Parse a frame in place and check whether it is addressed to the fast path.
+ *
+ * @param udpfast pointer to the udpfast struct.
+ * @param frame start of the frame.
+ * @param len number of bytes in the frame.
+ * @param pkt output datagram, valid when true is returned.
+ *
+ * @return true if the frame is a datagram for the bound address and port.
+ */
+bool udpfast_parse(udpfast_t *udpfast, const void *frame, uint16_t len, udpfast_pkt_t *pkt);
+
+/**
+ * Handle a received frame on the fast path. If the frame matches, the handler is invoked
+ * with a free TX buffer to write its reply into, and the reply is enqueued in the TX
+ * active queue. If the handler does not reply, the TX buffer is held for the next reply.
+ * The caller remains responsible for the RX buffer and for notifying the TX virtualiser
+ * when UDPFAST_REPLIED is returned.
+ *
+ * @param udpfast pointer to the udpfast struct.
+ * @param frame start of the frame.
+ * @param len number of bytes in the frame.
+ * @param tx_queue queue handle of the client's TX queues.
+ * @param tx_data_region start of the client's TX data region.
+ *
+ * @return result of handling the frame.
+ */
+udpfast_result_t udpfast_input(udpfast_t *udpfast, const void *frame, uint16_t len, net_queue_handle_t *tx_queue,
+                               uintptr_t tx_data_region);
@@ -9,8 +9,11 @@
 
 #if BYTE_ORDER == BIG_ENDIAN
 #define HTONS(x) ((uint16_t)(x))
+#define HTONL(x) ((uint32_t)(x))
 #else
 #define HTONS(x) ((uint16_t)((((x) & (uint16_t)0x00ffU) << 8) | (((x) & (uint16_t)0xff00U) >> 8)))
+#define HTONL(x) ((uint32_t)((((x) & 0x000000ffUL) << 24) | (((x) & 0x0000ff00UL) << 8) | \
+                             (((x) & 0x00ff0000UL) >> 8) | (((x) & 0xff000000UL) >> 24)))
 #endif
 
 static void net_set_mac_addr(uint8_t *mac, uint64_t val)
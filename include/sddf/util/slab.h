@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * This file provides a size-class slab allocator for a client-owned memory region.
+ * The region is split into one slab per size class, where class i holds objects of
+ * SLAB_MIN_OBJ_SIZE << i bytes. Every object is aligned to SLAB_MIN_OBJ_SIZE, so objects
+ * never share a cache line. Allocation rounds the request up to the next class and pops
+ * the class free list, or bumps into memory that has never been handed out. Freeing pushes
+ * the object back onto the free list of the class it came from, which is found by comparing
+ * the object's address against the range of each class in turn. Neither operation depends on
+ * the number of objects, only on the number of classes, which is at most SLAB_MAX_CLASSES.
+ * Since objects only ever go back to their own class, the region cannot fragment.
+ *
+ * If a class is exhausted, the allocation is served from the next larger class with free
+ * objects. Per-class and aggregate high-water marks are kept to help size the classes.
+ */
+
+#define SLAB_MIN_OBJ_SIZE_BITS 6
+#define SLAB_MIN_OBJ_SIZE (1UL << SLAB_MIN_OBJ_SIZE_BITS)
+#define SLAB_MAX_CLASSES 16
+
+/* Size in bytes of objects in size class i */
+#define SLAB_CLASS_OBJ_SIZE(i) (SLAB_MIN_OBJ_SIZE << (i))
+
+typedef struct slab_obj {
+    struct slab_obj *next;
+} slab_obj_t;
+
+/* Data struct holding the objects and statistics of a single size class */
+typedef struct slab_class {
+    uintptr_t start; /* address of the first object in the slab */
+    uintptr_t end; /* address one past the last object in the slab */
+    uintptr_t bump; /* address of the first object that has never been allocated */
+    slab_obj_t *free_list; /* objects that have been freed */
+    uint64_t obj_size; /* number of bytes in an object */
+    uint64_t capacity; /* number of objects in the slab */
+    uint64_t in_use; /* number of objects currently allocated */
+    uint64_t high_water; /* maximum value in_use has reached */
+    uint64_t failed; /* number of requests for this class that could not be served by this class */
+} slab_class_t;
+
+/* Data struct that handles allocation and freeing of variable sized objects in a memory region */
+typedef struct slab {
+    slab_class_t classes[SLAB_MAX_CLASSES];
+    uint32_t num_classes; /* number of size classes in use */
+    uint64_t bytes_in_use; /* number of bytes in allocated objects, in units of object sizes */
+    uint64_t bytes_high_water; /* maximum value bytes_in_use has reached */
+} slab_t;
+
+/**
+ * Initialise a slab allocator over a memory region. Class i holds class_capacities[i]
+ * objects of SLAB_CLASS_OBJ_SIZE(i) bytes. The region is not touched.
+ *
+ * @param slab pointer to the slab struct.
+ * @param region base address of the memory region.
+ * @param region_size number of bytes in the memory region.
+ * @param class_capacities number of objects in each size class.
+ * @param num_classes number of size classes, at most SLAB_MAX_CLASSES.
+ *
+ * @return -1 if the classes do not fit in the region, 0 on success.
+ */
+int slab_init(slab_t *slab, uintptr_t region, uint64_t region_size, const uint64_t *class_capacities,
+              uint32_t num_classes);
+
+/**
+ * Allocate an object of at least size bytes.
+ *
+ * @param slab pointer to the slab struct.
+ * @param size number of bytes requested.
+ *
+ * @return pointer to an object aligned to SLAB_MIN_OBJ_SIZE, NULL if no object is available.
+ */
+void *slab_alloc(slab_t *slab, size_t size);
+
+/**
+ * Allocate a zeroed object for an array of count elements of size bytes each.
+ *
+ * @param slab pointer to the slab struct.
+ * @param count number of elements.
+ * @param size number of bytes in an element.
+ *
+ * @return pointer to an object aligned to SLAB_MIN_OBJ_SIZE, NULL if count * size overflows or
+ *         no object is available.
+ */
+void *slab_calloc(slab_t *slab, size_t count, size_t size);
+
+/**
+ * Free an object previously returned by slab_alloc or slab_calloc.
+ *
+ * @param slab pointer to the slab struct.
+ * @param ptr pointer to the object, may be NULL.
+ */
+void slab_free(slab_t *slab, void *ptr);
+
@@ -3,6 +3,8 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#pragma once
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <sddf/util/printf.h>
@@ -91,6 +93,23 @@ uint32_t virtio_mmio_version(virtio_mmio_regs_t *regs)
     return regs->Version;
 }
 
+uint64_t virtio_mmio_device_features(virtio_mmio_regs_t *regs)
+{
+    regs->DeviceFeaturesSel = 0;
+    uint32_t features_low = regs->DeviceFeatures;
+    regs->DeviceFeaturesSel = 1;
+    uint32_t features_high = regs->DeviceFeatures;
+    return features_low | ((uint64_t)features_high << 32);
+}
+
+void virtio_mmio_set_driver_features(virtio_mmio_regs_t *regs, uint64_t features)
+{
+    regs->DriverFeaturesSel = 0;
+    regs->DriverFeatures = features & 0xFFFFFFFF;
+    regs->DriverFeaturesSel = 1;
+    regs->DriverFeatures = features >> 32;
+}
+
 void virtio_print_reserved_feature_bits(uint64_t feature)
 {
     if (feature & ((uint64_t)1 << VIRTIO_F_INDIRECT_DESC)) {
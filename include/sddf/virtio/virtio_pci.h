@@ -0,0 +1,486 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sddf/util/util.h>
+#include <sddf/virtio/virtio.h>
+
+/*
+ * This file implements the virtIO over PCI modern transport (section 4.1 of the virtIO 1.2
+ * specification). The configuration space of the device function is expected to be mapped
+ * through ECAM. Rather than relying on firmware to have assigned the BARs of the device,
+ * every memory BAR is assigned a naturally aligned slice of a window of physical memory
+ * that is mapped into the driver, so the same driver works whether or not the platform
+ * enumerates PCI before seL4 boots.
+ */
+
+#define PCI_VENDOR_ID_VIRTIO 0x1af4
+/* Modern devices have an ID of 0x1040 plus the virtIO device ID */
+#define VIRTIO_PCI_DEVICE_ID_MODERN_BASE 0x1040
+/* Transitional devices have IDs from 0x1000 that do not match the virtIO device ID */
+#define VIRTIO_PCI_DEVICE_ID_TRANSITIONAL_NET 0x1000
+#define VIRTIO_PCI_DEVICE_ID_TRANSITIONAL_BLK 0x1001
+
+#define PCI_COMMAND_MEMORY (1 << 1)
+#define PCI_COMMAND_MASTER (1 << 2)
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+#define PCI_STATUS_CAP_LIST (1 << 4)
+
+#define PCI_NUM_BARS 6
+#define PCI_BAR_IO (1 << 0)
+#define PCI_BAR_MEM_TYPE_MASK (0x3 << 1)
+#define PCI_BAR_MEM_TYPE_64 (0x2 << 1)
+#define PCI_BAR_MEM_ADDR_MASK (~0xfU)
+
+#define PCI_CAP_ID_VNDR 0x09
+#define PCI_CAP_ID_MSIX 0x11
+
+#define PCI_MSIX_CTRL_TABLE_SIZE_MASK 0x7ff
+#define PCI_MSIX_CTRL_FUNCTION_MASK (1 << 14)
+#define PCI_MSIX_CTRL_ENABLE (1 << 15)
+#define PCI_MSIX_BIR_MASK 0x7
+#define PCI_MSIX_ENTRY_CTRL_MASKED (1 << 0)
+
+/* Types of virtIO PCI capabilities */
+#define VIRTIO_PCI_CAP_COMMON_CFG 1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+#define VIRTIO_PCI_CAP_ISR_CFG 3
+#define VIRTIO_PCI_CAP_DEVICE_CFG 4
+#define VIRTIO_PCI_CAP_PCI_CFG 5
+
+/* MSI-X vector meaning no interrupt should be sent */
+#define VIRTIO_MSI_NO_VECTOR 0xffff
+
+/* Type 0 configuration space header */
+typedef volatile struct {
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t command;
+    uint16_t status;
+    uint8_t revision_id;
+    uint8_t prog_if;
+    uint8_t subclass;
+    uint8_t class_code;
+    uint8_t cache_line_size;
+    uint8_t latency_timer;
+    uint8_t header_type;
+    uint8_t bist;
+    uint32_t bar[PCI_NUM_BARS];
+    uint32_t cardbus_cis;
+    uint16_t subsystem_vendor_id;
+    uint16_t subsystem_id;
+    uint32_t expansion_rom;
+    uint8_t cap_ptr;
+    uint8_t _reserved0[7];
+    uint8_t interrupt_line;
+    uint8_t interrupt_pin;
+    uint8_t min_gnt;
+    uint8_t max_lat;
+} pci_config_header_t;
+
+struct virtio_pci_cap {
+    uint8_t cap_vndr;
+    uint8_t cap_next;
+    uint8_t cap_len;
+    uint8_t cfg_type;
+    uint8_t bar;
+    uint8_t id;
+    uint8_t padding[2];
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct virtio_pci_notify_cap {
+    struct virtio_pci_cap cap;
+    uint32_t notify_off_multiplier;
+};
+
+struct pci_msix_cap {
+    uint8_t cap_id;
+    uint8_t cap_next;
+    uint16_t msg_ctrl;
+    uint32_t table;
+    uint32_t pba;
+};
+
+typedef volatile struct {
+    uint32_t msg_addr_low;
+    uint32_t msg_addr_high;
+    uint32_t msg_data;
+    uint32_t vector_ctrl;
+} pci_msix_entry_t;
+
+/* The 64-bit queue addresses are accessed as two 32-bit halves, which every device must support */
+typedef volatile struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t config_msix_vector;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_low;
+    uint32_t queue_desc_high;
+    uint32_t queue_driver_low;
+    uint32_t queue_driver_high;
+    uint32_t queue_device_low;
+    uint32_t queue_device_high;
+    uint16_t queue_notify_data;
+    uint16_t queue_reset;
+} virtio_pci_common_cfg_t;
+
+typedef struct virtio_pci {
+    volatile pci_config_header_t *config;
+    /* Virtual address each memory BAR was assigned, 0 if the BAR is not implemented */
+    uintptr_t bar_vaddr[PCI_NUM_BARS];
+    volatile virtio_pci_common_cfg_t *common;
+    uintptr_t notify_base;
+    uint32_t notify_off_multiplier;
+    volatile uint8_t *isr;
+    volatile void *device_cfg;
+    /* MSI-X table, NULL if the device does not support MSI-X */
+    pci_msix_entry_t *msix_table;
+    uint16_t msix_table_size;
+    uint8_t msix_cap_off;
+} virtio_pci_t;
+
+/*
+ * MSI-X messages are written to the platform's MSI doorbell, with data identifying the
+ * interrupt to raise. On QEMU's virt machine, the GICv2m frame turns a write of an SPI's
+ * interrupt ID into that SPI, which seL4 delivers like any other. On x86, seL4 delivers
+ * IRQ n on CPU vector n + 0x20 through the local APIC of the boot CPU.
+ */
+#if defined(CONFIG_PLAT_QEMU_ARM_VIRT)
+#define VIRTIO_PCI_MSI_ADDR 0x08020040
+#define VIRTIO_PCI_MSI_DATA(irq) (irq)
+#elif defined(CONFIG_ARCH_X86_64)
+#define VIRTIO_PCI_MSI_ADDR 0xfee00000
+#define VIRTIO_PCI_MSI_DATA(irq) ((irq) + 0x20)
+#endif
+
+/**
+ * Assign every memory BAR of a function a naturally aligned slice of a window of physical
+ * memory. Decoding of memory accesses must be disabled while the BARs are sized.
+ *
+ * @param pci pointer to the virtio_pci struct, with the configuration space set.
+ * @param window_vaddr virtual address of the window.
+ * @param window_paddr physical address of the window, which must be in a range the host
+ *                     bridge forwards to PCI.
+ * @param window_size size of the window in bytes.
+ *
+ * @return false if the BARs do not fit in the window.
+ */
+static inline bool virtio_pci_assign_bars(virtio_pci_t *pci, uintptr_t window_vaddr, uint64_t window_paddr,
+                                          uint64_t window_size)
+{
+    volatile pci_config_header_t *config = pci->config;
+    uint64_t next = 0;
+
+    for (int i = 0; i < PCI_NUM_BARS; i++) {
+        pci->bar_vaddr[i] = 0;
+
+        uint32_t bar = config->bar[i];
+        if (bar & PCI_BAR_IO) {
+            continue;
+        }
+        bool is_64 = (bar & PCI_BAR_MEM_TYPE_MASK) == PCI_BAR_MEM_TYPE_64 && i + 1 < PCI_NUM_BARS;
+
+        /* Writing all ones and reading back gives the size of the BAR */
+        config->bar[i] = 0xffffffff;
+        uint64_t mask = config->bar[i] & PCI_BAR_MEM_ADDR_MASK;
+        if (is_64) {
+            config->bar[i + 1] = 0xffffffff;
+            mask |= (uint64_t)config->bar[i + 1] << 32;
+        } else {
+            mask |= 0xffffffff00000000ULL;
+        }
+
+        if (mask == 0 || mask == 0xffffffff00000000ULL) {
+            /* BAR is not implemented */
+            config->bar[i] = 0;
+            if (is_64) {
+                config->bar[i + 1] = 0;
+                i++;
+            }
+            continue;
+        }
+
+        uint64_t size = ~mask + 1;
+        uint64_t offset = ALIGN(next, size);
+        uint64_t paddr = window_paddr + offset;
+        if (offset + size > window_size || (paddr & (size - 1)) || (!is_64 && (paddr >> 32))) {
+            return false;
+        }
+
+        config->bar[i] = (paddr & 0xffffffff) | (bar & ~PCI_BAR_MEM_ADDR_MASK);
+        if (is_64) {
+            config->bar[i + 1] = paddr >> 32;
+        }
+        pci->bar_vaddr[i] = window_vaddr + offset;
+        next = offset + size;
+
+        if (is_64) {
+            i++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Get the virtual address of a region of a BAR given by a capability.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ * @param bar index of the BAR.
+ * @param offset offset of the region into the BAR.
+ *
+ * @return virtual address of the region, 0 if the BAR was not assigned.
+ */
+static inline uintptr_t virtio_pci_bar_region(virtio_pci_t *pci, uint8_t bar, uint32_t offset)
+{
+    if (bar >= PCI_NUM_BARS || pci->bar_vaddr[bar] == 0) {
+        return 0;
+    }
+    return pci->bar_vaddr[bar] + offset;
+}
+
+/**
+ * Initialise a virtIO PCI device function: assign its BARs, enable memory decoding and bus
+ * mastering, and find the virtIO configuration structures and the MSI-X table through the
+ * capability list.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ * @param config_vaddr virtual address of the configuration space of the function.
+ * @param window_vaddr virtual address of the window the BARs are assigned from.
+ * @param window_paddr physical address of the window the BARs are assigned from.
+ * @param window_size size of the window in bytes.
+ *
+ * @return false if the function is not a modern virtIO device or could not be set up.
+ */
+static inline bool virtio_pci_init(virtio_pci_t *pci, uintptr_t config_vaddr, uintptr_t window_vaddr,
+                                   uint64_t window_paddr, uint64_t window_size)
+{
+    pci->config = (volatile pci_config_header_t *)config_vaddr;
+    pci->common = NULL;
+    pci->notify_base = 0;
+    pci->isr = NULL;
+    pci->device_cfg = NULL;
+    pci->msix_table = NULL;
+    pci->msix_table_size = 0;
+    pci->msix_cap_off = 0;
+
+    volatile pci_config_header_t *config = pci->config;
+    if (config->vendor_id != PCI_VENDOR_ID_VIRTIO || !(config->status & PCI_STATUS_CAP_LIST)) {
+        return false;
+    }
+
+    config->command &= ~(PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    if (!virtio_pci_assign_bars(pci, window_vaddr, window_paddr, window_size)) {
+        return false;
+    }
+    config->command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+
+    uint8_t cap_off = config->cap_ptr & ~0x3;
+    while (cap_off != 0) {
+        volatile struct virtio_pci_cap *cap = (volatile struct virtio_pci_cap *)(config_vaddr + cap_off);
+
+        if (cap->cap_vndr == PCI_CAP_ID_MSIX) {
+            volatile struct pci_msix_cap *msix = (volatile struct pci_msix_cap *)cap;
+            uint32_t table = msix->table;
+            pci->msix_table = (pci_msix_entry_t *)virtio_pci_bar_region(pci, table & PCI_MSIX_BIR_MASK,
+                                                                        table & ~PCI_MSIX_BIR_MASK);
+            pci->msix_table_size = (msix->msg_ctrl & PCI_MSIX_CTRL_TABLE_SIZE_MASK) + 1;
+            pci->msix_cap_off = cap_off;
+        } else if (cap->cap_vndr == PCI_CAP_ID_VNDR) {
+            /* The first capability of each type is the preferred one */
+            uintptr_t region = virtio_pci_bar_region(pci, cap->bar, cap->offset);
+            switch (cap->cfg_type) {
+            case VIRTIO_PCI_CAP_COMMON_CFG:
+                if (pci->common == NULL) {
+                    pci->common = (volatile virtio_pci_common_cfg_t *)region;
+                }
+                break;
+            case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                if (pci->notify_base == 0) {
+                    pci->notify_base = region;
+                    pci->notify_off_multiplier = ((volatile struct virtio_pci_notify_cap *)cap)->notify_off_multiplier;
+                }
+                break;
+            case VIRTIO_PCI_CAP_ISR_CFG:
+                if (pci->isr == NULL) {
+                    pci->isr = (volatile uint8_t *)region;
+                }
+                break;
+            case VIRTIO_PCI_CAP_DEVICE_CFG:
+                if (pci->device_cfg == NULL) {
+                    pci->device_cfg = (volatile void *)region;
+                }
+                break;
+            }
+        }
+
+        cap_off = cap->cap_next & ~0x3;
+    }
+
+    return pci->common != NULL && pci->notify_base != 0 && pci->isr != NULL;
+}
+
+/**
+ * Get the virtIO device ID of a function from its PCI device ID.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ *
+ * @return virtIO device ID, 0 if the PCI device ID is unknown.
+ */
+static inline uint32_t virtio_pci_device_id(virtio_pci_t *pci)
+{
+    uint16_t device_id = pci->config->device_id;
+    if (device_id >= VIRTIO_PCI_DEVICE_ID_MODERN_BASE) {
+        return device_id - VIRTIO_PCI_DEVICE_ID_MODERN_BASE;
+    }
+    switch (device_id) {
+    case VIRTIO_PCI_DEVICE_ID_TRANSITIONAL_NET:
+        return VIRTIO_DEVICE_ID_NET;
+    case VIRTIO_PCI_DEVICE_ID_TRANSITIONAL_BLK:
+        return VIRTIO_DEVICE_ID_BLK;
+    default:
+        return 0;
+    }
+}
+
+static inline uint64_t virtio_pci_device_features(virtio_pci_t *pci)
+{
+    pci->common->device_feature_select = 0;
+    uint32_t features_low = pci->common->device_feature;
+    pci->common->device_feature_select = 1;
+    uint32_t features_high = pci->common->device_feature;
+    return features_low | ((uint64_t)features_high << 32);
+}
+
+static inline void virtio_pci_set_driver_features(virtio_pci_t *pci, uint64_t features)
+{
+    pci->common->driver_feature_select = 0;
+    pci->common->driver_feature = features & 0xFFFFFFFF;
+    pci->common->driver_feature_select = 1;
+    pci->common->driver_feature = features >> 32;
+}
+
+/**
+ * Enable MSI-X and disable legacy INTx interrupts of a function. Every vector starts
+ * masked, and is unmasked by virtio_pci_msix_set_vector.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ *
+ * @return false if the function does not support MSI-X.
+ */
+static inline bool virtio_pci_msix_enable(virtio_pci_t *pci)
+{
+    if (pci->msix_table == NULL) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < pci->msix_table_size; i++) {
+        pci->msix_table[i].vector_ctrl = PCI_MSIX_ENTRY_CTRL_MASKED;
+    }
+
+    volatile struct pci_msix_cap *msix = (volatile struct pci_msix_cap *)((uintptr_t)pci->config + pci->msix_cap_off);
+    msix->msg_ctrl = (msix->msg_ctrl & ~PCI_MSIX_CTRL_FUNCTION_MASK) | PCI_MSIX_CTRL_ENABLE;
+    pci->config->command |= PCI_COMMAND_INTX_DISABLE;
+
+    return true;
+}
+
+/**
+ * Set the message sent for an MSI-X vector and unmask it.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ * @param vector MSI-X vector.
+ * @param addr address the message is written to.
+ * @param data data of the message.
+ *
+ * @return false if the vector is not in the MSI-X table.
+ */
+static inline bool virtio_pci_msix_set_vector(virtio_pci_t *pci, uint16_t vector, uint64_t addr, uint32_t data)
+{
+    if (pci->msix_table == NULL || vector >= pci->msix_table_size) {
+        return false;
+    }
+
+    pci_msix_entry_t *entry = &pci->msix_table[vector];
+    entry->msg_addr_low = addr & 0xFFFFFFFF;
+    entry->msg_addr_high = addr >> 32;
+    entry->msg_data = data;
+    entry->vector_ctrl = 0;
+
+    return true;
+}
+
+/**
+ * Set the MSI-X vector used for configuration change notifications.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ * @param vector MSI-X vector, or VIRTIO_MSI_NO_VECTOR.
+ *
+ * @return false if the device could not allocate resources for the vector.
+ */
+static inline bool virtio_pci_set_config_vector(virtio_pci_t *pci, uint16_t vector)
+{
+    pci->common->config_msix_vector = vector;
+    return pci->common->config_msix_vector == vector;
+}
+
+/**
+ * Register the rings of a queue with the device and mark the queue ready.
+ *
+ * @param pci pointer to the virtio_pci struct.
+ * @param index index of the queue.
+ * @param num number of descriptors in the queue.
+ * @param desc_paddr physical address of the descriptor area.
+ * @param driver_paddr physical address of the driver area.
+ * @param device_paddr physical address of the device area.
+ * @param vector MSI-X vector for used buffer notifications, or VIRTIO_MSI_NO_VECTOR.
+ * @param notify_addr output address to write the queue index to, to notify the device.
+ *
+ * @return false if the device does not support queues of this size or the vector.
+ */
+static inline bool virtio_pci_queue_register(virtio_pci_t *pci, uint16_t index, uint16_t num, uint64_t desc_paddr,
+                                             uint64_t driver_paddr, uint64_t device_paddr, uint16_t vector,
+                                             uintptr_t *notify_addr)
+{
+    volatile virtio_pci_common_cfg_t *common = pci->common;
+
+    common->queue_select = index;
+    if (common->queue_size < num) {
+        return false;
+    }
+    common->queue_size = num;
+
+    common->queue_msix_vector = vector;
+    if (common->queue_msix_vector != vector) {
+        return false;
+    }
+
+    common->queue_desc_low = desc_paddr & 0xFFFFFFFF;
+    common->queue_desc_high = desc_paddr >> 32;
+    common->queue_driver_low = driver_paddr & 0xFFFFFFFF;
+    common->queue_driver_high = driver_paddr >> 32;
+    common->queue_device_low = device_paddr & 0xFFFFFFFF;
+    common->queue_device_high = device_paddr >> 32;
+
+    *notify_addr = pci->notify_base + (uintptr_t)common->queue_notify_off * pci->notify_off_multiplier;
+
+    common->queue_enable = 1;
+    return true;
+}
@@ -19,7 +19,13 @@
 /*
  * An interface for efficient virtio implementation.
  */
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <sddf/util/fence.h>
+#include <sddf/util/ialloc.h>
+#include <sddf/util/util.h>
+#include <sddf/virtio/virtio.h>
 
 /* This marks a buffer as continuing via the next field. */
 #define VIRTQ_DESC_F_NEXT       1
@@ -107,3 +113,681 @@ static inline uint16_t *virtq_avail_event(struct virtq *vq)
     /* For backwards compat, avail event index is at *end* of used ring. */
     return (uint16_t *)&vq->used->ring[vq->num];
 }
+
+/**
+ * Check whether the device must be notified of buffers made available since old_avail_idx.
+ * Must be called after the avail index has been updated. With VIRTIO_F_EVENT_IDX, the
+ * device is only notified once the avail index passes the avail event index it published,
+ * otherwise whenever it has not set VIRTQ_USED_F_NO_NOTIFY.
+ *
+ * @param vq virtqueue the buffers were made available in.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ * @param old_avail_idx avail index when the device was last considered for notification.
+ *
+ * @return true if the device needs to be notified.
+ */
+static inline bool virtq_kick_needed(struct virtq *vq, bool event_idx, uint16_t old_avail_idx)
+{
+    /* The new avail index must be visible to the device before we read its event index */
+    THREAD_MEMORY_FENCE();
+    if (event_idx) {
+        return virtq_need_event(*virtq_avail_event(vq), vq->avail->idx, old_avail_idx);
+    }
+    return !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+/**
+ * Ask the device to only send a used buffer notification once threshold more buffers
+ * have been used since last_seen_used, or once every buffer in flight has been used if
+ * there are fewer. Only has an effect with VIRTIO_F_EVENT_IDX.
+ *
+ * The device may have already used buffers past the new event index before seeing it, in
+ * which case no notification is sent, so the caller must process the used ring again.
+ *
+ * @param vq virtqueue to set the used event index of.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ * @param last_seen_used used index up to which the driver has processed the used ring.
+ * @param threshold number of used buffers to batch into a single notification.
+ *
+ * @return true if the used ring must be processed again.
+ */
+static inline bool virtq_set_used_threshold(struct virtq *vq, bool event_idx, uint16_t last_seen_used,
+                                            uint16_t threshold)
+{
+    if (!event_idx) {
+        return false;
+    }
+
+    uint16_t in_flight = vq->avail->idx - last_seen_used;
+    uint16_t count = threshold < in_flight ? threshold : in_flight;
+    if (count == 0) {
+        count = 1;
+    }
+
+    *virtq_used_event(vq) = last_seen_used + count - 1;
+    /* The event index must be visible to the device before we read the used index */
+    THREAD_MEMORY_FENCE();
+
+    return (uint16_t)(vq->used->idx - last_seen_used) >= count;
+}
+
+/*
+ * Packed virtqueues (VIRTIO_F_RING_PACKED).
+ *
+ * A packed virtqueue is a single ring of descriptors shared by the driver and the
+ * device. The driver makes buffers available by writing descriptors into the ring in
+ * order, and the device marks buffers used by writing a single descriptor per buffer
+ * back into the ring, also in order. Whether a descriptor is available or used is
+ * encoded by the AVAIL and USED flags relative to a wrap counter that flips each time
+ * the ring is traversed, so no separate avail and used rings are needed.
+ */
+
+/* Support for packed virtqueues */
+#define VIRTIO_F_RING_PACKED      34
+
+/* Mark a descriptor as available or used, relative to the wrap counters */
+#define VIRTQ_DESC_F_AVAIL      (1 << 7)
+#define VIRTQ_DESC_F_USED       (1 << 15)
+
+/* Enable events */
+#define RING_EVENT_FLAGS_ENABLE 0x0
+/* Disable events */
+#define RING_EVENT_FLAGS_DISABLE 0x1
+/* Enable events for a specific descriptor, only with VIRTIO_F_EVENT_IDX */
+#define RING_EVENT_FLAGS_DESC 0x2
+
+/* Bit of off_wrap holding the wrap counter of the event descriptor */
+#define RING_EVENT_WRAP_SHIFT 15
+
+struct pvirtq_desc {
+    /* Buffer address (guest-physical). */
+    uint64_t addr;
+    /* Buffer length. */
+    uint32_t len;
+    /* Buffer ID. */
+    uint16_t id;
+    /* The flags depending on descriptor type. */
+    uint16_t flags;
+};
+
+struct pvirtq_event_suppress {
+    /* Descriptor ring change event offset and wrap counter, only with RING_EVENT_FLAGS_DESC */
+    uint16_t off_wrap;
+    /* Descriptor ring change event flags, see RING_EVENT_FLAGS_* */
+    uint16_t flags;
+};
+
+struct pvirtq {
+    unsigned int num;
+
+    struct pvirtq_desc *desc;
+    /* Written by the driver to control used buffer notifications */
+    struct pvirtq_event_suppress *driver;
+    /* Written by the device to control available buffer notifications */
+    struct pvirtq_event_suppress *device;
+
+    /* Ring index and wrap counter of the next descriptor to make available */
+    uint16_t next_avail;
+    bool avail_wrap;
+    /* Ring index and wrap counter of the next used descriptor */
+    uint16_t next_used;
+    bool used_wrap;
+    /* Number of descriptors not owned by the device */
+    uint16_t num_free;
+    /* Number of descriptors made available since the device was last considered for notification */
+    uint16_t num_added;
+    /* Number of descriptors in the chain of each buffer ID, num entries */
+    uint16_t *chain_len;
+};
+
+/**
+ * Initialise the driver state of a packed virtqueue. The descriptor ring must be zeroed.
+ *
+ * @param vq packed virtqueue to initialise.
+ * @param num number of descriptors in the ring, also the number of buffer IDs.
+ * @param desc descriptor ring, aligned to 16 bytes.
+ * @param driver driver event suppression area, aligned to 4 bytes.
+ * @param device device event suppression area, aligned to 4 bytes.
+ * @param chain_len array of num entries used to track the length of each chain.
+ */
+static inline void pvirtq_init(struct pvirtq *vq, unsigned int num, struct pvirtq_desc *desc,
+                               struct pvirtq_event_suppress *driver, struct pvirtq_event_suppress *device,
+                               uint16_t *chain_len)
+{
+    vq->num = num;
+    vq->desc = desc;
+    vq->driver = driver;
+    vq->device = device;
+    vq->next_avail = 0;
+    vq->avail_wrap = true;
+    vq->next_used = 0;
+    vq->used_wrap = true;
+    vq->num_free = num;
+    vq->num_added = 0;
+    vq->chain_len = chain_len;
+
+    driver->off_wrap = 0;
+    driver->flags = RING_EVENT_FLAGS_ENABLE;
+}
+
+/**
+ * Make a chain of buffers available to the device. The caller must ensure that
+ * num_free is at least count.
+ *
+ * @param vq packed virtqueue to add the chain to.
+ * @param id buffer ID of the chain, less than num.
+ * @param chain descriptors of the chain. Only addr, len and the VIRTQ_DESC_F_NEXT,
+ *              VIRTQ_DESC_F_WRITE and VIRTQ_DESC_F_INDIRECT flags are used.
+ * @param count number of descriptors in the chain.
+ */
+static inline void pvirtq_add_chain(struct pvirtq *vq, uint16_t id, const struct virtq_desc *chain, uint16_t count)
+{
+    uint16_t head = vq->next_avail;
+    uint16_t head_flags = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        struct pvirtq_desc *desc = &vq->desc[vq->next_avail];
+        uint16_t flags = chain[i].flags & (VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_INDIRECT);
+        flags |= vq->avail_wrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+
+        desc->addr = chain[i].addr;
+        desc->len = chain[i].len;
+        desc->id = id;
+        if (i == 0) {
+            head_flags = flags;
+        } else {
+            desc->flags = flags;
+        }
+
+        vq->next_avail++;
+        if (vq->next_avail == vq->num) {
+            vq->next_avail = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
+
+    vq->chain_len[id] = count;
+    vq->num_free -= count;
+    vq->num_added += count;
+
+    /* The device may consume the chain as soon as the head is available */
+    __atomic_store_n(&vq->desc[head].flags, head_flags, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check whether the descriptor at a ring index has been marked used by the device.
+ *
+ * @param vq packed virtqueue to check.
+ * @param idx ring index of the descriptor.
+ * @param wrap wrap counter the descriptor is expected to be used in.
+ *
+ * @return true if the descriptor is used.
+ */
+static inline bool pvirtq_desc_used(struct pvirtq *vq, uint16_t idx, bool wrap)
+{
+    uint16_t flags = __atomic_load_n(&vq->desc[idx].flags, __ATOMIC_ACQUIRE);
+    bool avail = flags & VIRTQ_DESC_F_AVAIL;
+    bool used = flags & VIRTQ_DESC_F_USED;
+    return avail == used && used == wrap;
+}
+
+/**
+ * Get the next buffer used by the device, if any.
+ *
+ * @param vq packed virtqueue to get the used buffer from.
+ * @param id buffer ID of the used chain.
+ * @param len number of bytes written into the chain by the device.
+ *
+ * @return true if a used buffer was returned.
+ */
+static inline bool pvirtq_get_used(struct pvirtq *vq, uint16_t *id, uint32_t *len)
+{
+    if (!pvirtq_desc_used(vq, vq->next_used, vq->used_wrap)) {
+        return false;
+    }
+
+    struct pvirtq_desc *desc = &vq->desc[vq->next_used];
+    *id = desc->id;
+    *len = desc->len;
+
+    uint16_t count = vq->chain_len[*id];
+    vq->num_free += count;
+    vq->next_used += count;
+    if (vq->next_used >= vq->num) {
+        vq->next_used -= vq->num;
+        vq->used_wrap = !vq->used_wrap;
+    }
+
+    return true;
+}
+
+/**
+ * Check whether the device must be notified of buffers made available since it was
+ * last considered for notification.
+ *
+ * @param vq packed virtqueue the buffers were made available in.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ *
+ * @return true if the device needs to be notified.
+ */
+static inline bool pvirtq_kick_needed(struct pvirtq *vq, bool event_idx)
+{
+    uint16_t new_idx = vq->next_avail;
+    uint16_t old_idx = new_idx - vq->num_added;
+    vq->num_added = 0;
+
+    /* The newly available descriptors must be visible to the device before we read its event flags */
+    THREAD_MEMORY_FENCE();
+    uint16_t flags = vq->device->flags;
+    if (flags != RING_EVENT_FLAGS_DESC || !event_idx) {
+        return flags != RING_EVENT_FLAGS_DISABLE;
+    }
+
+    uint16_t off_wrap = vq->device->off_wrap;
+    uint16_t event = off_wrap & ~(1 << RING_EVENT_WRAP_SHIFT);
+    if ((bool)(off_wrap >> RING_EVENT_WRAP_SHIFT) != vq->avail_wrap) {
+        event -= vq->num;
+    }
+    return virtq_need_event(event, new_idx, old_idx);
+}
+
+/**
+ * Ask the device to only send a used buffer notification once threshold more buffers
+ * have been used, or once every buffer in flight has been used if there are fewer.
+ * Only has an effect with VIRTIO_F_EVENT_IDX. Assumes every chain in flight has the
+ * same number of descriptors, as the event is placed on a descriptor of the ring.
+ *
+ * @param vq packed virtqueue to set the driver event of.
+ * @param event_idx whether VIRTIO_F_EVENT_IDX was negotiated.
+ * @param threshold number of used buffers to batch into a single notification.
+ * @param chain_len number of descriptors in each chain.
+ *
+ * @return true if the used buffers have already been used, in which case the device
+ *         may not notify and the caller must process the ring again.
+ */
+static inline bool pvirtq_set_used_threshold(struct pvirtq *vq, bool event_idx, uint16_t threshold,
+                                             uint16_t chain_len)
+{
+    if (!event_idx) {
+        return false;
+    }
+
+    uint16_t in_flight = (vq->num - vq->num_free) / chain_len;
+    uint16_t count = threshold < in_flight ? threshold : in_flight;
+    if (count == 0) {
+        count = 1;
+    }
+
+    uint32_t off = vq->next_used + (uint32_t)(count - 1) * chain_len;
+    bool wrap = vq->used_wrap;
+    if (off >= vq->num) {
+        off -= vq->num;
+        wrap = !wrap;
+    }
+
+    vq->driver->off_wrap = off | ((uint16_t)wrap << RING_EVENT_WRAP_SHIFT);
+    __atomic_store_n(&vq->driver->flags, RING_EVENT_FLAGS_DESC, __ATOMIC_RELEASE);
+    /* The event must be visible to the device before we check whether it has been passed */
+    THREAD_MEMORY_FENCE();
+
+    return pvirtq_desc_used(vq, off, wrap);
+}
+
+/*
+ * Virtqueue management.
+ *
+ * virtio_queue_t puts a split or packed virtqueue behind a single interface for the
+ * sDDF virtIO drivers. It lays out the rings in memory given by the driver, builds
+ * descriptor chains, publishes batches of chains to the device with a single barrier,
+ * harvests used chains and recycles their descriptors, and handles notification
+ * suppression with or without VIRTIO_F_EVENT_IDX.
+ *
+ * Each chain in flight is identified by its head, an index less than the size of the
+ * queue. Drivers keep any per-chain state they need in tables indexed by the head, as
+ * the descriptors of a packed virtqueue are overwritten by the device when used.
+ */
+
+typedef struct virtio_queue {
+    /* Index of the queue in the device */
+    uint16_t index;
+    /* Number of descriptors in the queue */
+    uint16_t num;
+    /* Whether VIRTIO_F_RING_PACKED and VIRTIO_F_EVENT_IDX were negotiated */
+    bool packed;
+    bool event_idx;
+
+    struct virtq split;
+    struct pvirtq pvirtq;
+    /* Free descriptors of a split virtqueue, or free buffer IDs of a packed virtqueue */
+    ialloc_t ialloc;
+
+    /* Avail index when the device was last considered for notification, split only */
+    uint16_t old_avail_idx;
+    /* Number of chains added to the avail ring but not yet published, split only */
+    uint16_t num_pending;
+    /* Used index up to which the used ring has been processed, split only */
+    uint16_t last_seen_used;
+
+    /* Offsets of the descriptor, driver and device areas into the ring memory */
+    size_t desc_off;
+    size_t driver_off;
+    size_t device_off;
+
+    /* Register written to notify the device of new chains, set when the queue is registered */
+    uintptr_t notify_addr;
+} virtio_queue_t;
+
+/**
+ * Get the number of bytes of ring memory needed by a queue. This is the size of a split
+ * virtqueue, which a packed virtqueue of the same size always fits in.
+ *
+ * @param num number of descriptors in the queue.
+ *
+ * @return size of the ring memory in bytes, the memory must be aligned to 16 bytes.
+ */
+static inline size_t virtio_queue_ring_size(uint16_t num)
+{
+    size_t avail_off = ALIGN(16 * num, 2);
+    size_t used_off = ALIGN(avail_off + (6 + 2 * num), 4);
+    return used_off + (6 + 8 * num);
+}
+
+/**
+ * Initialise a queue and lay out its rings. Must be called after feature negotiation, and
+ * the ring memory must be zeroed.
+ *
+ * @param vq queue to initialise.
+ * @param index index of the queue in the device.
+ * @param num number of descriptors in the queue.
+ * @param features features negotiated with the device.
+ * @param ring_vaddr start of virtio_queue_ring_size(num) bytes of ring memory.
+ * @param idxlist array of num entries used to allocate descriptors or buffer IDs.
+ * @param chain_lens array of num entries used to track chains of a packed virtqueue.
+ */
+static inline void virtio_queue_init(virtio_queue_t *vq, uint16_t index, uint16_t num, uint64_t features,
+                                     uintptr_t ring_vaddr, uint32_t *idxlist, uint16_t *chain_lens)
+{
+    vq->index = index;
+    vq->num = num;
+    vq->packed = features & ((uint64_t)1 << VIRTIO_F_RING_PACKED);
+    vq->event_idx = features & ((uint64_t)1 << VIRTIO_F_EVENT_IDX);
+    vq->old_avail_idx = 0;
+    vq->num_pending = 0;
+    vq->last_seen_used = 0;
+    ialloc_init(&vq->ialloc, idxlist, num);
+
+    vq->desc_off = 0;
+    if (vq->packed) {
+        vq->driver_off = ALIGN(vq->desc_off + (16 * num), 4);
+        vq->device_off = vq->driver_off + sizeof(struct pvirtq_event_suppress);
+        pvirtq_init(&vq->pvirtq, num, (struct pvirtq_desc *)(ring_vaddr + vq->desc_off),
+                    (struct pvirtq_event_suppress *)(ring_vaddr + vq->driver_off),
+                    (struct pvirtq_event_suppress *)(ring_vaddr + vq->device_off), chain_lens);
+    } else {
+        vq->driver_off = ALIGN(vq->desc_off + (16 * num), 2);
+        vq->device_off = ALIGN(vq->driver_off + (6 + 2 * num), 4);
+        vq->split.num = num;
+        vq->split.desc = (struct virtq_desc *)(ring_vaddr + vq->desc_off);
+        vq->split.avail = (struct virtq_avail *)(ring_vaddr + vq->driver_off);
+        vq->split.used = (struct virtq_used *)(ring_vaddr + vq->device_off);
+    }
+}
+
+/**
+ * Register the rings of a queue with a device using the MMIO transport and mark the
+ * queue ready.
+ *
+ * @param vq queue to register.
+ * @param regs MMIO registers of the device.
+ * @param ring_paddr physical address of the ring memory given to virtio_queue_init.
+ *
+ * @return false if the device does not support queues of this size.
+ */
+static inline bool virtio_queue_mmio_register(virtio_queue_t *vq, volatile virtio_mmio_regs_t *regs,
+                                              uintptr_t ring_paddr)
+{
+    regs->QueueSel = vq->index;
+    if (regs->QueueNumMax < vq->num) {
+        return false;
+    }
+    regs->QueueNum = vq->num;
+    regs->QueueDescLow = (ring_paddr + vq->desc_off) & 0xFFFFFFFF;
+    regs->QueueDescHigh = (ring_paddr + vq->desc_off) >> 32;
+    regs->QueueDriverLow = (ring_paddr + vq->driver_off) & 0xFFFFFFFF;
+    regs->QueueDriverHigh = (ring_paddr + vq->driver_off) >> 32;
+    regs->QueueDeviceLow = (ring_paddr + vq->device_off) & 0xFFFFFFFF;
+    regs->QueueDeviceHigh = (ring_paddr + vq->device_off) >> 32;
+    vq->notify_addr = (uintptr_t)&regs->QueueNotify;
+    regs->QueueReady = 1;
+    return true;
+}
+
+/**
+ * Get the number of descriptors free for new chains.
+ *
+ * @param vq queue to check.
+ *
+ * @return number of free descriptors.
+ */
+static inline uint16_t virtio_queue_num_free(virtio_queue_t *vq)
+{
+    if (vq->packed) {
+        return vq->pvirtq.num_free;
+    }
+    return ialloc_num_free(&vq->ialloc);
+}
+
+/**
+ * Get the head the next chain added to the queue will have, so that per-chain state such
+ * as a request header can be prepared before the chain is made available. Only valid if
+ * there are free descriptors.
+ *
+ * @param vq queue the chain will be added to.
+ *
+ * @return head of the next chain.
+ */
+static inline uint16_t virtio_queue_next_head(virtio_queue_t *vq)
+{
+    return vq->ialloc.head;
+}
+
+/**
+ * Add a chain of buffers to the queue. Chains of a split virtqueue are only made visible
+ * to the device by virtio_queue_publish, those of a packed virtqueue immediately. The
+ * caller must ensure there are at least count free descriptors.
+ *
+ * @param vq queue to add the chain to.
+ * @param chain descriptors of the chain. Only addr, len and the VIRTQ_DESC_F_WRITE and
+ *              VIRTQ_DESC_F_INDIRECT flags need to be set, the descriptors are linked by
+ *              this function.
+ * @param count number of descriptors in the chain.
+ *
+ * @return head of the chain.
+ */
+static inline uint16_t virtio_queue_add(virtio_queue_t *vq, struct virtq_desc *chain, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        chain[i].flags &= VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_INDIRECT;
+        if (i != count - 1) {
+            chain[i].flags |= VIRTQ_DESC_F_NEXT;
+        }
+    }
+
+    uint32_t head = -1;
+    int err = ialloc_alloc(&vq->ialloc, &head);
+    assert(!err && head != -1);
+
+    if (vq->packed) {
+        pvirtq_add_chain(&vq->pvirtq, head, chain, count);
+        return head;
+    }
+
+    uint32_t idx = head;
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t next = 0;
+        if (i != count - 1) {
+            err = ialloc_alloc(&vq->ialloc, &next);
+            assert(!err);
+        }
+        chain[i].next = next;
+        vq->split.desc[idx] = chain[i];
+        idx = next;
+    }
+
+    vq->split.avail->ring[(uint16_t)(vq->split.avail->idx + vq->num_pending) % vq->num] = head;
+    vq->num_pending++;
+
+    return head;
+}
+
+/**
+ * Add a chain of buffers to the queue through an indirect descriptor table, so that it
+ * only takes a single descriptor of the queue. Needs VIRTIO_F_INDIRECT_DESC, and the
+ * table must not be reused until the chain has been used by the device.
+ *
+ * @param vq queue to add the chain to.
+ * @param table_vaddr indirect descriptor table of at least count entries, aligned to 16 bytes.
+ * @param table_paddr physical address of the table.
+ * @param chain descriptors of the chain. Only addr, len and the VIRTQ_DESC_F_WRITE flag
+ *              need to be set.
+ * @param count number of descriptors in the chain.
+ *
+ * @return head of the chain.
+ */
+static inline uint16_t virtio_queue_add_indirect(virtio_queue_t *vq, uintptr_t table_vaddr, uint64_t table_paddr,
+                                                 const struct virtq_desc *chain, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t flags = chain[i].flags & VIRTQ_DESC_F_WRITE;
+        if (vq->packed) {
+            /* Descriptors of a packed indirect table follow each other without VIRTQ_DESC_F_NEXT */
+            struct pvirtq_desc *desc = &((struct pvirtq_desc *)table_vaddr)[i];
+            *desc = (struct pvirtq_desc) { .addr = chain[i].addr, .len = chain[i].len, .flags = flags };
+        } else {
+            struct virtq_desc *desc = &((struct virtq_desc *)table_vaddr)[i];
+            *desc = (struct virtq_desc) { .addr = chain[i].addr, .len = chain[i].len, .flags = flags };
+            if (i != count - 1) {
+                desc->flags |= VIRTQ_DESC_F_NEXT;
+                desc->next = i + 1;
+            }
+        }
+    }
+
+    struct virtq_desc desc = {
+        .addr = table_paddr,
+        .len = count * sizeof(struct virtq_desc),
+        .flags = VIRTQ_DESC_F_INDIRECT,
+    };
+    return virtio_queue_add(vq, &desc, 1);
+}
+
+/**
+ * Make every chain added since the last call visible to the device, and check whether
+ * the device needs to be notified of them.
+ *
+ * @param vq queue to publish the chains of.
+ *
+ * @return true if the device needs to be notified.
+ */
+static inline bool virtio_queue_publish(virtio_queue_t *vq)
+{
+    if (vq->packed) {
+        if (vq->pvirtq.num_added == 0) {
+            return false;
+        }
+        return pvirtq_kick_needed(&vq->pvirtq, vq->event_idx);
+    }
+
+    if (vq->num_pending != 0) {
+        /* A single barrier makes the whole batch of ring entries visible before the index */
+        __atomic_store_n(&vq->split.avail->idx, vq->split.avail->idx + vq->num_pending, __ATOMIC_RELEASE);
+        vq->num_pending = 0;
+    }
+    if (vq->split.avail->idx == vq->old_avail_idx) {
+        return false;
+    }
+
+    bool kick = virtq_kick_needed(&vq->split, vq->event_idx, vq->old_avail_idx);
+    vq->old_avail_idx = vq->split.avail->idx;
+    return kick;
+}
+
+/**
+ * Get the next chain used by the device, if any, and free its descriptors.
+ *
+ * @param vq queue to get the used chain from.
+ * @param head head of the used chain.
+ * @param len number of bytes written into the chain by the device.
+ *
+ * @return true if a used chain was returned.
+ */
+static inline bool virtio_queue_get_used(virtio_queue_t *vq, uint16_t *head, uint32_t *len)
+{
+    if (vq->packed) {
+        if (!pvirtq_get_used(&vq->pvirtq, head, len)) {
+            return false;
+        }
+        int err = ialloc_free(&vq->ialloc, *head);
+        assert(!err);
+        return true;
+    }
+
+    if (vq->last_seen_used == __atomic_load_n(&vq->split.used->idx, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    struct virtq_used_elem used = vq->split.used->ring[vq->last_seen_used % vq->num];
+    *head = used.id;
+    *len = used.len;
+    vq->last_seen_used++;
+
+    uint32_t idx = used.id;
+    while (true) {
+        uint16_t flags = vq->split.desc[idx].flags;
+        uint32_t next = vq->split.desc[idx].next;
+        int err = ialloc_free(&vq->ialloc, idx);
+        assert(!err);
+        if (!(flags & VIRTQ_DESC_F_NEXT)) {
+            break;
+        }
+        idx = next % vq->num;
+    }
+
+    return true;
+}
+
+/**
+ * Ask the device to only send a used buffer notification once threshold more chains have
+ * been used, or once every chain in flight has been used if there are fewer. Only has an
+ * effect with VIRTIO_F_EVENT_IDX.
+ *
+ * @param vq queue to set the used threshold of.
+ * @param threshold number of used chains to batch into a single notification.
+ * @param chain_len number of descriptors in each chain, which must be the same for every
+ *                  chain in flight in a packed virtqueue.
+ *
+ * @return true if chains were used before the device could see the threshold, in which
+ *         case it may not notify and the caller must process the used chains again.
+ */
+static inline bool virtio_queue_set_used_threshold(virtio_queue_t *vq, uint16_t threshold, uint16_t chain_len)
+{
+    if (vq->packed) {
+        return pvirtq_set_used_threshold(&vq->pvirtq, vq->event_idx, threshold, chain_len);
+    }
+    return virtq_set_used_threshold(&vq->split, vq->event_idx, vq->last_seen_used, threshold);
+}
+
+/**
+ * Ask the device not to send used buffer notifications for a queue, for queues that are
+ * polled.
+ *
+ * @param vq queue to disable notifications of.
+ */
+static inline void virtio_queue_disable_used_irq(virtio_queue_t *vq)
+{
+    if (vq->packed) {
+        vq->pvirtq.driver->flags = RING_EVENT_FLAGS_DISABLE;
+    } else {
+        vq->split.avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/virtio/virtio.h>
+#include <sddf/virtio/virtio_pci.h>
+#include <sddf/virtio/virtio_queue.h>
+
+/*
+ * This file provides a common interface to the virtIO MMIO and PCI transports, so that
+ * device drivers do not need to know how the device they drive is attached.
+ *
+ * The interrupt status returned by virtio_transport_irq_status_ack uses the same bits for
+ * both transports, VIRTIO_MMIO_IRQ_VQUEUE and VIRTIO_MMIO_IRQ_CONFIG, as the ISR status of
+ * the PCI transport matches the interrupt status register of the MMIO transport. It is
+ * only meaningful for interrupts that are not delivered through MSI-X.
+ */
+
+typedef enum {
+    VIRTIO_TRANSPORT_TYPE_MMIO,
+    VIRTIO_TRANSPORT_TYPE_PCI,
+} virtio_transport_type_t;
+
+typedef struct virtio_transport {
+    virtio_transport_type_t type;
+    volatile virtio_mmio_regs_t *mmio;
+    virtio_pci_t pci;
+    /* Whether interrupts are delivered through MSI-X, PCI only */
+    bool msix;
+} virtio_transport_t;
+
+/**
+ * Initialise a transport for a device attached through MMIO.
+ *
+ * @param transport pointer to the transport struct.
+ * @param regs_vaddr virtual address of the MMIO registers of the device.
+ *
+ * @return false if the registers do not belong to a virtIO 1.x device.
+ */
+static inline bool virtio_transport_mmio_init(virtio_transport_t *transport, uintptr_t regs_vaddr)
+{
+    transport->type = VIRTIO_TRANSPORT_TYPE_MMIO;
+    transport->mmio = (volatile virtio_mmio_regs_t *)regs_vaddr;
+    transport->msix = false;
+
+    return virtio_mmio_check_magic(transport->mmio) && virtio_mmio_version(transport->mmio) == VIRTIO_VERSION;
+}
+
+/**
+ * Initialise a transport for a device attached through PCI. See virtio_pci_init.
+ *
+ * @param transport pointer to the transport struct.
+ * @param config_vaddr virtual address of the configuration space of the function.
+ * @param window_vaddr virtual address of the window the BARs are assigned from.
+ * @param window_paddr physical address of the window the BARs are assigned from.
+ * @param window_size size of the window in bytes.
+ *
+ * @return false if the function is not a modern virtIO device or could not be set up.
+ */
+static inline bool virtio_transport_pci_init(virtio_transport_t *transport, uintptr_t config_vaddr,
+                                             uintptr_t window_vaddr, uint64_t window_paddr, uint64_t window_size)
+{
+    transport->type = VIRTIO_TRANSPORT_TYPE_PCI;
+    transport->mmio = NULL;
+    transport->msix = false;
+
+    return virtio_pci_init(&transport->pci, config_vaddr, window_vaddr, window_paddr, window_size);
+}
+
+static inline uint32_t virtio_transport_device_id(virtio_transport_t *transport)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        return virtio_pci_device_id(&transport->pci);
+    }
+    return transport->mmio->DeviceID;
+}
+
+static inline uint8_t virtio_transport_status(virtio_transport_t *transport)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        return transport->pci.common->device_status;
+    }
+    return transport->mmio->Status;
+}
+
+static inline void virtio_transport_set_status(virtio_transport_t *transport, uint8_t status)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        transport->pci.common->device_status = status;
+    } else {
+        transport->mmio->Status = status;
+    }
+}
+
+static inline uint64_t virtio_transport_device_features(virtio_transport_t *transport)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        return virtio_pci_device_features(&transport->pci);
+    }
+    return virtio_mmio_device_features(transport->mmio);
+}
+
+static inline void virtio_transport_set_driver_features(virtio_transport_t *transport, uint64_t features)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        virtio_pci_set_driver_features(&transport->pci, features);
+    } else {
+        virtio_mmio_set_driver_features(transport->mmio, features);
+    }
+}
+
+/**
+ * Get the device specific configuration structure.
+ *
+ * @param transport pointer to the transport struct.
+ *
+ * @return pointer to the configuration, NULL if the device does not have one.
+ */
+static inline volatile void *virtio_transport_config(virtio_transport_t *transport)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        return transport->pci.device_cfg;
+    }
+    return transport->mmio->Config;
+}
+
+/**
+ * Deliver interrupts of a PCI device through MSI-X, with vector i raising interrupt
+ * irq_base + i, and configuration change notifications sent on vector 0. Must be called
+ * before any queue is registered. Has no effect for the MMIO transport.
+ *
+ * @param transport pointer to the transport struct.
+ * @param irq_base interrupt raised by vector 0.
+ * @param num_vectors number of vectors to set up.
+ *
+ * @return false if the device does not support MSI-X or enough vectors.
+ */
+static inline bool virtio_transport_msix_setup(virtio_transport_t *transport, uint32_t irq_base, uint16_t num_vectors)
+{
+    if (transport->type != VIRTIO_TRANSPORT_TYPE_PCI) {
+        return false;
+    }
+#ifdef VIRTIO_PCI_MSI_ADDR
+    virtio_pci_t *pci = &transport->pci;
+    if (pci->msix_table == NULL || pci->msix_table_size < num_vectors) {
+        return false;
+    }
+
+    virtio_pci_msix_enable(pci);
+    for (uint16_t i = 0; i < num_vectors; i++) {
+        virtio_pci_msix_set_vector(pci, i, VIRTIO_PCI_MSI_ADDR, VIRTIO_PCI_MSI_DATA(irq_base + i));
+    }
+    transport->msix = virtio_pci_set_config_vector(pci, 0);
+
+    return transport->msix;
+#else
+    /* The MSI doorbell of this platform is not known */
+    return false;
+#endif
+}
+
+/**
+ * Register the rings of a queue with the device and mark the queue ready.
+ *
+ * @param transport pointer to the transport struct.
+ * @param vq queue to register.
+ * @param ring_paddr physical address of the ring memory given to virtio_queue_init.
+ * @param vector MSI-X vector for used buffer notifications of the queue, or
+ *               VIRTIO_MSI_NO_VECTOR. Ignored unless MSI-X is set up.
+ *
+ * @return false if the device does not support queues of this size.
+ */
+static inline bool virtio_transport_queue_register(virtio_transport_t *transport, virtio_queue_t *vq,
+                                                   uintptr_t ring_paddr, uint16_t vector)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        if (!transport->msix) {
+            vector = VIRTIO_MSI_NO_VECTOR;
+        }
+        return virtio_pci_queue_register(&transport->pci, vq->index, vq->num, ring_paddr + vq->desc_off,
+                                         ring_paddr + vq->driver_off, ring_paddr + vq->device_off, vector,
+                                         &vq->notify_addr);
+    }
+    return virtio_queue_mmio_register(vq, transport->mmio, ring_paddr);
+}
+
+/**
+ * Notify the device of new chains in a queue.
+ *
+ * @param transport pointer to the transport struct.
+ * @param vq queue with new chains.
+ */
+static inline void virtio_transport_notify(virtio_transport_t *transport, virtio_queue_t *vq)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        *(volatile uint16_t *)vq->notify_addr = vq->index;
+    } else {
+        *(volatile uint32_t *)vq->notify_addr = vq->index;
+    }
+}
+
+/**
+ * Read and acknowledge the cause of an interrupt that was not delivered through MSI-X.
+ *
+ * @param transport pointer to the transport struct.
+ *
+ * @return interrupt status, a combination of VIRTIO_MMIO_IRQ_VQUEUE and VIRTIO_MMIO_IRQ_CONFIG.
+ */
+static inline uint32_t virtio_transport_irq_status_ack(virtio_transport_t *transport)
+{
+    if (transport->type == VIRTIO_TRANSPORT_TYPE_PCI) {
+        /* Reading the ISR status acknowledges the interrupt */
+        return *transport->pci.isr;
+    }
+
+    uint32_t irq_status = transport->mmio->InterruptStatus;
+    transport->mmio->InterruptACK = irq_status;
+    return irq_status;
+}
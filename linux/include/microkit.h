@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/*
+ * This header provides the libmicrokit API for sDDF components built as Linux
+ * processes, so that they can be run, profiled and debugged on a Linux host
+ * without modification. It is used in place of the microkit.h of the Microkit
+ * SDK, and is implemented by libmicrokit_linux.a. Each protection domain is a
+ * separate process started by sddf_linux.py from a System Description File.
+ *
+ * Notifications are delivered through eventfds, protected procedure calls are
+ * made over UNIX sockets, and memory regions are shared memory mapped at the
+ * virtual address given by the System Description File. As on seL4, a protection
+ * domain handles a single event at a time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MICROKIT_MAX_CHANNELS 62
+#define MICROKIT_MAX_MRS 64
+#define MICROKIT_PD_NAME_LENGTH 16
+
+typedef uint64_t seL4_Word;
+typedef seL4_Word seL4_CPtr;
+typedef bool seL4_Bool;
+
+typedef struct {
+    seL4_Word label;
+    seL4_Word count;
+} seL4_MessageInfo_t;
+
+typedef unsigned int microkit_channel;
+typedef unsigned int microkit_child;
+typedef seL4_MessageInfo_t microkit_msginfo;
+
+/* Entry points implemented by the protection domain */
+void init(void);
+void notified(microkit_channel ch);
+microkit_msginfo protected(microkit_channel ch, microkit_msginfo msginfo);
+
+extern char microkit_name[MICROKIT_PD_NAME_LENGTH];
+extern seL4_Word microkit_mrs[MICROKIT_MAX_MRS];
+
+void microkit_dbg_putc(int c);
+void microkit_dbg_puts(const char *s);
+
+void microkit_notify(microkit_channel ch);
+void microkit_irq_ack(microkit_channel ch);
+microkit_msginfo microkit_ppcall(microkit_channel ch, microkit_msginfo msginfo);
+
+/* Only one deferred action is performed, once the current event has been handled */
+void microkit_deferred_notify(microkit_channel ch);
+void microkit_deferred_irq_ack(microkit_channel ch);
+
+/*
+ * The pending deferred action, as recorded by libmicrokit. Components check these to
+ * tell whether a deferred action is already pending, and which channel it is for.
+ */
+#define BASE_OUTPUT_NOTIFICATION_CAP 10
+#define BASE_IRQ_CAP 138
+
+extern bool microkit_have_signal;
+extern seL4_CPtr microkit_signal_cap;
+
+/**
+ * Deliver a file descriptor becoming readable as an interrupt on a channel. As with
+ * an interrupt, the protection domain is notified once and not again until the
+ * interrupt is acknowledged. This is how drivers built for Linux hosts receive
+ * events from the host.
+ *
+ * @param fd file descriptor to poll for reading.
+ * @param ch channel to notify on.
+ */
+void microkit_linux_irq_fd(int fd, microkit_channel ch);
+
+static inline microkit_msginfo microkit_msginfo_new(seL4_Word label, uint16_t count)
+{
+    return (microkit_msginfo) { .label = label, .count = count };
+}
+
+static inline seL4_Word microkit_msginfo_get_label(microkit_msginfo msginfo)
+{
+    return msginfo.label;
+}
+
+static inline seL4_Word microkit_msginfo_get_count(microkit_msginfo msginfo)
+{
+    return msginfo.count;
+}
+
+static inline void microkit_mr_set(uint8_t mr, seL4_Word value)
+{
+    microkit_mrs[mr] = value;
+}
+
+static inline seL4_Word microkit_mr_get(uint8_t mr)
+{
+    return microkit_mrs[mr];
+}
+
+static inline seL4_Word seL4_GetMR(int i)
+{
+    return microkit_mrs[i];
+}
+
+static inline void seL4_SetMR(int i, seL4_Word value)
+{
+    microkit_mrs[i] = value;
+}
+
+/* Memory is only shared between processes on a Linux host, so no cache maintenance is needed */
+static inline int seL4_ARM_VSpace_Invalidate_Data(seL4_Word vspace, seL4_Word start, seL4_Word end)
+{
+    return 0;
+}
@@ -0,0 +1,34 @@
+#
+# Copyright 2024, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Include this snippet in your project Makefile to build sDDF components as
+# Linux processes, for running them on a Linux host with sddf_linux.py.
+#
+# NOTES:
+#   Generates libmicrokit_linux.a
+#   Add ${CFLAGS_linux} to CFLAGS in place of the Microkit SDK include directory,
+#   and link every protection domain with ${LDFLAGS_linux} and libmicrokit_linux.a
+#   using the host compiler rather than a freestanding toolchain.
+
+LINUX_DIR := $(abspath $(dir $(lastword ${MAKEFILE_LIST})))
+
+CFLAGS_linux := -I${LINUX_DIR}/include
+LDFLAGS_linux := -rdynamic
+
+libmicrokit_linux.a: linux/microkit.o
+	${AR} crv $@ $^
+	${RANLIB} $@
+
+linux/microkit.o: ${LINUX_DIR}/microkit.c |linux
+	${CC} ${CFLAGS} -c -o $@ $<
+
+linux:
+	mkdir -p $@
+
+clean::
+	${RM} -f linux/microkit.[od]
+
+clobber::
+	${RM} -f libmicrokit_linux.a
@@ -0,0 +1,354 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <microkit.h>
+
+/*
+ * This is the Linux host implementation of libmicrokit. The process is given a
+ * configuration file generated by sddf_linux.py from the System Description File,
+ * with one entry per line:
+ *
+ *   name <pd name>
+ *   map <fd> <vaddr> <size> <perms>
+ *   setvar <symbol> <value>
+ *   channel <id> <fd to wait on> <fd to signal>
+ *   ppcall <id> <socket fd>      this end can make protected procedure calls on the channel
+ *   protected <id> <socket fd>   this end receives protected procedure calls on the channel
+ *
+ * The file descriptors are inherited from sddf_linux.py. Symbols are patched through
+ * the dynamic symbol table, so protection domains must be linked with -rdynamic.
+ */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define MAX_EVENTS 16
+
+/* Events are tagged with their kind and channel */
+#define EVENT_NOTIFICATION 0
+#define EVENT_PROTECTED 1
+#define EVENT_IRQ 2
+#define EVENT_TAG(kind, ch) (((uint64_t)(kind) << 32) | (ch))
+
+typedef struct channel {
+    int wait_fd;
+    int signal_fd;
+    int ppcall_fd;
+    int protected_fd;
+    int irq_fd;
+} channel_t;
+
+/* Message sent over the socket of a protected procedure call, in both directions */
+typedef struct ppc_msg {
+    seL4_Word label;
+    seL4_Word count;
+    seL4_Word mrs[MICROKIT_MAX_MRS];
+} ppc_msg_t;
+
+char microkit_name[MICROKIT_PD_NAME_LENGTH];
+seL4_Word microkit_mrs[MICROKIT_MAX_MRS];
+
+static channel_t channels[MICROKIT_MAX_CHANNELS];
+static int epoll_fd = -1;
+
+bool microkit_have_signal;
+seL4_CPtr microkit_signal_cap;
+
+static void fatal(const char *msg)
+{
+    fprintf(stderr, "LINUX MICROKIT|%s: %s\n", microkit_name, msg);
+    exit(1);
+}
+
+static void epoll_set(int fd, uint64_t tag, uint32_t events, int op)
+{
+    struct epoll_event event = { .events = events, .data.u64 = tag };
+    if (epoll_ctl(epoll_fd, op, fd, &event)) {
+        fatal("could not watch file descriptor");
+    }
+}
+
+static channel_t *get_channel(microkit_channel ch)
+{
+    if (ch >= MICROKIT_MAX_CHANNELS) {
+        fatal("invalid channel");
+    }
+    return &channels[ch];
+}
+
+__attribute__((weak)) microkit_msginfo protected(microkit_channel ch, microkit_msginfo msginfo)
+{
+    fatal("received a protected procedure call without a protected entry point");
+    return msginfo;
+}
+
+void microkit_dbg_putc(int c)
+{
+    fputc(c, stdout);
+    if (c == '\n') {
+        fflush(stdout);
+    }
+}
+
+void microkit_dbg_puts(const char *s)
+{
+    fputs(s, stdout);
+    fflush(stdout);
+}
+
+void microkit_notify(microkit_channel ch)
+{
+    channel_t *channel = get_channel(ch);
+    if (channel->signal_fd < 0) {
+        fatal("notify on a channel that is not connected");
+    }
+    uint64_t value = 1;
+    if (write(channel->signal_fd, &value, sizeof(value)) != sizeof(value)) {
+        fatal("could not signal notification");
+    }
+}
+
+void microkit_irq_ack(microkit_channel ch)
+{
+    channel_t *channel = get_channel(ch);
+    if (channel->irq_fd >= 0) {
+        epoll_set(channel->irq_fd, EVENT_TAG(EVENT_IRQ, ch), EPOLLIN | EPOLLONESHOT, EPOLL_CTL_MOD);
+    }
+}
+
+microkit_msginfo microkit_ppcall(microkit_channel ch, microkit_msginfo msginfo)
+{
+    channel_t *channel = get_channel(ch);
+    if (channel->ppcall_fd < 0) {
+        fatal("ppcall on a channel that does not allow it");
+    }
+
+    ppc_msg_t msg = { .label = msginfo.label, .count = msginfo.count };
+    if (msg.count > MICROKIT_MAX_MRS) {
+        fatal("ppcall with too many message registers");
+    }
+    memcpy(msg.mrs, microkit_mrs, msg.count * sizeof(seL4_Word));
+    if (send(channel->ppcall_fd, &msg, sizeof(msg), 0) != sizeof(msg)) {
+        fatal("could not send ppcall");
+    }
+    if (recv(channel->ppcall_fd, &msg, sizeof(msg), 0) != sizeof(msg)) {
+        fatal("could not receive ppcall reply");
+    }
+    /* The count comes from another process, so it cannot be trusted */
+    if (msg.count > MICROKIT_MAX_MRS) {
+        fatal("ppcall reply with too many message registers");
+    }
+    memcpy(microkit_mrs, msg.mrs, msg.count * sizeof(seL4_Word));
+
+    return microkit_msginfo_new(msg.label, msg.count);
+}
+
+void microkit_deferred_notify(microkit_channel ch)
+{
+    microkit_have_signal = true;
+    microkit_signal_cap = BASE_OUTPUT_NOTIFICATION_CAP + ch;
+}
+
+void microkit_deferred_irq_ack(microkit_channel ch)
+{
+    microkit_have_signal = true;
+    microkit_signal_cap = BASE_IRQ_CAP + ch;
+}
+
+void microkit_linux_irq_fd(int fd, microkit_channel ch)
+{
+    channel_t *channel = get_channel(ch);
+    channel->irq_fd = fd;
+    /* One shot, so that the interrupt is masked until it is acknowledged */
+    epoll_set(fd, EVENT_TAG(EVENT_IRQ, ch), EPOLLIN | EPOLLONESHOT, EPOLL_CTL_ADD);
+}
+
+static void run_deferred(void)
+{
+    if (!microkit_have_signal) {
+        return;
+    }
+    microkit_have_signal = false;
+    if (microkit_signal_cap >= BASE_IRQ_CAP) {
+        microkit_irq_ack(microkit_signal_cap - BASE_IRQ_CAP);
+    } else {
+        microkit_notify(microkit_signal_cap - BASE_OUTPUT_NOTIFICATION_CAP);
+    }
+}
+
+static void handle_protected(microkit_channel ch)
+{
+    int fd = channels[ch].protected_fd;
+    ppc_msg_t msg;
+    ssize_t len = recv(fd, &msg, sizeof(msg), 0);
+    if (len == 0) {
+        /* The caller has exited */
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        return;
+    }
+    if (len != sizeof(msg)) {
+        fatal("could not receive ppcall");
+    }
+    if (msg.count > MICROKIT_MAX_MRS) {
+        fatal("ppcall with too many message registers");
+    }
+
+    memcpy(microkit_mrs, msg.mrs, msg.count * sizeof(seL4_Word));
+    microkit_msginfo reply = protected(ch, microkit_msginfo_new(msg.label, msg.count));
+
+    msg.label = reply.label;
+    msg.count = reply.count;
+    if (msg.count > MICROKIT_MAX_MRS) {
+        fatal("ppcall reply from the protected entry point with too many message registers");
+    }
+    memcpy(msg.mrs, microkit_mrs, msg.count * sizeof(seL4_Word));
+    if (send(fd, &msg, sizeof(msg), 0) != sizeof(msg)) {
+        fatal("could not send ppcall reply");
+    }
+}
+
+static void set_symbol(const char *symbol, uintptr_t value)
+{
+    uintptr_t *addr = dlsym(RTLD_DEFAULT, symbol);
+    if (addr == NULL) {
+        fprintf(stderr, "LINUX MICROKIT|%s: symbol '%s' not found, is the program linked with -rdynamic?\n",
+                microkit_name, symbol);
+        exit(1);
+    }
+    *addr = value;
+}
+
+static void map_region(int fd, uintptr_t vaddr, size_t size, const char *perms)
+{
+    int prot = 0;
+    if (strchr(perms, 'r')) {
+        prot |= PROT_READ;
+    }
+    if (strchr(perms, 'w')) {
+        prot |= PROT_WRITE;
+    }
+    if (strchr(perms, 'x')) {
+        prot |= PROT_EXEC;
+    }
+
+    void *addr = mmap((void *)vaddr, size, prot, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (addr != (void *)vaddr) {
+        fprintf(stderr, "LINUX MICROKIT|%s: could not map region at 0x%lx: %s\n", microkit_name, vaddr,
+                addr == MAP_FAILED ? strerror(errno) : "address in use");
+        exit(1);
+    }
+    close(fd);
+}
+
+static void load_config(const char *path)
+{
+    FILE *config = fopen(path, "r");
+    if (config == NULL) {
+        fprintf(stderr, "LINUX MICROKIT: could not open configuration '%s'\n", path);
+        exit(1);
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), config)) {
+        char kind[32], str[128], perms[8];
+        unsigned int ch;
+        int fd, fd2;
+        uintptr_t vaddr, value;
+        size_t size;
+
+        if (sscanf(line, "name %15s", microkit_name) == 1) {
+            continue;
+        } else if (sscanf(line, "map %d %lx %lx %7s", &fd, &vaddr, &size, perms) == 4) {
+            map_region(fd, vaddr, size, perms);
+        } else if (sscanf(line, "setvar %127s %lx", str, &value) == 2) {
+            set_symbol(str, value);
+        } else if (sscanf(line, "channel %u %d %d", &ch, &fd, &fd2) == 3) {
+            get_channel(ch)->wait_fd = fd;
+            get_channel(ch)->signal_fd = fd2;
+            epoll_set(fd, EVENT_TAG(EVENT_NOTIFICATION, ch), EPOLLIN, EPOLL_CTL_ADD);
+        } else if (sscanf(line, "%31s %u %d", kind, &ch, &fd) == 3 && !strcmp(kind, "ppcall")) {
+            get_channel(ch)->ppcall_fd = fd;
+        } else if (sscanf(line, "%31s %u %d", kind, &ch, &fd) == 3 && !strcmp(kind, "protected")) {
+            get_channel(ch)->protected_fd = fd;
+            epoll_set(fd, EVENT_TAG(EVENT_PROTECTED, ch), EPOLLIN, EPOLL_CTL_ADD);
+        } else {
+            fprintf(stderr, "LINUX MICROKIT: invalid configuration line '%s'\n", line);
+            exit(1);
+        }
+    }
+
+    fclose(config);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <configuration>\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < MICROKIT_MAX_CHANNELS; i++) {
+        channels[i] = (channel_t) { -1, -1, -1, -1, -1 };
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        fatal("could not create epoll instance");
+    }
+
+    load_config(argv[1]);
+
+    init();
+    run_deferred();
+
+    while (true) {
+        struct epoll_event events[MAX_EVENTS];
+        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (num_events < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal("could not wait for events");
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            uint32_t kind = events[i].data.u64 >> 32;
+            microkit_channel ch = events[i].data.u64 & 0xffffffff;
+
+            switch (kind) {
+            case EVENT_NOTIFICATION: {
+                /* Reading the eventfd clears it, so notifications coalesce as on seL4 */
+                uint64_t value;
+                if (read(channels[ch].wait_fd, &value, sizeof(value)) != sizeof(value)) {
+                    continue;
+                }
+                notified(ch);
+                break;
+            }
+            case EVENT_IRQ:
+                notified(ch);
+                break;
+            case EVENT_PROTECTED:
+                handle_protected(ch);
+                break;
+            }
+
+            run_deferred();
+        }
+    }
+
+    return 0;
+}
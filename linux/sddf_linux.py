@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Run a Microkit system on a Linux host, with every protection domain as a
+# process built against libmicrokit_linux.a. See linux/README.md.
+
+import argparse
+import os
+import shlex
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import xml.etree.ElementTree as ET
+
+# Memory regions without a physical address are given fake ones from here, so
+# that components translating between physical and virtual addresses still work
+FAKE_PADDR_BASE = 0x10_0000_0000
+
+
+def parse_int(value):
+    return int(value.replace("_", ""), 0)
+
+
+class MemoryRegion:
+    def __init__(self, name, size, page_size, paddr):
+        self.name = name
+        self.size = size
+        self.page_size = page_size
+        self.paddr = paddr
+        self.fd = os.memfd_create(name, 0)
+        os.ftruncate(self.fd, size)
+
+
+class ProtectionDomain:
+    def __init__(self, name, image):
+        self.name = name
+        self.image = image
+        self.config = []
+        self.fds = []
+
+    def add_fd(self, fd):
+        self.fds.append(fd)
+        return fd
+
+
+def parse_system(path):
+    root = ET.parse(path).getroot()
+
+    mrs = {}
+    next_paddr = FAKE_PADDR_BASE
+    for mr in root.iter("memory_region"):
+        size = parse_int(mr.get("size"))
+        page_size = parse_int(mr.get("page_size", "0x1000"))
+        if mr.get("phys_addr") is not None:
+            paddr = parse_int(mr.get("phys_addr"))
+        else:
+            next_paddr = (next_paddr + page_size - 1) & ~(page_size - 1)
+            paddr = next_paddr
+            next_paddr += size
+        mrs[mr.get("name")] = MemoryRegion(mr.get("name"), size, page_size, paddr)
+
+    pds = {}
+    for pd in root.iter("protection_domain"):
+        name = pd.get("name")
+        image = pd.find("program_image").get("path")
+        pds[name] = ProtectionDomain(name, image)
+        pds[name].config.append(f"name {name}")
+
+        for m in pd.findall("map"):
+            mr = mrs[m.get("mr")]
+            vaddr = parse_int(m.get("vaddr"))
+            fd = pds[name].add_fd(os.dup(mr.fd))
+            pds[name].config.append(f"map {fd} {vaddr:x} {mr.size:x} {m.get('perms', 'rw')}")
+            if m.get("setvar_vaddr") is not None:
+                pds[name].config.append(f"setvar {m.get('setvar_vaddr')} {vaddr:x}")
+
+        for setvar in pd.findall("setvar"):
+            mr = mrs[setvar.get("region_paddr")]
+            pds[name].config.append(f"setvar {setvar.get('symbol')} {mr.paddr:x}")
+
+    for channel in root.iter("channel"):
+        ends = channel.findall("end")
+        events = [os.eventfd(0, os.EFD_NONBLOCK) for _ in ends]
+        for i, end in enumerate(ends):
+            pd = pds[end.get("pd")]
+            peer = ends[1 - i]
+            wait_fd = pd.add_fd(os.dup(events[i]))
+            signal_fd = pd.add_fd(os.dup(events[1 - i]))
+            pd.config.append(f"channel {end.get('id')} {wait_fd} {signal_fd}")
+
+            if end.get("pp", "false") == "true":
+                caller, callee = socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+                pd.config.append(f"ppcall {end.get('id')} {pd.add_fd(caller.detach())}")
+                peer_pd = pds[peer.get("pd")]
+                peer_pd.config.append(f"protected {peer.get('id')} {peer_pd.add_fd(callee.detach())}")
+
+        for fd in events:
+            os.close(fd)
+
+    for mr in mrs.values():
+        os.close(mr.fd)
+
+    return pds
+
+
+def find_image(image, search_paths):
+    for path in search_paths:
+        candidate = os.path.join(path, image)
+        if os.path.isfile(candidate):
+            return candidate
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run a Microkit system as Linux processes")
+    parser.add_argument("system", help="System Description File")
+    parser.add_argument("--search-path", action="append", default=[],
+                        help="directory to search for program images built for Linux")
+    parser.add_argument("--exclude", action="append", default=[],
+                        help="protection domain not to run, such as a device driver")
+    parser.add_argument("--wrap", action="append", default=[], metavar="PD=COMMAND",
+                        help="run a protection domain under a command, such as 'perf record -g --'")
+    args = parser.parse_args()
+
+    wrappers = {}
+    for wrap in args.wrap:
+        pd, _, command = wrap.partition("=")
+        wrappers[pd] = shlex.split(command)
+
+    pds = parse_system(args.system)
+    for name in args.exclude + list(wrappers):
+        if name not in pds:
+            sys.exit(f"unknown protection domain '{name}'")
+
+    search_paths = args.search_path or ["."]
+    missing = False
+    for pd in pds.values():
+        if pd.name not in args.exclude:
+            pd.image = find_image(pd.image, search_paths) or pd.image
+            if not os.path.isfile(pd.image):
+                print(f"program image '{pd.image}' of '{pd.name}' not found", file=sys.stderr)
+                missing = True
+    if missing:
+        sys.exit("build the missing images for Linux or exclude their protection domains")
+
+    config_dir = tempfile.TemporaryDirectory(prefix="sddf_linux_")
+    procs = {}
+    for pd in pds.values():
+        if pd.name in args.exclude:
+            continue
+        config_path = os.path.join(config_dir.name, pd.name)
+        with open(config_path, "w") as config:
+            config.write("\n".join(pd.config) + "\n")
+        command = wrappers.get(pd.name, []) + [os.path.abspath(pd.image), config_path]
+        procs[pd.name] = subprocess.Popen(command, pass_fds=pd.fds)
+        print(f"{pd.name}: pid {procs[pd.name].pid}", file=sys.stderr)
+
+    for pd in pds.values():
+        for fd in pd.fds:
+            os.close(fd)
+
+    # Make sure the protection domains are stopped along with this script
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(1))
+    try:
+        # Protection domains never return, so the system stops when any of them exits
+        pid, status = os.wait()
+        for name, proc in procs.items():
+            if proc.pid == pid:
+                print(f"{name} exited with status {os.waitstatus_to_exitcode(status)}", file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        signal.signal(signal.SIGTERM, signal.SIG_IGN)
+        for proc in procs.values():
+            if proc.poll() is None:
+                proc.terminate()
+        for proc in procs.values():
+            proc.wait()
+
+
+if __name__ == "__main__":
+    main()
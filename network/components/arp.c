@@ -7,18 +7,36 @@
 #include <microkit.h>
 #include <sddf/network/queue.h>
 #include <sddf/network/constants.h>
+#include <sddf/network/checksum.h>
+#include <sddf/network/arp.h>
 #include <sddf/network/util.h>
+#include <sddf/timer/client.h>
 #include <sddf/util/printf.h>
 #include <ethernet_config.h>
 
 #define RX_CH 0
 #define TX_CH 1
 #define CLIENT_CH 2
-#define REG_IP 0
 #define IPV4_PROTO_LEN 4
 #define PADDING_SIZE 10
 #define LWIP_IANA_HWTYPE_ETHERNET 1
 #define NUM_ARP_CLIENTS (NUM_NETWORK_CLIENTS - 1)
+#define TIMER_CH (CLIENT_CH + NUM_ARP_CLIENTS)
+
+/* Maximum number of ARP replies held back until transmit buffers become available */
+#define ARP_MAX_PENDING 64
+
+/* Interval between gratuitous ARP announcements of every registered address */
+#ifndef ARP_ANNOUNCE_INTERVAL_NS
+#define ARP_ANNOUNCE_INTERVAL_NS (60 * NS_IN_S)
+#endif
+
+#define ARP_PACKET_LEN 56
+
+#define NDP_OPT_SOURCE_LL_ADDR 1
+#define NDP_OPT_TARGET_LL_ADDR 2
+#define NDP_NA_FLAG_SOLICITED 0x40000000U
+#define NDP_NA_FLAG_OVERRIDE 0x20000000U
 
 net_queue_handle_t rx_queue;
 net_queue_handle_t tx_queue;
@@ -31,8 +49,12 @@ net_queue_t *tx_active;
 uintptr_t rx_buffer_data_region;
 uintptr_t tx_buffer_data_region;
 
+/* MAC addresses of the clients, which their IPv6 addresses are answered for with */
 uint8_t mac_addrs[NUM_ARP_CLIENTS][ETH_HWADDR_LEN];
-uint32_t ipv4_addrs[NUM_ARP_CLIENTS];
+
+/* All-nodes multicast address ff02::1, and the MAC address it maps to */
+static const uint8_t ipv6_all_nodes[IPV6_ADDR_LEN] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+static const uint8_t mac_all_nodes[ETH_HWADDR_LEN] = { 0x33, 0x33, 0, 0, 0, 0x01 };
 
 struct __attribute__((__packed__)) arp_packet {
     uint8_t ethdst_addr[ETH_HWADDR_LEN];
@@ -51,6 +73,39 @@ struct __attribute__((__packed__)) arp_packet {
     uint32_t crc;
 };
 
+/* Registered IPv4 and IPv6 addresses, in the address table region, see sddf/network/arp.h */
+arp_entry_t *arp_table;
+uint32_t arp_num_addrs;
+/* Number of entries with announce set */
+uint32_t arp_num_announce;
+
+/* ARP request or Neighbor Solicitation that could not be answered for lack of transmit buffers */
+typedef struct arp_pending {
+    uint8_t type; /* ARP_ENTRY_IPV4 for an ARP reply, ARP_ENTRY_IPV6 for a Neighbor Advertisement */
+    /* looked up again when sending, as entries move when addresses are removed */
+    union {
+        uint32_t ipv4_addr;
+        uint8_t ipv6_addr[IPV6_ADDR_LEN];
+    };
+    uint8_t hwdst_addr[ETH_HWADDR_LEN];
+    union {
+        uint32_t ipdst_addr;
+        uint8_t ipv6dst_addr[IPV6_ADDR_LEN];
+    };
+    uint32_t ndp_flags;
+} arp_pending_t;
+
+arp_pending_t arp_pending[ARP_MAX_PENDING];
+uint32_t arp_pending_head;
+uint32_t arp_pending_tail;
+
+/* Frames built during the current event, handed to the transmit virtualiser together */
+net_buff_desc_t tx_batch[NET_TX_QUEUE_CAPACITY_ARP];
+uint32_t tx_batch_len;
+
+#define NDP_ICMP_LEN (sizeof(struct ndp_packet) - sizeof(struct ethernet_header) - sizeof(struct ipv6_header))
+#define NDP_NA_ICMP_LEN (NDP_ICMP_LEN + sizeof(struct ndp_option_ll_addr))
+
 static char *ipaddr_to_string(uint32_t s_addr, char *buf, int buflen)
 {
     char inv[3], *rp;
@@ -82,58 +137,400 @@ static char *ipaddr_to_string(uint32_t s_addr, char *buf, int buflen)
     return buf;
 }
 
-static int match_ip_to_client(uint32_t addr)
+static arp_entry_t *arp_lookup(uint32_t addr)
 {
-    for (int i = 0; i < NUM_ARP_CLIENTS; i++) {
-        if (ipv4_addrs[i] == addr) {
-            return i;
+    if (addr == 0) {
+        return NULL;
+    }
+    arp_entry_t *entry = arp_table_slot(arp_table, ARP_ENTRY_IPV4, &addr);
+    return entry->type != ARP_ENTRY_EMPTY ? entry : NULL;
+}
+
+static arp_entry_t *arp_lookup_ipv6(const uint8_t addr[IPV6_ADDR_LEN])
+{
+    arp_entry_t *entry = arp_table_slot(arp_table, ARP_ENTRY_IPV6, addr);
+    return entry->type != ARP_ENTRY_EMPTY ? entry : NULL;
+}
+
+/**
+ * Insert an address into the address table, or update it if it is already registered.
+ *
+ * @param type ARP_ENTRY_IPV4 or ARP_ENTRY_IPV6.
+ * @param addr IPv4 address in network byte order, or IPv6 address.
+ * @param mac MAC address to answer with.
+ * @param client client registering the address.
+ *
+ * @return the entry holding the address, NULL if the table is full.
+ */
+static arp_entry_t *arp_insert(uint8_t type, const void *addr, const uint8_t mac[ETH_HWADDR_LEN], uint8_t client)
+{
+    arp_entry_t *entry = arp_table_slot(arp_table, type, addr);
+    if (entry->type == ARP_ENTRY_EMPTY) {
+        if (arp_num_addrs == ARP_MAX_ADDRS) {
+            return NULL;
         }
+        arp_num_addrs++;
+        memcpy(entry->ipv6_addr, addr, (type == ARP_ENTRY_IPV4) ? sizeof(uint32_t) : IPV6_ADDR_LEN);
     }
+    memcpy(entry->mac_addr, mac, ETH_HWADDR_LEN);
+    entry->client = client;
+    /* The RX virtualiser must not see the entry before its address */
+    __atomic_store_n(&entry->type, type, __ATOMIC_RELEASE);
 
-    return -1;
+    return entry;
 }
 
-static int arp_reply(const uint8_t ethsrc_addr[ETH_HWADDR_LEN],
-                     const uint8_t ethdst_addr[ETH_HWADDR_LEN],
-                     const uint8_t hwsrc_addr[ETH_HWADDR_LEN], const uint32_t ipsrc_addr,
-                     const uint8_t hwdst_addr[ETH_HWADDR_LEN], const uint32_t ipdst_addr)
+/**
+ * Remove an entry from the address table. Later entries of the probe sequence are shifted
+ * back into the gap, so that arp_table_slot still finds them.
+ *
+ * @param entry entry to remove, which then holds the next entry to look at when iterating.
+ */
+static void arp_remove(arp_entry_t *entry)
 {
-    if (net_queue_empty_free(&tx_queue)) {
-        sddf_dprintf("ARP|LOG: Transmit free queue empty or transmit active queue full. Dropping reply\n");
-        return -1;
+    if (entry->announce) {
+        arp_num_announce--;
     }
+    arp_num_addrs--;
 
-    net_buff_desc_t buffer;
-    int err = net_dequeue_free(&tx_queue, &buffer);
-    assert(!err);
+    uint32_t gap = entry - arp_table;
+    uint32_t i = (gap + 1) & (ARP_TABLE_SIZE - 1);
+    while (arp_table[i].type != ARP_ENTRY_EMPTY) {
+        /* An entry may only move back to a slot between its hash and where it is */
+        uint32_t home = arp_entry_hash(&arp_table[i]);
+        if (((i - home) & (ARP_TABLE_SIZE - 1)) >= ((i - gap) & (ARP_TABLE_SIZE - 1))) {
+            arp_table[gap] = arp_table[i];
+            gap = i;
+        }
+        i = (i + 1) & (ARP_TABLE_SIZE - 1);
+    }
+    arp_table[gap] = (arp_entry_t) { 0 };
+}
 
-    struct arp_packet *reply = (struct arp_packet *)(tx_buffer_data_region + buffer.io_or_offset);
-    memcpy(&reply->ethdst_addr, ethdst_addr, ETH_HWADDR_LEN);
-    memcpy(&reply->ethsrc_addr, ethsrc_addr, ETH_HWADDR_LEN);
-
-    reply->type = HTONS(ETH_TYPE_ARP);
-    reply->hwtype = HTONS(LWIP_IANA_HWTYPE_ETHERNET);
-    reply->proto = HTONS(ETH_TYPE_IP);
-    reply->hwlen = ETH_HWADDR_LEN;
-    reply->protolen = IPV4_PROTO_LEN;
-    reply->opcode = HTONS(ETHARP_OPCODE_REPLY);
-
-    memcpy(&reply->hwsrc_addr, hwsrc_addr, ETH_HWADDR_LEN);
-    reply->ipsrc_addr = ipsrc_addr;
-    memcpy(&reply->hwdst_addr, hwdst_addr, ETH_HWADDR_LEN);
-    reply->ipdst_addr = ipdst_addr;
-    memset(&reply->padding, 0, 10);
-
-    buffer.len = 56;
-    err = net_enqueue_active(&tx_queue, buffer);
+/**
+ * Get a transmit buffer to build a frame in. The frame is sent by tx_batch_commit.
+ *
+ * @return address of the buffer, 0 if no transmit buffer is free.
+ */
+static uintptr_t tx_batch_next(void)
+{
+    if (net_dequeue_free(&tx_queue, &tx_batch[tx_batch_len])) {
+        return 0;
+    }
+    return tx_buffer_data_region + tx_batch[tx_batch_len].io_or_offset;
+}
+
+static void tx_batch_commit(uint16_t len)
+{
+    tx_batch[tx_batch_len++].len = len;
+}
+
+/**
+ * Hand every frame built since the last publish to the transmit virtualiser.
+ *
+ * @param deferred whether to defer the notification until returning from notified.
+ */
+static void tx_batch_publish(bool deferred)
+{
+    if (tx_batch_len == 0) {
+        return;
+    }
+
+    int err = net_enqueue_active_batch(&tx_queue, tx_batch, tx_batch_len);
     assert(!err);
+    tx_batch_len = 0;
+
+    if (net_require_signal_active(&tx_queue)) {
+        net_cancel_signal_active(&tx_queue);
+        if (deferred) {
+            microkit_deferred_notify(TX_CH);
+        } else {
+            microkit_notify(TX_CH);
+        }
+    }
+}
+
+static bool ipv6_addr_unspecified(const uint8_t addr[IPV6_ADDR_LEN])
+{
+    for (int i = 0; i < IPV6_ADDR_LEN; i++) {
+        if (addr[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Compute the ICMPv6 checksum of a message, including the IPv6 pseudo header (RFC 8200, section 8.1).
+ *
+ * @param ip IPv6 header preceding the message.
+ * @param icmp start of the ICMPv6 message.
+ * @param len length of the ICMPv6 message.
+ *
+ * @return checksum to place in the message.
+ */
+static uint16_t icmpv6_chksum(const struct ipv6_header *ip, const void *icmp, uint16_t len)
+{
+    uint32_t sum = net_chksum(ip->src, IPV6_ADDR_LEN);
+    sum += net_chksum(ip->dest, IPV6_ADDR_LEN);
+    sum += HTONS(len);
+    sum += HTONS(IPV6_NEXT_HEADER_ICMPV6);
+    sum += net_chksum(icmp, len);
+    return ~net_chksum_fold(sum);
+}
+
+/**
+ * Find the source link-layer address option of a Neighbor Solicitation.
+ *
+ * @param pkt Neighbor Solicitation.
+ * @param len length of the frame.
+ *
+ * @return MAC address in the option, NULL if there is none.
+ */
+static const uint8_t *ndp_source_ll_addr(const struct ndp_packet *pkt, uint16_t len)
+{
+    uintptr_t opt = (uintptr_t)pkt->options;
+    uintptr_t end = (uintptr_t)pkt + len;
+    while (opt + 2 <= end) {
+        const struct ndp_option_ll_addr *ll = (const struct ndp_option_ll_addr *)opt;
+        /* Option length is in units of 8 bytes, and zero is invalid */
+        if (ll->len == 0 || opt + ll->len * 8 > end) {
+            return NULL;
+        }
+        if (ll->type == NDP_OPT_SOURCE_LL_ADDR && ll->len == 1) {
+            return ll->addr;
+        }
+        opt += ll->len * 8;
+    }
+
+    return NULL;
+}
+
+/**
+ * Build a Neighbor Advertisement for a registered address into a transmit buffer.
+ *
+ * @param entry registered target address.
+ * @param ethdst_addr destination MAC address of the frame.
+ * @param ipdst_addr destination IPv6 address.
+ * @param flags NDP_NA_FLAG_* flags in host byte order.
+ *
+ * @return -1 if there was no free transmit buffer, 0 otherwise.
+ */
+static int ndp_send(const arp_entry_t *entry, const uint8_t ethdst_addr[ETH_HWADDR_LEN],
+                    const uint8_t ipdst_addr[IPV6_ADDR_LEN], uint32_t flags)
+{
+    struct ndp_packet *reply = (struct ndp_packet *)tx_batch_next();
+    if (reply == NULL) {
+        return -1;
+    }
+
+    memcpy(&reply->eth.dest, ethdst_addr, ETH_HWADDR_LEN);
+    memcpy(reply->ip.dest, ipdst_addr, IPV6_ADDR_LEN);
+    reply->flags = HTONL(flags);
+    memcpy(&reply->eth.src, entry->mac_addr, ETH_HWADDR_LEN);
+    reply->eth.type = HTONS(ETH_TYPE_IPV6);
+
+    reply->ip.version_class_flow = HTONL(6U << 28);
+    reply->ip.payload_len = HTONS(NDP_NA_ICMP_LEN);
+    reply->ip.next_header = IPV6_NEXT_HEADER_ICMPV6;
+    reply->ip.hop_limit = NDP_HOP_LIMIT;
+    memcpy(reply->ip.src, entry->ipv6_addr, IPV6_ADDR_LEN);
+
+    reply->icmp_type = ICMPV6_TYPE_NEIGHBOR_ADVERTISEMENT;
+    reply->icmp_code = 0;
+    reply->icmp_chksum = 0;
+    memcpy(reply->target, entry->ipv6_addr, IPV6_ADDR_LEN);
+    reply->options[0].type = NDP_OPT_TARGET_LL_ADDR;
+    reply->options[0].len = 1;
+    memcpy(reply->options[0].addr, entry->mac_addr, ETH_HWADDR_LEN);
+    reply->icmp_chksum = icmpv6_chksum(&reply->ip, &reply->icmp_type, NDP_NA_ICMP_LEN);
+
+    tx_batch_commit(sizeof(struct ethernet_header) + sizeof(struct ipv6_header) + NDP_NA_ICMP_LEN);
 
     return 0;
 }
 
+/**
+ * Build an ARP packet from a registered address into a transmit buffer.
+ *
+ * @param entry registered address the packet is sent on behalf of.
+ * @param opcode ARP opcode.
+ * @param ethdst_addr destination MAC address of the frame.
+ * @param hwdst_addr target hardware address.
+ * @param ipdst_addr target IPv4 address.
+ *
+ * @return -1 if there was no free transmit buffer, 0 otherwise.
+ */
+static int arp_send(const arp_entry_t *entry, uint16_t opcode, const uint8_t ethdst_addr[ETH_HWADDR_LEN],
+                    const uint8_t hwdst_addr[ETH_HWADDR_LEN], uint32_t ipdst_addr)
+{
+    struct arp_packet *pkt = (struct arp_packet *)tx_batch_next();
+    if (pkt == NULL) {
+        return -1;
+    }
+
+    memcpy(&pkt->ethdst_addr, ethdst_addr, ETH_HWADDR_LEN);
+    memcpy(&pkt->ethsrc_addr, entry->mac_addr, ETH_HWADDR_LEN);
+
+    pkt->type = HTONS(ETH_TYPE_ARP);
+    pkt->hwtype = HTONS(LWIP_IANA_HWTYPE_ETHERNET);
+    pkt->proto = HTONS(ETH_TYPE_IP);
+    pkt->hwlen = ETH_HWADDR_LEN;
+    pkt->protolen = IPV4_PROTO_LEN;
+    pkt->opcode = HTONS(opcode);
+
+    memcpy(&pkt->hwsrc_addr, entry->mac_addr, ETH_HWADDR_LEN);
+    pkt->ipsrc_addr = entry->ipv4_addr;
+    memcpy(&pkt->hwdst_addr, hwdst_addr, ETH_HWADDR_LEN);
+    pkt->ipdst_addr = ipdst_addr;
+    memset(&pkt->padding, 0, PADDING_SIZE);
+
+    tx_batch_commit(ARP_PACKET_LEN);
+
+    return 0;
+}
+
+/**
+ * Reserve a slot to hold back a reply until transmit buffers become available.
+ *
+ * @return the slot to fill in, NULL if too many replies are held back already.
+ */
+static arp_pending_t *arp_pending_push(void)
+{
+    if (arp_pending_tail - arp_pending_head == ARP_MAX_PENDING) {
+        sddf_dprintf("ARP|LOG: Transmit free queue empty and pending replies full. Dropping reply\n");
+        return NULL;
+    }
+
+    /* Have the transmit virtualiser tell us when buffers are returned */
+    net_request_signal_free(&tx_queue);
+
+    return &arp_pending[arp_pending_tail++ % ARP_MAX_PENDING];
+}
+
+/**
+ * Answer an ARP request for a registered address, or hold it back until transmit buffers become available.
+ */
+static void arp_reply(arp_entry_t *entry, const uint8_t hwdst_addr[ETH_HWADDR_LEN], uint32_t ipdst_addr)
+{
+    if (arp_pending_head == arp_pending_tail && !arp_send(entry, ETHARP_OPCODE_REPLY, hwdst_addr, hwdst_addr,
+                                                          ipdst_addr)) {
+        return;
+    }
+
+    arp_pending_t *pending = arp_pending_push();
+    if (pending == NULL) {
+        return;
+    }
+    pending->type = ARP_ENTRY_IPV4;
+    pending->ipv4_addr = entry->ipv4_addr;
+    memcpy(pending->hwdst_addr, hwdst_addr, ETH_HWADDR_LEN);
+    pending->ipdst_addr = ipdst_addr;
+}
+
+/**
+ * Answer a Neighbor Solicitation for a client's address with a Neighbor Advertisement (RFC 4861, section 7.2.4),
+ * or hold it back until transmit buffers become available. Solicitations from the unspecified address are
+ * duplicate address detection probes, and are answered to the all-nodes multicast address.
+ *
+ * @param entry registered target address.
+ * @param ns Neighbor Solicitation.
+ * @param len length of the Neighbor Solicitation frame.
+ */
+static void ndp_reply(const arp_entry_t *entry, const struct ndp_packet *ns, uint16_t len)
+{
+    const uint8_t *ethdst_addr;
+    const uint8_t *ipdst_addr;
+    uint32_t flags;
+    if (ipv6_addr_unspecified(ns->ip.src)) {
+        ethdst_addr = mac_all_nodes;
+        ipdst_addr = ipv6_all_nodes;
+        flags = NDP_NA_FLAG_OVERRIDE;
+    } else {
+        ethdst_addr = ndp_source_ll_addr(ns, len);
+        if (ethdst_addr == NULL) {
+            ethdst_addr = ns->eth.src.addr;
+        }
+        ipdst_addr = ns->ip.src;
+        flags = NDP_NA_FLAG_SOLICITED | NDP_NA_FLAG_OVERRIDE;
+    }
+
+    if (arp_pending_head == arp_pending_tail && !ndp_send(entry, ethdst_addr, ipdst_addr, flags)) {
+        return;
+    }
+
+    arp_pending_t *pending = arp_pending_push();
+    if (pending == NULL) {
+        return;
+    }
+    pending->type = ARP_ENTRY_IPV6;
+    memcpy(pending->ipv6_addr, entry->ipv6_addr, IPV6_ADDR_LEN);
+    memcpy(pending->hwdst_addr, ethdst_addr, ETH_HWADDR_LEN);
+    memcpy(pending->ipv6dst_addr, ipdst_addr, IPV6_ADDR_LEN);
+    pending->ndp_flags = flags;
+}
+
+/* Send replies held back for lack of transmit buffers */
+static void arp_send_pending(void)
+{
+    while (arp_pending_head != arp_pending_tail) {
+        arp_pending_t *pending = &arp_pending[arp_pending_head % ARP_MAX_PENDING];
+        /* The address may have been removed since the request arrived */
+        int err = 0;
+        if (pending->type == ARP_ENTRY_IPV4) {
+            arp_entry_t *entry = arp_lookup(pending->ipv4_addr);
+            if (entry != NULL) {
+                err = arp_send(entry, ETHARP_OPCODE_REPLY, pending->hwdst_addr, pending->hwdst_addr,
+                               pending->ipdst_addr);
+            }
+        } else {
+            arp_entry_t *entry = arp_lookup_ipv6(pending->ipv6_addr);
+            if (entry != NULL) {
+                err = ndp_send(entry, pending->hwdst_addr, pending->ipv6dst_addr, pending->ndp_flags);
+            }
+        }
+        if (err) {
+            net_request_signal_free(&tx_queue);
+            return;
+        }
+        arp_pending_head++;
+    }
+    net_cancel_signal_free(&tx_queue);
+}
+
+/* Send a gratuitous ARP (RFC 5227, section 2.3) for every address that is due one */
+static void arp_announce(void)
+{
+    static const uint8_t broadcast[ETH_HWADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    static const uint8_t unknown[ETH_HWADDR_LEN] = { 0 };
+
+    for (uint32_t i = 0; i < ARP_TABLE_SIZE && arp_num_announce > 0; i++) {
+        arp_entry_t *entry = &arp_table[i];
+        if (entry->type != ARP_ENTRY_IPV4 || !entry->announce) {
+            continue;
+        }
+        if (arp_send(entry, ETHARP_OPCODE_REQUEST, broadcast, unknown, entry->ipv4_addr)) {
+            /* The remaining announcements are sent once buffers are returned */
+            net_request_signal_free(&tx_queue);
+            return;
+        }
+        entry->announce = false;
+        arp_num_announce--;
+    }
+}
+
+static void arp_announce_all(void)
+{
+    for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+        if (arp_table[i].type == ARP_ENTRY_IPV4 && !arp_table[i].announce) {
+            arp_table[i].announce = true;
+            arp_num_announce++;
+        }
+    }
+}
+
 void receive(void)
 {
-    bool transmitted = false;
     bool reprocess = true;
     while (reprocess) {
         while (!net_queue_empty_active(&rx_queue)) {
@@ -144,19 +541,22 @@ void receive(void)
             /* Check if packet is an ARP request */
             struct ethernet_header *ethhdr = (struct ethernet_header *)(rx_buffer_data_region + buffer.io_or_offset);
             if (ethhdr->type == HTONS(ETH_TYPE_ARP)) {
-                struct arp_packet *pkt = (struct arp_packet *)addr;
+                struct arp_packet *pkt = (struct arp_packet *)ethhdr;
                 /* Check if it's a probe, ignore announcements */
                 if (pkt->opcode == HTONS(ETHARP_OPCODE_REQUEST)) {
                     /* Check it it's for a client */
-                    int client = match_ip_to_client(pkt->ipdst_addr);
-                    if (client >= 0) {
-                        /* Send a response */
-                        if (!arp_reply(mac_addrs[client], pkt->ethsrc_addr, mac_addrs[client], pkt->ipdst_addr,
-                                       pkt->hwsrc_addr, pkt->ipsrc_addr)) {
-                            transmitted = true;
-                        }
+                    arp_entry_t *entry = arp_lookup(pkt->ipdst_addr);
+                    if (entry != NULL) {
+                        arp_reply(entry, pkt->hwsrc_addr, pkt->ipsrc_addr);
                     }
                 }
+            } else if (arp_is_ndp_solicitation(ethhdr, buffer.len)) {
+                struct ndp_packet *pkt = (struct ndp_packet *)ethhdr;
+                /* Check it it's for a client */
+                arp_entry_t *entry = arp_lookup_ipv6(pkt->target);
+                if (entry != NULL) {
+                    ndp_reply(entry, pkt, buffer.len);
+                }
             }
 
             buffer.len = 0;
@@ -172,16 +572,84 @@ void receive(void)
             reprocess = true;
         }
     }
-
-    if (transmitted && net_require_signal_active(&tx_queue)) {
-        net_cancel_signal_active(&tx_queue);
-        microkit_deferred_notify(TX_CH);
-    }
 }
 
 void notified(microkit_channel ch)
 {
+    if (ch == TIMER_CH) {
+        arp_announce_all();
+        sddf_timer_set_timeout(TIMER_CH, ARP_ANNOUNCE_INTERVAL_NS);
+    }
+
+    /* Replies held back go out before anything newer, and announcements are least urgent */
+    arp_send_pending();
     receive();
+    arp_announce();
+
+    tx_batch_publish(true);
+}
+
+static void ipv6_addr_to_string(const uint8_t a[IPV6_ADDR_LEN], char *buf, int buflen)
+{
+    sddf_snprintf(buf, buflen, "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x", a[0], a[1],
+                  a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11], a[12], a[13], a[14], a[15]);
+}
+
+/**
+ * Register an address of a client.
+ *
+ * @param client client registering the address.
+ * @param type ARP_ENTRY_IPV4 or ARP_ENTRY_IPV6.
+ * @param addr IPv4 address in network byte order, or IPv6 address.
+ * @param mac MAC address to answer with.
+ *
+ * @return ARP_OK or an ARP_ERR_* code, the label of the reply.
+ */
+static int arp_add(int client, uint8_t type, const void *addr, const uint8_t mac[ETH_HWADDR_LEN])
+{
+    arp_entry_t *entry = arp_table_slot(arp_table, type, addr);
+    if (entry->type != ARP_ENTRY_EMPTY && entry->client != client) {
+        return ARP_ERR_IN_USE;
+    }
+
+    entry = arp_insert(type, addr, mac, client);
+    if (entry == NULL) {
+        sddf_dprintf("ARP|LOG: address table full, could not register address for client%d\n", client);
+        return ARP_ERR_FULL;
+    }
+
+    if (type == ARP_ENTRY_IPV4) {
+        /* Announce the new address straight away */
+        if (!entry->announce) {
+            entry->announce = true;
+            arp_num_announce++;
+        }
+        arp_announce();
+        tx_batch_publish(false);
+    }
+
+    return ARP_OK;
+}
+
+/**
+ * Remove an address a client registered.
+ *
+ * @param client client removing the address.
+ * @param type ARP_ENTRY_IPV4 or ARP_ENTRY_IPV6.
+ * @param addr IPv4 address in network byte order, or IPv6 address.
+ *
+ * @return ARP_OK or an ARP_ERR_* code, the label of the reply.
+ */
+static int arp_del(int client, uint8_t type, const void *addr)
+{
+    arp_entry_t *entry = arp_table_slot(arp_table, type, addr);
+    if (entry->type == ARP_ENTRY_EMPTY || entry->client != client) {
+        return ARP_ERR_NOT_FOUND;
+    }
+
+    arp_remove(entry);
+
+    return ARP_OK;
 }
 
 seL4_MessageInfo_t protected(microkit_channel ch, microkit_msginfo msginfo)
@@ -189,36 +657,82 @@ seL4_MessageInfo_t protected(microkit_channel ch, microkit_msginfo msginfo)
     int client = ch - CLIENT_CH;
     if (client >= NUM_ARP_CLIENTS || client < 0) {
         sddf_dprintf("ARP|LOG: PPC from unkown client %d\n", client);
-        return microkit_msginfo_new(0, 0);
+        return microkit_msginfo_new(ARP_ERR_INVALID, 0);
     }
 
-    uint32_t ip_addr = microkit_mr_get(0);
-    uint32_t mac_higher = microkit_mr_get(1);
-    uint32_t mac_lower = microkit_mr_get(2);
-    uint64_t mac = (((uint64_t) mac_higher) << 32) | mac_lower;
-
-    char buf[16];
+    uint32_t ipv4_addr;
+    uint8_t ipv6_addr[IPV6_ADDR_LEN];
+    char buf[40];
+    int err;
     switch (microkit_msginfo_get_label(msginfo)) {
-    case REG_IP:
+    case ARP_ADD_IPV4: {
+        ipv4_addr = microkit_mr_get(0);
+        uint32_t mac_higher = microkit_mr_get(1);
+        uint32_t mac_lower = microkit_mr_get(2);
+        uint64_t mac = (((uint64_t) mac_higher) << 32) | mac_lower;
+
         sddf_printf("ARP|NOTICE: client%d registering ip address: %s with MAC: %02lx:%02lx:%02lx:%02lx:%02lx:%02lx\n",
-                    client, ipaddr_to_string(ip_addr, buf, 16), mac >> 40, mac >> 32 & 0xff, mac >> 24 & 0xff,
+                    client, ipaddr_to_string(ipv4_addr, buf, 16), mac >> 40, mac >> 32 & 0xff, mac >> 24 & 0xff,
                     mac >> 16 & 0xff, mac >> 8 & 0xff, mac & 0xff);
-        ipv4_addrs[client] = ip_addr;
+
+        if (ipv4_addr == 0) {
+            err = ARP_ERR_INVALID;
+            break;
+        }
+        uint8_t mac_addr[ETH_HWADDR_LEN];
+        net_set_mac_addr(mac_addr, mac);
+        err = arp_add(client, ARP_ENTRY_IPV4, &ipv4_addr, mac_addr);
+        break;
+    }
+    case ARP_REMOVE_IPV4:
+        ipv4_addr = microkit_mr_get(0);
+        sddf_printf("ARP|NOTICE: client%d removing ip address: %s\n", client, ipaddr_to_string(ipv4_addr, buf, 16));
+        err = arp_del(client, ARP_ENTRY_IPV4, &ipv4_addr);
+        break;
+    case ARP_ADD_IPV6:
+    case ARP_REMOVE_IPV6:
+        for (int i = 0; i < IPV6_ADDR_LEN / sizeof(uint32_t); i++) {
+            uint32_t word = microkit_mr_get(i);
+            memcpy(&ipv6_addr[i * sizeof(uint32_t)], &word, sizeof(uint32_t));
+        }
+        ipv6_addr_to_string(ipv6_addr, buf, sizeof(buf));
+
+        if (microkit_msginfo_get_label(msginfo) == ARP_REMOVE_IPV6) {
+            sddf_printf("ARP|NOTICE: client%d removing ipv6 address: %s\n", client, buf);
+            err = arp_del(client, ARP_ENTRY_IPV6, ipv6_addr);
+            break;
+        }
+
+        sddf_printf("ARP|NOTICE: client%d registering ipv6 address: %s\n", client, buf);
+        if (ipv6_addr_unspecified(ipv6_addr)) {
+            err = ARP_ERR_INVALID;
+            break;
+        }
+        err = arp_add(client, ARP_ENTRY_IPV6, ipv6_addr, mac_addrs[client]);
         break;
     default:
         sddf_dprintf("ARP|LOG: PPC from client%d with unknown message label %lu\n", client,
                      microkit_msginfo_get_label(msginfo));
+        err = ARP_ERR_INVALID;
         break;
     }
 
-    return microkit_msginfo_new(0, 0);
+    return microkit_msginfo_new(err, 0);
 }
 
 void init(void)
 {
-    net_queue_init(&rx_queue, rx_free, rx_active, ETHERNET_RX_QUEUE_SIZE_ARP);
-    net_queue_init(&tx_queue, tx_free, tx_active, ETHERNET_TX_QUEUE_SIZE_ARP);
+    size_t rx_capacity, tx_capacity;
+    net_cli_queue_capacity(microkit_name, &rx_capacity, &tx_capacity);
+    net_queue_init(&rx_queue, rx_free, rx_active, rx_capacity);
+    net_queue_init(&tx_queue, tx_free, tx_active, tx_capacity);
     net_buffers_init(&tx_queue, 0);
 
-    ethernet_arp_mac_addr_init_sys(microkit_name, (uint8_t *) mac_addrs);
+    uint64_t macs[NUM_ARP_CLIENTS];
+    net_arp_mac_addrs(microkit_name, macs);
+    for (int i = 0; i < NUM_ARP_CLIENTS; i++) {
+        net_set_mac_addr(mac_addrs[i], macs[i]);
+    }
+
+    sddf_timer_set_timeout(TIMER_CH, ARP_ANNOUNCE_INTERVAL_NS);
 }
@@ -0,0 +1,535 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Packet capture component. When a system defines NET_CAPTURE in its ethernet config,
+ * the RX and TX virtualisers mirror the packets that match the capture rules to this
+ * component by sharing their buffers with it (see include/sddf/network/capture.h).
+ * Each packet, truncated to the snap length, is copied as a pcapng Enhanced Packet
+ * Block into the capture ring, and its buffer handed straight back. If the capture ring
+ * is full the packet is dropped from the capture, and the number of dropped captures
+ * is reported in Interface Statistics Blocks.
+ *
+ * The capture ring is drained as a pcapng stream, either to a serial connection or,
+ * when built with NET_CAPTURE_DRAIN_BLK, to consecutive blocks of a block device
+ * starting at NET_CAPTURE_BLK_START. The serial connection must not be shared with
+ * clients printing text. On a block device, the ring is the data region shared with
+ * the block virtualiser, and is written out in whole blocks. A partly filled block is
+ * padded out and written every NET_CAPTURE_FLUSH_INTERVAL. Capture stops once the end
+ * of the device is reached.
+ *
+ * Packets are timestamped when they are copied into the ring rather than when they
+ * were received or transmitted.
+ *
+ * The capture rules are given by NET_CAPTURE_RULES, an initialiser of an array of
+ * net_capture_rule_t, for example { { .ethertype = ETH_TYPE_IP, .port = 1235 } }.
+ * Every packet is captured if no rules are given.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <microkit.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/queue.h>
+#include <sddf/network/capture.h>
+#include <sddf/timer/client.h>
+#include <sddf/util/util.h>
+#include <sddf/util/string.h>
+#include <sddf/util/printf.h>
+#include <ethernet_config.h>
+#ifdef NET_CAPTURE_DRAIN_BLK
+#include <sddf/blk/queue.h>
+#include <sddf/blk/storage_info.h>
+#include <blk_config.h>
+#else
+#include <sddf/serial/queue.h>
+#include <serial_config.h>
+#endif
+
+#define LOG_CAPTURE_ERR(...) do{ sddf_printf("CAPTURE|ERROR: "); sddf_printf(__VA_ARGS__); }while(0)
+
+#define RX_VIRT_CH 0
+#define TX_VIRT_CH 1
+#define DRAIN_CH 2
+#define TIMER_CH 3
+
+#ifndef NET_CAPTURE_SNAPLEN
+#define NET_CAPTURE_SNAPLEN NET_BUFFER_SIZE
+#endif
+
+/* Size of the capture ring, which must fit in the block data region when draining to a block device */
+#ifndef NET_CAPTURE_RING_SIZE
+#define NET_CAPTURE_RING_SIZE 0x100000
+#endif
+
+#ifndef NET_CAPTURE_BLK_START
+#define NET_CAPTURE_BLK_START 0
+#endif
+
+#ifndef NET_CAPTURE_FLUSH_INTERVAL
+#define NET_CAPTURE_FLUSH_INTERVAL (NS_IN_S)
+#endif
+
+net_capture_ctrl_t *capture_ctrl;
+
+net_queue_t *rx_capture_free;
+net_queue_t *rx_capture_active;
+net_queue_t *tx_capture_free;
+net_queue_t *tx_capture_active;
+
+/* RX data region, and TX data regions of the clients mapped one after the other */
+uintptr_t rx_buffer_data_vaddr;
+uintptr_t tx_buffer_data_vaddr;
+
+#ifdef NET_CAPTURE_DRAIN_BLK
+_Static_assert(NET_CAPTURE_RING_SIZE % BLK_TRANSFER_SIZE == 0, "Capture ring must hold whole blocks");
+
+blk_storage_info_t *blk_storage_info;
+blk_req_queue_t *blk_request;
+blk_resp_queue_t *blk_response;
+uintptr_t blk_data;
+
+blk_queue_handle_t blk_queue;
+
+/* Blocks being written, only one write is in flight at a time */
+uint16_t blk_in_flight;
+uint64_t blk_next;
+bool blk_full;
+#else
+serial_queue_t *serial_tx_queue;
+char *serial_tx_data;
+
+serial_queue_handle_t serial_tx_queue_handle;
+
+static uint8_t ring_data[NET_CAPTURE_RING_SIZE];
+#endif
+
+net_queue_handle_t rx_queue;
+net_queue_handle_t tx_queue;
+
+/* The capture ring holds the pcapng stream from head, drained, to tail, written */
+typedef struct capture_ring {
+    uint8_t *data;
+    uint64_t head;
+    uint64_t tail;
+} capture_ring_t;
+
+capture_ring_t ring;
+
+uint64_t captured;
+uint64_t ring_dropped;
+uint64_t reported_dropped;
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0AU
+#define PCAPNG_BLOCK_IDB 0x00000001U
+#define PCAPNG_BLOCK_ISB 0x00000005U
+#define PCAPNG_BLOCK_EPB 0x00000006U
+/* Block types with the top bit set are reserved for local use, readers skip them */
+#define PCAPNG_BLOCK_PAD 0x80000BADU
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4DU
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_ISB_OSDROP 7
+#define PCAPNG_OPT_ISB_USRDELIV 8
+
+#define PCAPNG_EPB_FLAGS_INBOUND 1
+#define PCAPNG_EPB_FLAGS_OUTBOUND 2
+
+/* Timestamps are in nanoseconds */
+#define PCAPNG_TSRESOL_NS 9
+
+typedef struct pcapng_opt {
+    uint16_t code;
+    uint16_t len;
+} pcapng_opt_t;
+
+typedef struct pcapng_shb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int64_t section_len;
+    uint32_t len_trailer;
+} __attribute__((packed)) pcapng_shb_t;
+
+typedef struct pcapng_idb {
+    uint32_t type;
+    uint32_t len;
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+    pcapng_opt_t tsresol_opt;
+    uint8_t tsresol;
+    uint8_t tsresol_pad[3];
+    pcapng_opt_t end_opt;
+    uint32_t len_trailer;
+} __attribute__((packed)) pcapng_idb_t;
+
+typedef struct pcapng_epb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t interface_id;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t origlen;
+} __attribute__((packed)) pcapng_epb_t;
+
+/* Follows the packet data of an Enhanced Packet Block */
+typedef struct pcapng_epb_trailer {
+    pcapng_opt_t flags_opt;
+    uint32_t flags;
+    pcapng_opt_t end_opt;
+    uint32_t len;
+} __attribute__((packed)) pcapng_epb_trailer_t;
+
+typedef struct pcapng_isb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t interface_id;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    pcapng_opt_t osdrop_opt;
+    uint64_t osdrop;
+    pcapng_opt_t usrdeliv_opt;
+    uint64_t usrdeliv;
+    pcapng_opt_t end_opt;
+    uint32_t len_trailer;
+} __attribute__((packed)) pcapng_isb_t;
+
+static inline uint64_t ring_free(void)
+{
+    return NET_CAPTURE_RING_SIZE - (ring.tail - ring.head);
+}
+
+/* Copy into the ring at its tail, the caller must check there is space */
+static void ring_write(const void *src, uint64_t len)
+{
+    uint64_t off = ring.tail % NET_CAPTURE_RING_SIZE;
+    uint64_t prewrap = MIN(len, NET_CAPTURE_RING_SIZE - off);
+    sddf_memcpy(ring.data + off, src, prewrap);
+    if (len > prewrap) {
+        sddf_memcpy(ring.data, (const uint8_t *)src + prewrap, len - prewrap);
+    }
+    ring.tail += len;
+}
+
+static void ring_write_zeros(uint64_t len)
+{
+    static const uint8_t zeros[4] = { 0 };
+    while (len > 0) {
+        uint64_t n = MIN(len, sizeof(zeros));
+        ring_write(zeros, n);
+        len -= n;
+    }
+}
+
+static void write_header(void)
+{
+    pcapng_shb_t shb = {
+        .type = PCAPNG_BLOCK_SHB,
+        .len = sizeof(pcapng_shb_t),
+        .magic = PCAPNG_BYTE_ORDER_MAGIC,
+        .major = 1,
+        .minor = 0,
+        .section_len = -1,
+        .len_trailer = sizeof(pcapng_shb_t),
+    };
+    pcapng_idb_t idb = {
+        .type = PCAPNG_BLOCK_IDB,
+        .len = sizeof(pcapng_idb_t),
+        .linktype = PCAPNG_LINKTYPE_ETHERNET,
+        .snaplen = NET_CAPTURE_SNAPLEN,
+        .tsresol_opt = { PCAPNG_OPT_IF_TSRESOL, 1 },
+        .tsresol = PCAPNG_TSRESOL_NS,
+        .end_opt = { PCAPNG_OPT_END, 0 },
+        .len_trailer = sizeof(pcapng_idb_t),
+    };
+    ring_write(&shb, sizeof(shb));
+    ring_write(&idb, sizeof(idb));
+}
+
+/**
+ * Record a packet in the capture ring as an Enhanced Packet Block.
+ *
+ * @param frame start of the Ethernet frame.
+ * @param len length of the frame.
+ * @param dir direction of the packet, NET_CAPTURE_DIR_RX or NET_CAPTURE_DIR_TX.
+ * @param timestamp time in nanoseconds.
+ *
+ * @return true if there was space for the packet in the ring.
+ */
+static bool record_packet(const uint8_t *frame, uint32_t len, uint8_t dir, uint64_t timestamp)
+{
+    uint32_t caplen = MIN(len, NET_CAPTURE_SNAPLEN);
+    uint32_t padded = ALIGN(caplen, 4);
+    uint32_t block_len = sizeof(pcapng_epb_t) + padded + sizeof(pcapng_epb_trailer_t);
+    if (ring_free() < block_len) {
+        return false;
+    }
+
+    pcapng_epb_t epb = {
+        .type = PCAPNG_BLOCK_EPB,
+        .len = block_len,
+        .interface_id = 0,
+        .ts_high = timestamp >> 32,
+        .ts_low = timestamp & 0xffffffff,
+        .caplen = caplen,
+        .origlen = len,
+    };
+    pcapng_epb_trailer_t trailer = {
+        .flags_opt = { PCAPNG_OPT_EPB_FLAGS, sizeof(uint32_t) },
+        .flags = (dir == NET_CAPTURE_DIR_RX) ? PCAPNG_EPB_FLAGS_INBOUND : PCAPNG_EPB_FLAGS_OUTBOUND,
+        .end_opt = { PCAPNG_OPT_END, 0 },
+        .len = block_len,
+    };
+    ring_write(&epb, sizeof(epb));
+    ring_write(frame, caplen);
+    ring_write_zeros(padded - caplen);
+    ring_write(&trailer, sizeof(trailer));
+
+    return true;
+}
+
+/* Record the number of captures dropped so far, if it changed */
+static void record_stats(uint64_t timestamp)
+{
+    uint64_t dropped = ring_dropped + capture_ctrl->rx_dropped + capture_ctrl->tx_dropped;
+    if (dropped == reported_dropped || ring_free() < sizeof(pcapng_isb_t)) {
+        return;
+    }
+
+    pcapng_isb_t isb = {
+        .type = PCAPNG_BLOCK_ISB,
+        .len = sizeof(pcapng_isb_t),
+        .interface_id = 0,
+        .ts_high = timestamp >> 32,
+        .ts_low = timestamp & 0xffffffff,
+        .osdrop_opt = { PCAPNG_OPT_ISB_OSDROP, sizeof(uint64_t) },
+        .osdrop = dropped,
+        .usrdeliv_opt = { PCAPNG_OPT_ISB_USRDELIV, sizeof(uint64_t) },
+        .usrdeliv = captured,
+        .end_opt = { PCAPNG_OPT_END, 0 },
+        .len_trailer = sizeof(pcapng_isb_t),
+    };
+    ring_write(&isb, sizeof(isb));
+    reported_dropped = dropped;
+}
+
+/**
+ * Copy the packets mirrored by a virtualiser into the capture ring, and return their buffers.
+ *
+ * @param queue capture queue pair shared with the virtualiser.
+ * @param dir direction of the packets, NET_CAPTURE_DIR_RX or NET_CAPTURE_DIR_TX.
+ * @param data_vaddr start of the data region the buffer offsets are into.
+ * @param timestamp time in nanoseconds.
+ * @param ch channel of the virtualiser.
+ */
+static void capture_queue(net_queue_handle_t *queue, uint8_t dir, uintptr_t data_vaddr, uint64_t timestamp,
+                          microkit_channel ch)
+{
+    bool returned = false;
+    bool reprocess = true;
+    while (reprocess) {
+        while (!net_queue_empty_active(queue)) {
+            net_buff_desc_t buffer;
+            int err = net_dequeue_active(queue, &buffer);
+            assert(!err);
+
+            if (record_packet((uint8_t *)(data_vaddr + buffer.io_or_offset), buffer.len, dir, timestamp)) {
+                captured++;
+            } else {
+                ring_dropped++;
+            }
+
+            err = net_enqueue_free(queue, buffer);
+            assert(!err);
+            returned = true;
+        }
+
+        net_request_signal_active(queue);
+        reprocess = false;
+
+        if (!net_queue_empty_active(queue)) {
+            net_cancel_signal_active(queue);
+            reprocess = true;
+        }
+    }
+
+    if (returned && net_require_signal_free(queue)) {
+        net_cancel_signal_free(queue);
+        microkit_notify(ch);
+    }
+}
+
+#ifdef NET_CAPTURE_DRAIN_BLK
+
+/* Pad the ring out to a whole block, so that everything captured so far can be written */
+static void flush(void)
+{
+    uint64_t pad = (BLK_TRANSFER_SIZE - ring.tail % BLK_TRANSFER_SIZE) % BLK_TRANSFER_SIZE;
+    if (pad == 0) {
+        return;
+    }
+    /* The smallest block is a header and trailer */
+    if (pad < 3 * sizeof(uint32_t)) {
+        pad += BLK_TRANSFER_SIZE;
+    }
+    if (ring_free() < pad) {
+        return;
+    }
+
+    uint32_t header[2] = { PCAPNG_BLOCK_PAD, pad };
+    ring_write(header, sizeof(header));
+    ring_write_zeros(pad - 3 * sizeof(uint32_t));
+    ring_write(&header[1], sizeof(uint32_t));
+}
+
+static void drain(void)
+{
+    if (blk_in_flight || blk_full || !blk_storage_is_ready(blk_storage_info)) {
+        return;
+    }
+
+    uint64_t capacity = blk_storage_info->capacity;
+    if (blk_next >= capacity) {
+        LOG_CAPTURE_ERR("reached the end of the block device, stopping capture\n");
+        __atomic_store_n(&capture_ctrl->enabled, 0, __ATOMIC_RELEASE);
+        blk_full = true;
+        return;
+    }
+
+    /* Write as many whole blocks as are contiguous in the ring */
+    uint64_t off = ring.head % NET_CAPTURE_RING_SIZE;
+    uint64_t count = (ring.tail - ring.head) / BLK_TRANSFER_SIZE;
+    count = MIN(count, (NET_CAPTURE_RING_SIZE - off) / BLK_TRANSFER_SIZE);
+    count = MIN(count, capacity - blk_next);
+    count = MIN(count, UINT16_MAX);
+    if (count == 0) {
+        return;
+    }
+
+    int err = blk_enqueue_req(&blk_queue, BLK_REQ_WRITE, off, blk_next, count, 0);
+    assert(!err);
+    blk_in_flight = count;
+    microkit_notify(DRAIN_CH);
+}
+
+static void drain_complete(void)
+{
+    blk_resp_status_t status;
+    uint16_t success_count;
+    uint32_t id;
+    while (!blk_dequeue_resp(&blk_queue, &status, &success_count, &id)) {
+        if (status != BLK_RESP_OK) {
+            LOG_CAPTURE_ERR("failed to write to block %lu, stopping capture\n", blk_next);
+            __atomic_store_n(&capture_ctrl->enabled, 0, __ATOMIC_RELEASE);
+            blk_full = true;
+        }
+        ring.head += (uint64_t)blk_in_flight * BLK_TRANSFER_SIZE;
+        blk_next += blk_in_flight;
+        blk_in_flight = 0;
+    }
+}
+
+#else
+
+static void drain(void)
+{
+    bool transferred = false;
+    while (ring.tail != ring.head) {
+        uint64_t off = ring.head % NET_CAPTURE_RING_SIZE;
+        uint32_t len = MIN(ring.tail - ring.head, NET_CAPTURE_RING_SIZE - off);
+        uint32_t n = serial_enqueue_batch(&serial_tx_queue_handle, len, (char *)ring.data + off);
+        ring.head += n;
+        transferred |= n > 0;
+        if (n < len) {
+            break;
+        }
+    }
+
+    if (transferred && serial_require_producer_signal(&serial_tx_queue_handle)) {
+        serial_cancel_producer_signal(&serial_tx_queue_handle);
+        microkit_notify(DRAIN_CH);
+    }
+
+    /* Continue once the serial virtualiser has made space */
+    if (ring.tail != ring.head) {
+        serial_request_consumer_signal(&serial_tx_queue_handle);
+    }
+}
+
+#endif
+
+void notified(microkit_channel ch)
+{
+    switch (ch) {
+    case RX_VIRT_CH:
+    case TX_VIRT_CH: {
+        uint64_t timestamp = sddf_timer_time_now(TIMER_CH);
+        capture_queue(&rx_queue, NET_CAPTURE_DIR_RX, rx_buffer_data_vaddr, timestamp, RX_VIRT_CH);
+        capture_queue(&tx_queue, NET_CAPTURE_DIR_TX, tx_buffer_data_vaddr, timestamp, TX_VIRT_CH);
+        record_stats(timestamp);
+        break;
+    }
+    case DRAIN_CH:
+#ifdef NET_CAPTURE_DRAIN_BLK
+        drain_complete();
+#endif
+        break;
+    case TIMER_CH:
+#ifdef NET_CAPTURE_DRAIN_BLK
+        if (!blk_in_flight) {
+            flush();
+        }
+        sddf_timer_set_timeout(TIMER_CH, NET_CAPTURE_FLUSH_INTERVAL);
+#endif
+        break;
+    default:
+        LOG_CAPTURE_ERR("received notification on unexpected channel %u\n", ch);
+        break;
+    }
+
+    drain();
+}
+
+void init(void)
+{
+    net_queue_init(&rx_queue, rx_capture_free, rx_capture_active, NET_CAPTURE_QUEUE_CAPACITY);
+    net_queue_init(&tx_queue, tx_capture_free, tx_capture_active, NET_CAPTURE_QUEUE_CAPACITY);
+
+#ifdef NET_CAPTURE_DRAIN_BLK
+    blk_queue_init(&blk_queue, blk_request, blk_response, blk_cli_queue_size(microkit_name));
+    ring.data = (uint8_t *)blk_data;
+    blk_next = NET_CAPTURE_BLK_START;
+    sddf_timer_set_timeout(TIMER_CH, NET_CAPTURE_FLUSH_INTERVAL);
+#else
+    serial_cli_queue_init_sys(microkit_name, NULL, NULL, NULL, &serial_tx_queue_handle, serial_tx_queue,
+                              serial_tx_data);
+    ring.data = ring_data;
+#endif
+
+    write_header();
+
+#ifdef NET_CAPTURE_RULES
+    static const net_capture_rule_t rules[] = NET_CAPTURE_RULES;
+    _Static_assert(ARRAY_SIZE(rules) <= NET_CAPTURE_MAX_RULES, "Too many capture rules");
+    for (uint32_t i = 0; i < ARRAY_SIZE(rules); i++) {
+        capture_ctrl->rules[i] = rules[i];
+    }
+    capture_ctrl->num_rules = ARRAY_SIZE(rules);
+#else
+    capture_ctrl->num_rules = 0;
+#endif
+    /* The virtualisers start mirroring once the rules are visible to them */
+    __atomic_store_n(&capture_ctrl->enabled, 1, __ATOMIC_RELEASE);
+
+    drain();
+}
@@ -51,6 +51,9 @@ void rx_return(void)
 
             sddf_memcpy((void *)cli_addr, (void *)virt_addr, virt_buffer.len);
             cli_buffer.len = virt_buffer.len;
+            cli_buffer.flags = virt_buffer.flags;
+            cli_buffer.csum_start = virt_buffer.csum_start;
+            cli_buffer.csum_offset = virt_buffer.csum_offset;
             virt_buffer.len = 0;
 
             err = net_enqueue_active(&rx_queue_cli, cli_buffer);
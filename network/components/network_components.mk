@@ -8,15 +8,18 @@
 # it should be included into your project Makefile
 #
 # NOTES:
-# Generates network_virt_rx.elf network_virt_tx.elf arp.elf copy.elf
+# Generates network_virt_rx.elf network_virt_tx.elf arp.elf copy.elf capture.elf
 # Requires ${SDDF}/util/util.mk to build the utility library for debug output
+# Requires ${SDDF}/network/lib/network_lib.mk to build the network library for arp.elf
+# capture.elf is only used by systems that define NET_CAPTURE, and needs the
+# serial config (or, with NET_CAPTURE_DRAIN_BLK, the blk config) in CFLAGS_network
 
 NETWORK_COMPONENTS_DIR := $(abspath $(dir $(lastword ${MAKEFILE_LIST})))
-NETWORK_IMAGES:= network_virt_rx.elf network_virt_tx.elf arp.elf copy.elf
+NETWORK_IMAGES:= network_virt_rx.elf network_virt_tx.elf arp.elf copy.elf capture.elf
 network/components/%.o: ${SDDF}/network/components/%.c
 	${CC} ${CFLAGS} -c -o $@ $<
 
-NETWORK_COMPONENT_OBJ := $(addprefix network/components/, copy.o arp.o network_virt_tx.o network_virt_rx.o)
+NETWORK_COMPONENT_OBJ := $(addprefix network/components/, copy.o arp.o capture.o network_virt_tx.o network_virt_rx.o)
 
 CHECK_NETWORK_FLAGS_MD5:=.network_cflags-$(shell echo -- ${CFLAGS} ${CFLAGS_network} | shasum | sed 's/ *-//')
 
@@ -28,6 +31,8 @@ ${CHECK_NETWORK_FLAGS_MD5}:
 
 
 ${NETWORK_IMAGES}: LIBS := libsddf_util_debug.a ${LIBS}
+arp.elf: LIBS := libsddf_network.a libsddf_util_debug.a ${LIBS}
+arp.elf: libsddf_network.a
 
 ${NETWORK_COMPONENT_OBJ}: |network/components
 ${NETWORK_COMPONENT_OBJ}: ${CHECK_NETWORK_FLAGS_MD5}
@@ -40,7 +45,7 @@ network/components/network_virt_%.o: ${SDDF}/network/components/virt_%.c
 	${LD} ${LDFLAGS} -o $@ $< ${LIBS}
 
 clean::
-	rm -f network_virt_[rt]x.[od] copy.[od] arp.[od]
+	rm -f network_virt_[rt]x.[od] copy.[od] arp.[od] capture.[od]
 
 clobber::
 	rm -f ${IMAGES}
@@ -9,6 +9,10 @@
 #include <sddf/network/constants.h>
 #include <sddf/network/queue.h>
 #include <sddf/network/util.h>
+#include <sddf/network/capture.h>
+#ifdef NET_ARP_CLIENT
+#include <sddf/network/arp.h>
+#endif
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
 #include <sddf/util/cache.h>
@@ -32,15 +36,33 @@ net_queue_t *rx_active_cli0;
 uintptr_t buffer_data_vaddr;
 uintptr_t buffer_data_paddr;
 
+#ifdef NET_CAPTURE
+/* Received packets are mirrored to the capture component, which shares the buffer */
+#define CAPTURE_CH (CLIENT_CH + NUM_NETWORK_CLIENTS)
+
+net_queue_t *capture_free;
+net_queue_t *capture_active;
+net_capture_ctrl_t *capture_ctrl;
+#endif
+
+#ifdef NET_ARP_CLIENT
+/* Addresses registered with the ARP component, read-only */
+arp_entry_t *arp_table;
+#endif
+
 /* In order to handle broadcast packets where the same buffer is given to multiple clients
   * we keep track of a reference count of each buffer and only hand it back to the driver once
-  * all clients have returned the buffer. */
+  * all clients have returned the buffer. The capture component also holds a reference to the
+  * buffers it is given. */
 uint32_t buffer_refs[NET_RX_QUEUE_CAPACITY_DRIV] = { 0 };
 
 typedef struct state {
     net_queue_handle_t rx_queue_drv;
     net_queue_handle_t rx_queue_clients[NUM_NETWORK_CLIENTS];
     uint8_t mac_addrs[NUM_NETWORK_CLIENTS][ETH_HWADDR_LEN];
+#ifdef NET_CAPTURE
+    net_queue_handle_t capture_queue;
+#endif
 } state_t;
 
 state_t state;
@@ -50,7 +72,7 @@ static bool notify_drv;
 
 /* Return the client ID if the Mac address is a match to a client, return the broadcast ID if MAC address
   is a broadcast address. */
-int get_mac_addr_match(struct ethernet_header *buffer)
+int get_mac_addr_match(struct ethernet_header *buffer, uint32_t len)
 {
     for (int client = 0; client < NUM_NETWORK_CLIENTS; client++) {
         bool match = true;
@@ -64,6 +86,22 @@ int get_mac_addr_match(struct ethernet_header *buffer)
         }
     }
 
+#ifdef NET_ARP_CLIENT
+    /* Neighbor Solicitations are sent to solicited-node multicast addresses, which map to 33:33:ff:xx:xx:xx.
+     * Those for registered addresses are answered by the ARP component on behalf of the clients, so only
+     * deliver them there. Any other traffic to these addresses is delivered to every client. */
+    if (buffer->dest.addr[0] == 0x33 && buffer->dest.addr[1] == 0x33 && buffer->dest.addr[2] == 0xff) {
+        if (arp_is_ndp_solicitation(buffer, len)) {
+            struct ndp_packet *ns = (struct ndp_packet *)buffer;
+            arp_entry_t *entry = arp_table_slot(arp_table, ARP_ENTRY_IPV6, ns->target);
+            if (__atomic_load_n(&entry->type, __ATOMIC_ACQUIRE) == ARP_ENTRY_IPV6) {
+                return NET_ARP_CLIENT;
+            }
+        }
+        return BROADCAST_ID;
+    }
+#endif
+
     bool broadcast_match = true;
     for (int i = 0; (i < ETH_HWADDR_LEN) && broadcast_match; i++) {
         if (buffer->dest.addr[i] != 0xFF) {
@@ -81,6 +119,9 @@ void rx_return(void)
 {
     bool reprocess = true;
     bool notify_clients[NUM_NETWORK_CLIENTS] = {false};
+#ifdef NET_CAPTURE
+    bool notify_capture = false;
+#endif
     while (reprocess) {
         while (!net_queue_empty_active(&state.rx_queue_drv)) {
             net_buff_desc_t buffer;
@@ -100,14 +141,21 @@ void rx_return(void)
             //
             // [1]: https://developer.arm.com/documentation/ddi0595/2021-06/AArch64-Instructions/DC-IVAC--Data-or-unified-Cache-line-Invalidate-by-VA-to-PoC
             cache_clean_and_invalidate(buffer_vaddr, buffer_vaddr + buffer.len);
-            int client = get_mac_addr_match((struct ethernet_header *) buffer_vaddr);
+            int client = get_mac_addr_match((struct ethernet_header *) buffer_vaddr, buffer.len);
+            int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
+            assert(buffer_refs[ref_index] == 0);
+#ifdef NET_CAPTURE
+            if (net_capture_mirror(&state.capture_queue, capture_ctrl, NET_CAPTURE_DIR_RX, buffer,
+                                   (uint8_t *)buffer_vaddr, &capture_ctrl->rx_dropped)) {
+                buffer_refs[ref_index] = 1;
+                notify_capture = true;
+            }
+#endif
             if (client == BROADCAST_ID) {
-                int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
-                assert(buffer_refs[ref_index] == 0);
-                // For broadcast packets, set the refcount to number of clients
-                // in the system. Only enqueue buffer back to driver if
-                // all clients have consumed the buffer.
-                buffer_refs[ref_index] = NUM_NETWORK_CLIENTS;
+                // For broadcast packets, add the number of clients in the
+                // system to the refcount. Only enqueue buffer back to driver
+                // if all clients have consumed the buffer.
+                buffer_refs[ref_index] += NUM_NETWORK_CLIENTS;
 
                 for (int i = 0; i < NUM_NETWORK_CLIENTS; i++) {
                     err = net_enqueue_active(&state.rx_queue_clients[i], buffer);
@@ -116,14 +164,12 @@ void rx_return(void)
                 }
                 continue;
             } else if (client >= 0) {
-                int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
-                assert(buffer_refs[ref_index] == 0);
-                buffer_refs[ref_index] = 1;
+                buffer_refs[ref_index] += 1;
 
                 err = net_enqueue_active(&state.rx_queue_clients[client], buffer);
                 assert(!err);
                 notify_clients[client] = true;
-            } else {
+            } else if (buffer_refs[ref_index] == 0) {
                 buffer.io_or_offset = buffer.io_or_offset + buffer_data_paddr;
                 err = net_enqueue_free(&state.rx_queue_drv, buffer);
                 assert(!err);
@@ -145,6 +191,35 @@ void rx_return(void)
             microkit_notify(client + CLIENT_CH);
         }
     }
+
+#ifdef NET_CAPTURE
+    if (notify_capture && net_require_signal_active(&state.capture_queue)) {
+        net_cancel_signal_active(&state.capture_queue);
+        microkit_notify(CAPTURE_CH);
+    }
+#endif
+}
+
+/* Drop a reference to a buffer, and hand it back to the driver once every holder has returned it */
+static void buffer_release(net_buff_desc_t buffer)
+{
+    int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
+    assert(buffer_refs[ref_index] != 0);
+
+    buffer_refs[ref_index]--;
+
+    if (buffer_refs[ref_index] != 0) {
+        return;
+    }
+
+    // To avoid having to perform a cache clean here we ensure that
+    // the DMA region is only mapped in read only. This avoids the
+    // case where pending writes are only written to the buffer
+    // memory after DMA has occured.
+    buffer.io_or_offset = buffer.io_or_offset + buffer_data_paddr;
+    int err = net_enqueue_free(&state.rx_queue_drv, buffer);
+    assert(!err);
+    notify_drv = true;
 }
 
 void rx_provide(void)
@@ -156,26 +231,13 @@ void rx_provide(void)
                 net_buff_desc_t buffer;
                 int err = net_dequeue_free(&state.rx_queue_clients[client], &buffer);
                 assert(!err);
+                // The driver may have passed the frame up at an offset into its buffer,
+                // so buffers are returned to the driver from the start of the buffer.
+                buffer.io_or_offset -= buffer.io_or_offset % NET_BUFFER_SIZE;
                 assert(!(buffer.io_or_offset % NET_BUFFER_SIZE)
                        && (buffer.io_or_offset < NET_BUFFER_SIZE * state.rx_queue_clients[client].capacity));
 
-                int ref_index = buffer.io_or_offset / NET_BUFFER_SIZE;
-                assert(buffer_refs[ref_index] != 0);
-
-                buffer_refs[ref_index]--;
-
-                if (buffer_refs[ref_index] != 0) {
-                    continue;
-                }
-
-                // To avoid having to perform a cache clean here we ensure that
-                // the DMA region is only mapped in read only. This avoids the
-                // case where pending writes are only written to the buffer
-                // memory after DMA has occured.
-                buffer.io_or_offset = buffer.io_or_offset + buffer_data_paddr;
-                err = net_enqueue_free(&state.rx_queue_drv, buffer);
-                assert(!err);
-                notify_drv = true;
+                buffer_release(buffer);
             }
 
             net_request_signal_free(&state.rx_queue_clients[client]);
@@ -188,6 +250,27 @@ void rx_provide(void)
         }
     }
 
+#ifdef NET_CAPTURE
+    bool reprocess = true;
+    while (reprocess) {
+        while (!net_queue_empty_free(&state.capture_queue)) {
+            net_buff_desc_t buffer;
+            int err = net_dequeue_free(&state.capture_queue, &buffer);
+            assert(!err);
+            buffer.io_or_offset -= buffer.io_or_offset % NET_BUFFER_SIZE;
+            buffer_release(buffer);
+        }
+
+        net_request_signal_free(&state.capture_queue);
+        reprocess = false;
+
+        if (!net_queue_empty_free(&state.capture_queue)) {
+            net_cancel_signal_free(&state.capture_queue);
+            reprocess = true;
+        }
+    }
+#endif
+
     if (notify_drv && net_require_signal_free(&state.rx_queue_drv)) {
         net_cancel_signal_free(&state.rx_queue_drv);
         microkit_deferred_notify(DRIVER_CH);
@@ -215,6 +298,10 @@ void init(void)
         net_queue_init(&state.rx_queue_clients[i], queue_info[i].free, queue_info[i].active, queue_info[i].capacity);
     }
 
+#ifdef NET_CAPTURE
+    net_queue_init(&state.capture_queue, capture_free, capture_active, NET_CAPTURE_QUEUE_CAPACITY);
+#endif
+
     /* Set up driver queues */
     net_queue_init(&state.rx_queue_drv, rx_free_drv, rx_active_drv, NET_RX_QUEUE_CAPACITY_DRIV);
     net_buffers_init(&state.rx_queue_drv, buffer_data_paddr);
@@ -5,6 +5,7 @@
 
 #include <microkit.h>
 #include <sddf/network/queue.h>
+#include <sddf/network/capture.h>
 #include <sddf/util/cache.h>
 #include <sddf/util/util.h>
 #include <sddf/util/printf.h>
@@ -22,11 +23,31 @@ uintptr_t buffer_data_region_cli0_vaddr;
 uintptr_t buffer_data_region_cli0_paddr;
 uintptr_t buffer_data_region_cli1_paddr;
 
+#ifdef NET_CAPTURE
+/*
+ * Transmitted packets are mirrored to the capture component, which shares the buffer. The
+ * capture component is given the offset of the buffer into the TX data regions of the
+ * clients as if they were contiguous, with each NET_DATA_REGION_SIZE long.
+ */
+#define CAPTURE_CH (CLIENT_CH + NUM_NETWORK_CLIENTS)
+
+net_queue_t *capture_free;
+net_queue_t *capture_active;
+net_capture_ctrl_t *capture_ctrl;
+
+/* References to mirrored buffers, which are returned to the client once both the driver
+ * and the capture component have returned them. Zero for buffers that were not mirrored. */
+uint8_t buffer_refs[NUM_NETWORK_CLIENTS][NET_TX_QUEUE_CAPACITY_DRIV];
+#endif
+
 typedef struct state {
     net_queue_handle_t tx_queue_drv;
     net_queue_handle_t tx_queue_clients[NUM_NETWORK_CLIENTS];
     uintptr_t buffer_region_vaddrs[NUM_NETWORK_CLIENTS];
     uintptr_t buffer_region_paddrs[NUM_NETWORK_CLIENTS];
+#ifdef NET_CAPTURE
+    net_queue_handle_t capture_queue;
+#endif
 } state_t;
 
 state_t state;
@@ -43,9 +64,32 @@ int extract_offset(uintptr_t *phys)
     return -1;
 }
 
+#ifdef NET_CAPTURE
+/**
+ * Drop a reference to a transmitted buffer.
+ *
+ * @param client client the buffer belongs to.
+ * @param buffer buffer with its offset into the TX data region of the client.
+ *
+ * @return true if the buffer can be returned to the client.
+ */
+static bool buffer_release(int client, net_buff_desc_t buffer)
+{
+    uint8_t *refs = &buffer_refs[client][buffer.io_or_offset / NET_BUFFER_SIZE];
+    if (*refs == 0) {
+        return true;
+    }
+    (*refs)--;
+    return *refs == 0;
+}
+#endif
+
 void tx_provide(void)
 {
     bool enqueued = false;
+#ifdef NET_CAPTURE
+    bool notify_capture = false;
+#endif
     for (int client = 0; client < NUM_NETWORK_CLIENTS; client++) {
         bool reprocess = true;
         while (reprocess) {
@@ -66,6 +110,18 @@ void tx_provide(void)
                 cache_clean(buffer.io_or_offset + state.buffer_region_vaddrs[client],
                             buffer.io_or_offset + state.buffer_region_vaddrs[client] + buffer.len);
 
+#ifdef NET_CAPTURE
+                net_buff_desc_t mirror = buffer;
+                mirror.io_or_offset += client * NET_DATA_REGION_SIZE;
+                if (net_capture_mirror(&state.capture_queue, capture_ctrl, NET_CAPTURE_DIR_TX, mirror,
+                                       (uint8_t *)(buffer.io_or_offset + state.buffer_region_vaddrs[client]),
+                                       &capture_ctrl->tx_dropped)) {
+                    /* Held by both the driver and the capture component */
+                    buffer_refs[client][buffer.io_or_offset / NET_BUFFER_SIZE] = 2;
+                    notify_capture = true;
+                }
+#endif
+
                 buffer.io_or_offset = buffer.io_or_offset + state.buffer_region_paddrs[client];
                 err = net_enqueue_active(&state.tx_queue_drv, buffer);
                 assert(!err);
@@ -82,6 +138,13 @@ void tx_provide(void)
         }
     }
 
+#ifdef NET_CAPTURE
+    if (notify_capture && net_require_signal_active(&state.capture_queue)) {
+        net_cancel_signal_active(&state.capture_queue);
+        microkit_notify(CAPTURE_CH);
+    }
+#endif
+
     if (enqueued && net_require_signal_active(&state.tx_queue_drv)) {
         net_cancel_signal_active(&state.tx_queue_drv);
         microkit_deferred_notify(DRIVER);
@@ -101,6 +164,11 @@ void tx_return(void)
             int client = extract_offset(&buffer.io_or_offset);
             assert(client >= 0);
 
+#ifdef NET_CAPTURE
+            if (!buffer_release(client, buffer)) {
+                continue;
+            }
+#endif
             err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
             assert(!err);
             notify_clients[client] = true;
@@ -115,6 +183,36 @@ void tx_return(void)
         }
     }
 
+#ifdef NET_CAPTURE
+    reprocess = true;
+    while (reprocess) {
+        while (!net_queue_empty_free(&state.capture_queue)) {
+            net_buff_desc_t buffer;
+            int err = net_dequeue_free(&state.capture_queue, &buffer);
+            assert(!err);
+
+            int client = buffer.io_or_offset / NET_DATA_REGION_SIZE;
+            buffer.io_or_offset %= NET_DATA_REGION_SIZE;
+            assert(client < NUM_NETWORK_CLIENTS);
+            if (!buffer_release(client, buffer)) {
+                continue;
+            }
+
+            err = net_enqueue_free(&state.tx_queue_clients[client], buffer);
+            assert(!err);
+            notify_clients[client] = true;
+        }
+
+        net_request_signal_free(&state.capture_queue);
+        reprocess = false;
+
+        if (!net_queue_empty_free(&state.capture_queue)) {
+            net_cancel_signal_free(&state.capture_queue);
+            reprocess = true;
+        }
+    }
+#endif
+
     for (int client = 0; client < NUM_NETWORK_CLIENTS; client++) {
         if (notify_clients[client] && net_require_signal_free(&state.tx_queue_clients[client])) {
             net_cancel_signal_free(&state.tx_queue_clients[client]);
@@ -134,6 +232,10 @@ void init(void)
     /* Set up driver queues */
     net_queue_init(&state.tx_queue_drv, tx_free_drv, tx_active_drv, NET_TX_QUEUE_CAPACITY_DRIV);
 
+#ifdef NET_CAPTURE
+    net_queue_init(&state.capture_queue, capture_free, capture_active, NET_CAPTURE_QUEUE_CAPACITY);
+#endif
+
     /* Setup client queues and state */
     net_queue_info_t queue_info[NUM_NETWORK_CLIENTS] = {0};
     uintptr_t client_vaddrs[NUM_NETWORK_CLIENTS] = {0};
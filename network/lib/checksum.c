@@ -0,0 +1,194 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/network/checksum.h>
+
+/*
+ * Internet checksum (RFC 1071) with SIMD fast paths.
+ *
+ * The one's complement sum is independent of byte order (RFC 1071, section
+ * 2(B)), so we can sum the buffer as native-endian words of any width and fold
+ * the result down to 16 bits at the end. Buffers starting at an odd address are
+ * summed as if they started one byte earlier, with the result byte-swapped
+ * afterwards, which is the same trick lwIP's algorithm #3 uses.
+ *
+ * The bulk of the buffer is handled in CHKSUM_BLOCK sized chunks by an
+ * architecture specific routine. The remainder is handled with 64-bit and then
+ * 16-bit loads. All accumulators are sized so they cannot overflow for any
+ * buffer up to 64KiB, so no carries need to be propagated inside the loops.
+ *
+ * Defining NET_CHKSUM_GENERIC forces the portable implementation.
+ */
+
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(NET_CHKSUM_GENERIC)
+
+#include <arm_neon.h>
+
+#define CHKSUM_BLOCK 64
+
+static uint64_t chksum_blocks(const uint8_t *p, int nblocks)
+{
+    uint32x4_t acc0 = vdupq_n_u32(0);
+    uint32x4_t acc1 = vdupq_n_u32(0);
+
+    while (nblocks--) {
+        /* Pairwise add adjacent 16-bit words into the 32-bit lanes */
+        acc0 = vpadalq_u16(acc0, vreinterpretq_u16_u8(vld1q_u8(p)));
+        acc1 = vpadalq_u16(acc1, vreinterpretq_u16_u8(vld1q_u8(p + 16)));
+        acc0 = vpadalq_u16(acc0, vreinterpretq_u16_u8(vld1q_u8(p + 32)));
+        acc1 = vpadalq_u16(acc1, vreinterpretq_u16_u8(vld1q_u8(p + 48)));
+        p += CHKSUM_BLOCK;
+    }
+
+    return vaddlvq_u32(vaddq_u32(acc0, acc1));
+}
+
+#elif defined(__x86_64__) && defined(__AVX2__) && !defined(NET_CHKSUM_GENERIC)
+
+#include <immintrin.h>
+
+#define CHKSUM_BLOCK 64
+
+static uint64_t chksum_blocks(const uint8_t *p, int nblocks)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    while (nblocks--) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        /* Zero-extend the 16-bit words into 32-bit lanes and accumulate */
+        acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v0, zero));
+        acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v0, zero));
+        acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v1, zero));
+        acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v1, zero));
+        p += CHKSUM_BLOCK;
+    }
+
+    __m256i acc = _mm256_add_epi32(acc0, acc1);
+    __m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc128);
+
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#elif defined(__x86_64__) && defined(__SSE2__) && !defined(NET_CHKSUM_GENERIC)
+
+#include <emmintrin.h>
+
+#define CHKSUM_BLOCK 32
+
+static uint64_t chksum_blocks(const uint8_t *p, int nblocks)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    while (nblocks--) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+        /* Zero-extend the 16-bit words into 32-bit lanes and accumulate */
+        acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+        acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+        acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v1, zero));
+        acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v1, zero));
+        p += CHKSUM_BLOCK;
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(acc0, acc1));
+
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#else
+
+#define CHKSUM_BLOCK 32
+
+/* Expects p to be 8-byte aligned. */
+static uint64_t chksum_blocks(const uint8_t *p, int nblocks)
+{
+    const uint64_t *w = (const uint64_t *)(const void *)p;
+    uint64_t acc0 = 0;
+    uint64_t acc1 = 0;
+
+    while (nblocks--) {
+        /* Summing the 32-bit halves separately avoids carry propagation */
+        acc0 += (w[0] & 0xffffffff) + (w[0] >> 32);
+        acc1 += (w[1] & 0xffffffff) + (w[1] >> 32);
+        acc0 += (w[2] & 0xffffffff) + (w[2] >> 32);
+        acc1 += (w[3] & 0xffffffff) + (w[3] >> 32);
+        w += 4;
+    }
+
+    return acc0 + acc1;
+}
+
+#endif
+
+uint16_t net_chksum(const void *data, int len)
+{
+    const uint8_t *p = data;
+    uint64_t sum = 0;
+    uint16_t t = 0;
+    bool odd = (uintptr_t)p & 1;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    if (odd) {
+        /* The first byte is the second half of a 16-bit word */
+        ((uint8_t *)&t)[1] = *p++;
+        len--;
+    }
+
+    /* Align to 8 bytes for the word-at-a-time paths */
+    while (((uintptr_t)p & 7) && len > 1) {
+        sum += *(const uint16_t *)(const void *)p;
+        p += 2;
+        len -= 2;
+    }
+
+    int nblocks = len / CHKSUM_BLOCK;
+    if (nblocks) {
+        sum += chksum_blocks(p, nblocks);
+        p += nblocks * CHKSUM_BLOCK;
+        len -= nblocks * CHKSUM_BLOCK;
+    }
+
+    while (len > 7) {
+        uint64_t w = *(const uint64_t *)(const void *)p;
+        sum += (w & 0xffffffff) + (w >> 32);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len > 1) {
+        sum += *(const uint16_t *)(const void *)p;
+        p += 2;
+        len -= 2;
+    }
+
+    if (len > 0) {
+        /* Dangling tail byte is the first half of a 16-bit word */
+        ((uint8_t *)&t)[0] = *p;
+    }
+    sum += t;
+
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    uint16_t result = net_chksum_fold((uint32_t)sum);
+
+    if (odd) {
+        result = (uint16_t)((result << 8) | (result >> 8));
+    }
+
+    return result;
+}
@@ -0,0 +1,35 @@
+#
+# Copyright 2024, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# This Makefile snippet builds the network library
+# it should be included into your project Makefile
+#
+# NOTES:
+#  Generates libsddf_network.a
+#
+
+NETWORK_LIB_DIR := $(abspath $(dir $(lastword ${MAKEFILE_LIST})))
+
+OBJS_NETWORK_LIB := $(addprefix network/lib/, checksum.o offload.o udpfast.o)
+
+${OBJS_NETWORK_LIB}: ${CHECK_FLAGS_BOARD_MD5} |network/lib
+
+libsddf_network.a: ${OBJS_NETWORK_LIB}
+	${AR} crv $@ $^
+	${RANLIB} $@
+
+network/lib/%.o: ${NETWORK_LIB_DIR}/%.c
+	${CC} ${CFLAGS} -c -o $@ $<
+
+network/lib:
+	mkdir -p $@
+
+clean::
+	${RM} -f ${OBJS_NETWORK_LIB} ${OBJS_NETWORK_LIB:.o=.d}
+
+clobber::
+	${RM} -f libsddf_network.a
+
+-include ${OBJS_NETWORK_LIB:.o=.d}
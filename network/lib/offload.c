@@ -0,0 +1,121 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/network/checksum.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/offload.h>
+#include <sddf/network/queue.h>
+#include <sddf/network/util.h>
+
+/* Offsets of the checksum field within each transport header */
+#define TCP_CHKSUM_OFFSET 16
+#define UDP_CHKSUM_OFFSET 6
+#define ICMP_CHKSUM_OFFSET 2
+
+void net_chksum_offload(void *frame, net_buff_desc_t *buffer)
+{
+    uint8_t *data = frame;
+    struct ethernet_header *eth = frame;
+    uint16_t l3_start = sizeof(struct ethernet_header);
+    uint16_t l4_start;
+    uint16_t l4_len;
+    uint8_t proto;
+    uint32_t sum;
+    bool pseudo_header = true;
+
+    buffer->flags &= ~NET_BUFF_F_CSUM_PARTIAL;
+    buffer->csum_start = 0;
+    buffer->csum_offset = 0;
+
+    if (buffer->len < l3_start) {
+        return;
+    }
+
+    if (eth->type == HTONS(ETH_TYPE_IP)) {
+        struct ipv4_header *ip = (struct ipv4_header *)(data + l3_start);
+        if (buffer->len < l3_start + sizeof(struct ipv4_header)) {
+            return;
+        }
+
+        uint16_t ihl = (ip->version_ihl & 0xf) * 4;
+        uint16_t ip_len = HTONS(ip->len);
+        if (ihl < sizeof(struct ipv4_header) || ip_len < ihl || l3_start + ip_len > buffer->len) {
+            return;
+        }
+
+        ip->chksum = 0;
+        ip->chksum = ~net_chksum(ip, ihl);
+
+        /* The transport checksum covers the whole datagram, which a fragment does not hold */
+        if (ip->frag & HTONS(IPV4_FRAG_MF_OFFSET_MASK)) {
+            return;
+        }
+
+        proto = ip->proto;
+        l4_start = l3_start + ihl;
+        l4_len = ip_len - ihl;
+        /* Source and destination addresses are adjacent */
+        sum = net_chksum(&ip->src, 2 * sizeof(uint32_t));
+
+        if (proto == IPV4_PROTO_ICMP) {
+            /* ICMP has no pseudo header */
+            sum = 0;
+            pseudo_header = false;
+        } else if (proto != IPV4_PROTO_TCP && proto != IPV4_PROTO_UDP) {
+            return;
+        }
+    } else if (eth->type == HTONS(ETH_TYPE_IPV6)) {
+        struct ipv6_header *ip = (struct ipv6_header *)(data + l3_start);
+        if (buffer->len < l3_start + sizeof(struct ipv6_header)) {
+            return;
+        }
+
+        proto = ip->next_header;
+        l4_start = l3_start + sizeof(struct ipv6_header);
+        l4_len = HTONS(ip->payload_len);
+        if (l4_start + l4_len > buffer->len) {
+            return;
+        }
+
+        if (proto != IPV6_NEXT_HEADER_TCP && proto != IPV6_NEXT_HEADER_UDP && proto != IPV6_NEXT_HEADER_ICMPV6) {
+            return;
+        }
+        sum = net_chksum(ip->src, 2 * IPV6_ADDR_LEN);
+    } else {
+        return;
+    }
+
+    uint8_t offset;
+    switch (proto) {
+    case IPV4_PROTO_TCP:
+        offset = TCP_CHKSUM_OFFSET;
+        break;
+    case IPV4_PROTO_UDP:
+        offset = UDP_CHKSUM_OFFSET;
+        break;
+    default:
+        /* ICMP and ICMPv6 */
+        offset = ICMP_CHKSUM_OFFSET;
+        break;
+    }
+
+    if (l4_len < offset + sizeof(uint16_t)) {
+        return;
+    }
+
+    /* Upper-layer length and protocol of the pseudo header, summed the same way for IPv4 and IPv6 */
+    if (pseudo_header) {
+        sum += HTONS(l4_len) + HTONS((uint16_t)proto);
+    }
+
+    /* The device sums from csum_start to the end, including the seeded field, and stores the inverse */
+    *(uint16_t *)(data + l4_start + offset) = net_chksum_fold(sum);
+
+    buffer->flags |= NET_BUFF_F_CSUM_PARTIAL;
+    buffer->csum_start = l4_start;
+    buffer->csum_offset = offset;
+}
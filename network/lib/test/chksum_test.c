@@ -0,0 +1,187 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Host-side test of net_chksum. Every variant that the host can execute is
+ * compared against lwIP's inet_chksum, and then timed over Ethernet sized
+ * buffers.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lwip/inet_chksum.h"
+
+#define BUF_SIZE (65536 + 64)
+#define NUM_RANDOM 200000
+#define MAX_RANDOM_LEN 4096
+#define MAX_OFFSET 64
+#define MAX_ODD_LEN 1024
+#define BENCH_LEN 1500
+#define BENCH_BYTES (1ULL << 31)
+
+uint16_t net_chksum_generic(const void *data, int len);
+#if defined(__x86_64__)
+uint16_t net_chksum_sse2(const void *data, int len);
+uint16_t net_chksum_avx2(const void *data, int len);
+#elif defined(__aarch64__)
+uint16_t net_chksum_neon(const void *data, int len);
+#endif
+
+typedef struct chksum_variant {
+    const char *name;
+    uint16_t (*fn)(const void *data, int len);
+    bool supported;
+} chksum_variant_t;
+
+static uint16_t lwip_chksum(const void *data, int len)
+{
+    return (uint16_t)~inet_chksum(data, (u16_t)len);
+}
+
+static chksum_variant_t variants[] = {
+    { "lwip", lwip_chksum, true },
+    { "generic", net_chksum_generic, true },
+#if defined(__x86_64__)
+    { "sse2", net_chksum_sse2, true },
+    { "avx2", net_chksum_avx2, false },
+#elif defined(__aarch64__)
+    { "neon", net_chksum_neon, true },
+#endif
+};
+
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static uint8_t buf[BUF_SIZE];
+static unsigned long failures;
+
+/**
+ * Check every variant against lwIP for a single buffer.
+ *
+ * @param what description of the buffer contents, for failure messages.
+ * @param offset byte offset of the buffer start within buf.
+ * @param len number of bytes to sum.
+ */
+static void check(const char *what, int offset, int len)
+{
+    uint16_t expected = (uint16_t)~inet_chksum(buf + offset, (u16_t)len);
+
+    for (int v = 1; v < NUM_VARIANTS; v++) {
+        if (!variants[v].supported) {
+            continue;
+        }
+        uint16_t got = variants[v].fn(buf + offset, len);
+        if (got != expected) {
+            if (failures < 20) {
+                printf("FAIL %s: %s buffer, offset %d, len %d: got 0x%04x, expected 0x%04x\n", variants[v].name,
+                       what, offset, len, got, expected);
+            }
+            failures++;
+        }
+    }
+}
+
+static void fill_random(void)
+{
+    for (int i = 0; i < BUF_SIZE; i++) {
+        buf[i] = (uint8_t)rand();
+    }
+}
+
+static void test_random(void)
+{
+    fill_random();
+    for (int i = 0; i < NUM_RANDOM; i++) {
+        int offset = rand() % MAX_OFFSET;
+        int len = rand() % (MAX_RANDOM_LEN + 1);
+        check("random", offset, len);
+    }
+
+    /* The largest lengths exercise the accumulator carries */
+    for (int offset = 0; offset < MAX_OFFSET; offset++) {
+        check("random", offset, 65535);
+        check("random", offset, 65534);
+    }
+}
+
+static void test_odd(void)
+{
+    fill_random();
+    for (int offset = 0; offset < 8; offset++) {
+        for (int len = 1; len <= MAX_ODD_LEN; len += 2) {
+            check("random", offset, len);
+        }
+    }
+}
+
+static void test_ones(void)
+{
+    memset(buf, 0xff, BUF_SIZE);
+    for (int offset = 0; offset < 8; offset++) {
+        for (int len = 0; len <= MAX_ODD_LEN; len++) {
+            check("0xff", offset, len);
+        }
+        check("0xff", offset, 65535);
+        check("0xff", offset, 65534);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void)
+{
+    uint64_t iterations = BENCH_BYTES / BENCH_LEN;
+
+    fill_random();
+    printf("Throughput over %d byte buffers:\n", BENCH_LEN);
+    for (int v = 0; v < NUM_VARIANTS; v++) {
+        if (!variants[v].supported) {
+            printf("  %-8s  not supported by this CPU\n", variants[v].name);
+            continue;
+        }
+        /* Accumulate the results so the calls cannot be optimised away */
+        volatile uint32_t sink = 0;
+        double start = now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            sink += variants[v].fn(buf + (i & 1), BENCH_LEN);
+        }
+        double elapsed = now() - start;
+        printf("  %-8s %8.1f MB/s\n", variants[v].name, (double)iterations * BENCH_LEN / elapsed / 1e6);
+    }
+}
+
+int main(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    variants[NUM_VARIANTS - 1].supported = __builtin_cpu_supports("avx2");
+#endif
+
+    srand(1);
+    test_random();
+    test_odd();
+    test_ones();
+
+    for (int v = 1; v < NUM_VARIANTS; v++) {
+        printf("%-8s %s\n", variants[v].name, variants[v].supported ? "tested" : "skipped, not supported by this CPU");
+    }
+    if (failures) {
+        printf("%lu mismatches against lwIP\n", failures);
+        return 1;
+    }
+    printf("All variants match lwIP\n");
+
+    bench();
+
+    return 0;
+}
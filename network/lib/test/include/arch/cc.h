@@ -0,0 +1,13 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Leave LWIP_CHKSUM unset so that inet_chksum uses lwIP's own routine */
+
+#define LWIP_PLATFORM_DIAG(x)   do { printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x) do { fprintf(stderr, "Assertion failed: %s\n", x); abort(); } while (0)
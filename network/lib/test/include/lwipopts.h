@@ -0,0 +1,8 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Only inet_chksum.c is built for the host test, so the defaults suffice */
+#define NO_SYS 1
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sddf/network/checksum.h>
+#include <sddf/network/constants.h>
+#include <sddf/network/offload.h>
+#include <sddf/network/queue.h>
+#include <sddf/network/udpfast.h>
+#include <sddf/network/util.h>
+#include <sddf/util/util.h>
+
+#define IPV4_FRAG_DF 0x4000U
+
+/* Sum of the two 16-bit words of an IPv4 address as laid out in memory */
+static inline uint32_t ip_chksum_words(uint32_t ip)
+{
+    return (ip & 0xffff) + (ip >> 16);
+}
+
+void udpfast_init(udpfast_t *udpfast, const uint8_t mac[ETH_HWADDR_LEN], uint16_t port, udpfast_handler_t handler,
+                  void *arg)
+{
+    struct udpfast_header *tmpl = &udpfast->tmpl;
+
+    for (int i = 0; i < ETH_HWADDR_LEN; i++) {
+        tmpl->eth.src.addr[i] = mac[i];
+        tmpl->eth.dest.addr[i] = 0;
+    }
+    tmpl->eth.type = HTONS(ETH_TYPE_IP);
+
+    tmpl->ip.version_ihl = IPV4_VERSION_IHL_NO_OPTIONS;
+    tmpl->ip.tos = 0;
+    tmpl->ip.frag = HTONS(IPV4_FRAG_DF);
+    tmpl->ip.ttl = UDPFAST_TTL;
+    tmpl->ip.proto = IPV4_PROTO_UDP;
+
+    udpfast->port = HTONS(port);
+    udpfast->ip_id = 0;
+    udpfast->handler = handler;
+    udpfast->arg = arg;
+    udpfast->tx_buffer_held = false;
+    udpfast->rx_count = 0;
+    udpfast->tx_count = 0;
+
+    udpfast_set_ip(udpfast, 0);
+}
+
+void udpfast_set_ip(udpfast_t *udpfast, uint32_t ip)
+{
+    struct udpfast_header *tmpl = &udpfast->tmpl;
+
+    udpfast->ip = ip;
+
+    /* Per-packet fields are left as zero so they do not contribute to the base sums */
+    tmpl->ip.len = 0;
+    tmpl->ip.id = 0;
+    tmpl->ip.chksum = 0;
+    tmpl->ip.src = ip;
+    tmpl->ip.dest = 0;
+    tmpl->udp.src = udpfast->port;
+    tmpl->udp.dest = 0;
+    tmpl->udp.len = 0;
+    tmpl->udp.chksum = 0;
+
+    udpfast->ip_chksum_base = net_chksum(&tmpl->ip, sizeof(struct ipv4_header));
+    udpfast->udp_chksum_base = ip_chksum_words(ip) + HTONS(IPV4_PROTO_UDP) + udpfast->port;
+}
+
+bool udpfast_parse(udpfast_t *udpfast, const void *frame, uint16_t len, udpfast_pkt_t *pkt)
+{
+    const struct udpfast_header *hdr = frame;
+
+    if (udpfast->ip == 0 || len < UDPFAST_HDR_LEN) {
+        return false;
+    }
+
+    if (hdr->eth.type != HTONS(ETH_TYPE_IP) || hdr->ip.version_ihl != IPV4_VERSION_IHL_NO_OPTIONS
+        || hdr->ip.proto != IPV4_PROTO_UDP || (hdr->ip.frag & HTONS(IPV4_FRAG_MF_OFFSET_MASK))) {
+        return false;
+    }
+
+    if (hdr->ip.dest != udpfast->ip || hdr->udp.dest != udpfast->port) {
+        return false;
+    }
+
+    uint16_t ip_len = HTONS(hdr->ip.len);
+    uint16_t udp_len = HTONS(hdr->udp.len);
+    if (ip_len > len - sizeof(struct ethernet_header) || ip_len < sizeof(struct ipv4_header) + sizeof(struct udp_header)
+        || udp_len < sizeof(struct udp_header) || udp_len > ip_len - sizeof(struct ipv4_header)) {
+        return false;
+    }
+
+    pkt->src_mac = hdr->eth.src;
+    pkt->src_ip = hdr->ip.src;
+    pkt->src_port = hdr->udp.src;
+    pkt->payload = (const uint8_t *)frame + UDPFAST_HDR_LEN;
+    pkt->len = udp_len - sizeof(struct udp_header);
+
+    return true;
+}
+
+/**
+ * Fill in the per-packet fields of a reply whose headers have been copied from the template.
+ *
+ * @param hdr headers of the reply.
+ * @param pkt datagram being replied to.
+ * @param len number of bytes of reply payload following the headers.
+ */
+static void build_reply(udpfast_t *udpfast, struct udpfast_header *hdr, const udpfast_pkt_t *pkt, uint16_t len)
+{
+    uint16_t udp_len = HTONS(sizeof(struct udp_header) + len);
+    uint16_t ip_len = HTONS(sizeof(struct ipv4_header) + sizeof(struct udp_header) + len);
+    uint16_t ip_id = HTONS(udpfast->ip_id);
+    udpfast->ip_id++;
+
+    hdr->eth.dest = pkt->src_mac;
+    hdr->ip.len = ip_len;
+    hdr->ip.id = ip_id;
+    hdr->ip.dest = pkt->src_ip;
+    hdr->udp.dest = pkt->src_port;
+    hdr->udp.len = udp_len;
+
+#ifndef NETWORK_HW_HAS_CHECKSUM
+    uint32_t ip_sum = udpfast->ip_chksum_base + ip_len + ip_id + ip_chksum_words(pkt->src_ip);
+    hdr->ip.chksum = ~net_chksum_fold(ip_sum);
+
+    /* The UDP length is counted once in the pseudo header and once in the UDP header */
+    uint32_t udp_sum = udpfast->udp_chksum_base + ip_chksum_words(pkt->src_ip) + pkt->src_port + udp_len + udp_len;
+    udp_sum += net_chksum((uint8_t *)hdr + UDPFAST_HDR_LEN, len);
+    uint16_t udp_chksum = ~net_chksum_fold(udp_sum);
+    /* A zero UDP checksum means none was computed, so send the equivalent all ones instead */
+    hdr->udp.chksum = udp_chksum ? udp_chksum : 0xffff;
+#endif
+}
+
+udpfast_result_t udpfast_input(udpfast_t *udpfast, const void *frame, uint16_t len, net_queue_handle_t *tx_queue,
+                               uintptr_t tx_data_region)
+{
+    udpfast_pkt_t pkt;
+    if (!udpfast_parse(udpfast, frame, len, &pkt)) {
+        return UDPFAST_PASS;
+    }
+
+    if (!udpfast->tx_buffer_held) {
+        if (net_queue_empty_free(tx_queue)) {
+            /* Let the IP stack handle it, it can hold onto the reply until buffers are available */
+            return UDPFAST_PASS;
+        }
+        int err = net_dequeue_free(tx_queue, &udpfast->tx_buffer);
+        assert(!err);
+        udpfast->tx_buffer_held = true;
+    }
+
+    udpfast->rx_count++;
+
+    struct udpfast_header *hdr = (struct udpfast_header *)(tx_data_region + udpfast->tx_buffer.io_or_offset);
+    uint8_t *reply = (uint8_t *)hdr + UDPFAST_HDR_LEN;
+    uint16_t reply_len = udpfast->handler(udpfast->arg, &pkt, reply, UDPFAST_MAX_PAYLOAD);
+    if (reply_len == 0) {
+        return UDPFAST_CONSUMED;
+    }
+    assert(reply_len <= UDPFAST_MAX_PAYLOAD);
+
+    *hdr = udpfast->tmpl;
+    build_reply(udpfast, hdr, &pkt, reply_len);
+
+    udpfast->tx_buffer.len = UDPFAST_HDR_LEN + reply_len;
+#ifdef NETWORK_HW_HAS_PARTIAL_CHECKSUM
+    net_chksum_offload(hdr, &udpfast->tx_buffer);
+#endif
+    int err = net_enqueue_active(tx_queue, udpfast->tx_buffer);
+    assert(!err);
+    udpfast->tx_buffer_held = false;
+    udpfast->tx_count++;
+
+    return UDPFAST_REPLIED;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sddf/util/slab.h>
+#include <sddf/util/util.h>
+#include <sddf/util/string.h>
+
+/**
+ * Get the smallest size class that can hold an object of the given size.
+ *
+ * @param size number of bytes requested.
+ * @return index of the size class, may be out of range of the slab's classes.
+ */
+static inline uint32_t size_to_class(size_t size)
+{
+    if (size <= SLAB_MIN_OBJ_SIZE) {
+        return 0;
+    }
+    return (64 - __builtin_clzll((uint64_t)size - 1)) - SLAB_MIN_OBJ_SIZE_BITS;
+}
+
+/**
+ * Find the size class an object was allocated from. Classes occupy disjoint ranges of the
+ * region in order, and there are at most SLAB_MAX_CLASSES of them.
+ *
+ * @param addr address of the object.
+ * @return pointer to the size class, NULL if the address is not in the region.
+ */
+static inline slab_class_t *addr_to_class(slab_t *slab, uintptr_t addr)
+{
+    for (uint32_t i = 0; i < slab->num_classes; i++) {
+        slab_class_t *class = &slab->classes[i];
+        if (addr >= class->start && addr < class->end) {
+            return class;
+        }
+    }
+    return NULL;
+}
+
+int slab_init(slab_t *slab, uintptr_t region, uint64_t region_size, const uint64_t *class_capacities,
+              uint32_t num_classes)
+{
+    assert(num_classes <= SLAB_MAX_CLASSES);
+
+    uintptr_t end = region + region_size;
+    uintptr_t next = (region + SLAB_MIN_OBJ_SIZE - 1) & ~(SLAB_MIN_OBJ_SIZE - 1);
+    for (uint32_t i = 0; i < num_classes; i++) {
+        slab_class_t *class = &slab->classes[i];
+        class->obj_size = SLAB_CLASS_OBJ_SIZE(i);
+        class->capacity = class_capacities[i];
+        class->start = next;
+        class->end = next + class->capacity * class->obj_size;
+        class->bump = class->start;
+        class->free_list = NULL;
+        class->in_use = 0;
+        class->high_water = 0;
+        class->failed = 0;
+
+        if (class->end > end || class->end < class->start) {
+            return -1;
+        }
+        next = class->end;
+    }
+
+    slab->num_classes = num_classes;
+    slab->bytes_in_use = 0;
+    slab->bytes_high_water = 0;
+
+    return 0;
+}
+
+void *slab_alloc(slab_t *slab, size_t size)
+{
+    uint32_t first = size_to_class(size);
+    for (uint32_t i = first; i < slab->num_classes; i++) {
+        slab_class_t *class = &slab->classes[i];
+        void *obj;
+
+        if (class->free_list != NULL) {
+            obj = class->free_list;
+            class->free_list = class->free_list->next;
+        } else if (class->bump < class->end) {
+            obj = (void *)class->bump;
+            class->bump += class->obj_size;
+        } else {
+            class->failed++;
+            continue;
+        }
+
+        class->in_use++;
+        if (class->in_use > class->high_water) {
+            class->high_water = class->in_use;
+        }
+        slab->bytes_in_use += class->obj_size;
+        if (slab->bytes_in_use > slab->bytes_high_water) {
+            slab->bytes_high_water = slab->bytes_in_use;
+        }
+
+        return obj;
+    }
+
+    return NULL;
+}
+
+void *slab_calloc(slab_t *slab, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = slab_alloc(slab, count * size);
+    if (ptr != NULL) {
+        sddf_memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void slab_free(slab_t *slab, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    slab_class_t *class = addr_to_class(slab, (uintptr_t)ptr);
+    assert(class != NULL);
+    assert(((uintptr_t)ptr - class->start) % class->obj_size == 0);
+    assert(class->in_use > 0);
+
+    slab_obj_t *obj = ptr;
+    obj->next = class->free_list;
+    class->free_list = obj;
+
+    class->in_use--;
+    slab->bytes_in_use -= class->obj_size;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2024, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Host-side test of the slab allocator. Checks the size class each request is
+ * served from, the fallback to larger classes once a class is exhausted, the
+ * high-water marks, and that slab_calloc rejects overflowing requests.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sddf/util/slab.h>
+
+#define NUM_CLASSES 3
+
+static const uint64_t capacities[NUM_CLASSES] = { 4, 2, 1 };
+
+#define REGION_SIZE (4 * SLAB_CLASS_OBJ_SIZE(0) + 2 * SLAB_CLASS_OBJ_SIZE(1) + 1 * SLAB_CLASS_OBJ_SIZE(2))
+
+static uint8_t region[REGION_SIZE] __attribute__((aligned(SLAB_MIN_OBJ_SIZE)));
+static slab_t slab;
+static unsigned long failures;
+
+void _assert_fail(const char *assertion, const char *file, unsigned int line, const char *function)
+{
+    printf("Failed assertion '%s' at %s:%u in function %s\n", assertion, file, line, function);
+    abort();
+}
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * Get the size class an object was allocated from.
+ *
+ * @param ptr pointer to the object.
+ *
+ * @return index of the size class, -1 if the object is not in any class.
+ */
+static int obj_class(void *ptr)
+{
+    for (int i = 0; i < slab.num_classes; i++) {
+        if ((uintptr_t)ptr >= slab.classes[i].start && (uintptr_t)ptr < slab.classes[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void reset(void)
+{
+    int err = slab_init(&slab, (uintptr_t)region, REGION_SIZE, capacities, NUM_CLASSES);
+    CHECK(err == 0);
+}
+
+static void test_init(void)
+{
+    slab_t small;
+    CHECK(slab_init(&small, (uintptr_t)region, REGION_SIZE - 1, capacities, NUM_CLASSES) == -1);
+
+    reset();
+    CHECK(slab.num_classes == NUM_CLASSES);
+    CHECK(slab.classes[0].start == (uintptr_t)region);
+    CHECK(slab.classes[NUM_CLASSES - 1].end == (uintptr_t)region + REGION_SIZE);
+}
+
+static void test_classes(void)
+{
+    reset();
+
+    void *a = slab_alloc(&slab, 1);
+    void *b = slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(0));
+    void *c = slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(0) + 1);
+    void *d = slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(2));
+    CHECK(obj_class(a) == 0);
+    CHECK(obj_class(b) == 0);
+    CHECK(obj_class(c) == 1);
+    CHECK(obj_class(d) == 2);
+    CHECK((uintptr_t)c % SLAB_MIN_OBJ_SIZE == 0);
+
+    /* Larger than the largest class */
+    CHECK(slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(2) + 1) == NULL);
+
+    /* A freed object is handed out again by its own class */
+    slab_free(&slab, b);
+    CHECK(slab_alloc(&slab, 1) == b);
+
+    slab_free(&slab, a);
+    slab_free(&slab, b);
+    slab_free(&slab, c);
+    slab_free(&slab, d);
+    slab_free(&slab, NULL);
+    CHECK(slab.bytes_in_use == 0);
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        CHECK(slab.classes[i].in_use == 0);
+    }
+}
+
+static void test_fallback(void)
+{
+    reset();
+
+    void *objs[7];
+    for (int i = 0; i < 4; i++) {
+        objs[i] = slab_alloc(&slab, 1);
+        CHECK(obj_class(objs[i]) == 0);
+    }
+    CHECK(slab.classes[0].failed == 0);
+
+    /* Class 0 is exhausted, so the next requests are served by the larger classes */
+    objs[4] = slab_alloc(&slab, 1);
+    objs[5] = slab_alloc(&slab, 1);
+    objs[6] = slab_alloc(&slab, 1);
+    CHECK(obj_class(objs[4]) == 1);
+    CHECK(obj_class(objs[5]) == 1);
+    CHECK(obj_class(objs[6]) == 2);
+    CHECK(slab.classes[0].failed == 3);
+    CHECK(slab.classes[1].failed == 1);
+
+    /* Every class is exhausted */
+    CHECK(slab_alloc(&slab, 1) == NULL);
+    CHECK(slab.classes[0].failed == 4);
+    CHECK(slab.classes[1].failed == 2);
+    CHECK(slab.classes[2].failed == 1);
+
+    /* A fallback object goes back to the class it came from */
+    slab_free(&slab, objs[5]);
+    CHECK(slab.classes[0].in_use == 4);
+    CHECK(slab.classes[1].in_use == 1);
+    CHECK(slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(1)) == objs[5]);
+
+    for (int i = 0; i < 7; i++) {
+        slab_free(&slab, objs[i]);
+    }
+    CHECK(slab.bytes_in_use == 0);
+}
+
+static void test_high_water(void)
+{
+    reset();
+
+    void *a = slab_alloc(&slab, 1);
+    void *b = slab_alloc(&slab, 1);
+    void *c = slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(1));
+    CHECK(slab.classes[0].high_water == 2);
+    CHECK(slab.classes[1].high_water == 1);
+    CHECK(slab.bytes_high_water == 2 * SLAB_CLASS_OBJ_SIZE(0) + SLAB_CLASS_OBJ_SIZE(1));
+
+    /* Freeing lowers the counts in use, but not the high-water marks */
+    slab_free(&slab, a);
+    slab_free(&slab, b);
+    slab_free(&slab, c);
+    CHECK(slab.classes[0].in_use == 0);
+    CHECK(slab.classes[0].high_water == 2);
+    CHECK(slab.bytes_in_use == 0);
+    CHECK(slab.bytes_high_water == 2 * SLAB_CLASS_OBJ_SIZE(0) + SLAB_CLASS_OBJ_SIZE(1));
+
+    /* The aggregate mark is counted in object sizes, including those of fallback objects */
+    void *objs[5];
+    for (int i = 0; i < 5; i++) {
+        objs[i] = slab_alloc(&slab, 1);
+    }
+    CHECK(slab.classes[0].high_water == 4);
+    CHECK(slab.classes[1].high_water == 1);
+    CHECK(slab.bytes_high_water == 4 * SLAB_CLASS_OBJ_SIZE(0) + SLAB_CLASS_OBJ_SIZE(1));
+    for (int i = 0; i < 5; i++) {
+        slab_free(&slab, objs[i]);
+    }
+}
+
+static void test_calloc(void)
+{
+    reset();
+
+    /* Leave non-zero data behind in the object that slab_calloc is given next */
+    uint8_t *p = slab_alloc(&slab, SLAB_CLASS_OBJ_SIZE(1));
+    memset(p, 0xff, SLAB_CLASS_OBJ_SIZE(1));
+    slab_free(&slab, p);
+
+    uint8_t *z = slab_calloc(&slab, 3, 40);
+    CHECK(z == p);
+    bool zeroed = true;
+    for (int i = 0; i < 3 * 40; i++) {
+        zeroed = zeroed && z[i] == 0;
+    }
+    CHECK(zeroed);
+    slab_free(&slab, z);
+
+    /* count * size wraps around to a small size, which must not be allocated */
+    CHECK(slab_calloc(&slab, SIZE_MAX / 2 + 2, 2) == NULL);
+    CHECK(slab_calloc(&slab, 2, SIZE_MAX / 2 + 2) == NULL);
+    CHECK(slab_calloc(&slab, SIZE_MAX, SIZE_MAX) == NULL);
+    CHECK(slab.bytes_in_use == 0);
+    CHECK(slab.classes[0].failed == 0);
+
+    void *e = slab_calloc(&slab, 0, SIZE_MAX);
+    CHECK(obj_class(e) == 0);
+    slab_free(&slab, e);
+}
+
+int main(void)
+{
+    test_init();
+    test_classes();
+    test_fallback();
+    test_high_water();
+    test_calloc();
+
+    if (failures) {
+        printf("%lu checks failed\n", failures);
+        return 1;
+    }
+    printf("All slab checks passed\n");
+
+    return 0;
+}